@@ -64,6 +64,8 @@
 /* FRCT operations */
 #define FRCTSFLAGS    00001000 /* Set flags for FRCT     */
 #define FRCTGFLAGS    00002000 /* Get flags for FRCT     */
+#define FRCTSFEC      00003000 /* Set FEC group size     */
+#define FRCTGFEC      00004000 /* Get FEC group size     */
 
 __BEGIN_DECLS
 
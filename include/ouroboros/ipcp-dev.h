@@ -45,6 +45,11 @@ int    ipcp_flow_read(int                   fd,
 int    ipcp_flow_write(int                  fd,
                        struct shm_du_buff * sdb);
 
+/* Returns the number of packets written, the caller keeps the rest. */
+ssize_t ipcp_flow_write_n(int                   fd,
+                          struct shm_du_buff ** sdb,
+                          size_t                n);
+
 int    ipcp_flow_fini(int fd);
 
 int    ipcp_flow_get_qoscube(int         fd,
@@ -52,6 +57,9 @@ int    ipcp_flow_get_qoscube(int         fd,
 
 size_t ipcp_flow_queued(int fd);
 
+/* Time in ns the oldest packet queued for sending has waited */
+uint64_t ipcp_flow_sojourn(int fd);
+
 int    ipcp_sdb_reserve(struct shm_du_buff ** sdb,
                         size_t                len);
 
@@ -59,6 +59,13 @@ enum pol_cong_avoid {
         CA_MB_ECN
 };
 
+/* Scheduling of routing table recalculations, in ms */
+struct spf_timers {
+        uint32_t init; /* Delay after a quiet period            */
+        uint32_t hold; /* Delay between runs, doubles on churn */
+        uint32_t max;  /* Upper bound for the hold time        */
+};
+
 enum pol_dir_hash {
         DIR_HASH_SHA3_224 = 0,
         DIR_HASH_SHA3_256,
@@ -85,6 +92,7 @@ struct ipcp_config {
 
         enum pol_addr_auth  addr_auth_type;
         enum pol_routing    routing_type;
+        struct spf_timers   spf;
         enum pol_cong_avoid cong_avoid;
 
         /* UDP */
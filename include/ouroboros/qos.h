@@ -35,6 +35,7 @@ typedef struct qos_spec {
         uint8_t  in_order;      /* In-order delivery, enables FRCT */
         uint32_t max_gap;       /* In ms */
         uint16_t cypher_s;      /* Cypher strength, 0 = no encryption */
+        uint8_t  compress;      /* Payload compression, 0 = none */
 } qosspec_t;
 
 static const qosspec_t qos_raw = {
@@ -45,7 +46,8 @@ static const qosspec_t qos_raw = {
         .ber          = 1,
         .in_order     = 0,
         .max_gap      = UINT32_MAX,
-        .cypher_s     = 0
+        .cypher_s     = 0,
+        .compress     = 0
 };
 
 static const qosspec_t qos_raw_no_errors = {
@@ -56,7 +58,8 @@ static const qosspec_t qos_raw_no_errors = {
         .ber          = 0,
         .in_order     = 0,
         .max_gap      = UINT32_MAX,
-        .cypher_s     = 0
+        .cypher_s     = 0,
+        .compress     = 0
 };
 
 static const qosspec_t qos_raw_crypt = {
@@ -67,7 +70,8 @@ static const qosspec_t qos_raw_crypt = {
         .ber          = 0,
         .in_order     = 0,
         .max_gap      = UINT32_MAX,
-        .cypher_s     = 256
+        .cypher_s     = 256,
+        .compress     = 0
 };
 
 static const qosspec_t qos_best_effort = {
@@ -78,7 +82,8 @@ static const qosspec_t qos_best_effort = {
         .ber          = 0,
         .in_order     = 1,
         .max_gap      = UINT32_MAX,
-        .cypher_s     = 0
+        .cypher_s     = 0,
+        .compress     = 0
 };
 
 static const qosspec_t qos_best_effort_crypt = {
@@ -89,7 +94,8 @@ static const qosspec_t qos_best_effort_crypt = {
         .ber          = 0,
         .in_order     = 1,
         .max_gap      = UINT32_MAX,
-        .cypher_s     = 256
+        .cypher_s     = 256,
+        .compress     = 0
 };
 
 static const qosspec_t qos_video   = {
@@ -100,7 +106,8 @@ static const qosspec_t qos_video   = {
         .ber          = 0,
         .in_order     = 1,
         .max_gap      = 100,
-        .cypher_s     = 0
+        .cypher_s     = 0,
+        .compress     = 0
 };
 
 static const qosspec_t qos_video_crypt   = {
@@ -111,7 +118,8 @@ static const qosspec_t qos_video_crypt   = {
         .ber          = 0,
         .in_order     = 1,
         .max_gap      = 100,
-        .cypher_s     = 256
+        .cypher_s     = 256,
+        .compress     = 0
 };
 
 static const qosspec_t qos_voice = {
@@ -122,7 +130,8 @@ static const qosspec_t qos_voice = {
         .ber          = 0,
         .in_order     = 1,
         .max_gap      = 50,
-        .cypher_s     = 0
+        .cypher_s     = 0,
+        .compress     = 0
 };
 
 static const qosspec_t qos_voice_crypt = {
@@ -133,7 +142,8 @@ static const qosspec_t qos_voice_crypt = {
         .ber          = 0,
         .in_order     = 1,
         .max_gap      = 50,
-        .cypher_s     = 256
+        .cypher_s     = 256,
+        .compress     = 0
 };
 
 static const qosspec_t qos_data = {
@@ -144,7 +154,8 @@ static const qosspec_t qos_data = {
         .ber          = 0,
         .in_order     = 1,
         .max_gap      = 2000,
-        .cypher_s     = 0
+        .cypher_s     = 0,
+        .compress     = 0
 };
 
 static const qosspec_t qos_data_crypt = {
@@ -155,7 +166,8 @@ static const qosspec_t qos_data_crypt = {
         .ber          = 0,
         .in_order     = 1,
         .max_gap      = 2000,
-        .cypher_s     = 256
+        .cypher_s     = 256,
+        .compress     = 0
 };
 
 #endif /* OUROBOROS_QOS_H */
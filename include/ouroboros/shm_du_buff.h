@@ -30,6 +30,12 @@ struct shm_du_buff;
 
 size_t    shm_du_buff_get_idx(struct shm_du_buff * sdb);
 
+/* Time in ns at which the sdb was queued on a flow */
+void      shm_du_buff_set_stamp(struct shm_du_buff * sdb,
+                                uint64_t             stamp);
+
+uint64_t  shm_du_buff_get_stamp(struct shm_du_buff * sdb);
+
 uint8_t * shm_du_buff_head(struct shm_du_buff * sdb);
 
 uint8_t * shm_du_buff_tail(struct shm_du_buff * sdb);
@@ -56,6 +56,11 @@ void                  shm_flow_set_notify(struct shm_flow_set * set,
                                           int                   flow_id,
                                           int                   event);
 
+void                  shm_flow_set_notify_n(struct shm_flow_set * set,
+                                            int                   flow_id,
+                                            int                   event,
+                                            size_t                n);
+
 ssize_t               shm_flow_set_wait(const struct shm_flow_set * shm_set,
                                         size_t                      idx,
                                         int *                       fqueue,
@@ -58,6 +58,12 @@ int                shm_rbuff_write_b(struct shm_rbuff *      rb,
                                      size_t                  idx,
                                      const struct timespec * abstime);
 
+/* Returns the number of entries written, -err if none were. */
+ssize_t            shm_rbuff_write_b_n(struct shm_rbuff *      rb,
+                                       const size_t *          idx,
+                                       size_t                  n,
+                                       const struct timespec * abstime);
+
 ssize_t            shm_rbuff_read(struct shm_rbuff * rb);
 
 ssize_t            shm_rbuff_read_b(struct shm_rbuff *      rb,
@@ -65,4 +71,7 @@ ssize_t            shm_rbuff_read_b(struct shm_rbuff *      rb,
 
 size_t             shm_rbuff_queued(struct shm_rbuff * rb);
 
+/* Index of the oldest entry without removing it, -EAGAIN if empty. */
+ssize_t            shm_rbuff_peek(struct shm_rbuff * rb);
+
 #endif /* OUROBOROS_SHM_RBUFF_H */
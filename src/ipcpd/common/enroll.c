@@ -137,6 +137,9 @@ static int send_rcv_enroll_msg(int fd)
         enroll.conf.max_ttl        = reply->conf->max_ttl;
         enroll.conf.addr_auth_type = reply->conf->addr_auth_type;
         enroll.conf.routing_type   = reply->conf->routing_type;
+        enroll.conf.spf.init       = reply->conf->spf_init;
+        enroll.conf.spf.hold       = reply->conf->spf_hold;
+        enroll.conf.spf.max        = reply->conf->spf_max;
         enroll.conf.cong_avoid     = reply->conf->cong_avoid;
 #endif
         enroll.conf.layer_info.dir_hash_algo
@@ -175,6 +178,12 @@ static ssize_t enroll_pack(uint8_t ** buf)
         config.addr_auth_type     = enroll.conf.addr_auth_type;
         config.has_routing_type   = true;
         config.routing_type       = enroll.conf.routing_type;
+        config.has_spf_init       = true;
+        config.spf_init           = enroll.conf.spf.init;
+        config.has_spf_hold       = true;
+        config.spf_hold           = enroll.conf.spf.hold;
+        config.has_spf_max        = true;
+        config.spf_max            = enroll.conf.spf.max;
         config.has_cong_avoid     = true;
         config.cong_avoid         = enroll.conf.cong_avoid;
 #endif
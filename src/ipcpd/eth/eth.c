@@ -51,6 +51,7 @@
 #include <ouroboros/pthread.h>
 
 #include "ipcp.h"
+#include "placement.h"
 #include "shim-data.h"
 
 #include <signal.h>
@@ -166,6 +167,7 @@ struct mgmt_msg {
         uint32_t delay;
         uint16_t cypher_s;
         uint8_t  in_order;
+        uint8_t  compress;
 #if defined (BUILD_ETH_DIX)
         uint8_t  code;
         uint8_t  availability;
@@ -492,6 +494,7 @@ static int eth_ipcp_alloc(const uint8_t * dst_addr,
         msg->in_order     = qs.in_order;
         msg->max_gap      = hton32(qs.max_gap);
         msg->cypher_s     = hton16(qs.cypher_s);
+        msg->compress     = qs.compress;
 
         memcpy(msg + 1, hash, ipcp_dir_hash_len());
         memcpy(buf + len + ETH_HEADER_TOT_SIZE, data, dlen);
@@ -753,6 +756,7 @@ static int eth_ipcp_mgmt_frame(const uint8_t * buf,
                 qs.in_order = msg->in_order;
                 qs.max_gap = ntoh32(msg->max_gap);
                 qs.cypher_s = ntoh16(msg->cypher_s);
+                qs.compress = msg->compress;
 
                 if (shim_data_reg_has(eth_data.shim_data,
                                       buf + sizeof(*msg))) {
@@ -871,7 +875,7 @@ static void * eth_ipcp_packet_reader(void * o)
 
         (void) o;
 
-        ipcp_lock_to_core();
+        placement_bind("eth-reader");
 
         memset(br_addr, 0xff, MAC_SIZE * sizeof(uint8_t));
 
@@ -1055,7 +1059,7 @@ static void * eth_ipcp_packet_writer(void * o)
 
         pthread_cleanup_push(cleanup_writer, fq);
 
-        ipcp_lock_to_core();
+        placement_bind("eth-writer");
 
         while (true) {
                 fevent(eth_data.np1_flows, fq, NULL);
@@ -1480,6 +1484,8 @@ static int eth_ipcp_bootstrap(const struct ipcp_config * conf)
         }
 
 #endif /* HAVE_NETMAP */
+        placement_set_dev(conf->dev);
+
         ipcp_set_state(IPCP_OPERATIONAL);
 
 #if defined(__linux__)
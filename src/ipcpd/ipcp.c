@@ -26,11 +26,6 @@
 #define _POSIX_C_SOURCE 200112L
 #endif
 
-#if defined(__linux__) && !defined(DISABLE_CORE_LOCK)
-#define _GNU_SOURCE
-#define NPROC (sysconf(_SC_NPROCESSORS_ONLN))
-#endif
-
 #include "config.h"
 
 #define OUROBOROS_PREFIX  "ipcpd/ipcp"
@@ -49,6 +44,7 @@
 #include <ouroboros/pthread.h>
 
 #include "ipcp.h"
+#include "placement.h"
 
 #include <signal.h>
 #include <string.h>
@@ -56,9 +52,6 @@
 #include <stdlib.h>
 #if defined(__linux__)
 #include <sys/prctl.h>
-#ifndef DISABLE_CORE_LOCK
-#include <unistd.h>
-#endif
 #endif
 
 char * info[LAYER_NAME_SIZE + 1] = {
@@ -342,6 +335,9 @@ static void * mainloop(void * o)
                                 conf.max_ttl        = conf_msg->max_ttl;
                                 conf.addr_auth_type = conf_msg->addr_auth_type;
                                 conf.routing_type   = conf_msg->routing_type;
+                                conf.spf.init       = conf_msg->spf_init;
+                                conf.spf.hold       = conf_msg->spf_hold;
+                                conf.spf.max        = conf_msg->spf_max;
                                 conf.cong_avoid     = conf_msg->cong_avoid;
                                 break;
                         case IPCP_ETH_DIX:
@@ -771,6 +767,11 @@ int ipcp_init(int               argc,
                 goto fail_rib_init;
         }
 
+        if (placement_init()) {
+                log_err("Failed to initialize thread placement.");
+                goto fail_placement;
+        }
+
         list_head_init(&ipcpi.cmds);
 
         ipcpi.alloc_id = -1;
@@ -779,6 +780,8 @@ int ipcp_init(int               argc,
 
         return 0;
 
+ fail_placement:
+        rib_fini();
  fail_rib_init:
         pthread_cond_destroy(&ipcpi.cmd_cond);
  fail_cmd_cond:
@@ -906,6 +909,7 @@ void ipcp_shutdown()
 
 void ipcp_fini()
 {
+        placement_fini();
 
         rib_fini();
 
@@ -980,24 +984,3 @@ int ipcp_wait_state(enum ipcp_state         state,
 
         return ret;
 }
-
-void ipcp_lock_to_core(void)
-{
-#if defined(__linux__) && !defined(DISABLE_CORE_LOCK)
-        cpu_set_t           cpus;
-        size_t              cpu;
-
-        /* Choose a random core. */
-        cpu = rand() % NPROC;
-
-        CPU_ZERO(&cpus);
-        CPU_SET(cpu, &cpus);
-
-        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
-                log_warn("Failed to lock thread %lu to CPU %zu/%lu.",
-                         pthread_self(), cpu, NPROC);
-        else
-                log_dbg("Locked thread %lu to CPU %zu/%lu.",
-                        pthread_self(), cpu, NPROC);
-#endif
-}
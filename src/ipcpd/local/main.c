@@ -40,6 +40,7 @@
 #include <ouroboros/local-dev.h>
 
 #include "ipcp.h"
+#include "placement.h"
 #include "shim-data.h"
 
 #include <string.h>
@@ -103,7 +104,7 @@ static void * ipcp_local_packet_loop(void * o)
 {
         (void) o;
 
-        ipcp_lock_to_core();
+        placement_bind("local");
 
         while (true) {
                 int     fd;
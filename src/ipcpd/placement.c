@@ -0,0 +1,514 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Placement of IPCP data path threads on CPUs
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#elif defined(__CYGWIN__)
+#define _DEFAULT_SOURCE
+#else
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "config.h"
+
+#define OUROBOROS_PREFIX  "ipcpd/placement"
+#define PLACEMENT         "placement"
+
+#include <ouroboros/logs.h>
+#include <ouroboros/errno.h>
+#include <ouroboros/rib.h>
+
+#include "placement.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SYS_CPU      "/sys/devices/system/cpu"
+#define SYS_NODE     "/sys/devices/system/node"
+#define SYS_NET      "/sys/class/net"
+#define CPU_ENV      "OUROBOROS_IPCP_CPUS"
+#define MAX_CPUS     1024
+#define MAX_THREADS  128
+#define ROLE_LEN     16
+#define ENTRY_STRLEN 96
+
+struct cpu_info {
+        int cpu;
+        int core;
+        int pkg;
+        int node;
+        int rank; /* Index among the hyperthreads of its core */
+};
+
+struct {
+        struct cpu_info cpus[MAX_CPUS];
+        size_t          n_cpus;
+        bool            manual;   /* Admin provided CPU list */
+        int             node;     /* Preferred NUMA node, -1 for any */
+        size_t          next;
+
+        struct {
+                char            role[ROLE_LEN + 1];
+                bool            bound;
+                struct cpu_info cpu;
+        } thr[MAX_THREADS];
+        size_t          n_thr;
+
+        pthread_mutex_t lock;
+} plc;
+
+static int read_int(const char * path)
+{
+        FILE * f;
+        int    val;
+
+        f = fopen(path, "r");
+        if (f == NULL)
+                return -1;
+
+        if (fscanf(f, "%d", &val) != 1)
+                val = -1;
+
+        fclose(f);
+
+        return val;
+}
+
+/* Parses lists such as "0-3,8,10-11", returns the number of CPUs. */
+static size_t parse_cpulist(const char * str,
+                            int *        cpus,
+                            size_t       max)
+{
+        size_t n = 0;
+        long   lo;
+        long   hi;
+        char * end;
+
+        while (*str != '\0' && n < max) {
+                lo = strtol(str, &end, 10);
+                if (end == str || lo < 0)
+                        break;
+
+                hi = lo;
+                if (*end == '-') {
+                        str = end + 1;
+                        hi  = strtol(str, &end, 10);
+                        if (end == str || hi < lo)
+                                break;
+                }
+
+                while (lo <= hi && n < max)
+                        cpus[n++] = (int) lo++;
+
+                str = end;
+                while (*str == ',' || *str == ' ' || *str == '\n')
+                        ++str;
+        }
+
+        return n;
+}
+
+static size_t read_cpulist(const char * path,
+                           int *        cpus,
+                           size_t       max)
+{
+        FILE * f;
+        char   buf[4096];
+        size_t n = 0;
+
+        f = fopen(path, "r");
+        if (f == NULL)
+                return 0;
+
+        if (fgets(buf, sizeof(buf), f) != NULL)
+                n = parse_cpulist(buf, cpus, max);
+
+        fclose(f);
+
+        return n;
+}
+
+static struct cpu_info * find_cpu(int cpu)
+{
+        size_t i;
+
+        for (i = 0; i < plc.n_cpus; ++i)
+                if (plc.cpus[i].cpu == cpu)
+                        return &plc.cpus[i];
+
+        return NULL;
+}
+
+static void load_nodes(void)
+{
+        DIR *             dir;
+        struct dirent *   ent;
+        char              path[64 + sizeof(ent->d_name)];
+        int               cpus[MAX_CPUS];
+        struct cpu_info * c;
+        size_t            n;
+        size_t            i;
+        int               node;
+
+        dir = opendir(SYS_NODE);
+        if (dir == NULL)
+                return;
+
+        while ((ent = readdir(dir)) != NULL) {
+                if (sscanf(ent->d_name, "node%d", &node) != 1)
+                        continue;
+
+                sprintf(path, SYS_NODE "/%s/cpulist", ent->d_name);
+
+                n = read_cpulist(path, cpus, MAX_CPUS);
+                for (i = 0; i < n; ++i) {
+                        c = find_cpu(cpus[i]);
+                        if (c != NULL)
+                                c->node = node;
+                }
+        }
+
+        closedir(dir);
+}
+
+static void load_topology(void)
+{
+        char              path[64];
+        int               cpus[MAX_CPUS];
+        struct cpu_info * c;
+        size_t            n;
+        size_t            i;
+        size_t            j;
+
+        n = read_cpulist(SYS_CPU "/online", cpus, MAX_CPUS);
+        if (n == 0) {
+                n = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+                n = n > MAX_CPUS ? MAX_CPUS : n;
+                for (i = 0; i < n; ++i)
+                        cpus[i] = (int) i;
+        }
+
+        for (i = 0; i < n; ++i) {
+                c = &plc.cpus[i];
+
+                c->cpu  = cpus[i];
+                c->node = 0;
+
+                sprintf(path, SYS_CPU "/cpu%d/topology/core_id", c->cpu);
+                c->core = read_int(path);
+                if (c->core < 0)
+                        c->core = c->cpu;
+
+                sprintf(path, SYS_CPU "/cpu%d/topology/physical_package_id",
+                        c->cpu);
+                c->pkg = read_int(path);
+                if (c->pkg < 0)
+                        c->pkg = 0;
+
+                c->rank = 0;
+                for (j = 0; j < i; ++j)
+                        if (plc.cpus[j].pkg == c->pkg &&
+                            plc.cpus[j].core == c->core)
+                                ++c->rank;
+        }
+
+        plc.n_cpus = n;
+
+        load_nodes();
+}
+
+/*
+ * Distinct physical cores first, those near the preferred node
+ * before the others. Hyperthread siblings come last.
+ */
+static int cpu_cmp(const void * o1,
+                   const void * o2)
+{
+        const struct cpu_info * c1 = o1;
+        const struct cpu_info * c2 = o2;
+        int                     f1;
+        int                     f2;
+
+        if (c1->rank != c2->rank)
+                return c1->rank - c2->rank;
+
+        f1 = plc.node >= 0 && c1->node != plc.node;
+        f2 = plc.node >= 0 && c2->node != plc.node;
+        if (f1 != f2)
+                return f1 - f2;
+
+        if (c1->node != c2->node)
+                return c1->node - c2->node;
+
+        if (c1->pkg != c2->pkg)
+                return c1->pkg - c2->pkg;
+
+        if (c1->core != c2->core)
+                return c1->core - c2->core;
+
+        return c1->cpu - c2->cpu;
+}
+
+static bool load_manual(const char * list)
+{
+        int               cpus[MAX_CPUS];
+        struct cpu_info   sel[MAX_CPUS];
+        struct cpu_info * c;
+        size_t            n;
+        size_t            i;
+
+        n = parse_cpulist(list, cpus, MAX_CPUS);
+        if (n == 0) {
+                log_warn("Ignoring invalid CPU list \"%s\".", list);
+                return false;
+        }
+
+        /* Keep the admin's order, with the topology where known. */
+        for (i = 0; i < n; ++i) {
+                c = find_cpu(cpus[i]);
+                if (c != NULL) {
+                        sel[i] = *c;
+                } else {
+                        sel[i].cpu  = cpus[i];
+                        sel[i].core = cpus[i];
+                        sel[i].pkg  = 0;
+                        sel[i].node = 0;
+                }
+                sel[i].rank = 0;
+        }
+
+        memcpy(plc.cpus, sel, n * sizeof(*sel));
+
+        plc.n_cpus = n;
+        plc.manual = true;
+
+        return true;
+}
+
+static int placement_rib_read(const char * path,
+                              char *       buf,
+                              size_t       len)
+{
+        char *            entry;
+        char              name[ROLE_LEN + 24];
+        struct cpu_info * c;
+        size_t            i;
+        int               ret = 0;
+
+        if (len < ENTRY_STRLEN)
+                return 0;
+
+        entry = strstr(path, RIB_SEPARATOR) + 1;
+        assert(entry);
+
+        pthread_mutex_lock(&plc.lock);
+
+        for (i = 0; i < plc.n_thr; ++i) {
+                sprintf(name, "%s.%zu", plc.thr[i].role, i);
+                if (strcmp(name, entry) != 0)
+                        continue;
+
+                if (!plc.thr[i].bound) {
+                        ret = sprintf(buf, "CPU:    unbound\n");
+                        break;
+                }
+
+                c = &plc.thr[i].cpu;
+                ret = sprintf(buf,
+                              "CPU:    %d\n"
+                              "Core:   %d\n"
+                              "Socket: %d\n"
+                              "Node:   %d\n",
+                              c->cpu, c->core, c->pkg, c->node);
+                break;
+        }
+
+        pthread_mutex_unlock(&plc.lock);
+
+        return ret;
+}
+
+static int placement_rib_readdir(char *** buf)
+{
+        char   name[ROLE_LEN + 24];
+        size_t i;
+
+        pthread_mutex_lock(&plc.lock);
+
+        if (plc.n_thr == 0) {
+                pthread_mutex_unlock(&plc.lock);
+                return 0;
+        }
+
+        *buf = malloc(sizeof(**buf) * plc.n_thr);
+        if (*buf == NULL)
+                goto fail_entries;
+
+        for (i = 0; i < plc.n_thr; ++i) {
+                sprintf(name, "%s.%zu", plc.thr[i].role, i);
+                (*buf)[i] = strdup(name);
+                if ((*buf)[i] == NULL)
+                        goto fail_dup;
+        }
+
+        pthread_mutex_unlock(&plc.lock);
+
+        return (int) i;
+
+ fail_dup:
+        while (i-- > 0)
+                free((*buf)[i]);
+        free(*buf);
+ fail_entries:
+        pthread_mutex_unlock(&plc.lock);
+        return -ENOMEM;
+}
+
+static int placement_rib_getattr(const char *      path,
+                                 struct rib_attr * attr)
+{
+        (void) path;
+
+        attr->size  = ENTRY_STRLEN;
+        attr->mtime = 0;
+
+        return 0;
+}
+
+static struct rib_ops r_ops = {
+        .read    = placement_rib_read,
+        .readdir = placement_rib_readdir,
+        .getattr = placement_rib_getattr
+};
+
+int placement_init(void)
+{
+        const char * list;
+
+        memset(&plc, 0, sizeof(plc));
+
+        plc.node = -1;
+
+        if (pthread_mutex_init(&plc.lock, NULL))
+                goto fail_lock;
+
+        load_topology();
+
+        list = getenv(CPU_ENV);
+        if (list == NULL || *list == '\0')
+                list = IPCP_CPU_LIST;
+
+        if (*list == '\0' || !load_manual(list))
+                qsort(plc.cpus, plc.n_cpus, sizeof(*plc.cpus), cpu_cmp);
+
+        if (rib_reg(PLACEMENT, &r_ops))
+                goto fail_rib_reg;
+
+        return 0;
+
+ fail_rib_reg:
+        pthread_mutex_destroy(&plc.lock);
+ fail_lock:
+        return -1;
+}
+
+void placement_fini(void)
+{
+        rib_unreg(PLACEMENT);
+
+        pthread_mutex_destroy(&plc.lock);
+}
+
+void placement_set_dev(const char * dev)
+{
+        char path[64 + IF_NAMESIZE];
+        int  node;
+
+        assert(dev);
+
+        if (strlen(dev) >= IF_NAMESIZE)
+                return;
+
+        sprintf(path, SYS_NET "/%s/device/numa_node", dev);
+
+        node = read_int(path);
+        if (node < 0)
+                return;
+
+        pthread_mutex_lock(&plc.lock);
+
+        if (!plc.manual && node != plc.node) {
+                plc.node = node;
+                plc.next = 0;
+                qsort(plc.cpus, plc.n_cpus, sizeof(*plc.cpus), cpu_cmp);
+                log_dbg("Placing threads near NUMA node %d of %s.",
+                        node, dev);
+        }
+
+        pthread_mutex_unlock(&plc.lock);
+}
+
+void placement_bind(const char * role)
+{
+        struct cpu_info * c = NULL;
+#if defined(__linux__) && !defined(DISABLE_CORE_LOCK)
+        cpu_set_t         cpus;
+#endif
+        assert(role);
+
+        pthread_mutex_lock(&plc.lock);
+
+#if defined(__linux__) && !defined(DISABLE_CORE_LOCK)
+        if (plc.n_cpus > 0) {
+                c = &plc.cpus[plc.next++ % plc.n_cpus];
+
+                CPU_ZERO(&cpus);
+                CPU_SET(c->cpu, &cpus);
+
+                if (pthread_setaffinity_np(pthread_self(), sizeof(cpus),
+                                           &cpus)) {
+                        log_warn("Failed to lock %s thread to CPU %d.",
+                                 role, c->cpu);
+                        c = NULL;
+                } else {
+                        log_dbg("Locked %s thread to CPU %d.", role, c->cpu);
+                }
+        }
+#endif
+        if (plc.n_thr < MAX_THREADS) {
+                strncpy(plc.thr[plc.n_thr].role, role, ROLE_LEN);
+                plc.thr[plc.n_thr].bound = c != NULL;
+                if (c != NULL)
+                        plc.thr[plc.n_thr].cpu = *c;
+                ++plc.n_thr;
+        }
+
+        pthread_mutex_unlock(&plc.lock);
+}
@@ -0,0 +1,36 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Placement of IPCP data path threads on CPUs
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#ifndef OUROBOROS_IPCPD_PLACEMENT_H
+#define OUROBOROS_IPCPD_PLACEMENT_H
+
+int  placement_init(void);
+
+void placement_fini(void);
+
+/* Prefer the CPUs on the NUMA node of this network interface. */
+void placement_set_dev(const char * dev);
+
+/* Lock the calling thread to the next CPU in the placement order. */
+void placement_bind(const char * role);
+
+#endif /* OUROBOROS_IPCPD_PLACEMENT_H */
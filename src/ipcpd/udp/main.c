@@ -42,12 +42,14 @@
 #include <ouroboros/pthread.h>
 
 #include "ipcp.h"
+#include "placement.h"
 #include "shim-data.h"
 
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <arpa/inet.h>
+#include <ifaddrs.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <signal.h>
@@ -99,6 +101,7 @@ struct mgmt_msg {
         uint32_t ber;
         uint32_t max_gap;
         uint16_t cypher_s;
+        uint8_t  compress;
 } __attribute__((packed));
 
 struct mgmt_frame {
@@ -217,6 +220,7 @@ static int ipcp_udp_port_alloc(const struct sockaddr_in * r_saddr,
         msg->in_order     = qs.in_order;
         msg->max_gap      = hton32(qs.max_gap);
         msg->cypher_s     = hton16(qs.cypher_s);
+        msg->compress     = qs.compress;
 
         memcpy(msg + 1, dst, ipcp_dir_hash_len());
         memcpy(buf + len, data, dlen);
@@ -375,6 +379,7 @@ static int ipcp_udp_mgmt_frame(const uint8_t *    buf,
                 qs.in_order     = msg->in_order;
                 qs.max_gap      = ntoh32(msg->max_gap);
                 qs.cypher_s     = ntoh16(msg->cypher_s);
+                qs.compress     = msg->compress;
 
                 return ipcp_udp_port_req(&c_saddr, ntoh32(msg->s_eid),
                                          (uint8_t *) (msg + 1), qs,
@@ -437,6 +442,8 @@ static void * ipcp_udp_packet_reader(void * o)
 
         (void) o;
 
+        placement_bind("udp-reader");
+
         data  = buf + sizeof(uint32_t);
         eid_p = (uint32_t *) buf;
 
@@ -510,7 +517,7 @@ static void * ipcp_udp_packet_writer(void * o)
 
         (void) o;
 
-        ipcp_lock_to_core();
+        placement_bind("udp-writer");
 
         pthread_cleanup_push(cleanup_fqueue, fq);
 
@@ -572,6 +579,31 @@ static void * ipcp_udp_packet_writer(void * o)
         return (void *) 1;
 }
 
+/* Place the data path threads near the interface holding ip_addr. */
+static void udp_place_near(uint32_t ip_addr)
+{
+        struct ifaddrs *     ifaddr;
+        struct ifaddrs *     ifa;
+        struct sockaddr_in * sin;
+
+        if (getifaddrs(&ifaddr) < 0)
+                return;
+
+        for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+                if (ifa->ifa_addr == NULL ||
+                    ifa->ifa_addr->sa_family != AF_INET)
+                        continue;
+
+                sin = (struct sockaddr_in *) ifa->ifa_addr;
+                if (sin->sin_addr.s_addr == ip_addr) {
+                        placement_set_dev(ifa->ifa_name);
+                        break;
+                }
+        }
+
+        freeifaddrs(ifaddr);
+}
+
 static int ipcp_udp_bootstrap(const struct ipcp_config * conf)
 {
         char ipstr[INET_ADDRSTRLEN];
@@ -627,6 +659,8 @@ static int ipcp_udp_bootstrap(const struct ipcp_config * conf)
 
         udp_data.dns_addr = conf->dns_addr;
 
+        udp_place_near(conf->ip_addr);
+
         ipcp_set_state(IPCP_OPERATIONAL);
 
         if (pthread_create(&udp_data.mgmt_handler, NULL,
@@ -0,0 +1,342 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Active queue management on N-1 flows
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+/*
+ * The DT only sees the N-1 queues when it enqueues, the N-1 IPCP
+ * dequeues. Queueing delay is taken from the enqueue stamp of the
+ * oldest packet still in the queue, the sojourn time it has so far.
+ *
+ * CoDel (RFC 8289) signals once the delay stayed above target for an
+ * interval, then at a rate that grows with the square root of the
+ * number of signals. PIE (RFC 8033) signals at random, with a
+ * probability that follows the delay every update period.
+ */
+
+#if defined(__linux__) || defined(__CYGWIN__)
+#define _DEFAULT_SOURCE
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "config.h"
+
+#define OUROBOROS_PREFIX "aqm"
+
+#include <ouroboros/ipcp-dev.h>
+#include <ouroboros/logs.h>
+#include <ouroboros/time_utils.h>
+
+#include "aqm.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define CODEL_TARGET   (5 * MILLION)       /* 5 ms                 */
+#define CODEL_INTERVAL (100 * MILLION)     /* 100 ms               */
+#define PIE_TARGET     (15 * MILLION)      /* 15 ms                */
+#define PIE_TUPDATE    (15 * MILLION)      /* 15 ms update period  */
+#define PIE_MAX_BURST  (150 * MILLION)     /* 150 ms burst allowed */
+#define PIE_PROB_SHFT  32                  /* Probability of 1     */
+#define PIE_PROB_MAX   (1ULL << PIE_PROB_SHFT)
+
+enum aqm_pol {
+        AQM_NONE = 0,
+        AQM_CODEL,
+        AQM_PIE
+};
+
+struct codel {
+        uint64_t first_above; /* Time the delay is above target for long */
+        uint64_t drop_next;   /* Time of the next signal                 */
+        uint32_t count;       /* Signals since entering the signal state */
+        uint32_t lastcount;   /* Count when last leaving that state      */
+        bool     dropping;    /* In the signal state                     */
+};
+
+struct pie {
+        uint64_t prob;        /* Signal probability, 1 << PIE_PROB_SHFT  */
+        uint64_t qdelay_old;  /* Delay at the previous update            */
+        uint64_t last;        /* Time of the previous update             */
+        uint64_t burst;       /* Remaining burst allowance               */
+        uint64_t rnd;         /* Random state                            */
+};
+
+struct aqm_flow {
+        pthread_mutex_t lock;
+        union {
+                struct codel codel;
+                struct pie   pie;
+        } u;
+};
+
+struct {
+        enum aqm_pol    pol;
+        bool            ecn;
+        struct aqm_flow flows[PROG_MAX_FLOWS];
+} aqm;
+
+static uint64_t isqrt(uint64_t v)
+{
+        uint64_t r   = 0;
+        uint64_t bit = 1ULL << 62;
+
+        while (bit > v)
+                bit >>= 2;
+
+        while (bit != 0) {
+                if (v >= r + bit) {
+                        v -= r + bit;
+                        r  = (r >> 1) + bit;
+                } else {
+                        r >>= 1;
+                }
+                bit >>= 2;
+        }
+
+        return r;
+}
+
+/* Next signal time, interval / sqrt(count) after t. */
+static uint64_t codel_control_law(uint64_t t,
+                                  uint32_t count)
+{
+        return t + (CODEL_INTERVAL << 10) / isqrt((uint64_t) count << 20);
+}
+
+static bool codel_ok_to_signal(struct codel * c,
+                               uint64_t       sojourn,
+                               uint64_t       now)
+{
+        if (sojourn < CODEL_TARGET) {
+                c->first_above = 0;
+                return false;
+        }
+
+        if (c->first_above == 0) {
+                c->first_above = now + CODEL_INTERVAL;
+                return false;
+        }
+
+        return now >= c->first_above;
+}
+
+static bool codel_signal(struct codel * c,
+                         uint64_t       sojourn,
+                         uint64_t       now)
+{
+        uint32_t delta;
+        bool     ok;
+
+        ok = codel_ok_to_signal(c, sojourn, now);
+
+        if (c->dropping) {
+                if (!ok) {
+                        c->dropping = false;
+                        return false;
+                }
+
+                if (now < c->drop_next)
+                        return false;
+
+                ++c->count;
+                c->drop_next = codel_control_law(c->drop_next, c->count);
+
+                return true;
+        }
+
+        if (!ok)
+                return false;
+
+        c->dropping = true;
+
+        /* Start near the old rate if the last episode was recent. */
+        delta = c->count - c->lastcount;
+        if (delta > 1 && now - c->drop_next < 16 * CODEL_INTERVAL)
+                c->count = delta;
+        else
+                c->count = 1;
+
+        c->lastcount = c->count;
+        c->drop_next = codel_control_law(now, c->count);
+
+        return true;
+}
+
+/* Scale the adjustment down while the probability is still small. */
+static int64_t pie_scale(const struct pie * p,
+                         int64_t            delta)
+{
+        if (p->prob < PIE_PROB_MAX / 1000000)
+                return delta / 2048;
+        if (p->prob < PIE_PROB_MAX / 100000)
+                return delta / 512;
+        if (p->prob < PIE_PROB_MAX / 10000)
+                return delta / 128;
+        if (p->prob < PIE_PROB_MAX / 1000)
+                return delta / 32;
+        if (p->prob < PIE_PROB_MAX / 100)
+                return delta / 8;
+        if (p->prob < PIE_PROB_MAX / 10)
+                return delta / 2;
+
+        return delta;
+}
+
+static void pie_update(struct pie * p,
+                       uint64_t     qdelay)
+{
+        int64_t delta;
+        int64_t prob;
+
+        /* alpha = 0.125 Hz and beta = 1.25 Hz, delays in ns. */
+        delta = ((int64_t) qdelay - (int64_t) PIE_TARGET)
+                + 10 * ((int64_t) qdelay - (int64_t) p->qdelay_old);
+        delta = delta / 8 * (int64_t) (PIE_PROB_MAX >> 12) / (BILLION >> 12);
+
+        prob = (int64_t) p->prob + pie_scale(p, delta);
+
+        if (qdelay == 0 && p->qdelay_old == 0)
+                prob -= prob / 64;
+
+        if (prob < 0)
+                prob = 0;
+        if (prob > (int64_t) PIE_PROB_MAX)
+                prob = PIE_PROB_MAX;
+
+        p->prob = prob;
+
+        if (p->burst > PIE_TUPDATE)
+                p->burst -= PIE_TUPDATE;
+        else
+                p->burst = 0;
+
+        if (p->prob == 0 && qdelay < PIE_TARGET / 2 &&
+            p->qdelay_old < PIE_TARGET / 2)
+                p->burst = PIE_MAX_BURST;
+
+        p->qdelay_old = qdelay;
+}
+
+static bool pie_signal(struct pie * p,
+                       uint64_t     qdelay,
+                       uint64_t     now)
+{
+        if (now - p->last >= PIE_TUPDATE) {
+                pie_update(p, qdelay);
+                p->last = now;
+        }
+
+        if (p->burst > 0)
+                return false;
+
+        if (qdelay < PIE_TARGET / 2 && p->prob < PIE_PROB_MAX / 5)
+                return false;
+
+        /* xorshift64 */
+        p->rnd ^= p->rnd << 13;
+        p->rnd ^= p->rnd >> 7;
+        p->rnd ^= p->rnd << 17;
+
+        return (p->rnd >> (64 - PIE_PROB_SHFT)) < p->prob;
+}
+
+int aqm_init(bool ecn)
+{
+        int i;
+
+#if defined(IPCP_AQM_CODEL)
+        aqm.pol = AQM_CODEL;
+        log_dbg("Using CoDel on N-1 flows.");
+#elif defined(IPCP_AQM_PIE)
+        aqm.pol = AQM_PIE;
+        log_dbg("Using PIE on N-1 flows.");
+#else
+        aqm.pol = AQM_NONE;
+#endif
+        aqm.ecn = ecn;
+
+        for (i = 0; i < PROG_MAX_FLOWS; ++i) {
+                memset(&aqm.flows[i].u, 0, sizeof(aqm.flows[i].u));
+                if (aqm.pol == AQM_PIE) {
+                        aqm.flows[i].u.pie.burst = PIE_MAX_BURST;
+                        aqm.flows[i].u.pie.rnd   = i + 1;
+                }
+                if (pthread_mutex_init(&aqm.flows[i].lock, NULL))
+                        goto fail_lock;
+        }
+
+        return 0;
+
+ fail_lock:
+        while (i-- > 0)
+                pthread_mutex_destroy(&aqm.flows[i].lock);
+        return -1;
+}
+
+void aqm_fini(void)
+{
+        int i;
+
+        for (i = 0; i < PROG_MAX_FLOWS; ++i)
+                pthread_mutex_destroy(&aqm.flows[i].lock);
+}
+
+void aqm_enqueue_n(int            fd,
+                   enum aqm_act * act,
+                   size_t         n)
+{
+        struct aqm_flow * f;
+        struct timespec   ts;
+        uint64_t          sojourn;
+        uint64_t          now;
+        enum aqm_act      sig;
+        size_t            i;
+        bool              s;
+
+        memset(act, 0, n * sizeof(*act));
+
+        if (aqm.pol == AQM_NONE)
+                return;
+
+        f = &aqm.flows[fd];
+
+        /* Another thread is at it, the signal rate stays the same. */
+        if (pthread_mutex_trylock(&f->lock))
+                return;
+
+        clock_gettime(PTHREAD_COND_CLOCK, &ts);
+        now     = (uint64_t) ts.tv_sec * BILLION + ts.tv_nsec;
+        sojourn = ipcp_flow_sojourn(fd);
+        sig     = aqm.ecn ? AQM_MARK : AQM_DROP;
+
+        for (i = 0; i < n; ++i) {
+                if (aqm.pol == AQM_CODEL)
+                        s = codel_signal(&f->u.codel, sojourn, now);
+                else
+                        s = pie_signal(&f->u.pie, sojourn, now);
+
+                if (s)
+                        act[i] = sig;
+        }
+
+        pthread_mutex_unlock(&f->lock);
+}
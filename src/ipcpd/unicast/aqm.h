@@ -0,0 +1,49 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Active queue management on N-1 flows
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#ifndef OUROBOROS_IPCPD_UNICAST_AQM_H
+#define OUROBOROS_IPCPD_UNICAST_AQM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ECN value of a packet marked by the AQM */
+#define AQM_ECN_MARK UINT8_MAX
+
+enum aqm_act {
+        AQM_PASS = 0,
+        AQM_MARK,
+        AQM_DROP
+};
+
+/* With ecn set, congestion is signalled by marking instead of drops. */
+int  aqm_init(bool ecn);
+
+void aqm_fini(void);
+
+/* What to do with each of the next n packets to be written to fd. */
+void aqm_enqueue_n(int            fd,
+                   enum aqm_act * act,
+                   size_t         n);
+
+#endif /* OUROBOROS_IPCPD_UNICAST_AQM_H */
@@ -43,6 +43,7 @@
 
 #include "common/comp.h"
 #include "common/connmgr.h"
+#include "aqm.h"
 #include "ca.h"
 #include "ipcp.h"
 #include "dt.h"
@@ -72,67 +73,7 @@ struct comp_info {
         char * name;
 };
 
-/* Fixed field lengths */
-#define TTL_LEN 1
-#define QOS_LEN 1
-#define ECN_LEN 1
-
-struct dt_pci {
-        uint64_t  dst_addr;
-        qoscube_t qc;
-        uint8_t   ttl;
-        uint8_t   ecn;
-        uint64_t  eid;
-};
-
-struct {
-        uint8_t         addr_size;
-        uint8_t         eid_size;
-        size_t          head_size;
-
-        /* Offsets */
-        size_t          qc_o;
-        size_t          ttl_o;
-        size_t          ecn_o;
-        size_t          eid_o;
-
-        /* Initial TTL value */
-        uint8_t         max_ttl;
-} dt_pci_info;
-
-static void dt_pci_ser(uint8_t *       head,
-                       struct dt_pci * dt_pci)
-{
-        uint8_t ttl = dt_pci_info.max_ttl;
-
-        assert(head);
-        assert(dt_pci);
-
-        /* FIXME: Add check and operations for Big Endian machines. */
-        memcpy(head, &dt_pci->dst_addr, dt_pci_info.addr_size);
-        memcpy(head + dt_pci_info.qc_o, &dt_pci->qc, QOS_LEN);
-        memcpy(head + dt_pci_info.ttl_o, &ttl, TTL_LEN);
-        memcpy(head + dt_pci_info.ecn_o, &dt_pci->ecn, ECN_LEN);
-        memcpy(head + dt_pci_info.eid_o, &dt_pci->eid, dt_pci_info.eid_size);
-
-}
-
-static void dt_pci_des(uint8_t *       head,
-                       struct dt_pci * dt_pci)
-{
-        assert(head);
-        assert(dt_pci);
-
-        /* Decrease TTL */
-        --*(head + dt_pci_info.ttl_o);
-
-        /* FIXME: Add check and operations for Big Endian machines. */
-        memcpy(&dt_pci->dst_addr, head, dt_pci_info.addr_size);
-        memcpy(&dt_pci->qc, head + dt_pci_info.qc_o, QOS_LEN);
-        memcpy(&dt_pci->ttl, head + dt_pci_info.ttl_o, TTL_LEN);
-        memcpy(&dt_pci->ecn, head + dt_pci_info.ecn_o, ECN_LEN);
-        memcpy(&dt_pci->eid, head + dt_pci_info.eid_o, dt_pci_info.eid_size);
-}
+#include "dt_pci.c"
 
 static void dt_pci_shrink(struct shm_du_buff * sdb)
 {
@@ -141,6 +82,24 @@ static void dt_pci_shrink(struct shm_du_buff * sdb)
         shm_du_buff_head_release(sdb, dt_pci_info.head_size);
 }
 
+#ifdef IPCP_FLOW_STATS
+enum stat_type {
+        STAT_SND = 0,
+        STAT_RCV,
+        STAT_LCL_W,
+        STAT_LCL_R,
+        STAT_R_DRP,
+        STAT_W_DRP,
+        STAT_F_NHP,
+        STAT_MAX
+};
+
+struct stat_ctr {
+        size_t pkt[STAT_MAX][QOS_CUBE_MAX];
+        size_t bytes[STAT_MAX][QOS_CUBE_MAX];
+};
+#endif
+
 struct {
         struct psched *    psched;
 
@@ -150,23 +109,14 @@ struct {
         struct {
                 time_t          stamp;
                 uint64_t        addr;
-                size_t          snd_pkt[QOS_CUBE_MAX];
-                size_t          rcv_pkt[QOS_CUBE_MAX];
-                size_t          snd_bytes[QOS_CUBE_MAX];
-                size_t          rcv_bytes[QOS_CUBE_MAX];
-                size_t          lcl_r_pkt[QOS_CUBE_MAX];
-                size_t          lcl_r_bytes[QOS_CUBE_MAX];
-                size_t          lcl_w_pkt[QOS_CUBE_MAX];
-                size_t          lcl_w_bytes[QOS_CUBE_MAX];
-                size_t          r_drp_pkt[QOS_CUBE_MAX];
-                size_t          r_drp_bytes[QOS_CUBE_MAX];
-                size_t          w_drp_pkt[QOS_CUBE_MAX];
-                size_t          w_drp_bytes[QOS_CUBE_MAX];
-                size_t          f_nhp_pkt[QOS_CUBE_MAX];
-                size_t          f_nhp_bytes[QOS_CUBE_MAX];
                 pthread_mutex_t lock;
         } stat[PROG_MAX_FLOWS];
 
+        /* Counters, one shard of PROG_MAX_FLOWS entries per thread. */
+        struct stat_ctr *  ctr;
+        pthread_key_t      shard;
+        size_t             n_shards;
+
         size_t             n_flows;
 #endif
         struct bmp *       res_fds;
@@ -176,20 +126,97 @@ struct {
         pthread_t          listener;
 } dt;
 
+#ifdef IPCP_FLOW_STATS
+static struct stat_ctr * stat_ctr(int fd)
+{
+        void * s;
+        size_t id;
+
+        s = pthread_getspecific(dt.shard);
+        if (s == NULL) {
+                id = __sync_fetch_and_add(&dt.n_shards, 1);
+                id %= IPCP_FLOW_STATS_SHARDS;
+                pthread_setspecific(dt.shard, (void *) (uintptr_t) (id + 1));
+        } else {
+                id = (uintptr_t) s - 1;
+        }
+
+        return &dt.ctr[id * PROG_MAX_FLOWS + fd];
+}
+
+/* Lock-free, threads only share a shard past IPCP_FLOW_STATS_SHARDS. */
+static void stat_add(int            fd,
+                     enum stat_type type,
+                     qoscube_t      qc,
+                     size_t         pkt,
+                     size_t         bytes)
+{
+        struct stat_ctr * c = stat_ctr(fd);
+
+        __atomic_fetch_add(&c->pkt[type][qc], pkt, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c->bytes[type][qc], bytes, __ATOMIC_RELAXED);
+}
+
+/* Packets in flight may still count, so reset each counter atomically. */
+static void stat_clear(int fd)
+{
+        struct stat_ctr * c;
+        size_t            i;
+        int               t;
+        int               q;
+
+        for (i = 0; i < IPCP_FLOW_STATS_SHARDS; ++i) {
+                c = &dt.ctr[i * PROG_MAX_FLOWS + fd];
+                for (t = 0; t < STAT_MAX; ++t) {
+                        for (q = 0; q < QOS_CUBE_MAX; ++q) {
+                                __atomic_store_n(&c->pkt[t][q], 0,
+                                                 __ATOMIC_RELAXED);
+                                __atomic_store_n(&c->bytes[t][q], 0,
+                                                 __ATOMIC_RELAXED);
+                        }
+                }
+        }
+}
+
+static void stat_sum(int               fd,
+                     struct stat_ctr * sum)
+{
+        struct stat_ctr * c;
+        size_t            i;
+        int               t;
+        int               q;
+
+        memset(sum, 0, sizeof(*sum));
+
+        for (i = 0; i < IPCP_FLOW_STATS_SHARDS; ++i) {
+                c = &dt.ctr[i * PROG_MAX_FLOWS + fd];
+                for (t = 0; t < STAT_MAX; ++t) {
+                        for (q = 0; q < QOS_CUBE_MAX; ++q) {
+                                sum->pkt[t][q] += __atomic_load_n(
+                                        &c->pkt[t][q], __ATOMIC_RELAXED);
+                                sum->bytes[t][q] += __atomic_load_n(
+                                        &c->bytes[t][q], __ATOMIC_RELAXED);
+                        }
+                }
+        }
+}
+#endif
+
 static int dt_rib_read(const char * path,
                        char *       buf,
                        size_t       len)
 {
 #ifdef IPCP_FLOW_STATS
-        int         fd;
-        int         i;
-        char        str[QOS_BLOCK_LEN + 1];
-        char        addrstr[20];
-        char *      entry;
-        char        tmstr[20];
-        size_t      rxqlen = 0;
-        size_t      txqlen = 0;
-        struct tm * tm;
+        int             fd;
+        int             i;
+        char            str[QOS_BLOCK_LEN + 1];
+        char            addrstr[20];
+        char *          entry;
+        char            tmstr[20];
+        size_t          rxqlen = 0;
+        size_t          txqlen = 0;
+        struct tm *     tm;
+        struct stat_ctr sum;
 
         /* NOTE: we may need stronger checks. */
         entry = strstr(path, RIB_SEPARATOR) + 1;
@@ -217,6 +244,8 @@ static int dt_rib_read(const char * path,
         tm = localtime(&dt.stat[fd].stamp);
         strftime(tmstr, sizeof(tmstr), "%F %T", tm);
 
+        stat_sum(fd, &sum);
+
         if (fd >= PROG_RES_FDS) {
                 fccntl(fd, FLOWGRXQLEN, &rxqlen);
                 fccntl(fd, FLOWGTXQLEN, &txqlen);
@@ -246,20 +275,20 @@ static int dt_rib_read(const char * path,
                         " failed nhop (packets):   %20zu\n"
                         " failed nhop (bytes):     %20zu\n",
                         i,
-                        dt.stat[fd].snd_pkt[i],
-                        dt.stat[fd].snd_bytes[i],
-                        dt.stat[fd].rcv_pkt[i],
-                        dt.stat[fd].rcv_bytes[i],
-                        dt.stat[fd].lcl_w_pkt[i],
-                        dt.stat[fd].lcl_w_bytes[i],
-                        dt.stat[fd].lcl_r_pkt[i],
-                        dt.stat[fd].lcl_r_bytes[i],
-                        dt.stat[fd].r_drp_pkt[i],
-                        dt.stat[fd].r_drp_bytes[i],
-                        dt.stat[fd].w_drp_pkt[i],
-                        dt.stat[fd].w_drp_bytes[i],
-                        dt.stat[fd].f_nhp_pkt[i],
-                        dt.stat[fd].f_nhp_bytes[i]
+                        sum.pkt[STAT_SND][i],
+                        sum.bytes[STAT_SND][i],
+                        sum.pkt[STAT_RCV][i],
+                        sum.bytes[STAT_RCV][i],
+                        sum.pkt[STAT_LCL_W][i],
+                        sum.bytes[STAT_LCL_W][i],
+                        sum.pkt[STAT_LCL_R][i],
+                        sum.bytes[STAT_LCL_R][i],
+                        sum.pkt[STAT_R_DRP][i],
+                        sum.bytes[STAT_R_DRP][i],
+                        sum.pkt[STAT_W_DRP][i],
+                        sum.bytes[STAT_W_DRP][i],
+                        sum.pkt[STAT_F_NHP][i],
+                        sum.bytes[STAT_F_NHP][i]
                         );
                 strcat(buf, str);
         }
@@ -379,7 +408,7 @@ static void stat_used(int      fd,
 
         pthread_mutex_lock(&dt.stat[fd].lock);
 
-        memset(&dt.stat[fd], 0, sizeof(dt.stat[fd]));
+        stat_clear(fd);
 
         dt.stat[fd].stamp = (addr != INVALID_ADDR) ? now.tv_sec : 0;
         dt.stat[fd].addr = addr;
@@ -409,7 +438,7 @@ static void handle_event(void *       self,
 #ifdef IPCP_FLOW_STATS
                 stat_used(c->flow_info.fd, c->conn_info.addr);
 #endif
-                psched_add(dt.psched, c->flow_info.fd);
+                psched_add(dt.psched, c->flow_info.fd, &c->flow_info.qs);
                 log_dbg("Added fd %d to packet scheduler.", c->flow_info.fd);
                 break;
         case NOTIFY_DT_CONN_DEL:
@@ -425,121 +454,286 @@ static void handle_event(void *       self,
         }
 }
 
-static void packet_handler(int                  fd,
-                           qoscube_t            qc,
-                           struct shm_du_buff * sdb)
+/* Packets with the same key are kept on one path by multipath. */
+static uint64_t dt_flow(uint64_t  eid,
+                        qoscube_t qc)
+{
+        return eid ^ ((uint64_t) qc << 56);
+}
+
+/* Handles local delivery and drops, true if sdb is to be forwarded. */
+static bool dt_classify(int                  fd,
+                        struct shm_du_buff * sdb,
+                        uint64_t *           dst,
+                        uint64_t *           flow,
+                        qoscube_t *          qc)
 {
         struct dt_pci dt_pci;
-        int           ret;
-        int           ofd;
         uint8_t *     head;
         size_t        len;
 
         len = shm_du_buff_tail(sdb) - shm_du_buff_head(sdb);
 
-#ifndef IPCP_FLOW_STATS
-        (void)        fd;
-#else
-        pthread_mutex_lock(&dt.stat[fd].lock);
-
-        ++dt.stat[fd].rcv_pkt[qc];
-        dt.stat[fd].rcv_bytes[qc] += len;
-
-        pthread_mutex_unlock(&dt.stat[fd].lock);
-#endif
         memset(&dt_pci, 0, sizeof(dt_pci));
 
         head = shm_du_buff_head(sdb);
 
         dt_pci_des(head, &dt_pci);
+        if (dt_pci.qc >= QOS_CUBE_MAX) {
+                log_dbg("Invalid qos cube %d.", dt_pci.qc);
+                ipcp_sdb_release(sdb);
+#ifdef IPCP_FLOW_STATS
+                stat_add(fd, STAT_R_DRP, QOS_CUBE_BE, 1, len);
+#endif
+                return false;
+        }
+
+        /* The cube in the PCI holds end to end, not the N-1 flow's. */
+        *qc = dt_pci.qc;
+#ifndef IPCP_FLOW_STATS
+        (void)        fd;
+        (void)        len;
+#else
+        stat_add(fd, STAT_RCV, *qc, 1, len);
+#endif
         if (dt_pci.dst_addr != ipcpi.dt_addr) {
                 if (dt_pci.ttl == 0) {
                         log_dbg("TTL was zero.");
                         ipcp_sdb_release(sdb);
 #ifdef IPCP_FLOW_STATS
-                        pthread_mutex_lock(&dt.stat[fd].lock);
+                        stat_add(fd, STAT_R_DRP, *qc, 1, len);
+#endif
+                        return false;
+                }
+
+                *dst  = dt_pci.dst_addr;
+                *flow = dt_flow(dt_pci.eid, dt_pci.qc);
+
+                return true;
+        }
 
-                        ++dt.stat[fd].r_drp_pkt[qc];
-                        dt.stat[fd].r_drp_bytes[qc] += len;
+        dt_pci_shrink(sdb);
+        if (dt_pci.eid >= PROG_RES_FDS) {
+                uint8_t ecn = *(head + dt_pci_info.ecn_o);
+                fa_np1_rcv(dt_pci.eid, ecn, sdb);
+                return false;
+        }
 
-                        pthread_mutex_unlock(&dt.stat[fd].lock);
+        if (dt.comps[dt_pci.eid].post_packet == NULL) {
+                log_err("No registered component on eid %" PRIu64 ".",
+                        dt_pci.eid);
+                ipcp_sdb_release(sdb);
+                return false;
+        }
+#ifdef IPCP_FLOW_STATS
+        stat_add(fd, STAT_LCL_R, *qc, 1, len);
+        stat_add(dt_pci.eid, STAT_SND, *qc, 1, len);
 #endif
-                        return;
-                }
+        dt.comps[dt_pci.eid].post_packet(dt.comps[dt_pci.eid].comp, sdb);
 
-                /* FIXME: Use qoscube from PCI instead of incoming flow. */
-                ofd = pff_nhop(dt.pff[qc], dt_pci.dst_addr);
-                if (ofd < 0) {
-                        log_dbg("No next hop for %" PRIu64 ".",
-                                dt_pci.dst_addr);
-                        ipcp_sdb_release(sdb);
+        return false;
+}
+
+/* Writes a group of packets that share a next hop. */
+static void dt_forward(int                   ofd,
+                       qoscube_t             qc,
+                       struct shm_du_buff ** sdb,
+                       const size_t *        len,
+                       size_t                n)
+{
+        ssize_t ret;
+        size_t  i;
 #ifdef IPCP_FLOW_STATS
-                        pthread_mutex_lock(&dt.stat[fd].lock);
+        size_t  bytes = 0;
+        size_t  sent  = 0;
+#endif
+        ret = ipcp_flow_write_n(ofd, sdb, n);
+        if (ret < (ssize_t) n) {
+                log_dbg("Failed to write %zu packets to fd %d.",
+                        n - (ret < 0 ? 0 : ret), ofd);
+                if (ret == -EFLOWDOWN)
+                        notifier_event(NOTIFY_DT_FLOW_DOWN, &ofd);
+        }
+
+        if (ret < 0)
+                ret = 0;
 
-                        ++dt.stat[fd].f_nhp_pkt[qc];
-                        dt.stat[fd].f_nhp_bytes[qc] += len;
+        for (i = ret; i < n; ++i) {
+                ipcp_sdb_release(sdb[i]);
+#ifdef IPCP_FLOW_STATS
+                bytes += len[i];
+#endif
+        }
+#ifndef IPCP_FLOW_STATS
+        (void) qc;
+        (void) len;
+#else
+        for (i = 0; i < (size_t) ret; ++i)
+                sent += len[i];
 
-                        pthread_mutex_unlock(&dt.stat[fd].lock);
+        stat_add(ofd, STAT_SND, qc, ret, sent);
+        if ((size_t) ret < n)
+                stat_add(ofd, STAT_W_DRP, qc, n - ret, bytes);
 #endif
-                        return;
+}
+
+/* A cube owns its pff unless it shares that of a lower cube. */
+static bool dt_owns_pff(int qc)
+{
+        int c;
+
+        for (c = 0; c < qc; ++c)
+                if (dt.pff[c] == dt.pff[qc])
+                        return false;
+
+        return true;
+}
+
+/* Next hops for a burst, each packet looked up in the pff of its cube. */
+static void dt_nhop_n(const qoscube_t * qc,
+                      const uint64_t *  dst,
+                      const uint64_t *  flow,
+                      int *             ofd,
+                      size_t            n)
+{
+        uint64_t addr[IPCP_SCHED_BURST];
+        uint64_t key[IPCP_SCHED_BURST];
+        int      nhop[IPCP_SCHED_BURST];
+        size_t   idx[IPCP_SCHED_BURST];
+        size_t   i;
+        size_t   k;
+        int      c;
+
+        for (i = 1; i < n && dt.pff[qc[i]] == dt.pff[qc[0]]; ++i)
+                ;
+
+        /* Fast path, a single table for the burst. */
+        if (i == n) {
+                pff_nhop_n(dt.pff[qc[0]], dst, flow, ofd, n);
+                return;
+        }
+
+        for (c = 0; c < QOS_CUBE_MAX; ++c) {
+                if (!dt_owns_pff(c))
+                        continue;
+
+                k = 0;
+                for (i = 0; i < n; ++i) {
+                        if (dt.pff[qc[i]] != dt.pff[c])
+                                continue;
+                        addr[k]  = dst[i];
+                        key[k]   = flow[i];
+                        idx[k++] = i;
                 }
 
-                (void) ca_calc_ecn(ofd, head + dt_pci_info.ecn_o, qc, len);
+                if (k == 0)
+                        continue;
 
-                ret = ipcp_flow_write(ofd, sdb);
-                if (ret < 0) {
-                        log_dbg("Failed to write packet to fd %d.", ofd);
-                        if (ret == -EFLOWDOWN)
-                                notifier_event(NOTIFY_DT_FLOW_DOWN, &ofd);
-                        ipcp_sdb_release(sdb);
-#ifdef IPCP_FLOW_STATS
-                        pthread_mutex_lock(&dt.stat[ofd].lock);
+                pff_nhop_n(dt.pff[c], addr, key, nhop, k);
 
-                        ++dt.stat[ofd].w_drp_pkt[qc];
-                        dt.stat[ofd].w_drp_bytes[qc] += len;
+                for (i = 0; i < k; ++i)
+                        ofd[idx[i]] = nhop[i];
+        }
+}
 
-                        pthread_mutex_unlock(&dt.stat[ofd].lock);
+static void packet_handler(qoscube_t             qc,
+                           int *                 fd,
+                           struct shm_du_buff ** sdb,
+                           size_t                n)
+{
+        struct shm_du_buff * fwd[IPCP_SCHED_BURST];
+        struct shm_du_buff * grp[IPCP_SCHED_BURST];
+        uint64_t             dst[IPCP_SCHED_BURST];
+        uint64_t             flow[IPCP_SCHED_BURST];
+        qoscube_t            pqc[IPCP_SCHED_BURST];
+        size_t               len[IPCP_SCHED_BURST];
+#ifdef IPCP_FLOW_STATS
+        int                  ifd[IPCP_SCHED_BURST];
 #endif
-                        return;
-                }
+        int                  ofd[IPCP_SCHED_BURST];
+        enum aqm_act         act[IPCP_SCHED_BURST];
+        size_t               m = 0;
+        size_t               i;
+        size_t               j;
+        size_t               k;
+        size_t               g;
+
+        assert(n <= IPCP_SCHED_BURST);
+
+        /* The cube of the N-1 flow only drives scheduling. */
+        (void) qc;
+
+        for (i = 0; i < n; ++i) {
+                if (!dt_classify(fd[i], sdb[i], &dst[m], &flow[m],
+                                 &pqc[m]))
+                        continue;
+                fwd[m] = sdb[i];
 #ifdef IPCP_FLOW_STATS
-                pthread_mutex_lock(&dt.stat[ofd].lock);
+                ifd[m] = fd[i];
+#endif
+                ++m;
+        }
+
+        if (m == 0)
+                return;
 
-                ++dt.stat[ofd].snd_pkt[qc];
-                dt.stat[ofd].snd_bytes[qc] += len;
+        dt_nhop_n(pqc, dst, flow, ofd, m);
 
-                pthread_mutex_unlock(&dt.stat[ofd].lock);
+        /* Group by next hop and cube, keeping the order within a flow. */
+        for (i = 0; i < m; ++i) {
+                if (fwd[i] == NULL)
+                        continue;
+
+                if (ofd[i] < 0) {
+                        log_dbg("No next hop for %" PRIu64 ".", dst[i]);
+#ifdef IPCP_FLOW_STATS
+                        stat_add(ifd[i], STAT_F_NHP, pqc[i], 1,
+                                 shm_du_buff_tail(fwd[i]) -
+                                 shm_du_buff_head(fwd[i]));
 #endif
-        } else {
-                dt_pci_shrink(sdb);
-                if (dt_pci.eid >= PROG_RES_FDS) {
-                        uint8_t ecn = *(head + dt_pci_info.ecn_o);
-                        fa_np1_rcv(dt_pci.eid, ecn, sdb);
-                        return;
+                        ipcp_sdb_release(fwd[i]);
+                        continue;
                 }
 
-                if (dt.comps[dt_pci.eid].post_packet == NULL) {
-                        log_err("No registered component on eid %" PRIu64 ".",
-                                dt_pci.eid);
-                        ipcp_sdb_release(sdb);
-                        return;
+                k = 0;
+                for (j = i; j < m; ++j) {
+                        if (fwd[j] == NULL || ofd[j] != ofd[i] ||
+                            pqc[j] != pqc[i])
+                                continue;
+
+                        grp[k++] = fwd[j];
+                        fwd[j]   = NULL;
                 }
-#ifdef IPCP_FLOW_STATS
-                pthread_mutex_lock(&dt.stat[fd].lock);
 
-                ++dt.stat[fd].lcl_r_pkt[qc];
-                dt.stat[fd].lcl_r_bytes[qc] += len;
+                aqm_enqueue_n(ofd[i], act, k);
 
-                pthread_mutex_unlock(&dt.stat[fd].lock);
-                pthread_mutex_lock(&dt.stat[dt_pci.eid].lock);
+                g = 0;
+                for (j = 0; j < k; ++j) {
+                        uint8_t * head;
+                        size_t    l;
 
-                ++dt.stat[dt_pci.eid].snd_pkt[qc];
-                dt.stat[dt_pci.eid].snd_bytes[qc] += len;
+                        head = shm_du_buff_head(grp[j]);
+                        l    = shm_du_buff_tail(grp[j]) - head;
 
-                pthread_mutex_unlock(&dt.stat[dt_pci.eid].lock);
+                        if (act[j] == AQM_DROP) {
+#ifdef IPCP_FLOW_STATS
+                                stat_add(ofd[i], STAT_W_DRP, pqc[i], 1, l);
 #endif
-                dt.comps[dt_pci.eid].post_packet(dt.comps[dt_pci.eid].comp,
-                                                 sdb);
+                                ipcp_sdb_release(grp[j]);
+                                continue;
+                        }
+
+                        (void) ca_calc_ecn(ofd[i], head + dt_pci_info.ecn_o,
+                                           pqc[i], l);
+                        if (act[j] == AQM_MARK)
+                                head[dt_pci_info.ecn_o] = AQM_ECN_MARK;
+
+                        len[g]   = l;
+                        grp[g++] = grp[j];
+                }
+
+                if (g > 0)
+                        dt_forward(ofd[i], pqc[i], grp, len, g);
         }
 }
 
@@ -563,10 +757,11 @@ static void * dt_conn_handle(void * o)
         return 0;
 }
 
-int dt_init(enum pol_routing pr,
-            uint8_t          addr_size,
-            uint8_t          eid_size,
-            uint8_t          max_ttl)
+int dt_init(enum pol_routing          pr,
+            const struct spf_timers * spf,
+            uint8_t                   addr_size,
+            uint8_t                   eid_size,
+            uint8_t                   max_ttl)
 {
         int              i;
         int              j;
@@ -587,15 +782,7 @@ int dt_init(enum pol_routing pr,
                 eid_size = 8;
         }
 
-        dt_pci_info.addr_size = addr_size;
-        dt_pci_info.eid_size  = eid_size;
-        dt_pci_info.max_ttl   = max_ttl;
-
-        dt_pci_info.qc_o      = dt_pci_info.addr_size;
-        dt_pci_info.ttl_o     = dt_pci_info.qc_o + QOS_LEN;
-        dt_pci_info.ecn_o     = dt_pci_info.ttl_o + TTL_LEN;
-        dt_pci_info.eid_o     = dt_pci_info.ecn_o + ECN_LEN;
-        dt_pci_info.head_size = dt_pci_info.eid_o + dt_pci_info.eid_size;
+        dt_pci_init(addr_size, eid_size, max_ttl);
 
         if (notifier_reg(handle_event, NULL)) {
                 log_err("Failed to register with notifier.");
@@ -607,27 +794,41 @@ int dt_init(enum pol_routing pr,
                 goto fail_connmgr_comp_init;
         }
 
-        pp = routing_init(pr);
+        pp = routing_init(pr, spf);
         if (pp < 0) {
                 log_err("Failed to init routing.");
                 goto fail_routing;
         }
 
+        /* Cubes that route alike reference the table of the first. */
         for (i = 0; i < QOS_CUBE_MAX; ++i) {
+                j = routing_cube_table(i);
+                if (j != i) {
+                        log_dbg("QoS cube %d uses the PFF of cube %d.", i, j);
+                        dt.pff[i] = dt.pff[j];
+                        continue;
+                }
+
                 dt.pff[i] = pff_create(pp);
                 if (dt.pff[i] == NULL) {
                         log_err("Failed to create a PFF.");
                         for (j = 0; j < i; ++j)
-                                pff_destroy(dt.pff[j]);
+                                if (dt_owns_pff(j))
+                                        pff_destroy(dt.pff[j]);
                         goto fail_pff;
                 }
         }
 
         for (i = 0; i < QOS_CUBE_MAX; ++i) {
-                dt.routing[i] = routing_i_create(dt.pff[i]);
+                dt.routing[i] = NULL;
+                if (!dt_owns_pff(i))
+                        continue;
+
+                dt.routing[i] = routing_i_create(dt.pff[i], i);
                 if (dt.routing[i] == NULL) {
                         for (j = 0; j < i; ++j)
-                                routing_i_destroy(dt.routing[j]);
+                                if (dt.routing[j] != NULL)
+                                        routing_i_destroy(dt.routing[j]);
                         goto fail_routing_i;
                 }
         }
@@ -641,6 +842,16 @@ int dt_init(enum pol_routing pr,
         if (dt.res_fds == NULL)
                 goto fail_res_fds;
 #ifdef IPCP_FLOW_STATS
+        dt.ctr = calloc(IPCP_FLOW_STATS_SHARDS * PROG_MAX_FLOWS,
+                        sizeof(*dt.ctr));
+        if (dt.ctr == NULL)
+                goto fail_stat_ctr;
+
+        if (pthread_key_create(&dt.shard, NULL))
+                goto fail_stat_key;
+
+        dt.n_shards = 0;
+
         memset(dt.stat, 0, sizeof(dt.stat));
 
         for (i = 0; i < PROG_MAX_FLOWS; ++i)
@@ -663,16 +874,22 @@ int dt_init(enum pol_routing pr,
         for (i = 0; i < PROG_MAX_FLOWS; ++i)
                 pthread_mutex_destroy(&dt.stat[i].lock);
  fail_stat_lock:
+        pthread_key_delete(dt.shard);
+ fail_stat_key:
+        free(dt.ctr);
+ fail_stat_ctr:
 #endif
         bmp_destroy(dt.res_fds);
  fail_res_fds:
         pthread_rwlock_destroy(&dt.lock);
  fail_rwlock_init:
         for (j = 0; j < QOS_CUBE_MAX; ++j)
-                routing_i_destroy(dt.routing[j]);
+                if (dt.routing[j] != NULL)
+                        routing_i_destroy(dt.routing[j]);
  fail_routing_i:
         for (i = 0; i < QOS_CUBE_MAX; ++i)
-                pff_destroy(dt.pff[i]);
+                if (dt_owns_pff(i))
+                        pff_destroy(dt.pff[i]);
  fail_pff:
         routing_fini();
  fail_routing:
@@ -693,16 +910,21 @@ void dt_fini(void)
 #ifdef IPCP_FLOW_STATS
         for (i = 0; i < PROG_MAX_FLOWS; ++i)
                 pthread_mutex_destroy(&dt.stat[i].lock);
+
+        pthread_key_delete(dt.shard);
+        free(dt.ctr);
 #endif
         bmp_destroy(dt.res_fds);
 
         pthread_rwlock_destroy(&dt.lock);
 
         for (i = 0; i < QOS_CUBE_MAX; ++i)
-                routing_i_destroy(dt.routing[i]);
+                if (dt.routing[i] != NULL)
+                        routing_i_destroy(dt.routing[i]);
 
         for (i = 0; i < QOS_CUBE_MAX; ++i)
-                pff_destroy(dt.pff[i]);
+                if (dt_owns_pff(i))
+                        pff_destroy(dt.pff[i]);
 
         routing_fini();
 
@@ -773,6 +995,7 @@ int dt_write_packet(uint64_t             dst_addr,
                     struct shm_du_buff * sdb)
 {
         struct dt_pci dt_pci;
+        enum aqm_act  act;
         int           fd;
         int           ret;
         uint8_t *     head;
@@ -785,30 +1008,24 @@ int dt_write_packet(uint64_t             dst_addr,
 
 #ifdef IPCP_FLOW_STATS
         if (eid < PROG_RES_FDS) {
-                pthread_mutex_lock(&dt.stat[eid].lock);
-
-                ++dt.stat[eid].lcl_r_pkt[qc];
-                dt.stat[eid].lcl_r_bytes[qc] += len;
-
-                pthread_mutex_unlock(&dt.stat[eid].lock);
+                stat_add(eid, STAT_LCL_R, qc, 1, len);
         }
 #endif
-        fd = pff_nhop(dt.pff[qc], dst_addr);
+        fd = pff_nhop(dt.pff[qc], dst_addr, dt_flow(eid, qc));
         if (fd < 0) {
                 log_dbg("Could not get nhop for addr %" PRIu64 ".", dst_addr);
 #ifdef IPCP_FLOW_STATS
                 if (eid < PROG_RES_FDS) {
-                        pthread_mutex_lock(&dt.stat[eid].lock);
-
-                        ++dt.stat[eid].lcl_r_pkt[qc];
-                        dt.stat[eid].lcl_r_bytes[qc] += len;
-
-                        pthread_mutex_unlock(&dt.stat[eid].lock);
+                        stat_add(eid, STAT_LCL_R, qc, 1, len);
                 }
 #endif
                 return -EPERM;
         }
 
+        aqm_enqueue_n(fd, &act, 1);
+        if (act == AQM_DROP)
+                goto fail_write;
+
         head = shm_du_buff_head_alloc(sdb, dt_pci_info.head_size);
         if (head == NULL) {
                 log_dbg("Failed to allocate DT header.");
@@ -823,6 +1040,8 @@ int dt_write_packet(uint64_t             dst_addr,
         dt_pci.ecn      = 0;
 
         (void) ca_calc_ecn(fd, &dt_pci.ecn, qc, len);
+        if (act == AQM_MARK)
+                dt_pci.ecn = AQM_ECN_MARK;
 
         dt_pci_ser(head, &dt_pci);
 
@@ -834,31 +1053,17 @@ int dt_write_packet(uint64_t             dst_addr,
                 goto fail_write;
         }
 #ifdef IPCP_FLOW_STATS
-        pthread_mutex_lock(&dt.stat[fd].lock);
-
-        if (dt_pci.eid < PROG_RES_FDS) {
-                ++dt.stat[fd].lcl_w_pkt[qc];
-                dt.stat[fd].lcl_w_bytes[qc] += len;
-        }
-        ++dt.stat[fd].snd_pkt[qc];
-        dt.stat[fd].snd_bytes[qc] += len;
-
-        pthread_mutex_unlock(&dt.stat[fd].lock);
+        if (dt_pci.eid < PROG_RES_FDS)
+                stat_add(fd, STAT_LCL_W, qc, 1, len);
+        stat_add(fd, STAT_SND, qc, 1, len);
 #endif
         return 0;
 
  fail_write:
 #ifdef IPCP_FLOW_STATS
-        pthread_mutex_lock(&dt.stat[fd].lock);
-
-        if (eid < PROG_RES_FDS) {
-                ++dt.stat[fd].lcl_w_pkt[qc];
-                dt.stat[fd].lcl_w_bytes[qc] += len;
-        }
-        ++dt.stat[fd].w_drp_pkt[qc];
-        dt.stat[fd].w_drp_bytes[qc] += len;
-
-        pthread_mutex_unlock(&dt.stat[fd].lock);
+        if (eid < PROG_RES_FDS)
+                stat_add(fd, STAT_LCL_W, qc, 1, len);
+        stat_add(fd, STAT_W_DRP, qc, 1, len);
 #endif
         return -1;
 }
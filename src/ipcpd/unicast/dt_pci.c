@@ -0,0 +1,238 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Data Transfer PCI encoding and decoding
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+/*
+ * PCI layout, addresses and eids in network byte order:
+ *
+ *  dst_addr (addr_size) | qc (1) | ttl (1) | ecn (1) | eid (eid_size)
+ *
+ * The common layouts get a codec with fixed offsets, selected once
+ * in dt_pci_init. Other sizes use the generic byte-wise codec.
+ */
+
+#include <ouroboros/endian.h>
+#include <ouroboros/qoscube.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Fixed field lengths */
+#define TTL_LEN 1
+#define QOS_LEN 1
+#define ECN_LEN 1
+
+struct dt_pci {
+        uint64_t  dst_addr;
+        qoscube_t qc;
+        uint8_t   ttl;
+        uint8_t   ecn;
+        uint64_t  eid;
+};
+
+typedef void (* dt_pci_fn_t)(uint8_t * head, struct dt_pci * dt_pci);
+
+struct {
+        uint8_t         addr_size;
+        uint8_t         eid_size;
+        size_t          head_size;
+
+        /* Offsets */
+        size_t          qc_o;
+        size_t          ttl_o;
+        size_t          ecn_o;
+        size_t          eid_o;
+
+        /* Initial TTL value */
+        uint8_t         max_ttl;
+
+        /* Codec for this layout */
+        dt_pci_fn_t     ser;
+        dt_pci_fn_t     des;
+} dt_pci_info;
+
+static void dt_pci_put4(uint8_t * p,
+                        uint64_t  v)
+{
+        uint32_t n = hton32((uint32_t) v);
+
+        memcpy(p, &n, sizeof(n));
+}
+
+static void dt_pci_put8(uint8_t * p,
+                        uint64_t  v)
+{
+        uint64_t n = hton64(v);
+
+        memcpy(p, &n, sizeof(n));
+}
+
+static uint64_t dt_pci_get4(const uint8_t * p)
+{
+        uint32_t n;
+
+        memcpy(&n, p, sizeof(n));
+
+        return ntoh32(n);
+}
+
+static uint64_t dt_pci_get8(const uint8_t * p)
+{
+        uint64_t n;
+
+        memcpy(&n, p, sizeof(n));
+
+        return ntoh64(n);
+}
+
+static void dt_pci_put(uint8_t * p,
+                       uint64_t  v,
+                       size_t    len)
+{
+        while (len-- > 0) {
+                p[len] = (uint8_t) v;
+                v >>= 8;
+        }
+}
+
+static uint64_t dt_pci_get(const uint8_t * p,
+                           size_t          len)
+{
+        uint64_t v = 0;
+        size_t   i;
+
+        for (i = 0; i < len; ++i)
+                v = (v << 8) | p[i];
+
+        return v;
+}
+
+static void dt_pci_ser_gen(uint8_t *       head,
+                           struct dt_pci * dt_pci)
+{
+        dt_pci_put(head, dt_pci->dst_addr, dt_pci_info.addr_size);
+        head[dt_pci_info.qc_o]  = (uint8_t) dt_pci->qc;
+        head[dt_pci_info.ttl_o] = dt_pci_info.max_ttl;
+        head[dt_pci_info.ecn_o] = dt_pci->ecn;
+        dt_pci_put(head + dt_pci_info.eid_o, dt_pci->eid,
+                   dt_pci_info.eid_size);
+}
+
+static void dt_pci_des_gen(uint8_t *       head,
+                           struct dt_pci * dt_pci)
+{
+        /* Decrease TTL */
+        --head[dt_pci_info.ttl_o];
+
+        dt_pci->dst_addr = dt_pci_get(head, dt_pci_info.addr_size);
+        dt_pci->qc       = (qoscube_t) head[dt_pci_info.qc_o];
+        dt_pci->ttl      = head[dt_pci_info.ttl_o];
+        dt_pci->ecn      = head[dt_pci_info.ecn_o];
+        dt_pci->eid      = dt_pci_get(head + dt_pci_info.eid_o,
+                                      dt_pci_info.eid_size);
+}
+
+#define DT_PCI_CODEC(A, E)                                              \
+        static void dt_pci_ser_##A##_##E(uint8_t *       head,          \
+                                         struct dt_pci * dt_pci)        \
+        {                                                               \
+                dt_pci_put##A(head, dt_pci->dst_addr);                  \
+                head[A]     = (uint8_t) dt_pci->qc;                     \
+                head[A + 1] = dt_pci_info.max_ttl;                      \
+                head[A + 2] = dt_pci->ecn;                              \
+                dt_pci_put##E(head + A + 3, dt_pci->eid);               \
+        }                                                               \
+                                                                        \
+        static void dt_pci_des_##A##_##E(uint8_t *       head,          \
+                                         struct dt_pci * dt_pci)        \
+        {                                                               \
+                --head[A + 1];                                          \
+                dt_pci->dst_addr = dt_pci_get##A(head);                 \
+                dt_pci->qc       = (qoscube_t) head[A];                 \
+                dt_pci->ttl      = head[A + 1];                         \
+                dt_pci->ecn      = head[A + 2];                         \
+                dt_pci->eid      = dt_pci_get##E(head + A + 3);         \
+        }
+
+/* dt_init forces 64 bit EIDs, only the address size varies. */
+DT_PCI_CODEC(4, 8)
+DT_PCI_CODEC(8, 8)
+
+static const struct {
+        uint8_t     addr_size;
+        uint8_t     eid_size;
+        dt_pci_fn_t ser;
+        dt_pci_fn_t des;
+} dt_pci_codecs[] = {
+        { 4, 8, dt_pci_ser_4_8, dt_pci_des_4_8 },
+        { 8, 8, dt_pci_ser_8_8, dt_pci_des_8_8 }
+};
+
+static void dt_pci_init(uint8_t addr_size,
+                        uint8_t eid_size,
+                        uint8_t max_ttl)
+{
+        size_t i;
+
+        assert(addr_size > 0 && addr_size <= sizeof(uint64_t));
+        assert(eid_size > 0 && eid_size <= sizeof(uint64_t));
+
+        dt_pci_info.addr_size = addr_size;
+        dt_pci_info.eid_size  = eid_size;
+        dt_pci_info.max_ttl   = max_ttl;
+
+        dt_pci_info.qc_o      = dt_pci_info.addr_size;
+        dt_pci_info.ttl_o     = dt_pci_info.qc_o + QOS_LEN;
+        dt_pci_info.ecn_o     = dt_pci_info.ttl_o + TTL_LEN;
+        dt_pci_info.eid_o     = dt_pci_info.ecn_o + ECN_LEN;
+        dt_pci_info.head_size = dt_pci_info.eid_o + dt_pci_info.eid_size;
+
+        dt_pci_info.ser = dt_pci_ser_gen;
+        dt_pci_info.des = dt_pci_des_gen;
+
+        for (i = 0; i < sizeof(dt_pci_codecs) / sizeof(*dt_pci_codecs); ++i) {
+                if (dt_pci_codecs[i].addr_size == addr_size &&
+                    dt_pci_codecs[i].eid_size == eid_size) {
+                        dt_pci_info.ser = dt_pci_codecs[i].ser;
+                        dt_pci_info.des = dt_pci_codecs[i].des;
+                        break;
+                }
+        }
+}
+
+static void dt_pci_ser(uint8_t *       head,
+                       struct dt_pci * dt_pci)
+{
+        assert(head);
+        assert(dt_pci);
+
+        dt_pci_info.ser(head, dt_pci);
+}
+
+static void dt_pci_des(uint8_t *       head,
+                       struct dt_pci * dt_pci)
+{
+        assert(head);
+        assert(dt_pci);
+
+        dt_pci_info.des(head, dt_pci);
+}
@@ -48,6 +48,7 @@
 #include "ca.h"
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -80,6 +81,7 @@ struct fa_msg {
         uint32_t ber;
         uint32_t max_gap;
         uint16_t cypher_s;
+        uint8_t  compress;
 } __attribute__((packed));
 
 struct cmd {
@@ -87,6 +89,15 @@ struct cmd {
         struct shm_du_buff * sdb;
 };
 
+/* All messages for a flow are handled in order by the same worker. */
+struct fa_worker {
+        struct list_head cmds;
+        struct list_head pool; /* Free commands */
+        pthread_cond_t   cond;
+        pthread_mutex_t  mtx;
+        pthread_t        thr;
+};
+
 struct fa_flow {
 #ifdef IPCP_FLOW_STATS
         time_t   stamp;    /* Flow creation                  */
@@ -101,12 +112,20 @@ struct fa_flow {
         size_t   u_snd;    /* Flow updates sent              */
         size_t   u_rcv;    /* Flow updates received          */
 #endif
-        uint64_t s_eid;  /* Local endpoint id                */
-        uint64_t r_eid;  /* Remote endpoint id               */
-        uint64_t r_addr; /* Remote address                   */
-        void *   ctx;    /* Congestion avoidance context     */
+        uint64_t  r_eid;  /* Remote endpoint id               */
+        uint64_t  r_addr; /* Remote address                   */
+        void *    ctx;    /* Congestion avoidance context     */
+        qosspec_t qs;     /* Requested QoS                    */
+        uint64_t  s_eid;  /* Local endpoint id                */
+
+        pthread_mutex_t lock;
 };
 
+/*
+ * The flows_lock serializes allocation and deallocation, the packet
+ * paths only take the lock of their flow. The local endpoint id is
+ * written under both, so it can be checked without a lock first.
+ */
 struct {
         pthread_rwlock_t flows_lock;
         struct fa_flow   flows[PROG_MAX_FLOWS];
@@ -115,10 +134,7 @@ struct {
 #endif
         uint32_t         eid;
 
-        struct list_head cmds;
-        pthread_cond_t   cond;
-        pthread_mutex_t  mtx;
-        pthread_t        worker;
+        struct fa_worker workers[IPCP_FA_WORKERS];
 
         struct psched *  psched;
 } fa;
@@ -143,7 +159,7 @@ static int fa_rib_read(const char * path,
 
         fd = atoi(entry);
 
-        if (fd < 0 || fd > PROG_MAX_FLOWS)
+        if (fd < 0 || fd >= PROG_MAX_FLOWS)
                 return -1;
 
         if (len < 1536)
@@ -153,10 +169,10 @@ static int fa_rib_read(const char * path,
 
         buf[0] = '\0';
 
-        pthread_rwlock_rdlock(&fa.flows_lock);
+        pthread_mutex_lock(&flow->lock);
 
         if (flow->stamp ==0) {
-                pthread_rwlock_unlock(&fa.flows_lock);
+                pthread_mutex_unlock(&flow->lock);
                 return 0;
         }
 
@@ -194,7 +210,7 @@ static int fa_rib_read(const char * path,
                 flow->u_snd, flow->u_rcv,
                 castr);
 
-        pthread_rwlock_unlock(&fa.flows_lock);
+        pthread_mutex_unlock(&flow->lock);
 
         return strlen(buf);
 #else
@@ -303,17 +319,39 @@ static int eid_to_fd(uint64_t eid)
 
         fd = eid & 0xFFFFFFFF;
 
-        if (fd < 0 || fd > PROG_MAX_FLOWS)
+        if (fd < 0 || fd >= PROG_MAX_FLOWS)
                 return -1;
 
         flow = &fa.flows[fd];
 
-        if (flow->s_eid == eid)
+        if (__atomic_load_n(&flow->s_eid, __ATOMIC_ACQUIRE) == eid)
                 return fd;
 
         return -1;
 }
 
+/* Returns the flow for eid locked, NULL if it is not (or no longer) there. */
+static struct fa_flow * fa_flow_get(uint64_t eid,
+                                    int *    fd)
+{
+        struct fa_flow * flow;
+
+        *fd = eid_to_fd(eid);
+        if (*fd < 0)
+                return NULL;
+
+        flow = &fa.flows[*fd];
+
+        pthread_mutex_lock(&flow->lock);
+
+        if (flow->s_eid != eid) {
+                pthread_mutex_unlock(&flow->lock);
+                return NULL;
+        }
+
+        return flow;
+}
+
 static uint64_t gen_eid(int fd)
 {
         uint32_t rnd;
@@ -326,9 +364,9 @@ static uint64_t gen_eid(int fd)
         return ((uint64_t) rnd << 32) + fd;
 }
 
-static void packet_handler(int                  fd,
-                           qoscube_t            qc,
-                           struct shm_du_buff * sdb)
+static void fa_packet(int                  fd,
+                      qoscube_t            qc,
+                      struct shm_du_buff * sdb)
 {
         struct fa_flow * flow;
         uint64_t         r_addr;
@@ -338,10 +376,10 @@ static void packet_handler(int                  fd,
 
         flow = &fa.flows[fd];
 
-        pthread_rwlock_wrlock(&fa.flows_lock);
-
         len = shm_du_buff_tail(sdb) - shm_du_buff_head(sdb);
 
+        pthread_mutex_lock(&flow->lock);
+
 #ifdef IPCP_FLOW_STATS
         ++flow->p_snd;
         flow->b_snd += len;
@@ -351,7 +389,7 @@ static void packet_handler(int                  fd,
         r_addr = flow->r_addr;
         r_eid  = flow->r_eid;
 
-        pthread_rwlock_unlock(&fa.flows_lock);
+        pthread_mutex_unlock(&flow->lock);
 
         ca_wnd_wait(wnd);
 
@@ -359,30 +397,51 @@ static void packet_handler(int                  fd,
                 ipcp_sdb_release(sdb);
                 log_warn("Failed to forward packet.");
 #ifdef IPCP_FLOW_STATS
-                pthread_rwlock_wrlock(&fa.flows_lock);
+                pthread_mutex_lock(&flow->lock);
                 ++flow->p_snd_f;
                 flow->b_snd_f += len;
-                pthread_rwlock_unlock(&fa.flows_lock);
+                pthread_mutex_unlock(&flow->lock);
 #endif
                 return;
         }
 }
 
-static int fa_flow_init(struct fa_flow * flow)
+static void packet_handler(qoscube_t             qc,
+                           int *                 fd,
+                           struct shm_du_buff ** sdb,
+                           size_t                n)
+{
+        size_t i;
+
+        for (i = 0; i < n; ++i)
+                fa_packet(fd[i], qc, sdb[i]);
+}
+
+/* Called with the flows_lock held, s_eid is published last. */
+static int fa_flow_init(struct fa_flow *  flow,
+                        uint64_t          s_eid,
+                        uint64_t          r_eid,
+                        uint64_t          r_addr,
+                        const qosspec_t * qs)
 {
 #ifdef IPCP_FLOW_STATS
         struct timespec now;
 #endif
-        memset(flow, 0, sizeof(*flow));
-
-        flow->r_eid  = -1;
-        flow->s_eid  = -1;
-        flow->r_addr = INVALID_ADDR;
+        void *          ctx;
 
-        flow->ctx = ca_ctx_create();
-        if (flow->ctx == NULL)
+        ctx = ca_ctx_create();
+        if (ctx == NULL)
                 return -1;
 
+        pthread_mutex_lock(&flow->lock);
+
+        memset(flow, 0, offsetof(struct fa_flow, s_eid));
+
+        flow->r_eid  = r_eid;
+        flow->r_addr = r_addr;
+        flow->ctx    = ctx;
+        flow->qs     = *qs;
+
 #ifdef IPCP_FLOW_STATS
         clock_gettime(CLOCK_REALTIME_COARSE, &now);
 
@@ -390,85 +449,128 @@ static int fa_flow_init(struct fa_flow * flow)
 
         ++fa.n_flows;
 #endif
+        __atomic_store_n(&flow->s_eid, s_eid, __ATOMIC_RELEASE);
+
+        pthread_mutex_unlock(&flow->lock);
+
         return 0;
 }
 
+/* Called with the flows_lock held. */
 static void fa_flow_fini(struct fa_flow * flow)
 {
+        pthread_mutex_lock(&flow->lock);
+
+        __atomic_store_n(&flow->s_eid, -1, __ATOMIC_RELEASE);
+
         ca_ctx_destroy(flow->ctx);
 
-        memset(flow, 0, sizeof(*flow));
+        memset(flow, 0, offsetof(struct fa_flow, s_eid));
 
         flow->r_eid  = -1;
-        flow->s_eid  = -1;
         flow->r_addr = INVALID_ADDR;
 
 #ifdef IPCP_FLOW_STATS
         --fa.n_flows;
 #endif
+        pthread_mutex_unlock(&flow->lock);
+}
+
+/* Requests are sharded by the remote eid, the rest by the local one. */
+static struct fa_worker * fa_msg_worker(const struct fa_msg * msg)
+{
+        uint64_t eid;
+
+        if (msg->code == FLOW_REQ)
+                eid = ntoh64(msg->s_eid);
+        else
+                eid = ntoh64(msg->r_eid);
+
+        return &fa.workers[(eid ^ (eid >> 32)) % IPCP_FA_WORKERS];
 }
 
 static void fa_post_packet(void *               comp,
                            struct shm_du_buff * sdb)
 {
-        struct cmd * cmd;
+        struct fa_worker * w;
+        struct cmd *       cmd;
+        size_t             len;
 
         assert(comp == &fa);
 
         (void) comp;
 
-        cmd = malloc(sizeof(*cmd));
-        if (cmd == NULL) {
-                log_err("Command failed. Out of memory.");
+        len = shm_du_buff_tail(sdb) - shm_du_buff_head(sdb);
+        if (len < sizeof(struct fa_msg)) {
+                log_err("Flow allocation message too short.");
                 ipcp_sdb_release(sdb);
                 return;
         }
 
-        cmd->sdb = sdb;
+        w = fa_msg_worker((struct fa_msg *) shm_du_buff_head(sdb));
+
+        pthread_mutex_lock(&w->mtx);
 
-        pthread_mutex_lock(&fa.mtx);
+        if (list_is_empty(&w->pool)) {
+                cmd = malloc(sizeof(*cmd));
+                if (cmd == NULL) {
+                        pthread_mutex_unlock(&w->mtx);
+                        log_err("Command failed. Out of memory.");
+                        ipcp_sdb_release(sdb);
+                        return;
+                }
+        } else {
+                cmd = list_first_entry(&w->pool, struct cmd, next);
+                list_del(&cmd->next);
+        }
+
+        cmd->sdb = sdb;
 
-        list_add(&cmd->next, &fa.cmds);
+        list_add(&cmd->next, &w->cmds);
 
-        pthread_cond_signal(&fa.cond);
+        pthread_cond_signal(&w->cond);
 
-        pthread_mutex_unlock(&fa.mtx);
+        pthread_mutex_unlock(&w->mtx);
 }
 
 static void * fa_handle_packet(void * o)
 {
-        struct timespec ts  = {0, TIMEOUT * 1000};
-
-        (void) o;
+        struct timespec    ts = {0, TIMEOUT * 1000};
+        struct fa_worker * w  = (struct fa_worker *) o;
 
         while (true) {
-                struct timespec  abstime;
-                int              fd;
-                uint8_t          buf[MSGBUFSZ];
-                struct fa_msg *  msg;
-                qosspec_t        qs;
-                struct cmd *     cmd;
-                size_t           len;
-                size_t           msg_len;
-                struct fa_flow * flow;
+                struct timespec      abstime;
+                int                  fd;
+                uint8_t              buf[MSGBUFSZ];
+                struct fa_msg *      msg;
+                qosspec_t            qs;
+                struct cmd *         cmd;
+                struct shm_du_buff * sdb;
+                size_t               len;
+                size_t               msg_len;
+                struct fa_flow *     flow;
 
-                pthread_mutex_lock(&fa.mtx);
+                pthread_mutex_lock(&w->mtx);
 
-                pthread_cleanup_push(__cleanup_mutex_unlock, &fa.mtx);
+                pthread_cleanup_push(__cleanup_mutex_unlock, &w->mtx);
 
-                while (list_is_empty(&fa.cmds))
-                        pthread_cond_wait(&fa.cond, &fa.mtx);
+                while (list_is_empty(&w->cmds))
+                        pthread_cond_wait(&w->cond, &w->mtx);
 
-                cmd = list_last_entry(&fa.cmds, struct cmd, next);
+                cmd = list_last_entry(&w->cmds, struct cmd, next);
                 list_del(&cmd->next);
 
+                sdb = cmd->sdb;
+
+                list_add(&cmd->next, &w->pool);
+
                 pthread_cleanup_pop(true);
 
-                len = shm_du_buff_tail(cmd->sdb) - shm_du_buff_head(cmd->sdb);
+                len = shm_du_buff_tail(sdb) - shm_du_buff_head(sdb);
 
                 if (len > MSGBUFSZ) {
                         log_err("Message over buffer size.");
-                        free(cmd);
+                        ipcp_sdb_release(sdb);
                         continue;
                 }
 
@@ -476,11 +578,9 @@ static void * fa_handle_packet(void * o)
 
                 /* Depending on the message call the function in ipcp-dev.h */
 
-                memcpy(msg, shm_du_buff_head(cmd->sdb), len);
+                memcpy(msg, shm_du_buff_head(sdb), len);
 
-                ipcp_sdb_release(cmd->sdb);
-
-                free(cmd);
+                ipcp_sdb_release(sdb);
 
                 switch (msg->code) {
                 case FLOW_REQ:
@@ -517,6 +617,7 @@ static void * fa_handle_packet(void * o)
                         qs.in_order     = msg->in_order;
                         qs.max_gap      = ntoh32(msg->max_gap);
                         qs.cypher_s     = ntoh16(msg->cypher_s);
+                        qs.compress     = msg->compress;
 
                         fd = ipcp_flow_req_arr((uint8_t *) (msg + 1),
                                                ipcp_dir_hash_len(),
@@ -533,11 +634,10 @@ static void * fa_handle_packet(void * o)
 
                         pthread_rwlock_wrlock(&fa.flows_lock);
 
-                        fa_flow_init(flow);
-
-                        flow->s_eid  = gen_eid(fd);
-                        flow->r_eid  = ntoh64(msg->s_eid);
-                        flow->r_addr = ntoh64(msg->s_addr);
+                        if (fa_flow_init(flow, gen_eid(fd),
+                                         ntoh64(msg->s_eid),
+                                         ntoh64(msg->s_addr), &qs))
+                                log_err("Failed to init flow %d.", fd);
 
                         pthread_rwlock_unlock(&fa.flows_lock);
 
@@ -560,12 +660,14 @@ static void * fa_handle_packet(void * o)
 
                         flow = &fa.flows[fd];
 
+                        pthread_mutex_lock(&flow->lock);
                         flow->r_eid = ntoh64(msg->s_eid);
+                        pthread_mutex_unlock(&flow->lock);
 
                         if (msg->response < 0)
                                 fa_flow_fini(flow);
                         else
-                                psched_add(fa.psched, fd);
+                                psched_add(fa.psched, fd, &flow->qs);
 
                         pthread_rwlock_unlock(&fa.flows_lock);
 
@@ -577,21 +679,15 @@ static void * fa_handle_packet(void * o)
                 case FLOW_UPDATE:
                         assert(len >= sizeof(*msg));
 
-                        pthread_rwlock_wrlock(&fa.flows_lock);
-
-                        fd = eid_to_fd(ntoh64(msg->r_eid));
-                        if (fd < 0) {
-                                pthread_rwlock_unlock(&fa.flows_lock);
+                        flow = fa_flow_get(ntoh64(msg->r_eid), &fd);
+                        if (flow == NULL)
                                 break;
-                        }
-
-                        flow = &fa.flows[fd];
 #ifdef IPCP_FLOW_STATS
                         flow->u_rcv++;
 #endif
                         ca_ctx_update_ece(flow->ctx, ntoh16(msg->ece));
 
-                        pthread_rwlock_unlock(&fa.flows_lock);
+                        pthread_mutex_unlock(&flow->lock);
 
                         break;
                 default:
@@ -603,14 +699,38 @@ static void * fa_handle_packet(void * o)
         return (void *) 0;
 }
 
-int fa_init(void)
+static void fa_worker_fini(struct fa_worker * w)
+{
+        struct list_head * p;
+        struct list_head * h;
+
+        list_for_each_safe(p, h, &w->cmds) {
+                struct cmd * cmd = list_entry(p, struct cmd, next);
+                list_del(&cmd->next);
+                ipcp_sdb_release(cmd->sdb);
+                free(cmd);
+        }
+
+        list_for_each_safe(p, h, &w->pool) {
+                struct cmd * cmd = list_entry(p, struct cmd, next);
+                list_del(&cmd->next);
+                free(cmd);
+        }
+
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->mtx);
+}
+
+static int fa_worker_init(struct fa_worker * w)
 {
         pthread_condattr_t cattr;
+        struct cmd *       cmd;
+        int                i;
 
-        if (pthread_rwlock_init(&fa.flows_lock, NULL))
-                goto fail_rwlock;
+        list_head_init(&w->cmds);
+        list_head_init(&w->pool);
 
-        if (pthread_mutex_init(&fa.mtx, NULL))
+        if (pthread_mutex_init(&w->mtx, NULL))
                 goto fail_mtx;
 
         if (pthread_condattr_init(&cattr))
@@ -619,29 +739,71 @@ int fa_init(void)
 #ifndef __APPLE__
         pthread_condattr_setclock(&cattr, PTHREAD_COND_CLOCK);
 #endif
-        if (pthread_cond_init(&fa.cond, &cattr))
+        if (pthread_cond_init(&w->cond, &cattr))
                 goto fail_cond;
 
         pthread_condattr_destroy(&cattr);
 
-        list_head_init(&fa.cmds);
+        for (i = 0; i < IPCP_FA_CMD_POOL; ++i) {
+                cmd = malloc(sizeof(*cmd));
+                if (cmd == NULL) {
+                        fa_worker_fini(w);
+                        return -1;
+                }
+
+                list_add(&cmd->next, &w->pool);
+        }
+
+        return 0;
+
+ fail_cond:
+        pthread_condattr_destroy(&cattr);
+ fail_cattr:
+        pthread_mutex_destroy(&w->mtx);
+ fail_mtx:
+        return -1;
+}
+
+int fa_init(void)
+{
+        int i;
+        int j;
+
+        if (pthread_rwlock_init(&fa.flows_lock, NULL))
+                goto fail_rwlock;
+
+        for (i = 0; i < PROG_MAX_FLOWS; ++i) {
+                fa.flows[i].s_eid  = -1;
+                fa.flows[i].r_eid  = -1;
+                fa.flows[i].r_addr = INVALID_ADDR;
+                if (pthread_mutex_init(&fa.flows[i].lock, NULL))
+                        goto fail_flow_lock;
+        }
+
+        for (j = 0; j < IPCP_FA_WORKERS; ++j)
+                if (fa_worker_init(&fa.workers[j]))
+                        goto fail_worker;
 
         if (rib_reg(FA, &r_ops))
                 goto fail_rib_reg;
 
         fa.eid = dt_reg_comp(&fa, &fa_post_packet, FA);
         if ((int) fa.eid < 0)
-                goto fail_rib_reg;
+                goto fail_dt_reg;
 
         return 0;
 
+ fail_dt_reg:
+        rib_unreg(FA);
  fail_rib_reg:
-        pthread_cond_destroy(&fa.cond);
- fail_cond:
-        pthread_condattr_destroy(&cattr);
- fail_cattr:
-        pthread_mutex_destroy(&fa.mtx);
- fail_mtx:
+        j = IPCP_FA_WORKERS;
+ fail_worker:
+        while (j-- > 0)
+                fa_worker_fini(&fa.workers[j]);
+        i = PROG_MAX_FLOWS;
+ fail_flow_lock:
+        while (i-- > 0)
+                pthread_mutex_destroy(&fa.flows[i].lock);
         pthread_rwlock_destroy(&fa.flows_lock);
  fail_rwlock:
         log_err("Failed to initialize flow allocator.");
@@ -650,54 +812,78 @@ int fa_init(void)
 
 void fa_fini(void)
 {
+        int i;
+
         rib_unreg(FA);
 
-        pthread_cond_destroy(&fa.cond);;
-        pthread_mutex_destroy(&fa.mtx);
+        for (i = 0; i < IPCP_FA_WORKERS; ++i)
+                fa_worker_fini(&fa.workers[i]);
+
+        for (i = 0; i < PROG_MAX_FLOWS; ++i)
+                pthread_mutex_destroy(&fa.flows[i].lock);
+
         pthread_rwlock_destroy(&fa.flows_lock);
 }
 
-int fa_start(void)
+static int fa_worker_prio(pthread_t thr)
 {
-        struct sched_param  par;
-        int                 pol;
-        int                 max;
-
-        fa.psched = psched_create(packet_handler);
-        if (fa.psched == NULL) {
-                log_err("Failed to start packet scheduler.");
-                goto fail_psched;
-        }
+        struct sched_param par;
+        int                pol;
+        int                max;
 
-        if (pthread_create(&fa.worker, NULL, fa_handle_packet, NULL)) {
-                log_err("Failed to create worker thread.");
-                goto fail_thread;
-        }
-
-        if (pthread_getschedparam(fa.worker, &pol, &par)) {
+        if (pthread_getschedparam(thr, &pol, &par)) {
                 log_err("Failed to get worker thread scheduling parameters.");
-                goto fail_sched;
+                return -1;
         }
 
         max = sched_get_priority_max(pol);
         if (max < 0) {
                 log_err("Failed to get max priority for scheduler.");
-                goto fail_sched;
+                return -1;
         }
 
         par.sched_priority = max;
 
-        if (pthread_setschedparam(fa.worker, pol, &par)) {
+        if (pthread_setschedparam(thr, pol, &par)) {
                 log_err("Failed to set scheduler priority to maximum.");
-                goto fail_sched;
+                return -1;
+        }
+
+        return 0;
+}
+
+int fa_start(void)
+{
+        struct fa_worker * w;
+        int                i;
+
+        fa.psched = psched_create(packet_handler);
+        if (fa.psched == NULL) {
+                log_err("Failed to start packet scheduler.");
+                goto fail_psched;
+        }
+
+        for (i = 0; i < IPCP_FA_WORKERS; ++i) {
+                w = &fa.workers[i];
+                if (pthread_create(&w->thr, NULL, fa_handle_packet, w)) {
+                        log_err("Failed to create worker thread.");
+                        goto fail_thread;
+                }
+
+                if (fa_worker_prio(w->thr)) {
+                        pthread_cancel(w->thr);
+                        pthread_join(w->thr, NULL);
+                        goto fail_thread;
+                }
         }
 
         return 0;
 
- fail_sched:
-        pthread_cancel(fa.worker);
-        pthread_join(fa.worker, NULL);
  fail_thread:
+        while (i-- > 0) {
+                pthread_cancel(fa.workers[i].thr);
+                pthread_join(fa.workers[i].thr, NULL);
+        }
         psched_destroy(fa.psched);
  fail_psched:
         log_err("Failed to start flow allocator.");
@@ -706,8 +892,13 @@ int fa_start(void)
 
 void fa_stop(void)
 {
-        pthread_cancel(fa.worker);
-        pthread_join(fa.worker, NULL);
+        int i;
+
+        for (i = 0; i < IPCP_FA_WORKERS; ++i)
+                pthread_cancel(fa.workers[i].thr);
+
+        for (i = 0; i < IPCP_FA_WORKERS; ++i)
+                pthread_join(fa.workers[i].thr, NULL);
 
         psched_destroy(fa.psched);
 }
@@ -751,6 +942,7 @@ int fa_alloc(int             fd,
         msg->in_order     = qs.in_order;
         msg->max_gap      = hton32(qs.max_gap);
         msg->cypher_s     = hton16(qs.cypher_s);
+        msg->compress     = qs.compress;
 
         memcpy(msg + 1, dst, ipcp_dir_hash_len());
         memcpy(shm_du_buff_head(sdb) + len, data, dlen);
@@ -764,9 +956,10 @@ int fa_alloc(int             fd,
 
         pthread_rwlock_wrlock(&fa.flows_lock);
 
-        fa_flow_init(flow);
-        flow->r_addr = addr;
-        flow->s_eid  = eid;
+        if (fa_flow_init(flow, eid, -1, addr, &qs)) {
+                pthread_rwlock_unlock(&fa.flows_lock);
+                return -1;
+        }
 
         pthread_rwlock_unlock(&fa.flows_lock);
 
@@ -809,7 +1002,9 @@ int fa_alloc_resp(int          fd,
         pthread_mutex_unlock(&ipcpi.alloc_lock);
 
         if (ipcp_sdb_reserve(&sdb, sizeof(*msg) + len)) {
+                pthread_rwlock_wrlock(&fa.flows_lock);
                 fa_flow_fini(flow);
+                pthread_rwlock_unlock(&fa.flows_lock);
                 return -1;
         }
 
@@ -829,7 +1024,7 @@ int fa_alloc_resp(int          fd,
                 fa_flow_fini(flow);
                 ipcp_sdb_release(sdb);
         } else {
-                psched_add(fa.psched, fd);
+                psched_add(fa.psched, fd, &flow->qs);
         }
 
         if (dt_write_packet(flow->r_addr, qc, fa.eid, sdb)) {
@@ -881,7 +1076,7 @@ static int fa_update_remote(int      fd,
 
         flow = &fa.flows[fd];
 
-        pthread_rwlock_wrlock(&fa.flows_lock);
+        pthread_mutex_lock(&flow->lock);
 
         msg->code  = FLOW_UPDATE;
         msg->r_eid = hton64(flow->r_eid);
@@ -891,7 +1086,7 @@ static int fa_update_remote(int      fd,
 #ifdef IPCP_FLOW_STATS
         flow->u_snd++;
 #endif
-        pthread_rwlock_unlock(&fa.flows_lock);
+        pthread_mutex_unlock(&flow->lock);
 
 
         if (dt_write_packet(r_addr, qc, fa.eid, sdb)) {
@@ -914,35 +1109,30 @@ void  fa_np1_rcv(uint64_t             eid,
 
         len = shm_du_buff_tail(sdb) - shm_du_buff_head(sdb);
 
-        pthread_rwlock_wrlock(&fa.flows_lock);
-
-        fd = eid_to_fd(eid);
-        if (fd < 0) {
-                pthread_rwlock_unlock(&fa.flows_lock);
+        flow = fa_flow_get(eid, &fd);
+        if (flow == NULL) {
                 ipcp_sdb_release(sdb);
                 return;
         }
 
-        flow = &fa.flows[fd];
-
 #ifdef IPCP_FLOW_STATS
         ++flow->p_rcv;
         flow->b_rcv += len;
 #endif
         update = ca_ctx_update_rcv(flow->ctx, len, ecn, &ece);
 
-        pthread_rwlock_unlock(&fa.flows_lock);
+        pthread_mutex_unlock(&flow->lock);
 
         if (ipcp_flow_write(fd, sdb) < 0) {
                 ipcp_sdb_release(sdb);
 #ifdef IPCP_FLOW_STATS
-                pthread_rwlock_wrlock(&fa.flows_lock);
+                pthread_mutex_lock(&flow->lock);
                 ++flow->p_rcv_f;
                 flow->b_rcv_f += len;
-                pthread_rwlock_unlock(&fa.flows_lock);
+                pthread_mutex_unlock(&flow->lock);
 #endif
         }
 
         if (update)
-                fa_update_remote(eid, ece);
+                fa_update_remote(fd, ece);
 }
@@ -42,6 +42,7 @@
 #include "common/connmgr.h"
 #include "common/enroll.h"
 #include "addr_auth.h"
+#include "aqm.h"
 #include "ca.h"
 #include "dir.h"
 #include "dt.h"
@@ -88,7 +89,13 @@ static int initialize_components(const struct ipcp_config * conf)
                 goto fail_ca;
         }
 
+        if (aqm_init(conf->cong_avoid != CA_NONE)) {
+                log_err("Failed to initialize queue management.");
+                goto fail_aqm;
+        }
+
         if (dt_init(conf->routing_type,
+                    &conf->spf,
                     conf->addr_size,
                     conf->eid_size,
                     conf->max_ttl)) {
@@ -115,6 +122,8 @@ static int initialize_components(const struct ipcp_config * conf)
  fail_fa:
         dt_fini();
  fail_dt:
+        aqm_fini();
+ fail_aqm:
         ca_fini();
  fail_ca:
         addr_auth_fini();
@@ -132,6 +141,8 @@ static void finalize_components(void)
 
         dt_fini();
 
+        aqm_fini();
+
         ca_fini();
 
         addr_auth_fini();
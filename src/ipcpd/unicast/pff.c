@@ -110,15 +110,33 @@ int pff_del(struct pff * pff,
         return pff->ops->del(pff->pff_i, addr);
 }
 
-void pff_flush(struct pff * pff)
+int pff_flush(struct pff * pff)
 {
         return pff->ops->flush(pff->pff_i);
 }
 
 int pff_nhop(struct pff * pff,
-             uint64_t     addr)
+             uint64_t     addr,
+             uint64_t     flow)
 {
-        return pff->ops->nhop(pff->pff_i, addr);
+        return pff->ops->nhop(pff->pff_i, addr, flow);
+}
+
+void pff_nhop_n(struct pff *     pff,
+                const uint64_t * addr,
+                const uint64_t * flow,
+                int *            fd,
+                size_t           n)
+{
+        size_t i;
+
+        if (pff->ops->nhop_n != NULL) {
+                pff->ops->nhop_n(pff->pff_i, addr, flow, fd, n);
+                return;
+        }
+
+        for (i = 0; i < n; ++i)
+                fd[i] = pff->ops->nhop(pff->pff_i, addr[i], flow[i]);
 }
 
 int pff_flow_state_change(struct pff * pff,
@@ -56,11 +56,19 @@ int          pff_update(struct pff * pff,
 int          pff_del(struct pff * pff,
                      uint64_t     addr);
 
-void         pff_flush(struct pff * pff);
+int          pff_flush(struct pff * pff);
 
-/* Returns fd towards next hop */
+/* Returns fd towards next hop, packets of a flow take the same one */
 int          pff_nhop(struct pff * pff,
-                      uint64_t     addr);
+                      uint64_t     addr,
+                      uint64_t     flow);
+
+/* Next hop fds for a burst of addresses, -1 if unreachable */
+void         pff_nhop_n(struct pff *     pff,
+                        const uint64_t * addr,
+                        const uint64_t * flow,
+                        int *            fd,
+                        size_t           n);
 
 int          pff_flow_state_change(struct pff * pff,
                                    int          fd,
@@ -49,12 +49,19 @@ struct pol_pff_ops {
         int            (* del)(struct pff_i * pff_i,
                                uint64_t       addr);
 
-        void           (* flush)(struct pff_i * pff_i);
+        int            (* flush)(struct pff_i * pff_i);
 
         int            (* nhop)(struct pff_i * pff_i,
-                                uint64_t       addr);
+                                uint64_t       addr,
+                                uint64_t       flow);
+
+        /* Optional operations. */
+        void           (* nhop_n)(struct pff_i *   pff_i,
+                                  const uint64_t * addr,
+                                  const uint64_t * flow,
+                                  int *            fd,
+                                  size_t           n);
 
-        /* Optional operation. */
         int            (* flow_state_change)(struct pff_i * pff_i,
                                              int            fd,
                                              bool           up);
@@ -23,16 +23,22 @@
 #ifndef OUROBOROS_IPCPD_UNICAST_POL_ROUTING_OPS_H
 #define OUROBOROS_IPCPD_UNICAST_POL_ROUTING_OPS_H
 
+#include <ouroboros/qoscube.h>
+
 #include "pff.h"
 
 struct pol_routing_ops {
-        int                (* init)(enum pol_routing pr);
+        int                (* init)(enum pol_routing          pr,
+                                    const struct spf_timers * spf);
 
         void               (* fini)(void);
 
-        struct routing_i * (* routing_i_create)(struct pff * pff);
+        struct routing_i * (* routing_i_create)(struct pff * pff,
+                                                qoscube_t    qc);
 
         void               (* routing_i_destroy)(struct routing_i * instance);
+
+        qoscube_t          (* cube_table)(qoscube_t qc);
 };
 
 #endif /* OUROBOROS_IPCPD_UNICAST_POL_ROUTING_OPS_H */
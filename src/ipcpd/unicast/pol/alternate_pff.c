@@ -25,33 +25,27 @@
 #include "config.h"
 
 #include <ouroboros/errno.h>
-#include <ouroboros/list.h>
 
-#include "pft.h"
+#include "pft_pub.h"
 #include "alternate_pff.h"
 
 #include <string.h>
 #include <assert.h>
-#include <pthread.h>
-
-struct nhop {
-        struct list_head next;
-        int              fd;
-};
-
-struct addr {
-        struct list_head next;
-        uint64_t         addr;
-};
 
+/*
+ * Each entry holds a next hop group: the primary hop followed by the
+ * alternates, in order of preference. Lookups take the first hop of
+ * the group whose N-1 flow is up. The state of each N-1 flow is one
+ * flag shared by all groups, so a failure is a single atomic store
+ * and every destination behind it fails over at once, without a walk
+ * of the table.
+ *
+ * Lookups read the published table without locking, see pft_pub.
+ */
 struct pff_i {
-        struct pft *     pft;
-
-        struct list_head addrs;
-
-        struct list_head nhops_down;
+        struct pft_pub pub;
 
-        pthread_rwlock_t lock;
+        uint8_t        down[PROG_MAX_FLOWS];
 };
 
 struct pol_pff_ops alternate_pff_ops = {
@@ -64,132 +58,27 @@ struct pol_pff_ops alternate_pff_ops = {
         .del               = alternate_pff_del,
         .flush             = alternate_pff_flush,
         .nhop              = alternate_pff_nhop,
+        .nhop_n            = alternate_pff_nhop_n,
         .flow_state_change = alternate_flow_state_change
 };
 
-static int add_addr(struct pff_i * pff_i,
-                    uint64_t       addr)
-{
-        struct addr * a;
-
-        a = malloc(sizeof(*a));
-        if (a == NULL)
-                return -1;
-
-        a->addr = addr;
-
-        list_add(&a->next, &(pff_i->addrs));
-
-        return 0;
-}
-
-static void del_addr(struct pff_i * pff_i,
-                     uint64_t       addr)
-{
-        struct list_head * p;
-        struct list_head * h;
-
-        list_for_each_safe(p, h, &(pff_i->addrs)) {
-                struct addr * e = list_entry(p, struct addr, next);
-                if (e->addr == addr) {
-                        list_del(&e->next);
-                        free(e);
-                        return;
-                }
-        }
-}
-
-static void del_addrs(struct pff_i * pff_i)
-{
-        struct list_head * p;
-        struct list_head * h;
-
-        list_for_each_safe(p, h, &(pff_i->addrs)) {
-                struct addr * e = list_entry(p, struct addr, next);
-                list_del(&e->next);
-                free(e);
-        }
-}
-
-static void del_nhops_down(struct pff_i * pff_i)
-{
-        struct list_head * p;
-        struct list_head * h;
-
-        list_for_each_safe(p, h, &(pff_i->nhops_down)) {
-                struct nhop * e = list_entry(p, struct nhop, next);
-                list_del(&e->next);
-                free(e);
-        }
-}
-
-static int del_nhop_down(struct pff_i * pff_i,
-                         int            fd)
-{
-        struct list_head * p;
-        struct list_head * h;
-
-        list_for_each_safe(p, h, &(pff_i->nhops_down)) {
-                struct nhop * e = list_entry(p, struct nhop, next);
-                if (e->fd == fd) {
-                        list_del(&e->next);
-                        free(e);
-                        return 0;
-                }
-        }
-
-        return -1;
-}
-
-static int add_nhop_down(struct pff_i * pff_i,
-                         int            fd)
-{
-        struct nhop *      nhop;
-
-        nhop = malloc(sizeof(*nhop));
-        if (nhop == NULL)
-                return -1;
-
-        nhop->fd = fd;
-
-        list_add(&nhop->next, &(pff_i->nhops_down));
-
-        return 0;
-}
-
-static bool nhops_down_has(struct pff_i * pff_i,
-                           int            fd)
-{
-        struct list_head * pos = NULL;
-
-        list_for_each(pos, &pff_i->nhops_down) {
-                struct nhop * e = list_entry(pos, struct nhop, next);
-                if (e->fd == fd)
-                        return true;
-        }
-
-        return false;
-}
-
-static int add_to_pft(struct pff_i * pff_i,
-                      uint64_t       addr,
-                      int *          fd,
-                      size_t         len)
+static int add_to_pft(struct pft * pft,
+                      uint64_t     addr,
+                      int *        fd,
+                      size_t       len)
 {
         int * fds;
 
-        assert(pff_i);
+        assert(pft);
         assert(len > 0);
 
-        fds = malloc(sizeof(*fds) * (len + 1));
+        fds = malloc(sizeof(*fds) * len);
         if (fds == NULL)
                 goto fail_malloc;
 
         memcpy(fds, fd, len * sizeof(*fds));
-        /* Put primary hop again at the end */
-        fds[len] = fds[0];
 
-        if (pft_insert(pff_i->pft, addr, fds, len))
+        if (pft_insert(pft, addr, fds, len))
                 goto fail_insert;
 
         return 0;
@@ -200,6 +89,20 @@ static int add_to_pft(struct pff_i * pff_i,
         return -1;
 }
 
+/* The first hop that is up, the primary if none is. */
+static int group_nhop(const struct pff_i * pff_i,
+                      const int *          fds,
+                      size_t               len)
+{
+        size_t i;
+
+        for (i = 0; i < len; ++i)
+                if (!__atomic_load_n(&pff_i->down[fds[i]], __ATOMIC_RELAXED))
+                        return fds[i];
+
+        return fds[0];
+}
+
 struct pff_i * alternate_pff_create(void)
 {
         struct pff_i * tmp;
@@ -208,21 +111,14 @@ struct pff_i * alternate_pff_create(void)
         if (tmp == NULL)
                 goto fail_malloc;
 
-        if (pthread_rwlock_init(&tmp->lock, NULL))
-                goto fail_lock;
+        if (pft_pub_init(&tmp->pub))
+                goto fail_pub;
 
-        tmp->pft = pft_create(PFT_SIZE, false);
-        if (tmp->pft == NULL)
-                goto fail_pft;
-
-        list_head_init(&tmp->nhops_down);
-        list_head_init(&tmp->addrs);
+        memset(tmp->down, 0, sizeof(tmp->down));
 
         return tmp;
 
- fail_pft:
-        pthread_rwlock_destroy(&tmp->lock);
- fail_lock:
+ fail_pub:
         free(tmp);
  fail_malloc:
         return NULL;
@@ -232,21 +128,18 @@ void alternate_pff_destroy(struct pff_i * pff_i)
 {
         assert(pff_i);
 
-        pft_destroy(pff_i->pft);
-        del_nhops_down(pff_i);
-        del_addrs(pff_i);
-        pthread_rwlock_destroy(&pff_i->lock);
+        pft_pub_fini(&pff_i->pub);
         free(pff_i);
 }
 
 void alternate_pff_lock(struct pff_i * pff_i)
 {
-        pthread_rwlock_wrlock(&pff_i->lock);
+        pft_pub_lock(&pff_i->pub);
 }
 
 void alternate_pff_unlock(struct pff_i * pff_i)
 {
-        pthread_rwlock_unlock(&pff_i->lock);
+        pft_pub_unlock(&pff_i->pub);
 }
 
 int alternate_pff_add(struct pff_i * pff_i,
@@ -254,16 +147,17 @@ int alternate_pff_add(struct pff_i * pff_i,
                       int *          fd,
                       size_t         len)
 {
+        struct pft * pft;
+
         assert(pff_i);
         assert(len > 0);
 
-        if (add_to_pft(pff_i, addr, fd, len))
-                return -1;
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
+                return -ENOMEM;
 
-        if (add_addr(pff_i, addr)) {
-                pft_delete(pff_i->pft, addr);
+        if (add_to_pft(pft, addr, fd, len))
                 return -1;
-        }
 
         return 0;
 }
@@ -273,13 +167,19 @@ int alternate_pff_update(struct pff_i * pff_i,
                          int *          fd,
                          size_t         len)
 {
+        struct pft * pft;
+
         assert(pff_i);
         assert(len > 0);
 
-        if (pft_delete(pff_i->pft, addr))
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
+                return -ENOMEM;
+
+        if (pft_delete(pft, addr))
                 return -1;
 
-        if (add_to_pft(pff_i, addr, fd, len))
+        if (add_to_pft(pft, addr, fd, len))
                 return -1;
 
         return 0;
@@ -288,113 +188,91 @@ int alternate_pff_update(struct pff_i * pff_i,
 int alternate_pff_del(struct pff_i * pff_i,
                       uint64_t       addr)
 {
+        struct pft * pft;
+
         assert(pff_i);
 
-        del_addr(pff_i, addr);
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
+                return -ENOMEM;
 
-        if (pft_delete(pff_i->pft, addr))
+        if (pft_delete(pft, addr))
                 return -1;
 
         return 0;
 }
 
-void alternate_pff_flush(struct pff_i * pff_i)
+int alternate_pff_flush(struct pff_i * pff_i)
 {
         assert(pff_i);
 
-        pft_flush(pff_i->pft);
-
-        del_nhops_down(pff_i);
-
-        del_addrs(pff_i);
+        return pft_pub_flush(&pff_i->pub);
 }
 
 int alternate_pff_nhop(struct pff_i * pff_i,
-                       uint64_t       addr)
+                       uint64_t       addr,
+                       uint64_t       flow)
 {
-        int    fd;
-        size_t len;
-        int *  fds;
+        struct epoch_rdr * r;
+        struct pft *       pft;
+        int *              fds;
+        size_t             len;
+        int                fd = -1;
 
         assert(pff_i);
 
-        pthread_rwlock_rdlock(&pff_i->lock);
-
-        if (pft_lookup(pff_i->pft, addr, &fds, &len)) {
-                pthread_rwlock_unlock(&pff_i->lock);
-                return -1;
-        }
+        (void) flow;
 
-        fd = *fds;
+        pft = pft_pub_enter(&pff_i->pub, &r);
+        if (pft_lookup(pft, addr, &fds, &len) == 0)
+                fd = group_nhop(pff_i, fds, len);
 
-        pthread_rwlock_unlock(&pff_i->lock);
+        pft_pub_exit(&pff_i->pub, r);
 
         return fd;
 }
 
-int alternate_flow_state_change(struct pff_i * pff_i,
-                                int            fd,
-                                bool           up)
+void alternate_pff_nhop_n(struct pff_i *   pff_i,
+                          const uint64_t * addr,
+                          const uint64_t * flow,
+                          int *            fd,
+                          size_t           n)
 {
-        struct list_head * p;
-        size_t             len;
+        struct epoch_rdr * r;
+        struct pft *       pft;
         int *              fds;
+        size_t             len;
         size_t             i;
-        int                tmp;
 
         assert(pff_i);
 
-        pthread_rwlock_wrlock(&pff_i->lock);
-
-        if (up) {
-                if (del_nhop_down(pff_i, fd)) {
-                        pthread_rwlock_unlock(&pff_i->lock);
-                        return -1;
-                }
-        } else {
-                if (add_nhop_down(pff_i, fd)) {
-                        pthread_rwlock_unlock(&pff_i->lock);
-                        return -1;
-                }
-        }
+        (void) flow;
 
-        list_for_each(p, &pff_i->addrs) {
-                struct addr * e = list_entry(p, struct addr, next);
-                if (pft_lookup(pff_i->pft, e->addr, &fds, &len)) {
-                        pthread_rwlock_unlock(&pff_i->lock);
-                        return -1;
-                }
-
-                if (up) {
-                        /* It is using an alternate */
-                        if (fds[len] == fd && fds[0] != fd) {
-                                for (i = 0 ; i < len; i++) {
-                                        /* Found the primary */
-                                        if (fds[i] == fd) {
-                                                tmp = fds[0];
-                                                fds[0] = fds[i];
-                                                fds[i] = tmp;
-                                                break;
-                                        }
-                                }
-                        }
-                } else {
-                        /* Need to switch to a (different) alternate */
-                        if (fds[0] == fd) {
-                                for (i = 1; i < len; i++) {
-                                        /* Usable alternate */
-                                        if (!nhops_down_has(pff_i, fds[i])) {
-                                                tmp = fds[0];
-                                                fds[0] = fds[i];
-                                                fds[i] = tmp;
-                                                break;
-                                        }
-                                }
-                        }
-                }
+        pft = pft_pub_enter(&pff_i->pub, &r);
+        for (i = 0; i < n; ++i) {
+                fd[i] = -1;
+                if (pft_lookup(pft, addr[i], &fds, &len) == 0)
+                        fd[i] = group_nhop(pff_i, fds, len);
         }
 
-        pthread_rwlock_unlock(&pff_i->lock);
+        pft_pub_exit(&pff_i->pub, r);
+}
+
+/* Needs no lock, forwarding goes on while the state changes. */
+int alternate_flow_state_change(struct pff_i * pff_i,
+                                int            fd,
+                                bool           up)
+{
+        uint8_t was;
+
+        assert(pff_i);
+        assert(fd >= 0 && fd < PROG_MAX_FLOWS);
+
+        was = __atomic_exchange_n(&pff_i->down[fd], !up, __ATOMIC_RELAXED);
+
+        /* Coming up without having gone down. */
+        if (up && !was)
+                return -1;
 
         return 0;
 }
@@ -46,11 +46,18 @@ int            alternate_pff_update(struct pff_i * pff_i,
 int            alternate_pff_del(struct pff_i * pff_i,
                                  uint64_t       addr);
 
-void           alternate_pff_flush(struct pff_i * pff_i);
+int            alternate_pff_flush(struct pff_i * pff_i);
 
 /* Returns fd towards next hop */
 int            alternate_pff_nhop(struct pff_i * pff_i,
-                                  uint64_t       addr);
+                                  uint64_t       addr,
+                                  uint64_t       flow);
+
+void           alternate_pff_nhop_n(struct pff_i *   pff_i,
+                                    const uint64_t * addr,
+                                    const uint64_t * flow,
+                                    int *            fd,
+                                    size_t           n);
 
 int            alternate_flow_state_change(struct pff_i * pff_i,
                                            int            fd,
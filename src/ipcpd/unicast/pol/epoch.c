@@ -0,0 +1,213 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Epoch-based reclamation for lock-free readers
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+/*
+ * Each reader thread owns a slot in which it announces the epoch it
+ * entered in, or 0 when it is outside a critical section. A writer
+ * advances the epoch and waits until no slot holds an older one.
+ * Readers never block, they only store to their own cache line.
+ * A thread that cannot get a slot falls back to the writer mutex.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "epoch.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CACHE_LINE    64
+#define EPOCH_WAIT_NS 10000
+
+struct epoch_rdr {
+        uint64_t           active;
+        struct epoch_rdr * next;
+        struct epoch *     epoch;
+        bool               used;
+        uint8_t            pad[CACHE_LINE - sizeof(uint64_t)
+                               - 2 * sizeof(void *) - sizeof(bool)];
+};
+
+struct epoch {
+        uint64_t           now;
+        struct epoch_rdr * rdrs;
+        pthread_key_t      key;
+        pthread_mutex_t    lock;
+};
+
+static void rdr_release(void * o)
+{
+        struct epoch_rdr * r = (struct epoch_rdr *) o;
+
+        pthread_mutex_lock(&r->epoch->lock);
+        __atomic_store_n(&r->active, 0, __ATOMIC_RELEASE);
+        r->used = false;
+        pthread_mutex_unlock(&r->epoch->lock);
+}
+
+static struct epoch_rdr * rdr_register(struct epoch * e)
+{
+        struct epoch_rdr * r;
+
+        pthread_mutex_lock(&e->lock);
+
+        for (r = e->rdrs; r != NULL; r = r->next)
+                if (!r->used)
+                        break;
+
+        if (r == NULL) {
+                if (posix_memalign((void **) &r, CACHE_LINE, sizeof(*r)))
+                        goto fail_malloc;
+
+                r->active = 0;
+                r->epoch  = e;
+                r->next   = e->rdrs;
+                e->rdrs   = r;
+        }
+
+        if (pthread_setspecific(e->key, r))
+                goto fail_malloc;
+
+        r->used = true;
+
+        pthread_mutex_unlock(&e->lock);
+
+        return r;
+
+ fail_malloc:
+        pthread_mutex_unlock(&e->lock);
+        return NULL;
+}
+
+struct epoch * epoch_create(void)
+{
+        struct epoch * e;
+
+        e = malloc(sizeof(*e));
+        if (e == NULL)
+                goto fail_malloc;
+
+        if (pthread_mutex_init(&e->lock, NULL))
+                goto fail_lock;
+
+        if (pthread_key_create(&e->key, rdr_release))
+                goto fail_key;
+
+        e->now  = 1;
+        e->rdrs = NULL;
+
+        return e;
+
+ fail_key:
+        pthread_mutex_destroy(&e->lock);
+ fail_lock:
+        free(e);
+ fail_malloc:
+        return NULL;
+}
+
+void epoch_destroy(struct epoch * e)
+{
+        struct epoch_rdr * r;
+
+        assert(e);
+
+        pthread_key_delete(e->key);
+
+        while (e->rdrs != NULL) {
+                r = e->rdrs;
+                e->rdrs = r->next;
+                free(r);
+        }
+
+        pthread_mutex_destroy(&e->lock);
+        free(e);
+}
+
+struct epoch_rdr * epoch_enter(struct epoch * e)
+{
+        struct epoch_rdr * r;
+
+        assert(e);
+
+        r = pthread_getspecific(e->key);
+        if (r == NULL) {
+                r = rdr_register(e);
+                if (r == NULL) {
+                        pthread_mutex_lock(&e->lock);
+                        return NULL;
+                }
+        }
+
+        __atomic_store_n(&r->active,
+                         __atomic_load_n(&e->now, __ATOMIC_ACQUIRE),
+                         __ATOMIC_RELAXED);
+
+        /* Order the announcement before any load of shared data. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        return r;
+}
+
+void epoch_exit(struct epoch *     e,
+                struct epoch_rdr * r)
+{
+        assert(e);
+
+        if (r == NULL) {
+                pthread_mutex_unlock(&e->lock);
+                return;
+        }
+
+        __atomic_store_n(&r->active, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_sync(struct epoch * e)
+{
+        struct epoch_rdr * r;
+        uint64_t           target;
+        uint64_t           seen;
+        struct timespec    wait = {0, EPOCH_WAIT_NS};
+
+        assert(e);
+
+        pthread_mutex_lock(&e->lock);
+
+        target = __atomic_add_fetch(&e->now, 1, __ATOMIC_SEQ_CST);
+
+        /* Pairs with the fence in epoch_enter. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        for (r = e->rdrs; r != NULL; r = r->next) {
+                seen = __atomic_load_n(&r->active, __ATOMIC_ACQUIRE);
+                while (seen != 0 && seen < target) {
+                        nanosleep(&wait, NULL);
+                        seen = __atomic_load_n(&r->active, __ATOMIC_ACQUIRE);
+                }
+        }
+
+        pthread_mutex_unlock(&e->lock);
+}
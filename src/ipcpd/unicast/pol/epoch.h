@@ -0,0 +1,43 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Epoch-based reclamation for lock-free readers
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#ifndef OUROBOROS_IPCPD_UNICAST_EPOCH_H
+#define OUROBOROS_IPCPD_UNICAST_EPOCH_H
+
+struct epoch;
+
+struct epoch_rdr;
+
+struct epoch *     epoch_create(void);
+
+void               epoch_destroy(struct epoch * e);
+
+/* Read-side critical sections do not nest. */
+struct epoch_rdr * epoch_enter(struct epoch * e);
+
+void               epoch_exit(struct epoch *     e,
+                              struct epoch_rdr * r);
+
+/* Returns once all readers that entered before the call have left. */
+void               epoch_sync(struct epoch * e);
+
+#endif /* OUROBOROS_IPCPD_UNICAST_EPOCH_H */
@@ -27,6 +27,8 @@
 #define _POSIX_C_SOURCE 200112L
 #endif
 
+#include "config.h"
+
 #define OUROBOROS_PREFIX "graph"
 
 #include <ouroboros/logs.h>
@@ -41,12 +43,22 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <unistd.h>
+
+#define IDX_INIT  64   /* Initial size of the vertex index     */
+#define GRAPH_LOG 1024 /* Edge changes kept for incremental SPF */
+#define SPT_NONE  -2   /* No earlier next hop recorded          */
+#define CSR_ROOM  2    /* Spare edges per vertex in the CSR     */
+#define SPF_MAX_THREADS 64
+#define REF_BW    100000000000ULL /* Capacity that costs 1, 100 Gb/s  */
+#define DEF_BW    1000000000ULL   /* Capacity if unknown, 1 Gb/s      */
+#define W_MAX     65535           /* Heaviest link, sums saturate     */
 
 struct vertex {
         struct list_head next;
         uint64_t         addr;
         struct list_head edges;
-        int              index;
+        size_t           index; /* Slot, stable until compaction */
 };
 
 struct edge {
@@ -56,12 +68,190 @@ struct edge {
         int              announced;
 };
 
+/*
+ * Compressed sparse row snapshot of the links that both ends
+ * announced. Each vertex has some room to take links that come up
+ * in place, the snapshot is rebuilt when one runs out of it.
+ */
+struct csr {
+        size_t     nr_vertices;
+        size_t     nr_edges;
+        uint64_t * addr; /* Address of each vertex               */
+        size_t *   off;  /* Edges of v are off[v] to end[v]      */
+        size_t *   end;  /* Room for more up to off[v + 1]       */
+        size_t *   adj;  /* Neighbour at the end of each edge    */
+        int *      w[METRIC_MAX]; /* Weight of each edge            */
+};
+
+struct heap_el {
+        int    dist;
+        size_t v;
+};
+
+struct heap {
+        struct heap_el * el;
+        size_t           len;
+};
+
+struct graph_chg {
+        size_t u;
+        size_t v;
+};
+
 struct graph {
         size_t           nr_vertices;
         struct list_head vertices;
+        struct vertex ** idx;      /* Vertices by address         */
+        size_t           idx_size;
+        struct vertex ** vtx;      /* Vertices by slot            */
+        uint64_t *       vtx_addr; /* Address that held each slot */
+        size_t           vtx_len;
+        size_t           nr_slots;
+        struct graph_chg log[GRAPH_LOG];
+        uint64_t         seq;      /* Edge changes so far         */
+        uint64_t         base;     /* Slots renumbered at this    */
+        struct csr       csr;
+        bool             dirty;    /* Snapshot is stale           */
         pthread_mutex_t  lock;
 };
 
+/*
+ * A shortest path tree that a routing instance keeps between runs,
+ * so that only the part affected by the edge changes is redone.
+ */
+struct spt {
+        uint64_t            src;
+        enum routing_metric metric;
+        uint64_t            seq;    /* Graph changes applied        */
+        bool                valid;
+        size_t              len;
+        int *               dist;
+        int *               parent; /* Previous vertex on the path  */
+        int *               nhop;   /* First hop on the path or -1  */
+        int *               old;    /* nhop before, or SPT_NONE     */
+};
+
+struct spt_run {
+        const struct csr * csr;
+        const int *        w;       /* Edge weights of the metric     */
+        struct spt *       spt;
+        size_t             src;
+        struct heap        heap;
+        size_t *           touched; /* Relabelled, NULL on a full run */
+        size_t             nr_touched;
+};
+
+static uint64_t hash(uint64_t key)
+{
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDULL;
+        key ^= key >> 33;
+        key *= 0xC4CEB9FE1A85EC53ULL;
+        key ^= key >> 33;
+
+        return key;
+}
+
+/* Slot holding addr, or the empty slot where it would go. */
+static size_t idx_find(const struct graph * graph,
+                       uint64_t             addr)
+{
+        size_t mask = graph->idx_size - 1;
+        size_t i    = hash(addr) & mask;
+
+        while (graph->idx[i] != NULL && graph->idx[i]->addr != addr)
+                i = (i + 1) & mask;
+
+        return i;
+}
+
+static int idx_grow(struct graph * graph)
+{
+        struct vertex ** old  = graph->idx;
+        size_t           size = graph->idx_size;
+        size_t           i;
+
+        graph->idx = calloc(size << 1, sizeof(*graph->idx));
+        if (graph->idx == NULL) {
+                graph->idx = old;
+                return -ENOMEM;
+        }
+
+        graph->idx_size = size << 1;
+
+        for (i = 0; i < size; ++i)
+                if (old[i] != NULL)
+                        graph->idx[idx_find(graph, old[i]->addr)] = old[i];
+
+        free(old);
+
+        return 0;
+}
+
+static void idx_del(struct graph * graph,
+                    uint64_t       addr)
+{
+        size_t mask = graph->idx_size - 1;
+        size_t i;
+        size_t j;
+        size_t h;
+
+        i = idx_find(graph, addr);
+        assert(graph->idx[i] != NULL);
+
+        graph->idx[i] = NULL;
+
+        /* Move back what probed past the hole, no tombstones needed. */
+        for (j = (i + 1) & mask; graph->idx[j] != NULL; j = (j + 1) & mask) {
+                h = hash(graph->idx[j]->addr) & mask;
+                if (((j - h) & mask) < ((j - i) & mask))
+                        continue;
+                graph->idx[i] = graph->idx[j];
+                graph->idx[j] = NULL;
+                i = j;
+        }
+}
+
+static int vtx_grow(struct graph * graph)
+{
+        struct vertex ** vtx;
+        uint64_t *       addr;
+        size_t           len = graph->vtx_len << 1;
+
+        vtx = realloc(graph->vtx, len * sizeof(*vtx));
+        if (vtx == NULL)
+                return -ENOMEM;
+
+        graph->vtx = vtx;
+
+        addr = realloc(graph->vtx_addr, len * sizeof(*addr));
+        if (addr == NULL)
+                return -ENOMEM;
+
+        graph->vtx_addr = addr;
+        graph->vtx_len  = len;
+
+        return 0;
+}
+
+/* Renumber the slots once deleted vertices leave too many holes. */
+static void vtx_compact(struct graph * graph)
+{
+        struct list_head * p;
+        size_t             n = 0;
+
+        list_for_each(p, &graph->vertices) {
+                struct vertex * v = list_entry(p, struct vertex, next);
+                v->index              = n;
+                graph->vtx[n]         = v;
+                graph->vtx_addr[n++]  = v->addr;
+        }
+
+        graph->nr_slots = n;
+        graph->base     = graph->seq;
+}
+
+
 static struct edge * find_edge_by_addr(struct vertex * vertex,
                                        uint64_t        dst_addr)
 {
@@ -78,20 +268,150 @@ static struct edge * find_edge_by_addr(struct vertex * vertex,
         return NULL;
 }
 
-static struct vertex * find_vertex_by_addr(struct graph * graph,
-                                           uint64_t       addr)
+static int weight(const qosspec_t *   qs,
+                  enum routing_metric metric)
 {
-        struct list_head * p;
+        uint64_t w;
+
+        switch (metric) {
+        case METRIC_DELAY:
+                /* Every hop adds a ms, so hop count breaks ties. */
+                if (qs->delay == UINT32_MAX)
+                        w = 1;
+                else
+                        w = (uint64_t) qs->delay + 1;
+                break;
+        case METRIC_CAPACITY:
+                w = REF_BW / (qs->bandwidth == 0 ? DEF_BW : qs->bandwidth);
+                break;
+        default:
+                w = 1;
+        }
 
-        assert(graph);
+        if (w < 1)
+                return 1;
 
-        list_for_each(p, &graph->vertices) {
-                struct vertex * e = list_entry(p, struct vertex, next);
-                if (e->addr == addr)
-                        return e;
+        return w > W_MAX ? W_MAX : (int) w;
+}
+
+static void csr_set(struct csr *      csr,
+                    size_t            i,
+                    const qosspec_t * qs)
+{
+        int m;
+
+        for (m = 0; m < METRIC_MAX; ++m)
+                csr->w[m][i] = weight(qs, m);
+}
+
+static int csr_add(struct csr *      csr,
+                   size_t            u,
+                   size_t            v,
+                   const qosspec_t * qs)
+{
+        if (u >= csr->nr_vertices || v >= csr->nr_vertices ||
+            csr->end[u] == csr->off[u + 1])
+                return -1;
+
+        csr_set(csr, csr->end[u], qs);
+        csr->adj[csr->end[u]++] = v;
+
+        return 0;
+}
+
+static int csr_del(struct csr * csr,
+                   size_t       u,
+                   size_t       v)
+{
+        size_t i;
+        int    m;
+
+        if (u >= csr->nr_vertices)
+                return -1;
+
+        for (i = csr->off[u]; i < csr->end[u]; ++i) {
+                if (csr->adj[i] == v) {
+                        --csr->end[u];
+                        csr->adj[i] = csr->adj[csr->end[u]];
+                        for (m = 0; m < METRIC_MAX; ++m)
+                                csr->w[m][i] = csr->w[m][csr->end[u]];
+                        return 0;
+                }
         }
 
-        return NULL;
+        return -1;
+}
+
+/* Index of the edge from u to v, -1 if it is not in the snapshot. */
+static ssize_t csr_find(const struct csr * csr,
+                        size_t             u,
+                        size_t             v)
+{
+        size_t i;
+
+        if (u >= csr->nr_vertices)
+                return -1;
+
+        for (i = csr->off[u]; i < csr->end[u]; ++i)
+                if (csr->adj[i] == v)
+                        return (ssize_t) i;
+
+        return -1;
+}
+
+/* Keep the snapshot in step when a link comes up or goes down. */
+static void csr_patch(struct graph *  graph,
+                      struct vertex * u,
+                      struct vertex * v,
+                      bool            up)
+{
+        struct csr *  csr = &graph->csr;
+        struct edge * uv;
+        struct edge * vu;
+
+        if (graph->dirty)
+                return;
+
+        if (up) {
+                uv = find_edge_by_addr(u, v->addr);
+                vu = find_edge_by_addr(v, u->addr);
+                if (csr_add(csr, u->index, v->index, &uv->qs) ||
+                    csr_add(csr, v->index, u->index, &vu->qs))
+                        graph->dirty = true;
+                else
+                        csr->nr_edges += 2;
+        } else {
+                if (csr_del(csr, u->index, v->index) ||
+                    csr_del(csr, v->index, u->index))
+                        graph->dirty = true;
+                else
+                        csr->nr_edges -= 2;
+        }
+}
+
+/* A link between u and v was announced, before and after times. */
+static void log_change(struct graph *  graph,
+                       struct vertex * u,
+                       struct vertex * v,
+                       int             before,
+                       int             after)
+{
+        struct graph_chg * c = &graph->log[graph->seq++ % GRAPH_LOG];
+
+        c->u = u->index;
+        c->v = v->index;
+
+        /* It is in the snapshot if both sides announced it. */
+        if ((before == 2) != (after == 2))
+                csr_patch(graph, u, v, after == 2);
+}
+
+static struct vertex * find_vertex_by_addr(struct graph * graph,
+                                           uint64_t       addr)
+{
+        assert(graph);
+
+        return graph->idx[idx_find(graph, addr)];
 }
 
 static struct edge * add_edge(struct vertex * vertex,
@@ -125,37 +445,33 @@ static void del_edge(struct edge * edge)
 static struct vertex * add_vertex(struct graph * graph,
                                   uint64_t       addr)
 {
-        struct vertex *    vertex;
-        struct list_head * p;
-        int                i = 0;
+        struct vertex * vertex;
 
         assert(graph);
 
+        if ((graph->nr_vertices + 1) << 1 > graph->idx_size &&
+            idx_grow(graph))
+                return NULL;
+
+        if (graph->nr_slots == graph->vtx_len && vtx_grow(graph))
+                return NULL;
+
         vertex = malloc(sizeof(*vertex));
         if (vertex == NULL)
                 return NULL;
 
         list_head_init(&vertex->edges);
-        vertex->addr = addr;
+        vertex->addr  = addr;
+        vertex->index = graph->nr_slots++;
 
-        /* Keep them ordered on address. */
-        list_for_each(p, &graph->vertices) {
-                struct vertex * v = list_entry(p, struct vertex, next);
-                if (v->addr > addr)
-                        break;
-                i++;
-        }
-
-        vertex->index = i;
+        list_add_tail(&vertex->next, &graph->vertices);
 
-        list_add_tail(&vertex->next, p);
+        graph->idx[idx_find(graph, addr)]  = vertex;
+        graph->vtx[vertex->index]          = vertex;
+        graph->vtx_addr[vertex->index]     = addr;
 
-        /* Increase the index of the vertices to the right. */
-        list_for_each(p, &graph->vertices) {
-                struct vertex * v = list_entry(p, struct vertex, next);
-                if (v->addr > addr)
-                        v->index++;
-        }
+        /* Not in the snapshot yet. */
+        graph->dirty = true;
 
         graph->nr_vertices++;
 
@@ -171,14 +487,11 @@ static void del_vertex(struct graph *  graph,
         assert(graph);
         assert(vertex);
 
-        list_del(&vertex->next);
+        idx_del(graph, vertex->addr);
 
-        /* Decrease the index of the vertices to the right. */
-        list_for_each(p, &graph->vertices) {
-                struct vertex * v = list_entry(p, struct vertex, next);
-                if (v->addr > vertex->addr)
-                        v->index--;
-        }
+        graph->vtx[vertex->index] = NULL;
+
+        list_del(&vertex->next);
 
         list_for_each_safe(p, h, &vertex->edges) {
                 struct edge * e = list_entry(p, struct edge, next);
@@ -190,23 +503,150 @@ static void del_vertex(struct graph *  graph,
         graph->nr_vertices--;
 }
 
+static void csr_fini(struct csr * csr)
+{
+        int m;
+
+        free(csr->addr);
+        free(csr->off);
+        free(csr->end);
+        free(csr->adj);
+
+        for (m = 0; m < METRIC_MAX; ++m)
+                free(csr->w[m]);
+
+        memset(csr, 0, sizeof(*csr));
+}
+
+static int csr_build(struct graph * graph)
+{
+        struct csr *       csr = &graph->csr;
+        struct list_head * p;
+        struct list_head * q;
+        struct vertex *    v;
+        struct edge *      e;
+        size_t             n;
+        size_t             m = 0;
+        size_t             i;
+        int                k;
+
+        if (graph->nr_slots > (graph->nr_vertices << 1) + IDX_INIT)
+                vtx_compact(graph);
+
+        n = graph->nr_slots;
+
+        list_for_each(p, &graph->vertices) {
+                v = list_entry(p, struct vertex, next);
+                list_for_each(q, &v->edges) {
+                        e = list_entry(q, struct edge, next);
+                        /* Only include it if both sides announced it. */
+                        if (e->announced == 2)
+                                ++m;
+                }
+        }
+
+        csr_fini(csr);
+
+        csr->addr = malloc((n + 1) * sizeof(*csr->addr));
+        if (csr->addr == NULL)
+                goto fail_csr;
+
+        csr->off = malloc((n + 1) * sizeof(*csr->off));
+        if (csr->off == NULL)
+                goto fail_csr;
+
+        csr->end = malloc((n + 1) * sizeof(*csr->end));
+        if (csr->end == NULL)
+                goto fail_csr;
+
+        csr->adj = malloc((m + n * CSR_ROOM + 1) * sizeof(*csr->adj));
+        if (csr->adj == NULL)
+                goto fail_csr;
+
+        for (k = 0; k < METRIC_MAX; ++k) {
+                csr->w[k] = malloc((m + n * CSR_ROOM + 1) * sizeof(**csr->w));
+                if (csr->w[k] == NULL)
+                        goto fail_csr;
+        }
+
+        csr->nr_edges = m;
+
+        m = 0;
+
+        for (i = 0; i < n; ++i) {
+                v            = graph->vtx[i];
+                csr->addr[i] = graph->vtx_addr[i];
+                csr->off[i]  = m;
+                if (v != NULL) {
+                        list_for_each(q, &v->edges) {
+                                e = list_entry(q, struct edge, next);
+                                if (e->announced != 2)
+                                        continue;
+                                csr_set(csr, m, &e->qs);
+                                csr->adj[m++] = e->nb->index;
+                        }
+                }
+                csr->end[i] = m;
+                m += CSR_ROOM;
+        }
+
+        csr->off[n]      = m;
+        csr->nr_vertices = n;
+
+        graph->dirty = false;
+
+        return 0;
+
+ fail_csr:
+        csr_fini(csr);
+        return -ENOMEM;
+}
+
 struct graph * graph_create(void)
 {
         struct graph * graph;
 
         graph = malloc(sizeof(*graph));
         if (graph == NULL)
-                return NULL;
+                goto fail_graph;
 
-        if (pthread_mutex_init(&graph->lock, NULL)) {
-                free(graph);
-                return NULL;
-        }
+        graph->idx = calloc(IDX_INIT, sizeof(*graph->idx));
+        if (graph->idx == NULL)
+                goto fail_idx;
+
+        graph->vtx = malloc(IDX_INIT * sizeof(*graph->vtx));
+        if (graph->vtx == NULL)
+                goto fail_vtx;
+
+        graph->vtx_addr = malloc(IDX_INIT * sizeof(*graph->vtx_addr));
+        if (graph->vtx_addr == NULL)
+                goto fail_vtx_addr;
 
+        if (pthread_mutex_init(&graph->lock, NULL))
+                goto fail_lock;
+
+        graph->idx_size    = IDX_INIT;
+        graph->vtx_len     = IDX_INIT;
+        graph->nr_slots    = 0;
         graph->nr_vertices = 0;
+        graph->seq         = 0;
+        graph->base        = 0;
+        graph->dirty       = true;
         list_head_init(&graph->vertices);
+        memset(&graph->csr, 0, sizeof(graph->csr));
 
         return graph;
+
+ fail_lock:
+        free(graph->vtx_addr);
+ fail_vtx_addr:
+        free(graph->vtx);
+ fail_vtx:
+        free(graph->idx);
+ fail_idx:
+        free(graph);
+ fail_graph:
+        return NULL;
 }
 
 void graph_destroy(struct graph * graph)
@@ -223,10 +663,15 @@ void graph_destroy(struct graph * graph)
                 del_vertex(graph, e);
         }
 
+        csr_fini(&graph->csr);
+
         pthread_mutex_unlock(&graph->lock);
 
         pthread_mutex_destroy(&graph->lock);
 
+        free(graph->vtx_addr);
+        free(graph->vtx);
+        free(graph->idx);
         free(graph);
 }
 
@@ -297,10 +742,54 @@ int graph_update_edge(struct graph * graph,
                         log_err("Failed to add edge.");
                         return -ENOMEM;
                 }
+                /* Until the other side announces its own. */
+                nb_e->qs = qs;
         }
 
         nb_e->announced++;
-        nb_e->qs = qs;
+
+        log_change(graph, v, nb, e->announced - 1, e->announced);
+
+        pthread_mutex_unlock(&graph->lock);
+
+        return 0;
+}
+
+int graph_update_qos(struct graph * graph,
+                     uint64_t       s_addr,
+                     uint64_t       d_addr,
+                     qosspec_t      qs)
+{
+        struct vertex * v;
+        struct vertex * nb;
+        struct edge *   e;
+        ssize_t         i;
+
+        assert(graph);
+
+        pthread_mutex_lock(&graph->lock);
+
+        v  = find_vertex_by_addr(graph, s_addr);
+        nb = find_vertex_by_addr(graph, d_addr);
+        e  = v == NULL ? NULL : find_edge_by_addr(v, d_addr);
+        if (e == NULL || nb == NULL) {
+                pthread_mutex_unlock(&graph->lock);
+                log_err("No such edge.");
+                return -1;
+        }
+
+        e->qs = qs;
+
+        if (e->announced == 2 && !graph->dirty) {
+                i = csr_find(&graph->csr, v->index, nb->index);
+                if (i < 0)
+                        graph->dirty = true;
+                else
+                        csr_set(&graph->csr, i, &qs);
+        }
+
+        /* The trees through this edge have to be checked. */
+        log_change(graph, v, nb, e->announced, e->announced);
 
         pthread_mutex_unlock(&graph->lock);
 
@@ -348,6 +837,8 @@ int graph_del_edge(struct graph * graph,
                 return -1;
         }
 
+        log_change(graph, v, nb, e->announced, e->announced - 1);
+
         if (--e->announced == 0)
                 del_edge(e);
         if (--nb_e->announced == 0)
@@ -364,115 +855,220 @@ int graph_del_edge(struct graph * graph,
         return 0;
 }
 
-static int get_min_vertex(struct graph *   graph,
-                          int *            dist,
-                          bool *           used,
-                          struct vertex ** v)
+/* Path lengths saturate at INT_MAX, which also means unreachable. */
+static int dist_add(int d,
+                    int w)
 {
-        int                min = INT_MAX;
-        int                index = -1;
-        int                i = 0;
-        struct list_head * p;
+        assert(d >= 0 && w >= 0);
 
-        assert(v);
-        assert(graph);
-        assert(dist);
-        assert(used);
+        return d > INT_MAX - w ? INT_MAX : d + w;
+}
 
-        *v = NULL;
+static void heap_push(struct heap * heap,
+                      int           dist,
+                      size_t        v)
+{
+        size_t i = heap->len++;
+        size_t p;
 
-        list_for_each(p, &graph->vertices) {
-                if (!used[i] && dist[i] < min) {
-                        min = dist[i];
-                        index = i;
-                        *v = list_entry(p, struct vertex, next);
-                }
+        while (i > 0) {
+                p = (i - 1) >> 1;
+                if (heap->el[p].dist <= dist)
+                        break;
+                heap->el[i] = heap->el[p];
+                i = p;
+        }
+
+        heap->el[i].dist = dist;
+        heap->el[i].v    = v;
+}
 
-                i++;
+static struct heap_el heap_pop(struct heap * heap)
+{
+        struct heap_el top  = heap->el[0];
+        struct heap_el last = heap->el[--heap->len];
+        size_t         i    = 0;
+        size_t         c;
+
+        while ((c = (i << 1) + 1) < heap->len) {
+                if (c + 1 < heap->len &&
+                    heap->el[c + 1].dist < heap->el[c].dist)
+                        ++c;
+                if (last.dist <= heap->el[c].dist)
+                        break;
+                heap->el[i] = heap->el[c];
+                i = c;
         }
 
-        if (index != -1)
-                used[index] = true;
+        heap->el[i] = last;
 
-        return index;
+        return top;
 }
 
-static int dijkstra(struct graph *    graph,
-                    uint64_t          src,
-                    struct vertex *** nhops,
-                    int **            dist)
+/*
+ * Distances from src, INT_MAX if unreachable, and if nhop is not
+ * NULL the first hop towards each vertex, -1 for src or unreachable.
+ * Stale heap entries are skipped instead of decreasing keys, so every
+ * edge pushes at most once.
+ */
+static int dijkstra(const struct csr *  csr,
+                    enum routing_metric metric,
+                    size_t              src,
+                    int *               dist,
+                    int *               nhop)
 {
-        bool *             used;
-        struct list_head * p = NULL;
-        int                i = 0;
-        struct vertex *    v = NULL;
-        struct edge *      e = NULL;
-        int                alt;
-
-        assert(graph);
-        assert(nhops);
+        struct heap    heap;
+        struct heap_el u;
+        const int *    w = csr->w[metric];
+        size_t         i;
+        size_t         v;
+        int            alt;
+
+        assert(csr);
         assert(dist);
 
-        *nhops = malloc(sizeof(**nhops) * graph->nr_vertices);
-        if (*nhops == NULL)
-                goto fail_pnhops;
+        heap.el = malloc((csr->nr_edges + 1) * sizeof(*heap.el));
+        if (heap.el == NULL)
+                return -ENOMEM;
 
-        *dist = malloc(sizeof(**dist) * graph->nr_vertices);
-        if (*dist == NULL)
-                goto fail_pdist;
+        heap.len = 0;
 
-        used = malloc(sizeof(*used) * graph->nr_vertices);
-        if (used == NULL)
-                goto fail_used;
+        for (i = 0; i < csr->nr_vertices; ++i)
+                dist[i] = INT_MAX;
 
-        /* Init the data structures */
-        memset(used, 0, sizeof(*used) * graph->nr_vertices);
-        memset(*nhops, 0, sizeof(**nhops) * graph->nr_vertices);
-        memset(*dist, 0, sizeof(**dist) * graph->nr_vertices);
+        if (nhop != NULL)
+                for (i = 0; i < csr->nr_vertices; ++i)
+                        nhop[i] = -1;
 
-        list_for_each(p, &graph->vertices) {
-                v = list_entry(p, struct vertex, next);
-                (*dist)[i++]  = (v->addr == src) ? 0 : INT_MAX;
-        }
+        dist[src] = 0;
+        heap_push(&heap, 0, src);
 
-        /* Perform actual Dijkstra */
-        i = get_min_vertex(graph, *dist, used, &v);
-        while (v != NULL) {
-                list_for_each(p, &v->edges) {
-                        e = list_entry(p, struct edge, next);
+        while (heap.len > 0) {
+                u = heap_pop(&heap);
+                if (u.dist > dist[u.v])
+                        continue;
 
-                        /* Only include it if both sides announced it. */
-                        if (e->announced != 2)
+                for (i = csr->off[u.v]; i < csr->end[u.v]; ++i) {
+                        v   = csr->adj[i];
+                        alt = dist_add(u.dist, w[i]);
+                        if (alt >= dist[v])
                                 continue;
 
-                        /*
-                         * NOTE: Current weight is just hop count.
-                         * Method could be extended to use a different
-                         * weight for a different QoS cube.
-                         */
-                        alt = (*dist)[i] + 1;
-                        if (alt < (*dist)[e->nb->index]) {
-                                (*dist)[e->nb->index] = alt;
-                                if (v->addr == src)
-                                        (*nhops)[e->nb->index] = e->nb;
-                                else
-                                        (*nhops)[e->nb->index] = (*nhops)[i];
-                        }
+                        dist[v] = alt;
+                        if (nhop != NULL)
+                                nhop[v] = u.v == src ? (int) v : nhop[u.v];
+
+                        heap_push(&heap, alt, v);
                 }
-                i = get_min_vertex(graph, *dist, used, &v);
         }
 
-        free(used);
+        free(heap.el);
 
         return 0;
+}
 
- fail_used:
-        free(*dist);
- fail_pdist:
-        free(*nhops);
- fail_pnhops:
-        return -1;
+struct nb_spf {
+        const struct csr *  csr;
+        enum routing_metric metric;
+        size_t              src;
+        int *               dist; /* A row of nr_vertices per neighbor */
+        size_t              next; /* Next neighbor to run from         */
+        int                 ret;
+        pthread_mutex_t     lock;
+};
+
+static void * nb_spf_worker(void * o)
+{
+        struct nb_spf *    s   = (struct nb_spf *) o;
+        const struct csr * csr = s->csr;
+        size_t             deg;
+        size_t             j;
+
+        deg = csr->end[s->src] - csr->off[s->src];
+
+        while (true) {
+                pthread_mutex_lock(&s->lock);
+                j = s->next++;
+                pthread_mutex_unlock(&s->lock);
+
+                if (j >= deg)
+                        break;
+
+                if (dijkstra(csr, s->metric, csr->adj[csr->off[s->src] + j],
+                             s->dist + j * csr->nr_vertices, NULL)) {
+                        pthread_mutex_lock(&s->lock);
+                        s->ret = -1;
+                        pthread_mutex_unlock(&s->lock);
+                }
+        }
+
+        return (void *) 0;
+}
+
+static size_t spf_threads(void)
+{
+        long n = IPCP_SPF_THREADS;
+
+        if (n <= 0)
+                n = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (n < 1)
+                return 1;
+
+        return n > SPF_MAX_THREADS ? SPF_MAX_THREADS : (size_t) n;
+}
+
+/*
+ * Distances from each neighbor of src, the runs are independent and
+ * only read the snapshot, so they are spread over a few threads.
+ * Row j of dist belongs to the j-th neighbor whoever computed it.
+ */
+static int nb_dijkstra(const struct csr *  csr,
+                       enum routing_metric metric,
+                       size_t              src,
+                       int *               dist)
+{
+        struct nb_spf s;
+        pthread_t     thr[SPF_MAX_THREADS];
+        size_t        deg;
+        size_t        nr;
+        size_t        i;
+        int           state;
+
+        deg = csr->end[src] - csr->off[src];
+
+        nr = spf_threads();
+        if (nr > deg)
+                nr = deg;
+
+        s.csr    = csr;
+        s.metric = metric;
+        s.src    = src;
+        s.dist   = dist;
+        s.next   = 0;
+        s.ret    = 0;
+
+        if (pthread_mutex_init(&s.lock, NULL))
+                return -1;
+
+        /* The workers use s, don't leave them behind on a cancel. */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+        /* This thread takes part, if a create fails the rest do more. */
+        for (i = 0; i + 1 < nr; ++i)
+                if (pthread_create(&thr[i], NULL, nb_spf_worker, &s))
+                        break;
+
+        nb_spf_worker(&s);
 
+        while (i-- > 0)
+                pthread_join(thr[i], NULL);
+
+        pthread_setcancelstate(state, NULL);
+
+        pthread_mutex_destroy(&s.lock);
+
+        return s.ret;
 }
 
 static void free_routing_table(struct list_head * table)
@@ -510,340 +1106,716 @@ void graph_free_routing_table(struct graph *     graph,
         pthread_mutex_unlock(&graph->lock);
 }
 
-static int graph_routing_table_simple(struct graph *     graph,
-                                      uint64_t           s_addr,
-                                      struct list_head * table,
-                                      int **             dist)
+
+static struct routing_table * add_entry(struct list_head * table,
+                                        uint64_t           dst)
 {
-        struct vertex **       nhops;
-        struct list_head *     p;
-        int                    i = 0;
-        struct vertex *        v;
         struct routing_table * t;
-        struct nhop *          n;
 
-        assert(graph);
-        assert(table);
-        assert(dist);
+        t = malloc(sizeof(*t));
+        if (t == NULL)
+                return NULL;
 
-        /* We need at least 2 vertices for a table */
-        if (graph->nr_vertices < 2)
-                goto fail_vertices;
+        t->dst = dst;
+        list_head_init(&t->nhops);
 
-        if (dijkstra(graph, s_addr, &nhops, dist))
-                goto fail_vertices;
+        list_add(&t->next, table);
 
-        list_head_init(table);
+        return t;
+}
 
-        /* Now construct the routing table from the nhops. */
-        list_for_each(p, &graph->vertices) {
-                v = list_entry(p, struct vertex, next);
+static int add_nhop(struct routing_table * t,
+                    uint64_t               addr)
+{
+        struct nhop * n;
 
-                /* This is the src */
-                if (nhops[i] == NULL) {
-                        i++;
-                        continue;
-                }
+        n = malloc(sizeof(*n));
+        if (n == NULL)
+                return -ENOMEM;
 
-                t = malloc(sizeof(*t));
-                if (t == NULL)
-                        goto fail_t;
+        n->nhop = addr;
 
-                list_head_init(&t->nhops);
+        list_add_tail(&n->next, &t->nhops);
+
+        return 0;
+}
 
-                n = malloc(sizeof(*n));
-                if (n == NULL)
-                        goto fail_n;
+/* Weight of the edge from u to v, -1 if it is not in the snapshot. */
+static int run_weight(const struct spt_run * r,
+                      size_t                 u,
+                      size_t                 v)
+{
+        ssize_t i;
 
-                t->dst = v->addr;
-                n->nhop = nhops[i]->addr;
+        i = csr_find(r->csr, u, v);
+        if (i < 0)
+                return -1;
 
-                list_add(&n->next, &t->nhops);
-                list_add(&t->next, table);
+        return r->w[i];
+}
 
-                i++;
+static int spt_resize(struct spt * spt,
+                      size_t       len)
+{
+        int *  a;
+        size_t i;
+
+        if (len <= spt->len)
+                return 0;
+
+        a = realloc(spt->dist, len * sizeof(*a));
+        if (a == NULL)
+                return -ENOMEM;
+        spt->dist = a;
+
+        a = realloc(spt->parent, len * sizeof(*a));
+        if (a == NULL)
+                return -ENOMEM;
+        spt->parent = a;
+
+        a = realloc(spt->nhop, len * sizeof(*a));
+        if (a == NULL)
+                return -ENOMEM;
+        spt->nhop = a;
+
+        a = realloc(spt->old, len * sizeof(*a));
+        if (a == NULL)
+                return -ENOMEM;
+        spt->old = a;
+
+        for (i = spt->len; i < len; ++i) {
+                spt->dist[i]   = INT_MAX;
+                spt->parent[i] = -1;
+                spt->nhop[i]   = -1;
+                spt->old[i]    = SPT_NONE;
         }
 
-        free(nhops);
+        spt->len = len;
 
         return 0;
+}
 
- fail_n:
-        free(t);
- fail_t:
-        free_routing_table(table);
-        free(nhops);
-        free(*dist);
- fail_vertices:
-        *dist = NULL;
-        return -1;
+/* Set the distance of x, reached through from, -1 if unreachable. */
+static void run_label(struct spt_run * r,
+                      size_t           x,
+                      int              from,
+                      int              dist)
+{
+        struct spt * spt = r->spt;
+
+        if (r->touched != NULL && spt->old[x] == SPT_NONE) {
+                spt->old[x] = spt->nhop[x];
+                r->touched[r->nr_touched++] = x;
+        }
+
+        spt->dist[x]   = dist;
+        spt->parent[x] = from;
+
+        if (from < 0)
+                spt->nhop[x] = -1;
+        else if ((size_t) from == r->src)
+                spt->nhop[x] = (int) x;
+        else
+                spt->nhop[x] = spt->nhop[from];
 }
 
-static int add_lfa_to_table(struct list_head * table,
-                            uint64_t           addr,
-                            uint64_t           lfa)
+/* Settle what is on the heap and everything it improves. */
+static void run_settle(struct spt_run * r)
 {
-        struct list_head * p;
-        struct nhop *      n;
+        const struct csr * csr = r->csr;
+        struct spt *       spt = r->spt;
+        struct heap_el     u;
+        size_t             i;
+        size_t             x;
+        int                alt;
 
-        assert(table);
+        while (r->heap.len > 0) {
+                u = heap_pop(&r->heap);
+                if (u.dist > spt->dist[u.v])
+                        continue;
 
-        n = malloc(sizeof(*n));
-        if (n == NULL)
-                return -1;
+                for (i = csr->off[u.v]; i < csr->end[u.v]; ++i) {
+                        x   = csr->adj[i];
+                        alt = dist_add(u.dist, r->w[i]);
+                        if (alt >= spt->dist[x])
+                                continue;
 
-        n->nhop = lfa;
+                        run_label(r, x, (int) u.v, alt);
+                        heap_push(&r->heap, alt, x);
+                }
+        }
+}
 
-        list_for_each(p, table) {
-                struct routing_table * t =
-                        list_entry(p, struct routing_table, next);
-                if (t->dst == addr) {
-                        list_add_tail(&n->next, &t->nhops);
-                        return 0;
+/*
+ * A tree edge is gone: everything below it loses its distance and is
+ * put back at its best remaining neighbor by run_reattach.
+ */
+static void run_cut(struct spt_run * r,
+                    size_t           root,
+                    size_t *         cut,
+                    size_t *         nr_cut)
+{
+        const struct csr * csr = r->csr;
+        size_t             h   = *nr_cut;
+        size_t             y;
+        size_t             x;
+        size_t             i;
+
+        run_label(r, root, -1, INT_MAX);
+        cut[(*nr_cut)++] = root;
+
+        while (h < *nr_cut) {
+                y = cut[h++];
+                for (i = csr->off[y]; i < csr->end[y]; ++i) {
+                        x = csr->adj[i];
+                        if (r->spt->parent[x] != (int) y)
+                                continue;
+                        run_label(r, x, -1, INT_MAX);
+                        cut[(*nr_cut)++] = x;
                 }
         }
+}
+
+static void run_reattach(struct spt_run * r,
+                         size_t           x)
+{
+        const struct csr * csr = r->csr;
+        struct spt *       spt = r->spt;
+        size_t             i;
+        size_t             y;
+        int                w;
+        int                best = INT_MAX;
+        int                from = -1;
+
+        /* Links can weigh differently each way, x is reached from y. */
+        for (i = csr->off[x]; i < csr->end[x]; ++i) {
+                y = csr->adj[i];
+                if (spt->dist[y] == INT_MAX)
+                        continue;
+                w = run_weight(r, y, x);
+                if (w < 0 || dist_add(spt->dist[y], w) >= best)
+                        continue;
+                best = dist_add(spt->dist[y], w);
+                from = (int) y;
+        }
 
-        free(n);
+        if (from < 0)
+                return;
 
-        return -1;
+        run_label(r, x, from, best);
+        heap_push(&r->heap, best, x);
 }
 
-static int graph_routing_table_lfa(struct graph *     graph,
-                                   uint64_t           s_addr,
-                                   struct list_head * table,
-                                   int **             dist)
+static void spt_full(struct spt_run * r)
 {
-        int *              n_dist[PROG_MAX_FLOWS];
-        uint64_t           addrs[PROG_MAX_FLOWS];
-        int                n_index[PROG_MAX_FLOWS];
-        struct list_head * p;
-        struct list_head * q;
-        struct vertex *    v;
-        struct edge *      e;
-        struct vertex **   nhops;
-        int                i = 0;
-        int                j;
-        int                k;
+        size_t i;
 
-        if (graph_routing_table_simple(graph, s_addr, table, dist))
-                goto fail_table;
+        for (i = 0; i < r->csr->nr_vertices; ++i) {
+                r->spt->dist[i]   = INT_MAX;
+                r->spt->parent[i] = -1;
+                r->spt->nhop[i]   = -1;
+        }
+
+        r->spt->dist[r->src] = 0;
+        heap_push(&r->heap, 0, r->src);
 
-        for (j = 0; j < PROG_MAX_FLOWS; j++) {
-                n_dist[j] = NULL;
-                n_index[j] = -1;
-                addrs[j] = -1;
+        run_settle(r);
+}
+
+/*
+ * Apply the logged edge changes: cut the subtrees below tree edges
+ * that disappeared or got heavier and reattach them, then relax the
+ * edges that appeared or got lighter. Labels only get relaxed from
+ * consistent neighbors, so the result is a shortest path tree of the
+ * new graph.
+ */
+static int spt_incremental(struct graph *   graph,
+                           struct spt_run * r)
+{
+        const struct csr * csr = r->csr;
+        struct spt *       spt = r->spt;
+        struct graph_chg * c;
+        size_t *           cut;
+        size_t             nr_cut = 0;
+        size_t             a;
+        size_t             b;
+        uint64_t           s;
+        size_t             i;
+        int                w;
+
+        cut = malloc(csr->nr_vertices * sizeof(*cut));
+        if (cut == NULL)
+                return -ENOMEM;
+
+        for (s = spt->seq; s < graph->seq; ++s) {
+                c = &graph->log[s % GRAPH_LOG];
+                for (i = 0; i < 2; ++i) {
+                        a = i == 0 ? c->u : c->v;
+                        b = i == 0 ? c->v : c->u;
+                        if (spt->parent[b] != (int) a)
+                                continue;
+                        w = run_weight(r, a, b);
+                        if (w < 0 || dist_add(spt->dist[a], w) != spt->dist[b])
+                                run_cut(r, b, cut, &nr_cut);
+                }
         }
 
-        list_for_each(p, &graph->vertices) {
-                v = list_entry(p, struct vertex, next);
+        for (i = 0; i < nr_cut; ++i)
+                run_reattach(r, cut[i]);
+
+        for (s = spt->seq; s < graph->seq; ++s) {
+                c = &graph->log[s % GRAPH_LOG];
+                for (i = 0; i < 2; ++i) {
+                        a = i == 0 ? c->u : c->v;
+                        b = i == 0 ? c->v : c->u;
+                        if (spt->dist[a] == INT_MAX)
+                                continue;
+                        w = run_weight(r, a, b);
+                        if (w < 0 || dist_add(spt->dist[a], w) >= spt->dist[b])
+                                continue;
+                        run_label(r, b, (int) a, dist_add(spt->dist[a], w));
+                        heap_push(&r->heap, spt->dist[b], b);
+                }
+        }
+
+        run_settle(r);
+
+        free(cut);
+
+        return 0;
+}
+
+static int spt_entry(const struct csr * csr,
+                     const struct spt * spt,
+                     size_t             x,
+                     struct list_head * table)
+{
+        struct routing_table * t;
+
+        t = add_entry(table, csr->addr[x]);
+        if (t == NULL)
+                return -ENOMEM;
+
+        if (spt->nhop[x] < 0)
+                return 0;
 
-                if (v->addr != s_addr)
+        return add_nhop(t, csr->addr[spt->nhop[x]]);
+}
+
+static int spt_table(struct graph *     graph,
+                     struct spt_run *   r,
+                     bool               full,
+                     struct list_head * table)
+{
+        const struct csr * csr = r->csr;
+        struct spt *       spt = r->spt;
+        size_t             i;
+        size_t             x;
+
+        if (full) {
+                for (x = 0; x < csr->nr_vertices; ++x)
+                        if (spt->nhop[x] >= 0 && spt_entry(csr, spt, x, table))
+                                goto fail_entry;
+                return 0;
+        }
+
+        for (i = 0; i < r->nr_touched; ++i) {
+                x = r->touched[i];
+                if (spt->nhop[x] == spt->old[x])
+                        continue;
+                /* The address may have moved to a new slot. */
+                if (spt->nhop[x] < 0 && graph->vtx[x] == NULL &&
+                    find_vertex_by_addr(graph, csr->addr[x]) != NULL)
                         continue;
+                if (spt_entry(csr, spt, x, table))
+                        goto fail_entry;
+        }
 
-                /*
-                 * Get the distances for every neighbor
-                 * of the source.
-                 */
-                list_for_each(q, &v->edges) {
-                        e = list_entry(q, struct edge, next);
+        return 0;
 
-                        addrs[i] = e->nb->addr;
-                        n_index[i] = e->nb->index;
-                        if (dijkstra(graph, e->nb->addr,
-                                     &nhops, &(n_dist[i++])))
-                                goto fail_dijkstra;
+ fail_entry:
+        free_routing_table(table);
+        return -ENOMEM;
+}
 
-                        free(nhops);
-                }
+static int graph_routing_table_simple(struct graph *      graph,
+                                      enum routing_metric metric,
+                                      size_t              src,
+                                      struct list_head *  table,
+                                      int *               dist)
+{
+        const struct csr *     csr = &graph->csr;
+        struct routing_table * t;
+        int *                  nhop;
+        size_t                 v;
 
-                break;
+        assert(graph);
+        assert(table);
+        assert(dist);
+
+        nhop = malloc(csr->nr_vertices * sizeof(*nhop));
+        if (nhop == NULL)
+                goto fail_nhop;
+
+        if (dijkstra(csr, metric, src, dist, nhop))
+                goto fail_dijkstra;
+
+        /* Now construct the routing table from the nhops. */
+        for (v = 0; v < csr->nr_vertices; ++v) {
+                if (nhop[v] < 0)
+                        continue;
+
+                t = add_entry(table, csr->addr[v]);
+                if (t == NULL)
+                        goto fail_t;
+
+                if (add_nhop(t, csr->addr[nhop[v]]))
+                        goto fail_t;
         }
 
+        free(nhop);
+
+        return 0;
+
+ fail_t:
+        free_routing_table(table);
+ fail_dijkstra:
+        free(nhop);
+ fail_nhop:
+        return -1;
+}
+
+static int graph_routing_table_lfa(struct graph *      graph,
+                                   enum routing_metric metric,
+                                   size_t              src,
+                                   struct list_head *  table,
+                                   int *               dist)
+{
+        const struct csr * csr = &graph->csr;
+        struct list_head * p;
+        int *              n_dist;
+        size_t             n;
+        size_t             deg;
+        size_t             nb;
+        size_t             v;
+        size_t             j;
+
+        n   = csr->nr_vertices;
+        deg = csr->end[src] - csr->off[src];
+
+        if (graph_routing_table_simple(graph, metric, src, table, dist))
+                goto fail_table;
+
+        n_dist = malloc((deg * n + 1) * sizeof(*n_dist));
+        if (n_dist == NULL)
+                goto fail_n_dist;
+
+        /* Get the distances for every neighbor of the source. */
+        if (nb_dijkstra(csr, metric, src, n_dist))
+                goto fail_dijkstra;
+
         /* Loop though all nodes to see if we have a LFA for them. */
-        list_for_each(p, &graph->vertices) {
-                v = list_entry(p, struct vertex, next);
+        list_for_each(p, table) {
+                struct routing_table * t =
+                        list_entry(p, struct routing_table, next);
 
-                if (v->addr == s_addr)
-                        continue;
+                v = find_vertex_by_addr(graph, t->dst)->index;
 
                 /*
                  * Check for every neighbor if
                  * dist(neighbor, destination) <
                  * dist(neighbor, source) + dist(source, destination).
                  */
-                for (j = 0; j < i; j++) {
+                for (j = 0; j < deg; ++j) {
+                        nb = csr->adj[csr->off[src] + j];
+
                         /* Exclude ourselves. */
-                        if (addrs[j] == v->addr)
+                        if (nb == v)
                                 continue;
 
-                        if (n_dist[j][v->index] <
-                            (*dist)[n_index[j]] + (*dist)[v->index])
-                                if (add_lfa_to_table(table, v->addr,
-                                                     addrs[j]))
-                                        goto fail_add_lfa;
+                        if (n_dist[j * n + v] < dist_add(dist[nb], dist[v]))
+                                if (add_nhop(t, csr->addr[nb]))
+                                        goto fail_dijkstra;
                 }
         }
 
-        for (j = 0; j < i; j++)
-                free(n_dist[j]);
+        free(n_dist);
 
         return 0;
 
- fail_add_lfa:
-        for (k = j; k < i; k++)
-                free(n_dist[k]);
  fail_dijkstra:
+        free(n_dist);
+ fail_n_dist:
         free_routing_table(table);
  fail_table:
         return -1;
 }
 
-static int graph_routing_table_ecmp(struct graph *     graph,
-                                    uint64_t           s_addr,
-                                    struct list_head * table,
-                                    int **             dist)
+static int graph_routing_table_ecmp(struct graph *      graph,
+                                    enum routing_metric metric,
+                                    size_t              src,
+                                    struct list_head *  table,
+                                    int *               dist)
 {
-        struct vertex **       nhops;
-        struct list_head *     p;
-        struct list_head *     h;
-        size_t                 i;
-        struct vertex *        v;
-        struct vertex *        src_v;
-        struct edge *          e;
-        struct routing_table * t;
-        struct nhop *          n;
-        struct list_head *     forwarding;
+        const struct csr *      csr = &graph->csr;
+        struct routing_table ** ent;
+        int *                   n_dist;
+        int *                   tmp_dist;
+        size_t                  n;
+        size_t                  deg;
+        size_t                  nb;
+        size_t                  v;
+        size_t                  j;
+        int                     w;
 
         assert(graph);
         assert(dist);
 
-        if (graph-> nr_vertices < 2)
-                goto fail_vertices;
+        n   = csr->nr_vertices;
+        deg = csr->end[src] - csr->off[src];
 
-        forwarding = malloc(sizeof(*forwarding) * graph->nr_vertices);
-        if (forwarding == NULL)
-                goto fail_vertices;
+        ent = calloc(n, sizeof(*ent));
+        if (ent == NULL)
+                goto fail_ent;
 
-        for (i = 0; i < graph->nr_vertices; ++i)
-                list_head_init(&forwarding[i]);
+        n_dist = malloc((deg * n + 1) * sizeof(*n_dist));
+        if (n_dist == NULL)
+                goto fail_n_dist;
 
-        if (dijkstra(graph, s_addr, &nhops, dist))
+        if (dijkstra(csr, metric, src, dist, NULL))
                 goto fail_dijkstra;
 
-        free(nhops);
-
-        src_v = find_vertex_by_addr(graph, s_addr);
-        if (src_v == NULL)
-                goto fail_src_v;
-
-        list_for_each(p, &src_v->edges) {
-                int * tmp_dist;
+        if (nb_dijkstra(csr, metric, src, n_dist))
+                goto fail_dijkstra;
 
-                e = list_entry(p, struct edge, next);
-                if (dijkstra(graph, e->nb->addr, &nhops, &tmp_dist))
-                        goto fail_src_v;
+        /* A neighbor is a next hop if it lies on a shortest path. */
+        for (j = 0; j < deg; ++j) {
+                nb       = csr->adj[csr->off[src] + j];
+                w        = csr->w[metric][csr->off[src] + j];
+                tmp_dist = n_dist + j * n;
 
-                free(nhops);
+                for (v = 0; v < n; ++v) {
+                        if (v == src || tmp_dist[v] == INT_MAX ||
+                            dist_add(tmp_dist[v], w) != dist[v])
+                                continue;
 
-                list_for_each(h, &graph->vertices) {
-                        v = list_entry(h, struct vertex, next);
-                        if (tmp_dist[v->index] + 1 == (*dist)[v->index]) {
-                                n = malloc(sizeof(*n));
-                                if (n == NULL) {
-                                        free(tmp_dist);
-                                        goto fail_src_v;
-                                }
-                                n->nhop = e->nb->addr;
-                                list_add_tail(&n->next, &forwarding[v->index]);
+                        if (ent[v] == NULL) {
+                                ent[v] = add_entry(table, csr->addr[v]);
+                                if (ent[v] == NULL)
+                                        goto fail_t;
                         }
-                }
 
-                free(tmp_dist);
-        }
-
-        list_head_init(table);
-        i = 0;
-        list_for_each(p, &graph->vertices) {
-                v = list_entry(p, struct vertex, next);
-                if (v->addr == s_addr) {
-                        ++i;
-                        continue;
+                        if (add_nhop(ent[v], csr->addr[nb]))
+                                goto fail_t;
                 }
-
-                t = malloc(sizeof(*t));
-                if (t == NULL)
-                        goto fail_t;
-
-                t->dst = v->addr;
-
-                list_head_init(&t->nhops);
-                if (&forwarding[i] != forwarding[i].nxt) {
-                        t->nhops.nxt = forwarding[i].nxt;
-                        t->nhops.prv = forwarding[i].prv;
-                        forwarding[i].prv->nxt = &t->nhops;
-                        forwarding[i].nxt->prv = &t->nhops;
-                }
-
-                list_add(&t->next, table);
-                ++i;
         }
 
-        free(*dist);
-        *dist = NULL;
-        free(forwarding);
+        free(n_dist);
+        free(ent);
 
         return 0;
 
  fail_t:
         free_routing_table(table);
- fail_src_v:
-        free(*dist);
  fail_dijkstra:
-        free(forwarding);
- fail_vertices:
-        *dist = NULL;
+        free(n_dist);
+ fail_n_dist:
+        free(ent);
+ fail_ent:
         return -1;
 }
 
-int graph_routing_table(struct graph *     graph,
-                        enum routing_algo  algo,
-                        uint64_t           s_addr,
-                        struct list_head * table)
+int graph_routing_table(struct graph *      graph,
+                        enum routing_algo   algo,
+                        enum routing_metric metric,
+                        uint64_t            s_addr,
+                        struct list_head *  table)
 {
-        int * s_dist;
+        struct vertex * s;
+        int *           s_dist;
+        int             ret;
 
         assert(graph);
         assert(table);
+        assert(metric < METRIC_MAX);
+
+        list_head_init(table);
 
         pthread_mutex_lock(&graph->lock);
 
+        /* We need at least 2 vertices for a table */
+        if (graph->nr_vertices < 2)
+                goto fail_table;
+
+        if (graph->dirty && csr_build(graph))
+                goto fail_table;
+
+        s = find_vertex_by_addr(graph, s_addr);
+        if (s == NULL) {
+                pthread_mutex_unlock(&graph->lock);
+                return 0;
+        }
+
+        s_dist = malloc(graph->csr.nr_vertices * sizeof(*s_dist));
+        if (s_dist == NULL)
+                goto fail_table;
+
         switch (algo) {
         case ROUTING_SIMPLE:
-                /* LFA uses the s_dist this returns. */
-                if (graph_routing_table_simple(graph, s_addr, table, &s_dist))
-                        goto fail_table;
+                ret = graph_routing_table_simple(graph, metric, s->index,
+                                                 table, s_dist);
                 break;
         case ROUTING_LFA:
-                if (graph_routing_table_lfa(graph, s_addr, table, &s_dist))
-                        goto fail_table;
+                ret = graph_routing_table_lfa(graph, metric, s->index,
+                                              table, s_dist);
                 break;
-
         case ROUTING_ECMP:
-                if (graph_routing_table_ecmp(graph, s_addr, table, &s_dist))
-                        goto fail_table;
+                ret = graph_routing_table_ecmp(graph, metric, s->index,
+                                               table, s_dist);
                 break;
         default:
                 log_err("Unsupported algorithm.");
-                goto fail_table;
+                ret = -1;
         }
 
-        pthread_mutex_unlock(&graph->lock);
-
         free(s_dist);
 
+        if (ret < 0)
+                goto fail_table;
+
+        pthread_mutex_unlock(&graph->lock);
+
         return 0;
 
  fail_table:
         pthread_mutex_unlock(&graph->lock);
         return -1;
 }
+
+struct spt * graph_spt_create(void)
+{
+        struct spt * spt;
+
+        spt = malloc(sizeof(*spt));
+        if (spt == NULL)
+                return NULL;
+
+        memset(spt, 0, sizeof(*spt));
+
+        return spt;
+}
+
+void graph_spt_destroy(struct spt * spt)
+{
+        assert(spt);
+
+        free(spt->dist);
+        free(spt->parent);
+        free(spt->nhop);
+        free(spt->old);
+        free(spt);
+}
+
+void graph_spt_invalidate(struct spt * spt)
+{
+        assert(spt);
+
+        spt->valid = false;
+}
+
+int graph_routing_update(struct graph *      graph,
+                         enum routing_algo   algo,
+                         enum routing_metric metric,
+                         uint64_t            s_addr,
+                         struct spt *        spt,
+                         struct list_head *  table)
+{
+        struct spt_run  r;
+        struct vertex * s;
+        bool            full;
+        size_t          i;
+
+        assert(graph);
+        assert(spt);
+        assert(table);
+        assert(metric < METRIC_MAX);
+
+        /* Alternates still need the distances from every neighbor. */
+        if (algo != ROUTING_SIMPLE)
+                return graph_routing_table(graph, algo, metric, s_addr,
+                                           table) ? -1 : 1;
+
+        list_head_init(table);
+
+        pthread_mutex_lock(&graph->lock);
+
+        if (graph->dirty && csr_build(graph))
+                goto fail_csr;
+
+        s = find_vertex_by_addr(graph, s_addr);
+        if (graph->nr_vertices < 2 || s == NULL) {
+                spt->valid = false;
+                pthread_mutex_unlock(&graph->lock);
+                return 1;
+        }
+
+        if (spt_resize(spt, graph->csr.nr_vertices))
+                goto fail_csr;
+
+        full = !spt->valid || spt->src != s_addr || spt->metric != metric ||
+                spt->seq < graph->base || graph->seq - spt->seq > GRAPH_LOG;
+
+        r.csr        = &graph->csr;
+        r.w          = graph->csr.w[metric];
+        r.spt        = spt;
+        r.src        = s->index;
+        r.nr_touched = 0;
+        r.heap.len   = 0;
+        r.heap.el    = malloc((graph->csr.nr_vertices + graph->csr.nr_edges
+                               + 2 * GRAPH_LOG + 1) * sizeof(*r.heap.el));
+        if (r.heap.el == NULL)
+                goto fail_csr;
+
+        r.touched = NULL;
+        if (!full) {
+                r.touched = malloc(graph->csr.nr_vertices
+                                   * sizeof(*r.touched));
+                if (r.touched == NULL)
+                        goto fail_touched;
+        }
+
+        spt->valid = false;
+
+        if (full)
+                spt_full(&r);
+        else if (spt_incremental(graph, &r))
+                goto fail_run;
+
+        if (spt_table(graph, &r, full, table))
+                goto fail_run;
+
+        for (i = 0; i < r.nr_touched; ++i)
+                spt->old[r.touched[i]] = SPT_NONE;
+
+        spt->src    = s_addr;
+        spt->metric = metric;
+        spt->seq    = graph->seq;
+        spt->valid  = true;
+
+        pthread_mutex_unlock(&graph->lock);
+
+        free(r.touched);
+        free(r.heap.el);
+
+        return full ? 1 : 0;
+
+ fail_run:
+        for (i = 0; i < r.nr_touched; ++i)
+                spt->old[r.touched[i]] = SPT_NONE;
+        free(r.touched);
+ fail_touched:
+        free(r.heap.el);
+ fail_csr:
+        pthread_mutex_unlock(&graph->lock);
+        return -1;
+}
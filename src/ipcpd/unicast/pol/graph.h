@@ -34,6 +34,14 @@ enum routing_algo {
          ROUTING_ECMP
 };
 
+/* What a link costs, taken from the qosspec of the edge. */
+enum routing_metric {
+        METRIC_HOPS = 0, /* Every link costs the same          */
+        METRIC_DELAY,    /* One plus the delay in ms           */
+        METRIC_CAPACITY, /* Inverse of the bandwidth, as OSPF  */
+        METRIC_MAX
+};
+
 struct nhop {
         struct list_head next;
         uint64_t         nhop;
@@ -54,16 +62,42 @@ int            graph_update_edge(struct graph * graph,
                                  uint64_t       d_addr,
                                  qosspec_t      qs);
 
+/* New delay or bandwidth of the link from s_addr to d_addr. */
+int            graph_update_qos(struct graph * graph,
+                                uint64_t       s_addr,
+                                uint64_t       d_addr,
+                                qosspec_t      qs);
+
 int            graph_del_edge(struct graph * graph,
                               uint64_t       s_addr,
                               uint64_t       d_addr);
 
-int            graph_routing_table(struct graph *     graph,
-                                   enum routing_algo  algo,
-                                   uint64_t           s_addr,
-                                   struct list_head * table);
+int            graph_routing_table(struct graph *      graph,
+                                   enum routing_algo   algo,
+                                   enum routing_metric metric,
+                                   uint64_t            s_addr,
+                                   struct list_head *  table);
 
 void           graph_free_routing_table(struct graph *     graph,
                                         struct list_head * table);
 
+struct spt *   graph_spt_create(void);
+
+void           graph_spt_destroy(struct spt * spt);
+
+/* The next graph_routing_update with this spt returns a full table. */
+void           graph_spt_invalidate(struct spt * spt);
+
+/*
+ * Only the entries that changed since the last call with this spt,
+ * one without next hops became unreachable. Returns 1 if the table
+ * is complete instead, 0 if it holds changes, -1 on error.
+ */
+int            graph_routing_update(struct graph *      graph,
+                                    enum routing_algo   algo,
+                                    enum routing_metric metric,
+                                    uint64_t            s_addr,
+                                    struct spt *        spt,
+                                    struct list_head *  table);
+
 #endif /* OUROBOROS_IPCPD_UNICAST_GRAPH_H */
@@ -40,6 +40,7 @@
 #include <ouroboros/notifier.h>
 #include <ouroboros/pthread.h>
 #include <ouroboros/rib.h>
+#include <ouroboros/time_utils.h>
 #include <ouroboros/utils.h>
 
 #include "common/comp.h"
@@ -54,44 +55,113 @@
 #include <inttypes.h>
 #include <string.h>
 
-#define RECALC_TIME    4
 #define LS_UPDATE_TIME 15
 #define LS_TIMEO       60
-#define LS_ENTRY_SIZE  104
+#define LS_DELAY_HYST  4    /* Advertise delay changes over 1/4th  */
+#define LS_DELAY_SLACK 2    /* ms, and over this                   */
+#define LS_ENTRY_SIZE  156
+#define LS_MSG_SIZE    1024 /* Fits in an SDU on any N-1 layer */
+#define LS_IDX_INIT    64
 #define LSDB           "lsdb"
+#define SPF            "spf"
+#define SPF_ENTRY_SIZE 294
 
 #ifndef CLOCK_REALTIME_COARSE
 #define CLOCK_REALTIME_COARSE CLOCK_REALTIME
 #endif
 
+/*
+ * LSA, SUMMARY and REQUEST messages pack as many entries as fit in
+ * LS_MSG_SIZE after the header. A new mgmt neighbor gets a SUMMARY
+ * of the lsdb and REQUESTs only the LSAs it lacks or has older.
+ */
+enum ls_msg_type {
+        LS_MSG_LSA = 0,
+        LS_MSG_PROBE,
+        LS_MSG_ECHO,
+        LS_MSG_SUMMARY,
+        LS_MSG_REQUEST
+};
+
+struct ls_hdr {
+        uint8_t  type;
+        uint16_t n;
+} __attribute__((packed));
+
 struct lsa {
         uint64_t d_addr;
         uint64_t s_addr;
         uint64_t seqno;
+        uint64_t bandwidth; /* Capacity in bits/s, 0 if unknown  */
+        uint32_t delay;     /* In ms, UINT32_MAX if not measured */
 } __attribute__((packed));
 
-struct routing_i {
-        struct list_head next;
+/* Identifies an LSA in a SUMMARY or REQUEST. */
+struct lsd {
+        uint64_t d_addr;
+        uint64_t s_addr;
+        uint64_t seqno;
+} __attribute__((packed));
 
-        struct pff *     pff;
-        pthread_t        calculator;
+#define LSD_MAX ((LS_MSG_SIZE - sizeof(struct ls_hdr)) / sizeof(struct lsd))
 
-        bool             modified;
-        pthread_mutex_t  lock;
+/* Builds a packed message, entries are all of size sz. */
+struct ls_msg {
+        uint8_t buf[LS_MSG_SIZE];
+        size_t  sz;
+        size_t  n;
+};
+
+/* Sent to a mgmt neighbor, which echoes it back to measure the rtt. */
+struct ls_probe {
+        uint8_t  type;
+        uint64_t stamp;
+} __attribute__((packed));
+
+struct routing_i {
+        struct list_head    next;
+
+        struct pff *        pff;
+        struct spt *        spt;
+        qoscube_t           qc;
+        enum routing_metric metric;
+        uint64_t            nb_gen;   /* ls.nb_gen of the last run   */
+        pthread_t           calculator;
+
+        bool                modified;
+        pthread_mutex_t     lock;
+        pthread_cond_t      cond;
+
+        uint32_t            hold;     /* Current hold time in ms     */
+        struct timespec     last;     /* End of the last run         */
+        size_t              triggers; /* Changes signalled           */
+        size_t              runs;
+        size_t              full;     /* Runs that rebuilt the table */
+        uint64_t            t_last;   /* Run durations in us         */
+        uint64_t            t_max;
+        uint64_t            t_total;
 };
 
-/* TODO: link weight support. */
 struct adjacency {
         struct list_head next;
+        struct list_head hnext; /* In the (src, dst) index */
 
         uint64_t         dst;
         uint64_t         src;
 
         uint64_t         seqno;
+        qosspec_t        qs;    /* Delay and bandwidth of the link */
 
         time_t           stamp;
 };
 
+enum lsdb_res {
+        LSDB_OLD = -1,
+        LSDB_REFRESH,
+        LSDB_CHANGED,
+        LSDB_NEW
+};
+
 enum nb_type {
         NB_DT = 0,
         NB_MGMT
@@ -103,37 +173,114 @@ struct nb {
         uint64_t         addr;
         int              fd;
         enum nb_type     type;
+        uint64_t         bandwidth; /* Of the N-1 flow, dt only     */
+        uint64_t         srtt;      /* Smoothed rtt in ns, mgmt only */
 };
 
 struct {
-        struct list_head  nbs;
-        size_t            nbs_len;
-        fset_t *          mgmt_set;
+        struct list_head   nbs;
+        size_t             nbs_len;
+        uint64_t           nb_gen;   /* Changes to dt neighbor fds */
+        fset_t *           mgmt_set;
 
-        struct list_head  db;
-        size_t            db_len;
+        struct list_head   db;
+        size_t             db_len;
+        struct list_head * idx;
+        size_t             idx_size;
 
-        pthread_rwlock_t  db_lock;
+        pthread_rwlock_t   db_lock;
 
-        struct graph *    graph;
+        struct graph *     graph;
 
-        pthread_t         lsupdate;
-        pthread_t         lsreader;
-        pthread_t         listener;
+        pthread_t          lsupdate;
+        pthread_t          lsreader;
+        pthread_t          listener;
 
-        struct list_head  routing_instances;
-        pthread_mutex_t   routing_i_lock;
+        struct list_head   routing_instances;
+        pthread_mutex_t    routing_i_lock;
 
-        enum routing_algo routing_algo;
+        enum routing_algo  routing_algo;
+        struct spf_timers  spf;
 } ls;
 
 struct pol_routing_ops link_state_ops = {
         .init              = link_state_init,
         .fini              = link_state_fini,
         .routing_i_create  = link_state_routing_i_create,
-        .routing_i_destroy = link_state_routing_i_destroy
+        .routing_i_destroy = link_state_routing_i_destroy,
+        .cube_table        = link_state_cube_table
 };
 
+static size_t adj_hash(uint64_t src,
+                       uint64_t dst)
+{
+        uint64_t key = src * 0x9E3779B97F4A7C15ULL ^ dst;
+
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDULL;
+        key ^= key >> 33;
+
+        return key & (ls.idx_size - 1);
+}
+
+static struct adjacency * lsdb_find(uint64_t src,
+                                    uint64_t dst)
+{
+        struct list_head * p;
+
+        list_for_each(p, &ls.idx[adj_hash(src, dst)]) {
+                struct adjacency * a;
+                a = list_entry(p, struct adjacency, hnext);
+                if (a->src == src && a->dst == dst)
+                        return a;
+        }
+
+        return NULL;
+}
+
+static void lsdb_idx_grow(void)
+{
+        struct list_head * idx;
+        struct list_head * p;
+        size_t             i;
+
+        idx = malloc(2 * ls.idx_size * sizeof(*idx));
+        if (idx == NULL)
+                return; /* Longer chains, but lookups still work. */
+
+        free(ls.idx);
+
+        ls.idx       = idx;
+        ls.idx_size *= 2;
+
+        for (i = 0; i < ls.idx_size; ++i)
+                list_head_init(&ls.idx[i]);
+
+        list_for_each(p, &ls.db) {
+                struct adjacency * a = list_entry(p, struct adjacency, next);
+                list_add(&a->hnext, &ls.idx[adj_hash(a->src, a->dst)]);
+        }
+}
+
+static void lsdb_insert(struct adjacency * adj)
+{
+        if (ls.db_len >= ls.idx_size)
+                lsdb_idx_grow();
+
+        list_add_tail(&adj->next, &ls.db);
+        list_add(&adj->hnext, &ls.idx[adj_hash(adj->src, adj->dst)]);
+
+        ++ls.db_len;
+}
+
+static void lsdb_remove(struct adjacency * adj)
+{
+        list_del(&adj->next);
+        list_del(&adj->hnext);
+
+        --ls.db_len;
+}
+
 static int str_adj(struct adjacency * adj,
                    char *             buf,
                    size_t             len)
@@ -142,6 +289,8 @@ static int str_adj(struct adjacency * adj,
         char        srcbuf[64];
         char        dstbuf[64];
         char        seqnobuf[64];
+        char        delaybuf[64];
+        char        bwbuf[64];
         struct tm * tm;
 
         assert(adj);
@@ -156,27 +305,36 @@ static int str_adj(struct adjacency * adj,
         sprintf(dstbuf, "%" PRIu64, adj->dst);
         sprintf(seqnobuf, "%" PRIu64, adj->seqno);
 
-        sprintf(buf, "src: %20s\ndst: %20s\nseqno: %18s\nupd: %20s\n",
-                srcbuf, dstbuf, seqnobuf, tmbuf);
+        if (adj->qs.delay == UINT32_MAX)
+                sprintf(delaybuf, "unknown");
+        else
+                sprintf(delaybuf, "%" PRIu32 " ms", adj->qs.delay);
+
+        if (adj->qs.bandwidth == 0)
+                sprintf(bwbuf, "unknown");
+        else
+                sprintf(bwbuf, "%" PRIu64 " b/s", adj->qs.bandwidth);
+
+        sprintf(buf, "src: %20s\ndst: %20s\nseqno: %18s\nupd: %20s\n"
+                "delay: %18s\nbw: %21s\n",
+                srcbuf, dstbuf, seqnobuf, tmbuf, delaybuf, bwbuf);
 
         return LS_ENTRY_SIZE;
 }
 
 static struct adjacency * get_adj(const char * path)
 {
-        struct list_head * p;
-        char               entry[RIB_PATH_LEN + 1];
+        uint64_t src;
+        uint64_t dst;
+        int      n;
 
         assert(path);
 
-        list_for_each(p, &ls.db) {
-                struct adjacency * a = list_entry(p, struct adjacency, next);
-                sprintf(entry, "%" PRIu64 ".%" PRIu64, a->src, a->dst);
-                if (strcmp(entry, path) == 0)
-                        return a;
-        }
+        if (sscanf(path, "%" SCNu64 ".%" SCNu64 "%n", &src, &dst, &n) != 2
+            || path[n] != '\0')
+                return NULL;
 
-        return NULL;
+        return lsdb_find(src, dst);
 }
 
 static int lsdb_rib_getattr(const char *      path,
@@ -312,9 +470,158 @@ static struct rib_ops r_ops = {
         .getattr = lsdb_rib_getattr
 };
 
-static int lsdb_add_nb(uint64_t     addr,
-                       int          fd,
-                       enum nb_type type)
+/* With the routing instances locked. */
+static struct routing_i * get_routing_i(const char * path)
+{
+        struct list_head * p;
+        char *             entry;
+
+        entry = strstr(path, RIB_SEPARATOR) + 1;
+        assert(entry);
+
+        list_for_each(p, &ls.routing_instances) {
+                struct routing_i * r = list_entry(p, struct routing_i, next);
+                if ((int) r->qc == atoi(entry))
+                        return r;
+        }
+
+        return NULL;
+}
+
+static int spf_rib_read(const char * path,
+                        char *       buf,
+                        size_t       len)
+{
+        struct routing_i * r;
+
+        assert(path);
+
+        if (len < SPF_ENTRY_SIZE)
+                return -1;
+
+        pthread_mutex_lock(&ls.routing_i_lock);
+
+        r = get_routing_i(path);
+        if (r == NULL) {
+                pthread_mutex_unlock(&ls.routing_i_lock);
+                return -1;
+        }
+
+        pthread_mutex_lock(&r->lock);
+
+        sprintf(buf,
+                "Changes:             %20zu\n"
+                "Runs:                %20zu\n"
+                "Full runs:           %20zu\n"
+                "Last run (us):       %20" PRIu64 "\n"
+                "Longest run (us):    %20" PRIu64 "\n"
+                "Total run time (us): %20" PRIu64 "\n"
+                "Hold time (ms):      %20" PRIu32 "\n",
+                r->triggers, r->runs, r->full, r->t_last, r->t_max,
+                r->t_total, r->hold);
+
+        pthread_mutex_unlock(&r->lock);
+
+        pthread_mutex_unlock(&ls.routing_i_lock);
+
+        return SPF_ENTRY_SIZE;
+}
+
+static int spf_rib_readdir(char *** buf)
+{
+        struct list_head * p;
+        char               entry[RIB_PATH_LEN + 1];
+        size_t             n = 0;
+        int                idx = 0;
+
+        assert(buf);
+
+        pthread_mutex_lock(&ls.routing_i_lock);
+
+        list_for_each(p, &ls.routing_instances)
+                ++n;
+
+        if (n == 0) {
+                pthread_mutex_unlock(&ls.routing_i_lock);
+                return 0;
+        }
+
+        *buf = malloc(sizeof(**buf) * n);
+        if (*buf == NULL) {
+                pthread_mutex_unlock(&ls.routing_i_lock);
+                return -ENOMEM;
+        }
+
+        list_for_each(p, &ls.routing_instances) {
+                struct routing_i * r = list_entry(p, struct routing_i, next);
+                sprintf(entry, "%d", r->qc);
+                (*buf)[idx] = malloc(strlen(entry) + 1);
+                if ((*buf)[idx] == NULL) {
+                        while (idx-- > 0)
+                                free((*buf)[idx]);
+                        free(*buf);
+                        pthread_mutex_unlock(&ls.routing_i_lock);
+                        return -ENOMEM;
+                }
+
+                strcpy((*buf)[idx++], entry);
+        }
+
+        pthread_mutex_unlock(&ls.routing_i_lock);
+
+        return idx;
+}
+
+static int spf_rib_getattr(const char *      path,
+                           struct rib_attr * attr)
+{
+        struct routing_i * r;
+        struct timespec    now;
+
+        assert(path);
+        assert(attr);
+
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+        pthread_mutex_lock(&ls.routing_i_lock);
+
+        r = get_routing_i(path);
+
+        attr->mtime = now.tv_sec;
+        attr->size  = r != NULL ? SPF_ENTRY_SIZE : 0;
+
+        pthread_mutex_unlock(&ls.routing_i_lock);
+
+        return 0;
+}
+
+static struct rib_ops spf_r_ops = {
+        .read    = spf_rib_read,
+        .readdir = spf_rib_readdir,
+        .getattr = spf_rib_getattr
+};
+
+static void set_pff_modified(void)
+{
+        struct list_head * p;
+
+        pthread_mutex_lock(&ls.routing_i_lock);
+        list_for_each(p, &ls.routing_instances) {
+                struct routing_i * inst =
+                        list_entry(p, struct routing_i, next);
+                pthread_mutex_lock(&inst->lock);
+                inst->modified = true;
+                ++inst->triggers;
+                pthread_cond_signal(&inst->cond);
+                pthread_mutex_unlock(&inst->lock);
+        }
+        pthread_mutex_unlock(&ls.routing_i_lock);
+}
+
+static int lsdb_add_nb(uint64_t          addr,
+                       int               fd,
+                       enum nb_type      type,
+                       const qosspec_t * qs)
 {
         struct list_head * p;
         struct nb *        nb;
@@ -326,11 +633,17 @@ static int lsdb_add_nb(uint64_t     addr,
                 if (el->addr == addr && el->type == type) {
                         log_dbg("Already know %s neighbor %" PRIu64 ".",
                                 type == NB_DT ? "dt" : "mgmt", addr);
-                        if (el->fd != fd) {
-                                log_warn("Existing neighbor assigned new fd.");
-                                el->fd = fd;
+                        if (el->fd == fd) {
+                                pthread_rwlock_unlock(&ls.db_lock);
+                                return -EPERM;
                         }
+                        log_warn("Existing neighbor assigned new fd.");
+                        el->fd = fd;
+                        if (type == NB_DT)
+                                ++ls.nb_gen;
                         pthread_rwlock_unlock(&ls.db_lock);
+                        if (type == NB_DT)
+                                set_pff_modified();
                         return -EPERM;
                 }
 
@@ -344,9 +657,11 @@ static int lsdb_add_nb(uint64_t     addr,
                 return -ENOMEM;
         }
 
-        nb->addr  = addr;
-        nb->fd    = fd;
-        nb->type  = type;
+        nb->addr      = addr;
+        nb->fd        = fd;
+        nb->type      = type;
+        nb->bandwidth = qs->bandwidth;
+        nb->srtt      = 0;
 
         list_add_tail(&nb->next, p);
 
@@ -355,8 +670,14 @@ static int lsdb_add_nb(uint64_t     addr,
         log_dbg("Type %s neighbor %" PRIu64 " added.",
                 nb->type == NB_DT ? "dt" : "mgmt", addr);
 
+        if (type == NB_DT)
+                ++ls.nb_gen;
+
         pthread_rwlock_unlock(&ls.db_lock);
 
+        if (type == NB_DT)
+                set_pff_modified();
+
         return 0;
 }
 
@@ -373,9 +694,13 @@ static int lsdb_del_nb(uint64_t addr,
                 if (nb->addr == addr && nb->fd == fd) {
                         list_del(&nb->next);
                         --ls.nbs_len;
+                        if (nb->type == NB_DT)
+                                ++ls.nb_gen;
                         pthread_rwlock_unlock(&ls.db_lock);
                         log_dbg("Type %s neighbor %" PRIu64 " deleted.",
                                 nb->type == NB_DT ? "dt" : "mgmt", addr);
+                        if (nb->type == NB_DT)
+                                set_pff_modified();
                         free(nb);
                         return 0;
                 }
@@ -407,26 +732,67 @@ static int nbr_to_fd(uint64_t addr)
         return -1;
 }
 
-static void calculate_pff(struct routing_i * instance)
+/* What we know of the link to a neighbor, with the lsdb locked. */
+static void local_qs(uint64_t    addr,
+                     qosspec_t * qs)
+{
+        struct list_head * p;
+
+        memset(qs, 0, sizeof(*qs));
+        qs->delay = UINT32_MAX;
+
+        list_for_each(p, &ls.nbs) {
+                struct nb * nb = list_entry(p, struct nb, next);
+                if (nb->addr != addr)
+                        continue;
+
+                if (nb->type == NB_DT)
+                        qs->bandwidth = nb->bandwidth;
+                else if (nb->srtt != 0)
+                        qs->delay = (nb->srtt / 2 + MILLION / 2) / MILLION;
+        }
+}
+
+static void lsdb_rtt(int      fd,
+                     uint64_t rtt)
+{
+        struct list_head * p;
+
+        pthread_rwlock_wrlock(&ls.db_lock);
+
+        list_for_each(p, &ls.nbs) {
+                struct nb * nb = list_entry(p, struct nb, next);
+                if (nb->fd != fd || nb->type != NB_MGMT)
+                        continue;
+
+                /* Same gain as the FRCT rtt estimator. */
+                if (nb->srtt == 0)
+                        nb->srtt = rtt;
+                else
+                        nb->srtt = nb->srtt - (nb->srtt >> 3) + (rtt >> 3);
+                break;
+        }
+
+        pthread_rwlock_unlock(&ls.db_lock);
+}
+
+static int update_pff(struct routing_i * instance,
+                      struct list_head * table,
+                      bool               full)
 {
         int                fd;
-        struct list_head   table;
         struct list_head * p;
         struct list_head * q;
         int                fds[PROG_MAX_FLOWS];
 
-        assert(instance);
-
-        if (graph_routing_table(ls.graph, ls.routing_algo,
-                                ipcpi.dt_addr, &table))
-                return;
-
         pff_lock(instance->pff);
 
-        pff_flush(instance->pff);
+        /* A full table replaces everything, else only apply changes. */
+        if (full && pff_flush(instance->pff))
+                goto fail;
 
         /* Calculate forwarding table from routing table. */
-        list_for_each(p, &table) {
+        list_for_each(p, table) {
                 int                    i = 0;
                 struct routing_table * t =
                         list_entry(p, struct routing_table, next);
@@ -440,122 +806,226 @@ static void calculate_pff(struct routing_i * instance)
 
                         fds[i++] = fd;
                 }
-                if (i > 0)
-                        pff_add(instance->pff, t->dst, fds, i);
+
+                /* A new destination has no entry to delete yet. */
+                if (!full && pff_del(instance->pff, t->dst) == -ENOMEM)
+                        goto fail;
+
+                if (i > 0 && pff_add(instance->pff, t->dst, fds, i))
+                        goto fail;
         }
 
         pff_unlock(instance->pff);
 
-        graph_free_routing_table(ls.graph, &table);
+        return 0;
+
+ fail:
+        pff_unlock(instance->pff);
+        return -ENOMEM;
 }
 
-static void set_pff_modified(bool calc)
+/* Only the scheduler of the instance runs this, in order. */
+static int calculate_pff(struct routing_i * instance)
 {
-        struct list_head * p;
+        struct list_head table;
+        uint64_t         gen;
+        int              ret;
 
-        pthread_mutex_lock(&ls.routing_i_lock);
-        list_for_each(p, &ls.routing_instances) {
-                struct routing_i * inst =
-                        list_entry(p, struct routing_i, next);
-                pthread_mutex_lock(&inst->lock);
-                inst->modified = true;
-                pthread_mutex_unlock(&inst->lock);
-                if (calc)
-                        calculate_pff(inst);
+        assert(instance);
+
+        /*
+         * The spt only tracks next hop addresses. The fds behind them
+         * are looked up again for every entry after a neighbor change.
+         */
+        pthread_rwlock_rdlock(&ls.db_lock);
+        gen = ls.nb_gen;
+        pthread_rwlock_unlock(&ls.db_lock);
+
+        if (gen != instance->nb_gen) {
+                graph_spt_invalidate(instance->spt);
+                instance->nb_gen = gen;
         }
-        pthread_mutex_unlock(&ls.routing_i_lock);
+
+        ret = graph_routing_update(ls.graph, ls.routing_algo,
+                                   instance->metric, ipcpi.dt_addr,
+                                   instance->spt, &table);
+        if (ret < 0)
+                return ret;
+
+        if (update_pff(instance, &table, ret > 0)) {
+                /* The table may be half updated, rebuild it next run. */
+                graph_spt_invalidate(instance->spt);
+                ret = -ENOMEM;
+        }
+
+        graph_free_routing_table(ls.graph, &table);
+
+        return ret;
 }
 
-static int lsdb_add_link(uint64_t    src,
-                         uint64_t    dst,
-                         uint64_t    seqno,
-                         qosspec_t * qs)
+/*
+ * The srtt also holds the queueing delay, so it moves with the load.
+ * Keep advertising the old delay until the new one is clearly off.
+ */
+static uint32_t adv_delay(uint32_t adv,
+                          uint32_t delay)
+{
+        uint32_t diff;
+
+        if (adv == UINT32_MAX || delay == UINT32_MAX)
+                return delay;
+
+        diff = delay > adv ? delay - adv : adv - delay;
+        if (diff <= MAX(adv / LS_DELAY_HYST, LS_DELAY_SLACK))
+                return adv;
+
+        return delay;
+}
+
+/* Returns true if the delay or bandwidth of the link changed. */
+static bool lsdb_update_qs(struct adjacency * adj,
+                           const qosspec_t *  qs)
+{
+        if (adj->qs.delay == qs->delay &&
+            adj->qs.bandwidth == qs->bandwidth)
+                return false;
+
+        adj->qs.delay     = qs->delay;
+        adj->qs.bandwidth = qs->bandwidth;
+
+        if (graph_update_qos(ls.graph, adj->src, adj->dst, adj->qs))
+                log_warn("Failed to update edge in graph.");
+
+        return true;
+}
+
+/* Refresh a link from us with what we measured, the lsdb locked. */
+static bool lsdb_local_qs(struct adjacency * adj)
+{
+        qosspec_t qs;
+
+        local_qs(adj->dst, &qs);
+
+        qs.delay = adv_delay(adj->qs.delay, qs.delay);
+
+        return lsdb_update_qs(adj, &qs);
+}
+
+/*
+ * With the lsdb write locked. Returns LSDB_OLD if the LSA is not
+ * newer than what we have, else what it did to the lsdb.
+ */
+static int lsdb_put(uint64_t          src,
+                    uint64_t          dst,
+                    uint64_t          seqno,
+                    const qosspec_t * qs,
+                    time_t            now)
 {
-        struct list_head * p;
         struct adjacency * adj;
-        struct timespec    now;
-        int                ret = -1;
 
         assert(qs);
 
-        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        adj = lsdb_find(src, dst);
+        if (adj != NULL) {
+                if (adj->seqno >= seqno)
+                        return LSDB_OLD;
 
-        pthread_rwlock_wrlock(&ls.db_lock);
+                adj->stamp = now;
+                adj->seqno = seqno;
 
-        list_for_each(p, &ls.db) {
-                struct adjacency * a = list_entry(p, struct adjacency, next);
-                if (a->dst == dst && a->src == src) {
-                        if (a->seqno < seqno) {
-                                a->stamp = now.tv_sec;
-                                a->seqno = seqno;
-                                ret = 0;
-                        }
-                        pthread_rwlock_unlock(&ls.db_lock);
-                        return ret;
-                }
-
-                if (a->dst > dst || (a->dst == dst && a->src > src))
-                        break;
+                return lsdb_update_qs(adj, qs) ? LSDB_CHANGED : LSDB_REFRESH;
         }
 
         adj = malloc(sizeof(*adj));
-        if (adj == NULL) {
-                pthread_rwlock_unlock(&ls.db_lock);
+        if (adj == NULL)
                 return -ENOMEM;
-        }
 
         adj->dst   = dst;
         adj->src   = src;
         adj->seqno = seqno;
-        adj->stamp = now.tv_sec;
-
-        list_add_tail(&adj->next, p);
+        adj->qs    = *qs;
+        adj->stamp = now;
 
-        ls.db_len++;
+        lsdb_insert(adj);
 
         if (graph_update_edge(ls.graph, src, dst, *qs))
                 log_warn("Failed to add edge to graph.");
 
+        return LSDB_NEW;
+}
+
+static int lsdb_add_link(uint64_t          src,
+                         uint64_t          dst,
+                         uint64_t          seqno,
+                         const qosspec_t * qs)
+{
+        struct timespec now;
+        int             ret;
+
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+        pthread_rwlock_wrlock(&ls.db_lock);
+
+        ret = lsdb_put(src, dst, seqno, qs, now.tv_sec);
+
         pthread_rwlock_unlock(&ls.db_lock);
 
-        set_pff_modified(true);
+        if (ret > LSDB_REFRESH)
+                set_pff_modified();
 
-        return 0;
+        return ret < 0 ? ret : 0;
 }
 
 static int lsdb_del_link(uint64_t src,
                          uint64_t dst)
 {
-        struct list_head * p;
-        struct list_head * h;
+        struct adjacency * a;
 
         pthread_rwlock_wrlock(&ls.db_lock);
 
-        list_for_each_safe(p, h, &ls.db) {
-                struct adjacency * a = list_entry(p, struct adjacency, next);
-                if (a->dst == dst && a->src == src) {
-                        list_del(&a->next);
-                        if (graph_del_edge(ls.graph, src, dst))
-                                log_warn("Failed to delete edge from graph.");
+        a = lsdb_find(src, dst);
+        if (a == NULL) {
+                pthread_rwlock_unlock(&ls.db_lock);
+                return -EPERM;
+        }
 
-                        ls.db_len--;
+        lsdb_remove(a);
 
-                        pthread_rwlock_unlock(&ls.db_lock);
-                        set_pff_modified(false);
-                        free(a);
-                        return 0;
-                }
-        }
+        if (graph_del_edge(ls.graph, src, dst))
+                log_warn("Failed to delete edge from graph.");
 
         pthread_rwlock_unlock(&ls.db_lock);
 
-        return -EPERM;
+        set_pff_modified();
+
+        free(a);
+
+        return 0;
 }
 
-static void * periodic_recalc_pff(void * o)
+static void ms_to_ts(uint32_t          ms,
+                     struct timespec * ts)
+{
+        ts->tv_sec  = ms / 1000;
+        ts->tv_nsec = (ms % 1000) * MILLION;
+}
+
+/*
+ * The first change after a quiet period is handled spf.init ms later.
+ * While changes keep coming, runs are at least hold ms apart and the
+ * hold doubles up to spf.max. All changes that arrive while waiting
+ * are handled by the same run.
+ */
+static void * spf_scheduler(void * o)
 {
-        bool               modified;
         struct routing_i * inst;
+        struct timespec    now;
+        struct timespec    due;
+        struct timespec    intv;
+        struct timespec    t0;
+        uint64_t           dur;
+        bool               quiet;
+        int                ret;
 
         assert(o);
 
@@ -563,79 +1033,225 @@ static void * periodic_recalc_pff(void * o)
 
         while (true) {
                 pthread_mutex_lock(&inst->lock);
-                modified = inst->modified;
+
+                pthread_cleanup_push(__cleanup_mutex_unlock, &inst->lock);
+
+                while (!inst->modified)
+                        pthread_cond_wait(&inst->cond, &inst->lock);
+
+                clock_gettime(PTHREAD_COND_CLOCK, &now);
+
+                quiet = inst->runs == 0 ||
+                        ts_diff_ms(&inst->last, &now) > 2 * ls.spf.max;
+                if (quiet) {
+                        inst->hold = ls.spf.hold;
+                        ms_to_ts(ls.spf.init, &intv);
+                        ts_add(&now, &intv, &due);
+                } else {
+                        ms_to_ts(inst->hold, &intv);
+                        ts_add(&inst->last, &intv, &due);
+                }
+
+                while (pthread_cond_timedwait(&inst->cond, &inst->lock,
+                                              &due) == 0)
+                        ;
+
                 inst->modified = false;
-                pthread_mutex_unlock(&inst->lock);
 
-                if (modified)
-                        calculate_pff(inst);
+                pthread_cleanup_pop(true);
+
+                clock_gettime(PTHREAD_COND_CLOCK, &t0);
+
+                ret = calculate_pff(inst);
+
+                clock_gettime(PTHREAD_COND_CLOCK, &now);
+
+                dur = ts_diff_us(&t0, &now);
+
+                pthread_mutex_lock(&inst->lock);
+
+                inst->last = now;
+                if (!quiet)
+                        inst->hold = MIN(2 * inst->hold, ls.spf.max);
+
+                ++inst->runs;
+                if (ret > 0)
+                        ++inst->full;
+
+                /* Try again after the hold time. */
+                if (ret < 0)
+                        inst->modified = true;
 
-                sleep(RECALC_TIME);
+                inst->t_last   = dur;
+                inst->t_total += dur;
+                if (dur > inst->t_max)
+                        inst->t_max = dur;
+
+                pthread_mutex_unlock(&inst->lock);
         }
 
         return (void *) 0;
 }
 
-static void send_lsm(uint64_t src,
-                     uint64_t dst,
-                     uint64_t seqno)
+static void msg_init(struct ls_msg * msg,
+                     uint8_t         type,
+                     size_t          sz)
+{
+        ((struct ls_hdr *) msg->buf)->type = type;
+
+        msg->sz = sz;
+        msg->n  = 0;
+}
+
+static bool msg_full(const struct ls_msg * msg)
+{
+        return sizeof(struct ls_hdr) + (msg->n + 1) * msg->sz > LS_MSG_SIZE;
+}
+
+/* Returns the next free entry, check msg_full() first. */
+static void * msg_add(struct ls_msg * msg)
+{
+        assert(!msg_full(msg));
+
+        return msg->buf + sizeof(struct ls_hdr) + msg->sz * msg->n++;
+}
+
+static size_t msg_len(struct ls_msg * msg)
+{
+        ((struct ls_hdr *) msg->buf)->n = hton16(msg->n);
+
+        return sizeof(struct ls_hdr) + msg->n * msg->sz;
+}
+
+/* Returns the entries of a received message, NULL if malformed. */
+static void * msg_entries(uint8_t * buf,
+                          size_t    len,
+                          size_t    sz,
+                          size_t *  n)
+{
+        struct ls_hdr * hdr = (struct ls_hdr *) buf;
+
+        if (len < sizeof(*hdr))
+                return NULL;
+
+        *n = ntoh16(hdr->n);
+        if (len != sizeof(*hdr) + *n * sz)
+                return NULL;
+
+        return hdr + 1;
+}
+
+static void send_msg(int             fd,
+                     struct ls_msg * msg)
+{
+        flow_write(fd, msg->buf, msg_len(msg));
+        msg->n = 0;
+}
+
+/* Sends to all mgmt neighbors but in_fd, with the lsdb locked. */
+static void flood_msg(struct ls_msg * msg,
+                      int             in_fd)
 {
-        struct lsa         lsm;
         struct list_head * p;
+        size_t             len;
 
-        lsm.d_addr = hton64(dst);
-        lsm.s_addr = hton64(src);
-        lsm.seqno  = hton64(seqno);
+        len = msg_len(msg);
 
         list_for_each(p, &ls.nbs) {
                 struct nb * nb = list_entry(p, struct nb, next);
-                if (nb->type == NB_MGMT)
-                        flow_write(nb->fd, &lsm, sizeof(lsm));
+                if (nb->type == NB_MGMT && nb->fd != in_fd)
+                        flow_write(nb->fd, msg->buf, len);
         }
+
+        msg->n = 0;
 }
 
-/* replicate the lsdb to a mgmt neighbor */
-static void lsdb_replicate(int fd)
+static void lsa_fill(struct lsa *      lsa,
+                     uint64_t          src,
+                     uint64_t          dst,
+                     uint64_t          seqno,
+                     const qosspec_t * qs)
 {
-        struct list_head * p;
-        struct list_head * h;
-        struct list_head   copy;
+        lsa->d_addr    = hton64(dst);
+        lsa->s_addr    = hton64(src);
+        lsa->seqno     = hton64(seqno);
+        lsa->bandwidth = hton64(qs->bandwidth);
+        lsa->delay     = hton32(qs->delay);
+}
+
+static void send_lsm(uint64_t          src,
+                     uint64_t          dst,
+                     uint64_t          seqno,
+                     const qosspec_t * qs)
+{
+        struct ls_msg msg;
+
+        msg_init(&msg, LS_MSG_LSA, sizeof(struct lsa));
 
-        list_head_init(&copy);
+        lsa_fill(msg_add(&msg), src, dst, seqno, qs);
 
-        /* Lock the lsdb, copy the lsms and send outside of lock. */
+        flood_msg(&msg, -1);
+}
+
+/* Send a summary of the lsdb to a new mgmt neighbor. */
+static void lsdb_sync(int fd)
+{
+        struct list_head * p;
+        struct lsd *       sum;
+        struct ls_msg      msg;
+        size_t             len = 0;
+        size_t             i;
+
+        /* Lock the lsdb, copy the summary and send outside of lock. */
         pthread_rwlock_rdlock(&ls.db_lock);
 
-        list_for_each(p, &ls.db) {
-                struct adjacency * adj;
-                struct adjacency * cpy;
-                adj = list_entry(p, struct adjacency, next);
-                cpy = malloc(sizeof(*cpy));
-                if (cpy == NULL) {
-                        log_warn("Failed to replicate full lsdb.");
-                        break;
-                }
+        if (ls.db_len == 0) {
+                pthread_rwlock_unlock(&ls.db_lock);
+                return;
+        }
 
-                cpy->dst   = adj->dst;
-                cpy->src   = adj->src;
-                cpy->seqno = adj->seqno;
+        sum = malloc(ls.db_len * sizeof(*sum));
+        if (sum == NULL) {
+                pthread_rwlock_unlock(&ls.db_lock);
+                log_warn("Failed to summarize lsdb.");
+                return;
+        }
 
-                list_add_tail(&cpy->next, &copy);
+        list_for_each(p, &ls.db) {
+                struct adjacency * a = list_entry(p, struct adjacency, next);
+                sum[len].d_addr = hton64(a->dst);
+                sum[len].s_addr = hton64(a->src);
+                sum[len].seqno  = hton64(a->seqno);
+                ++len;
         }
 
         pthread_rwlock_unlock(&ls.db_lock);
 
-        list_for_each_safe(p, h, &copy) {
-                struct lsa         lsm;
-                struct adjacency * adj;
-                adj = list_entry(p, struct adjacency, next);
-                lsm.d_addr = hton64(adj->dst);
-                lsm.s_addr = hton64(adj->src);
-                lsm.seqno  = hton64(adj->seqno);
-                list_del(&adj->next);
-                free(adj);
-                flow_write(fd, &lsm, sizeof(lsm));
+        msg_init(&msg, LS_MSG_SUMMARY, sizeof(*sum));
+
+        for (i = 0; i < len; ++i) {
+                if (msg_full(&msg))
+                        send_msg(fd, &msg);
+                memcpy(msg_add(&msg), &sum[i], sizeof(*sum));
         }
+
+        if (msg.n > 0)
+                send_msg(fd, &msg);
+
+        free(sum);
+}
+
+static void send_probe(int fd)
+{
+        struct ls_probe probe;
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        probe.type  = LS_MSG_PROBE;
+        probe.stamp = hton64(now.tv_sec * BILLION + now.tv_nsec);
+
+        flow_write(fd, &probe, sizeof(probe));
 }
 
 static void * lsupdate(void * o)
@@ -643,39 +1259,64 @@ static void * lsupdate(void * o)
         struct list_head * p;
         struct list_head * h;
         struct timespec    now;
+        struct ls_msg      msg;
+        bool               changed;
 
         (void) o;
 
         while (true) {
                 clock_gettime(CLOCK_REALTIME_COARSE, &now);
 
+                changed = false;
+
+                msg_init(&msg, LS_MSG_LSA, sizeof(struct lsa));
+
                 pthread_rwlock_wrlock(&ls.db_lock);
 
                 pthread_cleanup_push(__cleanup_rwlock_unlock, &ls.db_lock);
 
+                /* Measure for the next round. */
+                list_for_each(p, &ls.nbs) {
+                        struct nb * nb = list_entry(p, struct nb, next);
+                        if (nb->type == NB_MGMT)
+                                send_probe(nb->fd);
+                }
+
                 list_for_each_safe(p, h, &ls.db) {
                         struct adjacency * adj;
                         adj = list_entry(p, struct adjacency, next);
                         if (now.tv_sec - adj->stamp > LS_TIMEO) {
-                                list_del(&adj->next);
+                                lsdb_remove(adj);
                                 log_dbg("%" PRIu64 " - %" PRIu64" timed out.",
                                         adj->src, adj->dst);
                                 if (graph_del_edge(ls.graph, adj->src,
                                                    adj->dst))
                                         log_err("Failed to del edge.");
                                 free(adj);
+                                changed = true;
                                 continue;
                         }
 
                         if (adj->src == ipcpi.dt_addr) {
+                                if (lsdb_local_qs(adj))
+                                        changed = true;
                                 adj->seqno++;
-                                send_lsm(adj->src, adj->dst, adj->seqno);
                                 adj->stamp = now.tv_sec;
+                                if (msg_full(&msg))
+                                        flood_msg(&msg, -1);
+                                lsa_fill(msg_add(&msg), adj->src, adj->dst,
+                                         adj->seqno, &adj->qs);
                         }
                 }
 
+                if (msg.n > 0)
+                        flood_msg(&msg, -1);
+
                 pthread_cleanup_pop(true);
 
+                if (changed)
+                        set_pff_modified();
+
                 sleep(LS_UPDATE_TIME);
         }
 
@@ -703,21 +1344,14 @@ static void * ls_conn_handle(void * o)
 }
 
 
-static void forward_lsm(uint8_t * buf,
-                        size_t    len,
-                        int       in_fd)
+static void forward_lsm(struct ls_msg * msg,
+                        int             in_fd)
 {
-        struct list_head * p;
-
         pthread_rwlock_rdlock(&ls.db_lock);
 
         pthread_cleanup_push(__cleanup_rwlock_unlock, &ls.db_lock);
 
-        list_for_each(p, &ls.nbs) {
-                struct nb * nb = list_entry(p, struct nb, next);
-                if (nb->type == NB_MGMT && nb->fd != in_fd)
-                        flow_write(nb->fd, buf, len);
-        }
+        flood_msg(msg, in_fd);
 
         pthread_cleanup_pop(true);
 }
@@ -727,20 +1361,167 @@ static void cleanup_fqueue(void * fq)
         fqueue_destroy((fqueue_t *) fq);
 }
 
-static void * lsreader(void * o)
+static void handle_lsa(uint8_t * buf,
+                       size_t    len,
+                       int       fd)
 {
-        fqueue_t *   fq;
-        int          ret;
-        uint8_t      buf[sizeof(struct lsa)];
-        int          fd;
-        qosspec_t    qs;
-        struct lsa * msg;
-        size_t       len;
+        struct lsa *    lsa;
+        struct ls_msg   fwd;
+        struct timespec now;
+        qosspec_t       qs;
+        size_t          n;
+        size_t          i;
+        int             ret;
+        int             res = LSDB_OLD;
+
+        lsa = msg_entries(buf, len, sizeof(*lsa), &n);
+        if (lsa == NULL)
+                return;
 
-        (void) o;
+        /* Only the LSAs that were newer are passed on. */
+        msg_init(&fwd, LS_MSG_LSA, sizeof(*lsa));
 
         memset(&qs, 0, sizeof(qs));
 
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+        pthread_rwlock_wrlock(&ls.db_lock);
+
+        pthread_cleanup_push(__cleanup_rwlock_unlock, &ls.db_lock);
+
+        for (i = 0; i < n; ++i) {
+                qs.delay     = ntoh32(lsa[i].delay);
+                qs.bandwidth = ntoh64(lsa[i].bandwidth);
+
+                ret = lsdb_put(ntoh64(lsa[i].s_addr),
+                               ntoh64(lsa[i].d_addr),
+                               ntoh64(lsa[i].seqno),
+                               &qs, now.tv_sec);
+                if (ret < 0)
+                        continue;
+
+                memcpy(msg_add(&fwd), &lsa[i], sizeof(*lsa));
+
+                if (ret > res)
+                        res = ret;
+        }
+
+        pthread_cleanup_pop(true);
+
+        if (fwd.n > 0)
+                forward_lsm(&fwd, fd);
+
+        if (res > LSDB_REFRESH)
+                set_pff_modified();
+}
+
+/* Request what the neighbor has that we lack or have older. */
+static void handle_summary(uint8_t * buf,
+                           size_t    len,
+                           int       fd)
+{
+        struct lsd *       lsd;
+        struct adjacency * adj;
+        struct ls_msg      req;
+        size_t             n;
+        size_t             i;
+
+        lsd = msg_entries(buf, len, sizeof(*lsd), &n);
+        if (lsd == NULL)
+                return;
+
+        msg_init(&req, LS_MSG_REQUEST, sizeof(*lsd));
+
+        pthread_rwlock_rdlock(&ls.db_lock);
+
+        for (i = 0; i < n; ++i) {
+                adj = lsdb_find(ntoh64(lsd[i].s_addr), ntoh64(lsd[i].d_addr));
+                if (adj != NULL && adj->seqno >= ntoh64(lsd[i].seqno))
+                        continue;
+
+                memcpy(msg_add(&req), &lsd[i], sizeof(*lsd));
+        }
+
+        pthread_rwlock_unlock(&ls.db_lock);
+
+        if (req.n > 0)
+                send_msg(fd, &req);
+}
+
+static void handle_request(uint8_t * buf,
+                           size_t    len,
+                           int       fd)
+{
+        struct lsd *       lsd;
+        struct adjacency * adj;
+        struct lsa         lsa[LSD_MAX];
+        struct ls_msg      msg;
+        size_t             m = 0;
+        size_t             n;
+        size_t             i;
+
+        lsd = msg_entries(buf, len, sizeof(*lsd), &n);
+        if (lsd == NULL)
+                return;
+
+        pthread_rwlock_rdlock(&ls.db_lock);
+
+        for (i = 0; i < n; ++i) {
+                adj = lsdb_find(ntoh64(lsd[i].s_addr), ntoh64(lsd[i].d_addr));
+                if (adj == NULL)
+                        continue;
+
+                lsa_fill(&lsa[m++], adj->src, adj->dst, adj->seqno, &adj->qs);
+        }
+
+        pthread_rwlock_unlock(&ls.db_lock);
+
+        msg_init(&msg, LS_MSG_LSA, sizeof(*lsa));
+
+        for (i = 0; i < m; ++i) {
+                if (msg_full(&msg))
+                        send_msg(fd, &msg);
+                memcpy(msg_add(&msg), &lsa[i], sizeof(*lsa));
+        }
+
+        if (msg.n > 0)
+                send_msg(fd, &msg);
+}
+
+static void handle_probe(uint8_t * buf,
+                         size_t    len,
+                         int       fd)
+{
+        struct ls_probe * msg = (struct ls_probe *) buf;
+        struct timespec   now;
+        uint64_t          stamp;
+
+        if (len != sizeof(*msg))
+                return;
+
+        if (msg->type == LS_MSG_PROBE) {
+                msg->type = LS_MSG_ECHO;
+                flow_write(fd, buf, len);
+                return;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        stamp = ntoh64(msg->stamp);
+
+        lsdb_rtt(fd, now.tv_sec * BILLION + now.tv_nsec - stamp);
+}
+
+static void * lsreader(void * o)
+{
+        fqueue_t * fq;
+        int        ret;
+        uint8_t    buf[LS_MSG_SIZE];
+        int        fd;
+        ssize_t    len;
+
+        (void) o;
+
         fq = fqueue_create();
         if (fq == NULL)
                 return (void *) -1;
@@ -758,19 +1539,27 @@ static void * lsreader(void * o)
                         if (fqueue_type(fq) != FLOW_PKT)
                                 continue;
 
-                        len = flow_read(fd, buf, sizeof(*msg));
-                        if (len <= 0 || len != sizeof(*msg))
-                                continue;
-
-                        msg = (struct lsa *) buf;
-
-                        if (lsdb_add_link(ntoh64(msg->s_addr),
-                                          ntoh64(msg->d_addr),
-                                          ntoh64(msg->seqno),
-                                          &qs))
+                        len = flow_read(fd, buf, sizeof(buf));
+                        if (len <= 0)
                                 continue;
 
-                        forward_lsm(buf, len, fd);
+                        switch (buf[0]) {
+                        case LS_MSG_LSA:
+                                handle_lsa(buf, len, fd);
+                                break;
+                        case LS_MSG_PROBE:
+                        case LS_MSG_ECHO:
+                                handle_probe(buf, len, fd);
+                                break;
+                        case LS_MSG_SUMMARY:
+                                handle_summary(buf, len, fd);
+                                break;
+                        case LS_MSG_REQUEST:
+                                handle_request(buf, len, fd);
+                                break;
+                        default:
+                                log_dbg("Unknown message type %d.", buf[0]);
+                        }
                 }
         }
 
@@ -801,7 +1590,6 @@ static void handle_event(void *       self,
                          int          event,
                          const void * o)
 {
-        /* FIXME: Apply correct QoS on graph */
         struct conn *      c;
         qosspec_t          qs;
         int                flags;
@@ -816,16 +1604,21 @@ static void handle_event(void *       self,
 
         switch (event) {
         case NOTIFY_DT_CONN_ADD:
+                /* The fd may be reused from a flow that went down. */
+                flow_event(c->flow_info.fd, true);
+
+                if (lsdb_add_nb(c->conn_info.addr, c->flow_info.fd, NB_DT,
+                                &c->flow_info.qs))
+                        log_dbg("Failed to add neighbor to LSDB.");
+
                 pthread_rwlock_rdlock(&ls.db_lock);
 
                 pthread_cleanup_push(__cleanup_rwlock_unlock, &ls.db_lock);
 
-                send_lsm(ipcpi.dt_addr, c->conn_info.addr, 0);
+                local_qs(c->conn_info.addr, &qs);
+                send_lsm(ipcpi.dt_addr, c->conn_info.addr, 0, &qs);
                 pthread_cleanup_pop(true);
 
-                if (lsdb_add_nb(c->conn_info.addr, c->flow_info.fd, NB_DT))
-                        log_dbg("Failed to add neighbor to LSDB.");
-
                 if (lsdb_add_link(ipcpi.dt_addr, c->conn_info.addr, 0, &qs))
                         log_dbg("Failed to add new adjacency to LSDB.");
                 break;
@@ -851,10 +1644,11 @@ static void handle_event(void *       self,
                 fccntl(c->flow_info.fd, FLOWGFLAGS, &flags);
                 fccntl(c->flow_info.fd, FLOWSFLAGS, flags | FLOWFRNOPART);
                 fset_add(ls.mgmt_set, c->flow_info.fd);
-                if (lsdb_add_nb(c->conn_info.addr, c->flow_info.fd, NB_MGMT))
+                if (lsdb_add_nb(c->conn_info.addr, c->flow_info.fd, NB_MGMT,
+                                &c->flow_info.qs))
                         log_warn("Failed to add mgmt neighbor to LSDB.");
-                /* replicate the entire lsdb */
-                lsdb_replicate(c->flow_info.fd);
+                lsdb_sync(c->flow_info.fd);
+                send_probe(c->flow_info.fd);
                 break;
         case NOTIFY_MGMT_CONN_DEL:
                 fset_del(ls.mgmt_set, c->flow_info.fd);
@@ -866,9 +1660,37 @@ static void handle_event(void *       self,
         }
 }
 
-struct routing_i * link_state_routing_i_create(struct pff * pff)
+static enum routing_metric cube_metric(qoscube_t qc)
+{
+        switch (qc) {
+        case QOS_CUBE_VOICE:
+                return QOS_METRIC_VOICE;
+        case QOS_CUBE_VIDEO:
+                return QOS_METRIC_VIDEO;
+        default:
+                return QOS_METRIC_BE;
+        }
+}
+
+/* Cubes routing on the same metric get the same forwarding table. */
+qoscube_t link_state_cube_table(qoscube_t qc)
+{
+        int c;
+
+        assert(qc < QOS_CUBE_MAX);
+
+        for (c = 0; c < (int) qc; ++c)
+                if (cube_metric((qoscube_t) c) == cube_metric(qc))
+                        return (qoscube_t) c;
+
+        return qc;
+}
+
+struct routing_i * link_state_routing_i_create(struct pff * pff,
+                                               qoscube_t    qc)
 {
         struct routing_i * tmp;
+        pthread_condattr_t cattr;
 
         assert(pff);
 
@@ -876,14 +1698,32 @@ struct routing_i * link_state_routing_i_create(struct pff * pff)
         if (tmp == NULL)
                 goto fail_tmp;
 
+        memset(tmp, 0, sizeof(*tmp));
+
         tmp->pff      = pff;
+        tmp->qc       = qc;
+        tmp->metric   = cube_metric(qc);
         tmp->modified = false;
 
+        tmp->spt = graph_spt_create();
+        if (tmp->spt == NULL)
+                goto fail_spt;
+
         if (pthread_mutex_init(&tmp->lock, NULL))
                 goto fail_instance_lock_init;
 
-        if (pthread_create(&tmp->calculator, NULL,
-                           periodic_recalc_pff, tmp))
+        if (pthread_condattr_init(&cattr))
+                goto fail_cattr;
+
+#ifndef __APPLE__
+        pthread_condattr_setclock(&cattr, PTHREAD_COND_CLOCK);
+#endif
+        if (pthread_cond_init(&tmp->cond, &cattr))
+                goto fail_cond;
+
+        pthread_condattr_destroy(&cattr);
+
+        if (pthread_create(&tmp->calculator, NULL, spf_scheduler, tmp))
                 goto fail_pthread_create_lsupdate;
 
         pthread_mutex_lock(&ls.routing_i_lock);
@@ -895,8 +1735,14 @@ struct routing_i * link_state_routing_i_create(struct pff * pff)
         return tmp;
 
  fail_pthread_create_lsupdate:
+        pthread_cond_destroy(&tmp->cond);
+ fail_cond:
+        pthread_condattr_destroy(&cattr);
+ fail_cattr:
         pthread_mutex_destroy(&tmp->lock);
  fail_instance_lock_init:
+        graph_spt_destroy(tmp->spt);
+ fail_spt:
         free(tmp);
  fail_tmp:
         return NULL;
@@ -916,14 +1762,19 @@ void link_state_routing_i_destroy(struct routing_i * instance)
 
         pthread_join(instance->calculator, NULL);
 
+        pthread_cond_destroy(&instance->cond);
         pthread_mutex_destroy(&instance->lock);
 
+        graph_spt_destroy(instance->spt);
+
         free(instance);
 }
 
-int link_state_init(enum pol_routing pr)
+int link_state_init(enum pol_routing          pr,
+                    const struct spf_timers * spf)
 {
         struct conn_info info;
+        size_t           i;
 
         memset(&info, 0, sizeof(info));
 
@@ -950,6 +1801,13 @@ int link_state_init(enum pol_routing pr)
                 goto fail_graph;
         }
 
+        ls.spf = *spf;
+        if (ls.spf.max < ls.spf.hold)
+                ls.spf.max = ls.spf.hold;
+
+        log_dbg("SPF delay %" PRIu32 " ms, hold %" PRIu32 " to %" PRIu32
+                " ms.", ls.spf.init, ls.spf.hold, ls.spf.max);
+
         ls.graph = graph_create();
         if (ls.graph == NULL)
                 goto fail_graph;
@@ -970,6 +1828,15 @@ int link_state_init(enum pol_routing pr)
         if (ls.mgmt_set == NULL)
                 goto fail_fset_create;
 
+        ls.idx = malloc(LS_IDX_INIT * sizeof(*ls.idx));
+        if (ls.idx == NULL)
+                goto fail_idx;
+
+        ls.idx_size = LS_IDX_INIT;
+
+        for (i = 0; i < ls.idx_size; ++i)
+                list_head_init(&ls.idx[i]);
+
         list_head_init(&ls.db);
         list_head_init(&ls.nbs);
         list_head_init(&ls.routing_instances);
@@ -986,11 +1853,16 @@ int link_state_init(enum pol_routing pr)
         if (rib_reg(LSDB, &r_ops))
                 goto fail_rib_reg;
 
+        if (rib_reg(SPF, &spf_r_ops))
+                goto fail_rib_reg_spf;
+
         ls.db_len  = 0;
         ls.nbs_len = 0;
 
         return 0;
 
+ fail_rib_reg_spf:
+        rib_unreg(LSDB);
  fail_rib_reg:
         pthread_cancel(ls.listener);
         pthread_join(ls.listener, NULL);
@@ -1001,6 +1873,8 @@ int link_state_init(enum pol_routing pr)
         pthread_cancel(ls.lsupdate);
         pthread_join(ls.lsupdate, NULL);
  fail_pthread_create_lsupdate:
+        free(ls.idx);
+ fail_idx:
         fset_destroy(ls.mgmt_set);
  fail_fset_create:
         connmgr_comp_fini(COMPID_MGMT);
@@ -1021,6 +1895,7 @@ void link_state_fini(void)
         struct list_head * p;
         struct list_head * h;
 
+        rib_unreg(SPF);
         rib_unreg(LSDB);
 
         notifier_unreg(handle_event);
@@ -1047,6 +1922,8 @@ void link_state_fini(void)
                 free(a);
         }
 
+        free(ls.idx);
+
         pthread_rwlock_unlock(&ls.db_lock);
 
         pthread_rwlock_destroy(&ls.db_lock);
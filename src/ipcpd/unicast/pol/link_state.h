@@ -28,14 +28,18 @@
 
 #include "pol-routing-ops.h"
 
-int                link_state_init(enum pol_routing pr);
+int                link_state_init(enum pol_routing          pr,
+                                   const struct spf_timers * spf);
 
 void               link_state_fini(void);
 
-struct routing_i * link_state_routing_i_create(struct pff * pff);
+struct routing_i * link_state_routing_i_create(struct pff * pff,
+                                               qoscube_t    qc);
 
 void               link_state_routing_i_destroy(struct routing_i * instance);
 
+qoscube_t          link_state_cube_table(qoscube_t qc);
+
 extern struct pol_routing_ops link_state_ops;
 
 #endif /* OUROBOROS_IPCPD_UNICAST_POL_LINK_STATE_H */
@@ -26,17 +26,32 @@
 #include "config.h"
 
 #include <ouroboros/errno.h>
+#include <ouroboros/ipcp-dev.h>
+#include <ouroboros/time_utils.h>
 
-#include "pft.h"
+#include "pft_pub.h"
 #include "multipath_pff.h"
 
 #include <string.h>
 #include <assert.h>
-#include <pthread.h>
+
+/*
+ * Packets are spread over the next hops by a hash of the destination
+ * and the flow, so a flow stays on one path and arrives in order.
+ *
+ * With flowlets enabled, a flow that was idle for PFF_FLOWLET_GAP us
+ * may move to the next hop with the fewest packets queued. The last
+ * hop and time are kept per hash slot as (fd + 1) << 48 | time.
+ */
+#define FLOWLET_SLOTS (1 << 12)
+#define TIME_MASK     ((1ULL << 48) - 1)
+#define FLOWLET_FD(v) ((int) ((v) >> 48) - 1)
 
 struct pff_i {
-        struct pft *     pft;
-        pthread_rwlock_t lock;
+        struct pft_pub pub;
+#if PFF_FLOWLET_GAP > 0
+        uint64_t       flowlets[FLOWLET_SLOTS];
+#endif
 };
 
 struct pol_pff_ops multipath_pff_ops = {
@@ -49,50 +64,175 @@ struct pol_pff_ops multipath_pff_ops = {
         .del               = multipath_pff_del,
         .flush             = multipath_pff_flush,
         .nhop              = multipath_pff_nhop,
+        .nhop_n            = multipath_pff_nhop_n,
         .flow_state_change = NULL
 };
 
-struct pff_i * multipath_pff_create(void)
+static int * dup_fds(int *  fds,
+                     size_t len)
 {
-        struct pff_i * tmp;
+        int * tmp;
 
-        tmp = malloc(sizeof(*tmp));
+        tmp = malloc(len * sizeof(*tmp));
         if (tmp == NULL)
                 return NULL;
 
-        if (pthread_rwlock_init(&tmp->lock, NULL)) {
-                free(tmp);
-                return NULL;
-        }
+        memcpy(tmp, fds, len * sizeof(*tmp));
 
-        tmp->pft = pft_create(PFT_SIZE, false);
-        if (tmp->pft == NULL) {
-                pthread_rwlock_destroy(&tmp->lock);
-                free(tmp);
-                return NULL;
+        return tmp;
+}
+
+static uint64_t flow_hash(uint64_t addr,
+                          uint64_t flow)
+{
+        uint64_t h = addr ^ (flow * 0x9E3779B97F4A7C15ULL);
+
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+
+        return h;
+}
+
+/* Maps the hash onto [0, len) without a division. */
+static size_t hash_pick(uint64_t h,
+                        size_t   len)
+{
+        return (size_t) (((h >> 32) * len) >> 32);
+}
+
+#if PFF_FLOWLET_GAP > 0
+static uint64_t now_us(void)
+{
+        struct timespec now;
+
+        clock_gettime(PTHREAD_COND_CLOCK, &now);
+
+        return (uint64_t) now.tv_sec * MILLION + now.tv_nsec / 1000;
+}
+
+static bool has_fd(const int * fds,
+                   size_t      len,
+                   int         fd)
+{
+        size_t i;
+
+        for (i = 0; i < len; ++i)
+                if (fds[i] == fd)
+                        return true;
+
+        return false;
+}
+
+/* The hashed hop, unless another one has a shorter queue. */
+static int least_queued(const int * fds,
+                        size_t      len,
+                        uint64_t    h)
+{
+        size_t start = hash_pick(h, len);
+        size_t best  = start;
+        size_t min;
+        size_t q;
+        size_t i;
+
+        min = ipcp_flow_queued(fds[start]);
+
+        for (i = 1; i < len && min > 0; ++i) {
+                q = ipcp_flow_queued(fds[(start + i) % len]);
+                if (q < min) {
+                        min  = q;
+                        best = (start + i) % len;
+                }
         }
 
+        return fds[best];
+}
+
+static int flowlet_fd(struct pff_i * pff_i,
+                      const int *    fds,
+                      size_t         len,
+                      uint64_t       h,
+                      uint64_t       now)
+{
+        uint64_t * slot = &pff_i->flowlets[h & (FLOWLET_SLOTS - 1)];
+        uint64_t   v;
+        uint64_t   n;
+        int        fd;
+
+        v  = __atomic_load_n(slot, __ATOMIC_RELAXED);
+        fd = FLOWLET_FD(v);
+
+        if (v == 0 || ((now - v) & TIME_MASK) > PFF_FLOWLET_GAP ||
+            !has_fd(fds, len, fd))
+                fd = least_queued(fds, len, h);
+
+        n = ((uint64_t) (fd + 1) << 48) | (now & TIME_MASK);
+        if (n != v)
+                __atomic_store_n(slot, n, __ATOMIC_RELAXED);
+
+        return fd;
+}
+#else
+#define now_us() 0
+#endif
+
+static int pick_fd(struct pff_i * pff_i,
+                   const int *    fds,
+                   size_t         len,
+                   uint64_t       h,
+                   uint64_t       now)
+{
+        assert(len > 0);
+
+        if (len == 1)
+                return fds[0];
+#if PFF_FLOWLET_GAP > 0
+        return flowlet_fd(pff_i, fds, len, h, now);
+#else
+        (void) pff_i;
+        (void) now;
+
+        return fds[hash_pick(h, len)];
+#endif
+}
+
+struct pff_i * multipath_pff_create(void)
+{
+        struct pff_i * tmp;
+
+        tmp = malloc(sizeof(*tmp));
+        if (tmp == NULL)
+                goto fail_malloc;
+
+        if (pft_pub_init(&tmp->pub))
+                goto fail_pub;
+#if PFF_FLOWLET_GAP > 0
+        memset(tmp->flowlets, 0, sizeof(tmp->flowlets));
+#endif
         return tmp;
+
+ fail_pub:
+        free(tmp);
+ fail_malloc:
+        return NULL;
 }
 
 void multipath_pff_destroy(struct pff_i * pff_i)
 {
         assert(pff_i);
 
-        pft_destroy(pff_i->pft);
-
-        pthread_rwlock_destroy(&pff_i->lock);
+        pft_pub_fini(&pff_i->pub);
         free(pff_i);
 }
 
 void multipath_pff_lock(struct pff_i * pff_i)
 {
-        pthread_rwlock_wrlock(&pff_i->lock);
+        pft_pub_lock(&pff_i->pub);
 }
 
 void multipath_pff_unlock(struct pff_i * pff_i)
 {
-        pthread_rwlock_unlock(&pff_i->lock);
+        pft_pub_unlock(&pff_i->pub);
 }
 
 int multipath_pff_add(struct pff_i * pff_i,
@@ -100,19 +240,22 @@ int multipath_pff_add(struct pff_i * pff_i,
                       int *          fds,
                       size_t         len)
 {
-        int * tmp;
+        struct pft * pft;
+        int *        tmp;
 
         assert(pff_i);
         assert(fds);
         assert(len > 0);
 
-        tmp = malloc(len * sizeof(*tmp));
-        if (tmp == NULL)
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
                 return -ENOMEM;
 
-        memcpy(tmp,fds, len * sizeof(*tmp));
+        tmp = dup_fds(fds, len);
+        if (tmp == NULL)
+                return -ENOMEM;
 
-        if (pft_insert(pff_i->pft, addr, tmp, len)) {
+        if (pft_insert(pft, addr, tmp, len)) {
                 free(tmp);
                 return -1;
         }
@@ -125,24 +268,27 @@ int multipath_pff_update(struct pff_i * pff_i,
                          int *          fds,
                          size_t         len)
 {
-        int * tmp;
+        struct pft * pft;
+        int *        tmp;
 
         assert(pff_i);
         assert(fds);
         assert(len > 0);
 
-        tmp = malloc(sizeof(*tmp));
-        if (tmp == NULL)
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
                 return -ENOMEM;
 
-        memcpy(tmp,fds, len * sizeof(*tmp));
+        tmp = dup_fds(fds, len);
+        if (tmp == NULL)
+                return -ENOMEM;
 
-        if (pft_delete(pff_i->pft, addr)) {
+        if (pft_delete(pft, addr)) {
                 free(tmp);
                 return -1;
         }
 
-        if (pft_insert(pff_i->pft, addr, tmp, 1)) {
+        if (pft_insert(pft, addr, tmp, len)) {
                 free(tmp);
                 return -1;
         }
@@ -153,46 +299,75 @@ int multipath_pff_update(struct pff_i * pff_i,
 int multipath_pff_del(struct pff_i * pff_i,
                       uint64_t       addr)
 {
+        struct pft * pft;
+
         assert(pff_i);
 
-        if (pft_delete(pff_i->pft, addr))
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
+                return -ENOMEM;
+
+        if (pft_delete(pft, addr))
                 return -1;
 
         return 0;
 }
 
-void multipath_pff_flush(struct pff_i * pff_i)
+int multipath_pff_flush(struct pff_i * pff_i)
 {
         assert(pff_i);
 
-        pft_flush(pff_i->pft);
+        return pft_pub_flush(&pff_i->pub);
 }
 
 int multipath_pff_nhop(struct pff_i * pff_i,
-                       uint64_t       addr)
+                       uint64_t       addr,
+                       uint64_t       flow)
 {
-        int    fd;
-        int *  fds;
-        size_t len;
+        struct epoch_rdr * r;
+        struct pft *       pft;
+        int *              fds;
+        size_t             len;
+        int                fd = -1;
+        uint64_t           now;
 
         assert(pff_i);
 
-        pthread_rwlock_rdlock(&pff_i->lock);
+        now = now_us();
 
-        if (pft_lookup(pff_i->pft, addr, &fds, &len)) {
-                pthread_rwlock_unlock(&pff_i->lock);
-                return -1;
-        }
+        pft = pft_pub_enter(&pff_i->pub, &r);
+        if (pft_lookup(pft, addr, &fds, &len) == 0)
+                fd = pick_fd(pff_i, fds, len, flow_hash(addr, flow), now);
 
-        fd = *fds;
+        pft_pub_exit(&pff_i->pub, r);
 
-        assert(len > 0);
+        return fd;
+}
+
+void multipath_pff_nhop_n(struct pff_i *   pff_i,
+                          const uint64_t * addr,
+                          const uint64_t * flow,
+                          int *            fd,
+                          size_t           n)
+{
+        struct epoch_rdr * r;
+        struct pft *       pft;
+        int *              fds;
+        size_t             len;
+        size_t             i;
+        uint64_t           now;
 
-        /* Rotate fds left. */
-        memcpy(fds, fds + 1, (len - 1) * sizeof(*fds));
-        fds[len - 1] = fd;
+        assert(pff_i);
 
-        pthread_rwlock_unlock(&pff_i->lock);
+        now = now_us();
 
-        return fd;
+        pft = pft_pub_enter(&pff_i->pub, &r);
+        for (i = 0; i < n; ++i) {
+                fd[i] = -1;
+                if (pft_lookup(pft, addr[i], &fds, &len) == 0)
+                        fd[i] = pick_fd(pff_i, fds, len,
+                                        flow_hash(addr[i], flow[i]), now);
+        }
+
+        pft_pub_exit(&pff_i->pub, r);
 }
@@ -47,11 +47,18 @@ int            multipath_pff_update(struct pff_i * pff_i,
 int            multipath_pff_del(struct pff_i * pff_i,
                                  uint64_t       addr);
 
-void multipath_pff_flush(struct pff_i * pff_i);
+int            multipath_pff_flush(struct pff_i * pff_i);
 
 /* Returns fd towards next hop */
 int            multipath_pff_nhop(struct pff_i * pff_i,
-                                  uint64_t       addr);
+                                  uint64_t       addr,
+                                  uint64_t       flow);
+
+void           multipath_pff_nhop_n(struct pff_i *   pff_i,
+                                    const uint64_t * addr,
+                                    const uint64_t * flow,
+                                    int *            fd,
+                                    size_t           n);
 
 extern struct pol_pff_ops multipath_pff_ops;
 
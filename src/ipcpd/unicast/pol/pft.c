@@ -1,7 +1,7 @@
 /*
  * Ouroboros - Copyright (C) 2016 - 2021
  *
- * Packet forwarding table (PFT) with chaining on collisions
+ * Packet forwarding table (PFT) with open addressing
  *
  *    Dimitri Staessens <dimitri@ouroboros.rocks>
  *    Sander Vrijders   <sander@ouroboros.rocks>
@@ -20,123 +20,343 @@
  * Foundation, Inc., http://www.fsf.org/about/contact/.
  */
 
+/*
+ * Open addressing in the style of a swiss table. Each slot has a
+ * control byte that is EMPTY, DELETED or holds 7 bits of the hash.
+ * Lookups compare a group of control bytes at once and only touch
+ * the entries whose tag matches. Probing visits groups in
+ * triangular order and stops at the first group with an EMPTY slot.
+ */
+
 #if defined(__linux__) || defined(__CYGWIN__)
 #define _DEFAULT_SOURCE
 #endif
 
-#include <ouroboros/list.h>
 #include <ouroboros/errno.h>
-#include <ouroboros/hash.h>
 
 #include "pft.h"
 
 #include <assert.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GROUP_SIZE 16
+typedef uint32_t mask_t;
+#else
+#define GROUP_SIZE 8
+typedef uint64_t mask_t;
+#define LSB        0x0101010101010101ULL
+#define MSB        0x8080808080808080ULL
+#endif
+
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
+#define TAG_MASK     0x7F
+#define MAX_LOAD(c)  ((c) - (c) / 8)
+
 /* store <len> output fds for dst addr */
 struct pft_entry {
-        struct list_head next;
-        uint64_t         dst;
-        int *            fds;
-        size_t           len;
+        uint64_t dst;
+        int *    fds;
+        size_t   len;
 };
 
 struct pft {
-        struct list_head * buckets;
-        bool               hash_key;
-        uint64_t           buckets_size;
+        uint8_t *          ctrl;
+        struct pft_entry * entries;
+        size_t             size;
+        size_t             used;
+        size_t             deleted;
 };
 
-struct pft * pft_create(uint64_t buckets,
-                        bool     hash_key)
+#if defined(__SSE2__)
+static mask_t group_match(const uint8_t * ctrl,
+                          uint8_t         tag)
+{
+        __m128i g = _mm_loadu_si128((const __m128i *) ctrl);
+
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(tag)));
+}
+
+static mask_t group_empty(const uint8_t * ctrl)
+{
+        return group_match(ctrl, CTRL_EMPTY);
+}
+
+static mask_t group_free(const uint8_t * ctrl)
+{
+        __m128i g = _mm_loadu_si128((const __m128i *) ctrl);
+
+        /* EMPTY and DELETED both have the top bit set. */
+        return _mm_movemask_epi8(g);
+}
+
+static size_t mask_first(mask_t m)
+{
+        return __builtin_ctz(m);
+}
+#else
+static uint64_t group_load(const uint8_t * ctrl)
+{
+        uint64_t g;
+
+        memcpy(&g, ctrl, sizeof(g));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        g = __builtin_bswap64(g);
+#endif
+        return g;
+}
+
+/* May report false positives, the caller compares the key. */
+static mask_t group_match(const uint8_t * ctrl,
+                          uint8_t         tag)
+{
+        uint64_t x = group_load(ctrl) ^ (LSB * tag);
+
+        return (x - LSB) & ~x & MSB;
+}
+
+static mask_t group_empty(const uint8_t * ctrl)
+{
+        uint64_t g = group_load(ctrl);
+
+        return g & ~(g << 6) & MSB;
+}
+
+static mask_t group_free(const uint8_t * ctrl)
+{
+        return group_load(ctrl) & MSB;
+}
+
+static size_t mask_first(mask_t m)
+{
+        return __builtin_ctzll(m) >> 3;
+}
+#endif
+
+static uint64_t hash(uint64_t key)
+{
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDULL;
+        key ^= key >> 33;
+        key *= 0xC4CEB9FE1A85EC53ULL;
+        key ^= key >> 33;
+
+        return key;
+}
+
+static size_t first_free(const struct pft * pft,
+                         uint64_t           h)
+{
+        size_t mask  = pft->size / GROUP_SIZE - 1;
+        size_t g     = (h >> 7) & mask;
+        size_t probe = 0;
+        mask_t m;
+
+        while (true) {
+                m = group_free(pft->ctrl + g * GROUP_SIZE);
+                if (m != 0)
+                        return g * GROUP_SIZE + mask_first(m);
+                g = (g + ++probe) & mask;
+        }
+}
+
+static struct pft_entry * find(const struct pft * pft,
+                               uint64_t           dst)
+{
+        uint64_t        h     = hash(dst);
+        size_t          mask  = pft->size / GROUP_SIZE - 1;
+        size_t          g     = (h >> 7) & mask;
+        uint8_t         tag   = h & TAG_MASK;
+        size_t          probe = 0;
+        const uint8_t * ctrl;
+        mask_t          m;
+        size_t          i;
+
+        while (true) {
+                ctrl = pft->ctrl + g * GROUP_SIZE;
+                for (m = group_match(ctrl, tag); m != 0; m &= m - 1) {
+                        i = g * GROUP_SIZE + mask_first(m);
+                        if (pft->entries[i].dst == dst)
+                                return &pft->entries[i];
+                }
+
+                if (group_empty(ctrl) != 0)
+                        return NULL;
+
+                g = (g + ++probe) & mask;
+        }
+}
+
+static void place(struct pft * pft,
+                  uint64_t     dst,
+                  int *        fds,
+                  size_t       len)
+{
+        uint64_t h = hash(dst);
+        size_t   i;
+
+        i = first_free(pft, h);
+
+        if (pft->ctrl[i] == CTRL_DELETED)
+                --pft->deleted;
+
+        pft->ctrl[i]        = h & TAG_MASK;
+        pft->entries[i].dst = dst;
+        pft->entries[i].fds = fds;
+        pft->entries[i].len = len;
+
+        ++pft->used;
+}
+
+static int alloc_slots(struct pft * pft,
+                       size_t       size)
+{
+        pft->ctrl = malloc(size);
+        if (pft->ctrl == NULL)
+                return -ENOMEM;
+
+        pft->entries = malloc(size * sizeof(*pft->entries));
+        if (pft->entries == NULL) {
+                free(pft->ctrl);
+                return -ENOMEM;
+        }
+
+        memset(pft->ctrl, CTRL_EMPTY, size);
+
+        pft->size    = size;
+        pft->used    = 0;
+        pft->deleted = 0;
+
+        return 0;
+}
+
+/* Doubles the table if it is over half full, else clears tombstones. */
+static int rehash(struct pft * pft)
+{
+        struct pft         old = *pft;
+        size_t             size;
+        size_t             i;
+
+        size = pft->size;
+        if (pft->used >= MAX_LOAD(size) / 2)
+                size <<= 1;
+
+        if (alloc_slots(pft, size)) {
+                *pft = old;
+                return -ENOMEM;
+        }
+
+        for (i = 0; i < old.size; ++i)
+                if (!(old.ctrl[i] & CTRL_EMPTY))
+                        place(pft, old.entries[i].dst,
+                              old.entries[i].fds, old.entries[i].len);
+
+        free(old.ctrl);
+        free(old.entries);
+
+        return 0;
+}
+
+struct pft * pft_create(uint64_t size)
 {
         struct pft * tmp;
-        unsigned int i;
 
-        if (buckets == 0)
+        if (size == 0)
                 return NULL;
 
-        buckets--;
-        buckets |= buckets >> 1;
-        buckets |= buckets >> 2;
-        buckets |= buckets >> 4;
-        buckets |= buckets >> 8;
-        buckets |= buckets >> 16;
-        buckets |= buckets >> 32;
-        buckets++;
+        if (size < GROUP_SIZE)
+                size = GROUP_SIZE;
+
+        size--;
+        size |= size >> 1;
+        size |= size >> 2;
+        size |= size >> 4;
+        size |= size >> 8;
+        size |= size >> 16;
+        size |= size >> 32;
+        size++;
 
         tmp = malloc(sizeof(*tmp));
         if (tmp == NULL)
                 return NULL;
 
-        tmp->hash_key = hash_key;
-        tmp->buckets_size = buckets;
-
-        tmp->buckets = malloc(buckets * sizeof(*tmp->buckets));
-        if (tmp->buckets == NULL) {
+        if (alloc_slots(tmp, size)) {
                 free(tmp);
                 return NULL;
         }
 
-        for (i = 0; i < buckets; i++)
-                list_head_init(&(tmp->buckets[i]));
-
         return tmp;
 }
 
 void pft_destroy(struct pft * pft)
 {
         assert(pft);
-        assert(pft->buckets);
 
         pft_flush(pft);
-        free(pft->buckets);
+        free(pft->entries);
+        free(pft->ctrl);
         free(pft);
 }
 
 void pft_flush(struct pft * pft)
 {
-        unsigned int       i;
-        struct list_head * p;
-        struct list_head * h;
-        struct pft_entry * entry;
+        size_t i;
 
         assert(pft);
 
-        for (i = 0; i < pft->buckets_size; i++) {
-                list_for_each_safe(p, h, &(pft->buckets[i])) {
-                        entry = list_entry(p, struct pft_entry, next);
-                        list_del(&entry->next);
-                        free(entry->fds);
-                        free(entry);
-                }
-        }
+        for (i = 0; i < pft->size; ++i)
+                if (!(pft->ctrl[i] & CTRL_EMPTY))
+                        free(pft->entries[i].fds);
+
+        memset(pft->ctrl, CTRL_EMPTY, pft->size);
+
+        pft->used    = 0;
+        pft->deleted = 0;
 }
 
-static uint64_t hash(uint64_t key)
+struct pft * pft_clone(struct pft * pft)
 {
-        void *   res;
-        uint64_t ret;
-        uint8_t  keys[4];
+        struct pft *       tmp;
+        struct pft_entry * e;
+        size_t             i;
+        size_t             n;
+
+        assert(pft);
 
-        memcpy(keys, &key, 4);
+        tmp = pft_create(pft->size);
+        if (tmp == NULL)
+                goto fail_create;
 
-        mem_hash(HASH_MD5, &res, keys, 4);
+        memcpy(tmp->entries, pft->entries, pft->size * sizeof(*tmp->entries));
 
-        ret = (* (uint64_t *) res);
+        for (i = 0; i < pft->size; ++i) {
+                if (pft->ctrl[i] & CTRL_EMPTY)
+                        continue;
 
-        free(res);
+                e = &tmp->entries[i];
+                n = e->len * sizeof(*e->fds);
 
-        return ret;
-}
+                e->fds = malloc(n);
+                if (e->fds == NULL)
+                        goto fail_entry;
 
-static uint64_t calc_key(struct pft * pft,
-                         uint64_t     dst)
-{
-        if (pft->hash_key)
-                dst = hash(dst);
+                memcpy(e->fds, pft->entries[i].fds, n);
+                tmp->ctrl[i] = pft->ctrl[i];
+                ++tmp->used;
+        }
+
+        /* Copy the tombstones too, they keep the probe chains intact. */
+        memcpy(tmp->ctrl, pft->ctrl, pft->size);
+        tmp->deleted = pft->deleted;
+
+        return tmp;
 
-        return (dst & (pft->buckets_size - 1));
+ fail_entry:
+        pft_destroy(tmp);
+ fail_create:
+        return NULL;
 }
 
 int pft_insert(struct pft * pft,
@@ -144,30 +364,17 @@ int pft_insert(struct pft * pft,
                int *        fds,
                size_t       len)
 {
-        struct pft_entry * entry;
-        uint64_t           lookup_key;
-        struct list_head * p;
-
         assert(pft);
         assert(len > 0);
 
-        lookup_key = calc_key(pft, dst);
+        if (find(pft, dst) != NULL)
+                return -EPERM;
 
-        list_for_each(p, &(pft->buckets[lookup_key])) {
-                entry = list_entry(p, struct pft_entry, next);
-                if (entry->dst == dst)
-                        return -EPERM;
-        }
+        if (pft->used + pft->deleted + 1 > MAX_LOAD(pft->size))
+                if (rehash(pft))
+                        return -ENOMEM;
 
-        entry = malloc(sizeof(*entry));
-        if (entry == NULL)
-                return -ENOMEM;
-
-        entry->dst = dst;
-        entry->fds = fds;
-        entry->len = len;
-
-        list_add(&entry->next, &(pft->buckets[lookup_key]));
+        place(pft, dst, fds, len);
 
         return 0;
 }
@@ -177,47 +384,47 @@ int pft_lookup(struct pft * pft,
                int **       fds,
                size_t *     len)
 {
-        struct pft_entry * entry;
-        struct list_head * p;
-        uint64_t           lookup_key;
+        struct pft_entry * e;
 
         assert(pft);
 
-        lookup_key = calc_key(pft, dst);
+        e = find(pft, dst);
+        if (e == NULL)
+                return -1;
 
-        list_for_each(p, &(pft->buckets[lookup_key])) {
-                entry = list_entry(p, struct pft_entry, next);
-                if (entry->dst == dst) {
-                        *fds = entry->fds;
-                        *len = entry->len;
-                        return 0;
-                }
-        }
+        *fds = e->fds;
+        *len = e->len;
 
-        return -1;
+        return 0;
 }
 
 int pft_delete(struct pft * pft,
                uint64_t     dst)
 {
-        struct pft_entry * entry;
-        uint64_t           lookup_key;
-        struct list_head * p;
-        struct list_head * h;
+        struct pft_entry * e;
+        size_t             i;
+        size_t             g;
 
         assert(pft);
 
-        lookup_key = calc_key(pft, dst);
+        e = find(pft, dst);
+        if (e == NULL)
+                return -1;
 
-        list_for_each_safe(p, h, &(pft->buckets[lookup_key])) {
-                entry = list_entry(p, struct pft_entry, next);
-                if (entry->dst == dst) {
-                        list_del(&entry->next);
-                        free(entry->fds);
-                        free(entry);
-                        return 0;
-                }
+        i = e - pft->entries;
+        g = i - i % GROUP_SIZE;
+
+        free(e->fds);
+
+        /* Probes never went past a group that still has an EMPTY. */
+        if (group_empty(pft->ctrl + g) != 0) {
+                pft->ctrl[i] = CTRL_EMPTY;
+        } else {
+                pft->ctrl[i] = CTRL_DELETED;
+                ++pft->deleted;
         }
 
-        return -1;
+        --pft->used;
+
+        return 0;
 }
@@ -29,14 +29,16 @@
 
 struct pft;
 
-/* Buckets is rounded up to the nearest power of 2 */
-struct pft * pft_create(uint64_t buckets,
-                        bool     hash_key);
+/* Size is rounded up to the nearest power of 2, the table grows */
+struct pft * pft_create(uint64_t size);
 
 void         pft_destroy(struct pft * table);
 
 void         pft_flush(struct pft * table);
 
+/* Deep copy, including the blocks of fds */
+struct pft * pft_clone(struct pft * pft);
+
 /* Passes ownership of the block of memory */
 int          pft_insert(struct pft * pft,
                         uint64_t     dst,
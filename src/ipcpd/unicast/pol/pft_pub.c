@@ -0,0 +1,126 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Publication of forwarding tables to lock-free readers
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "config.h"
+
+#include <ouroboros/errno.h>
+
+#include "pft_pub.h"
+
+#include <assert.h>
+
+int pft_pub_init(struct pft_pub * pub)
+{
+        assert(pub);
+
+        if (pthread_mutex_init(&pub->lock, NULL))
+                goto fail_lock;
+
+        pub->epoch = epoch_create();
+        if (pub->epoch == NULL)
+                goto fail_epoch;
+
+        pub->pft = pft_create(PFT_SIZE);
+        if (pub->pft == NULL)
+                goto fail_pft;
+
+        pub->next = NULL;
+
+        return 0;
+
+ fail_pft:
+        epoch_destroy(pub->epoch);
+ fail_epoch:
+        pthread_mutex_destroy(&pub->lock);
+ fail_lock:
+        return -1;
+}
+
+void pft_pub_fini(struct pft_pub * pub)
+{
+        assert(pub);
+        assert(pub->next == NULL);
+
+        pft_destroy(pub->pft);
+        epoch_destroy(pub->epoch);
+        pthread_mutex_destroy(&pub->lock);
+}
+
+void pft_pub_lock(struct pft_pub * pub)
+{
+        pthread_mutex_lock(&pub->lock);
+}
+
+void pft_pub_unlock(struct pft_pub * pub)
+{
+        struct pft * old;
+
+        if (pub->next != NULL) {
+                old = pub->pft;
+                __atomic_store_n(&pub->pft, pub->next, __ATOMIC_RELEASE);
+                pub->next = NULL;
+                epoch_sync(pub->epoch);
+                pft_destroy(old);
+        }
+
+        pthread_mutex_unlock(&pub->lock);
+}
+
+struct pft * pft_pub_next(struct pft_pub * pub)
+{
+        if (pub->next == NULL)
+                pub->next = pft_clone(pub->pft);
+
+        return pub->next;
+}
+
+int pft_pub_flush(struct pft_pub * pub)
+{
+        assert(pub);
+
+        if (pub->next != NULL) {
+                pft_flush(pub->next);
+                return 0;
+        }
+
+        pub->next = pft_create(PFT_SIZE);
+        if (pub->next == NULL)
+                return -ENOMEM;
+
+        return 0;
+}
+
+struct pft * pft_pub_enter(struct pft_pub *    pub,
+                           struct epoch_rdr ** r)
+{
+        *r = epoch_enter(pub->epoch);
+
+        return __atomic_load_n(&pub->pft, __ATOMIC_ACQUIRE);
+}
+
+void pft_pub_exit(struct pft_pub *   pub,
+                  struct epoch_rdr * r)
+{
+        epoch_exit(pub->epoch, r);
+}
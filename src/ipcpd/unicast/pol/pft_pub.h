@@ -0,0 +1,65 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Publication of forwarding tables to lock-free readers
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#ifndef OUROBOROS_IPCPD_UNICAST_PFT_PUB_H
+#define OUROBOROS_IPCPD_UNICAST_PFT_PUB_H
+
+#include "epoch.h"
+#include "pft.h"
+
+#include <pthread.h>
+
+/*
+ * Lookups read the published table without locking. Updates between
+ * lock and unlock go into a private copy that unlock publishes with a
+ * pointer swap, the old table is freed after a grace period.
+ */
+struct pft_pub {
+        struct pft *    pft;   /* Published table            */
+        struct pft *    next;  /* Copy under update, or NULL */
+        struct epoch *  epoch;
+        pthread_mutex_t lock;
+};
+
+int                pft_pub_init(struct pft_pub * pub);
+
+void               pft_pub_fini(struct pft_pub * pub);
+
+void               pft_pub_lock(struct pft_pub * pub);
+
+/* Publishes the copy, if there were updates. */
+void               pft_pub_unlock(struct pft_pub * pub);
+
+/* The copy to update, with the lock held. NULL if out of memory. */
+struct pft *       pft_pub_next(struct pft_pub * pub);
+
+/* Empties the copy, with the lock held. */
+int                pft_pub_flush(struct pft_pub * pub);
+
+/* The published table, valid until pft_pub_exit. */
+struct pft *       pft_pub_enter(struct pft_pub *    pub,
+                                 struct epoch_rdr ** r);
+
+void               pft_pub_exit(struct pft_pub *   pub,
+                                struct epoch_rdr * r);
+
+#endif /* OUROBOROS_IPCPD_UNICAST_PFT_PUB_H */
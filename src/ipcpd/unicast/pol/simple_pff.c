@@ -26,15 +26,14 @@
 
 #include <ouroboros/errno.h>
 
-#include "pft.h"
+#include "pft_pub.h"
 #include "simple_pff.h"
 
 #include <assert.h>
-#include <pthread.h>
 
+/* Lookups read the published table without locking, see pft_pub. */
 struct pff_i {
-        struct pft *     pft;
-        pthread_rwlock_t lock;
+        struct pft_pub pub;
 };
 
 struct pol_pff_ops simple_pff_ops = {
@@ -47,6 +46,7 @@ struct pol_pff_ops simple_pff_ops = {
         .del               = simple_pff_del,
         .flush             = simple_pff_flush,
         .nhop              = simple_pff_nhop,
+        .nhop_n            = simple_pff_nhop_n,
         .flow_state_change = NULL
 };
 
@@ -56,41 +56,35 @@ struct pff_i * simple_pff_create(void)
 
         tmp = malloc(sizeof(*tmp));
         if (tmp == NULL)
-                return NULL;
+                goto fail_malloc;
 
-        if (pthread_rwlock_init(&tmp->lock, NULL)) {
-                free(tmp);
-                return NULL;
-        }
-
-        tmp->pft = pft_create(PFT_SIZE, false);
-        if (tmp->pft == NULL) {
-                pthread_rwlock_destroy(&tmp->lock);
-                free(tmp);
-                return NULL;
-        }
+        if (pft_pub_init(&tmp->pub))
+                goto fail_pub;
 
         return tmp;
+
+ fail_pub:
+        free(tmp);
+ fail_malloc:
+        return NULL;
 }
 
 void simple_pff_destroy(struct pff_i * pff_i)
 {
         assert(pff_i);
 
-        pft_destroy(pff_i->pft);
-
-        pthread_rwlock_destroy(&pff_i->lock);
+        pft_pub_fini(&pff_i->pub);
         free(pff_i);
 }
 
 void simple_pff_lock(struct pff_i * pff_i)
 {
-        pthread_rwlock_wrlock(&pff_i->lock);
+        pft_pub_lock(&pff_i->pub);
 }
 
 void simple_pff_unlock(struct pff_i * pff_i)
 {
-        pthread_rwlock_unlock(&pff_i->lock);
+        pft_pub_unlock(&pff_i->pub);
 }
 
 int simple_pff_add(struct pff_i * pff_i,
@@ -98,7 +92,8 @@ int simple_pff_add(struct pff_i * pff_i,
                    int *          fd,
                    size_t         len)
 {
-        int * fds;
+        struct pft * pft;
+        int *        fds;
 
         assert(pff_i);
         assert(fd);
@@ -106,13 +101,17 @@ int simple_pff_add(struct pff_i * pff_i,
 
         (void) len;
 
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
+                return -ENOMEM;
+
         fds = malloc(sizeof(*fds));
         if (fds == NULL)
                 return -ENOMEM;
 
         *fds = *fd;
 
-        if (pft_insert(pff_i->pft, addr, fds, 1)) {
+        if (pft_insert(pft, addr, fds, 1)) {
                 free(fds);
                 return -1;
         }
@@ -125,7 +124,8 @@ int simple_pff_update(struct pff_i * pff_i,
                       int *          fd,
                       size_t         len)
 {
-        int * fds;
+        struct pft * pft;
+        int *        fds;
 
         assert(pff_i);
         assert(fd);
@@ -133,18 +133,22 @@ int simple_pff_update(struct pff_i * pff_i,
 
         (void) len;
 
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
+                return -ENOMEM;
+
         fds = malloc(sizeof(*fds));
         if (fds == NULL)
                 return -ENOMEM;
 
         *fds = *fd;
 
-        if (pft_delete(pff_i->pft, addr)) {
+        if (pft_delete(pft, addr)) {
                 free(fds);
                 return -1;
         }
 
-        if (pft_insert(pff_i->pft, addr, fds, 1)) {
+        if (pft_insert(pft, addr, fds, 1)) {
                 free(fds);
                 return -1;
         }
@@ -155,36 +159,72 @@ int simple_pff_update(struct pff_i * pff_i,
 int simple_pff_del(struct pff_i * pff_i,
                    uint64_t       addr)
 {
+        struct pft * pft;
+
         assert(pff_i);
 
-        if (pft_delete(pff_i->pft, addr))
+        pft = pft_pub_next(&pff_i->pub);
+        if (pft == NULL)
+                return -ENOMEM;
+
+        if (pft_delete(pft, addr))
                 return -1;
 
         return 0;
 }
 
-void simple_pff_flush(struct pff_i * pff_i)
+int simple_pff_flush(struct pff_i * pff_i)
 {
         assert(pff_i);
 
-        pft_flush(pff_i->pft);
+        return pft_pub_flush(&pff_i->pub);
 }
 
 int simple_pff_nhop(struct pff_i * pff_i,
-                    uint64_t       addr)
+                    uint64_t       addr,
+                    uint64_t       flow)
 {
-        int *  fds;
-        size_t len;
-        int    fd = -1;
+        struct epoch_rdr * r;
+        struct pft *       pft;
+        int *              fds;
+        size_t             len;
+        int                fd = -1;
 
         assert(pff_i);
 
-        pthread_rwlock_rdlock(&pff_i->lock);
+        (void) flow;
 
-        if (pft_lookup(pff_i->pft, addr, &fds, &len) == 0)
+        pft = pft_pub_enter(&pff_i->pub, &r);
+        if (pft_lookup(pft, addr, &fds, &len) == 0)
                 fd = *fds;
 
-        pthread_rwlock_unlock(&pff_i->lock);
+        pft_pub_exit(&pff_i->pub, r);
 
         return fd;
 }
+
+void simple_pff_nhop_n(struct pff_i *   pff_i,
+                       const uint64_t * addr,
+                       const uint64_t * flow,
+                       int *            fd,
+                       size_t           n)
+{
+        struct epoch_rdr * r;
+        struct pft *       pft;
+        int *              fds;
+        size_t             len;
+        size_t             i;
+
+        assert(pff_i);
+
+        (void) flow;
+
+        pft = pft_pub_enter(&pff_i->pub, &r);
+        for (i = 0; i < n; ++i) {
+                fd[i] = -1;
+                if (pft_lookup(pft, addr[i], &fds, &len) == 0)
+                        fd[i] = *fds;
+        }
+
+        pft_pub_exit(&pff_i->pub, r);
+}
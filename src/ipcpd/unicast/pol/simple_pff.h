@@ -46,11 +46,19 @@ int            simple_pff_update(struct pff_i * pff_i,
 int            simple_pff_del(struct pff_i * pff_i,
                               uint64_t       addr);
 
-void           simple_pff_flush(struct pff_i * pff_i);
+int            simple_pff_flush(struct pff_i * pff_i);
 
 /* Returns fd towards next hop */
 int            simple_pff_nhop(struct pff_i * pff_i,
-                               uint64_t       addr);
+                               uint64_t       addr,
+                               uint64_t       flow);
+
+/* Looks up n addresses under one lock */
+void           simple_pff_nhop_n(struct pff_i *   pff_i,
+                                 const uint64_t * addr,
+                                 const uint64_t * flow,
+                                 int *            fd,
+                                 size_t           n);
 
 extern struct pol_pff_ops simple_pff_ops;
 
@@ -0,0 +1,191 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the alternate PFF failover
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+/* The pft and epoch are linked in through the other tests. */
+#include "alternate_pff.c"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#define FD_A     10
+#define FD_B     11
+#define FD_C     12
+#define ENTRIES  1000
+#define BURST    32
+
+static struct pff_i * pff;
+
+static int check(uint64_t addr,
+                 int      exp)
+{
+        int fd;
+
+        fd = alternate_pff_nhop(pff, addr, 0);
+        if (fd != exp) {
+                printf("Next hop for %" PRIu64 " is %d, not %d.\n",
+                       addr, fd, exp);
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Even destinations prefer A then B, odd ones B then C then A. */
+static int fill(void)
+{
+        int      even[] = {FD_A, FD_B};
+        int      odd[]  = {FD_B, FD_C, FD_A};
+        uint64_t addr;
+
+        alternate_pff_lock(pff);
+
+        for (addr = 0; addr < ENTRIES; ++addr) {
+                if (addr & 1) {
+                        if (alternate_pff_add(pff, addr, odd, 3))
+                                goto fail;
+                } else if (alternate_pff_add(pff, addr, even, 2)) {
+                        goto fail;
+                }
+        }
+
+        alternate_pff_unlock(pff);
+
+        return 0;
+ fail:
+        alternate_pff_unlock(pff);
+        printf("Failed to add %" PRIu64 ".\n", addr);
+        return -1;
+}
+
+static int check_all(int even,
+                     int odd)
+{
+        uint64_t addr[BURST];
+        uint64_t flow[BURST];
+        int      fd[BURST];
+        size_t   i;
+
+        for (i = 0; i < ENTRIES; ++i)
+                if (check(i, i & 1 ? odd : even))
+                        return -1;
+
+        for (i = 0; i < BURST; ++i) {
+                addr[i] = i;
+                flow[i] = 0;
+        }
+
+        alternate_pff_nhop_n(pff, addr, flow, fd, BURST);
+
+        for (i = 0; i < BURST; ++i) {
+                if (fd[i] != (i & 1 ? odd : even)) {
+                        printf("Burst lookup differs for %zu.\n", i);
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+static int test_failover(void)
+{
+        if (check_all(FD_A, FD_B))
+                return -1;
+
+        alternate_flow_state_change(pff, FD_A, false);
+
+        if (check_all(FD_B, FD_B))
+                return -1;
+
+        alternate_flow_state_change(pff, FD_B, false);
+
+        /* Nothing left for even destinations, they keep the primary. */
+        if (check_all(FD_A, FD_C))
+                return -1;
+
+        alternate_flow_state_change(pff, FD_A, true);
+
+        if (check_all(FD_A, FD_C))
+                return -1;
+
+        alternate_flow_state_change(pff, FD_B, true);
+
+        if (check_all(FD_A, FD_B))
+                return -1;
+
+        if (alternate_flow_state_change(pff, FD_C, true) == 0) {
+                printf("Flow came up without going down.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+/* The state of a flow outlives a rebuild of the table. */
+static int test_flush(void)
+{
+        alternate_flow_state_change(pff, FD_B, false);
+
+        alternate_pff_lock(pff);
+        if (alternate_pff_flush(pff)) {
+                alternate_pff_unlock(pff);
+                printf("Failed to flush.\n");
+                return -1;
+        }
+        alternate_pff_unlock(pff);
+
+        if (check(0, -1))
+                return -1;
+
+        if (fill())
+                return -1;
+
+        if (check_all(FD_A, FD_C))
+                return -1;
+
+        alternate_flow_state_change(pff, FD_B, true);
+
+        return 0;
+}
+
+int alternate_pff_test(int     argc,
+                       char ** argv)
+{
+        int ret = 0;
+
+        (void) argc;
+        (void) argv;
+
+        pff = alternate_pff_create();
+        if (pff == NULL) {
+                printf("Failed to create.\n");
+                return -1;
+        }
+
+        if (fill() || test_failover() || test_flush())
+                ret = -1;
+
+        alternate_pff_destroy(pff);
+
+        return ret;
+}
@@ -23,13 +23,26 @@
 #define _POSIX_C_SOURCE 200112L
 
 #include <ouroboros/utils.h>
+#include <ouroboros/time_utils.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "graph.c"
 
+#define RING   100
+#define CHORDS 2    /* Random extra links per node in the benchmark */
+#define INC_N  2000 /* Nodes in the incremental SPF test            */
+#define INC_L  3000 /* Links in the incremental SPF test            */
+#define ROUNDS 100
+#define HUB    48   /* Neighbors of the source in the hub test      */
+#define LONG   33000 /* Hops of max weight that exceed an int        */
+
+static uint64_t links[INC_L][2];
+static uint64_t model[INC_N + 1]; /* Next hop per address, 0 if none */
+
 struct graph *   graph;
 struct list_head table;
 qosspec_t        qs;
@@ -39,7 +52,8 @@ int graph_test_entries(int entries)
         struct list_head * p;
         int                i = 0;
 
-        if (graph_routing_table(graph, ROUTING_SIMPLE, 1, &table)) {
+        if (graph_routing_table(graph, ROUTING_SIMPLE, METRIC_HOPS, 1,
+                                &table)) {
                 printf("Failed to get routing table.\n");
                 return -1;
         }
@@ -63,7 +77,8 @@ int graph_test_double_link(void)
         struct list_head * p;
         int                i = 0;
 
-        if (graph_routing_table(graph, ROUTING_SIMPLE, 1, &table)) {
+        if (graph_routing_table(graph, ROUTING_SIMPLE, METRIC_HOPS, 1,
+                                &table)) {
                 printf("Failed to get routing table.\n");
                 return -1;
         }
@@ -101,7 +116,8 @@ int graph_test_single_link(void)
         struct list_head * p;
         int                i = 0;
 
-        if (graph_routing_table(graph, ROUTING_SIMPLE, 1, &table)) {
+        if (graph_routing_table(graph, ROUTING_SIMPLE, METRIC_HOPS, 1,
+                                &table)) {
                 printf("Failed to get routing table.\n");
                 return -1;
         }
@@ -173,6 +189,741 @@ static int distance_check(int               dst,
         return 0;
 }
 
+static void add_link(struct graph * g,
+                     uint64_t       a,
+                     uint64_t       b)
+{
+        graph_update_edge(g, a, b, qs);
+        graph_update_edge(g, b, a, qs);
+}
+
+static int graph_test_ring(void)
+{
+        struct graph *     g;
+        struct list_head * p;
+        struct list_head * q;
+        uint64_t           i;
+        int                n;
+
+        g = graph_create();
+        if (g == NULL) {
+                printf("Failed to create graph.\n");
+                return -1;
+        }
+
+        for (i = 1; i <= RING; ++i)
+                add_link(g, i, i % RING + 1);
+
+        if (graph_routing_table(g, ROUTING_ECMP, METRIC_HOPS, 1, &table)) {
+                printf("Failed to get routing table for ECMP.\n");
+                goto fail_graph;
+        }
+
+        n = 0;
+        list_for_each(p, &table) {
+                struct routing_table * t =
+                        list_entry(p, struct routing_table, next);
+                struct nhop *          h =
+                        list_first_entry(&t->nhops, struct nhop, next);
+                size_t                 k = 0;
+
+                list_for_each(q, &t->nhops)
+                        ++k;
+
+                if (t->dst == RING / 2 + 1 ? k != 2 :
+                    k != 1 || h->nhop != (t->dst <= RING / 2 ? 2 : RING)) {
+                        printf("Wrong ring entry for %" PRIu64 ".\n",
+                               t->dst);
+                        goto fail_routing;
+                }
+
+                ++n;
+        }
+
+        if (n != RING - 1) {
+                printf("Wrong number of ring entries.\n");
+                goto fail_routing;
+        }
+
+        graph_free_routing_table(g, &table);
+
+        /* Cut the ring, everything now goes the other way around. */
+        graph_del_edge(g, 1, 2);
+        graph_del_edge(g, 2, 1);
+
+        if (graph_routing_table(g, ROUTING_SIMPLE, METRIC_HOPS, 1, &table)) {
+                printf("Failed to get routing table.\n");
+                goto fail_graph;
+        }
+
+        list_for_each(p, &table) {
+                struct routing_table * t =
+                        list_entry(p, struct routing_table, next);
+                struct nhop *          h =
+                        list_first_entry(&t->nhops, struct nhop, next);
+
+                if (h->nhop != RING) {
+                        printf("Route to %" PRIu64 " not updated.\n",
+                               t->dst);
+                        goto fail_routing;
+                }
+        }
+
+        graph_free_routing_table(g, &table);
+        graph_destroy(g);
+
+        return 0;
+
+ fail_routing:
+        graph_free_routing_table(g, &table);
+ fail_graph:
+        graph_destroy(g);
+        return -1;
+}
+
+/* The next hops towards dst, in order, or 0 if there is no entry. */
+static size_t get_nhops(struct list_head * t,
+                        uint64_t           dst,
+                        uint64_t *         nhops)
+{
+        struct list_head * p;
+        struct list_head * q;
+        size_t             n = 0;
+
+        list_for_each(p, t) {
+                struct routing_table * e =
+                        list_entry(p, struct routing_table, next);
+
+                if (e->dst != dst)
+                        continue;
+
+                list_for_each(q, &e->nhops)
+                        nhops[n++] = list_entry(q, struct nhop, next)->nhop;
+        }
+
+        return n;
+}
+
+static uint64_t first_nhop(struct graph *      g,
+                           enum routing_metric metric,
+                           uint64_t            dst)
+{
+        uint64_t nhops[HUB + 1];
+        uint64_t ret = 0;
+
+        if (graph_routing_table(g, ROUTING_SIMPLE, metric, 1, &table))
+                return 0;
+
+        if (get_nhops(&table, dst, nhops) > 0)
+                ret = nhops[0];
+
+        graph_free_routing_table(g, &table);
+
+        return ret;
+}
+
+/*
+ * 1 - 3 is direct but slow and thin, 1 - 2 - 3 is fast and wide.
+ * Only the hop count takes the direct link.
+ */
+static int graph_test_metrics(void)
+{
+        struct graph * g;
+        qosspec_t      fast = qs;
+        qosspec_t      slow = qs;
+
+        g = graph_create();
+        if (g == NULL) {
+                printf("Failed to create graph.\n");
+                return -1;
+        }
+
+        fast.delay     = 1;
+        fast.bandwidth = 10000000000ULL;
+        slow.delay     = 100;
+        slow.bandwidth = 10000000ULL;
+
+        graph_update_edge(g, 1, 2, fast);
+        graph_update_edge(g, 2, 1, fast);
+        graph_update_edge(g, 2, 3, fast);
+        graph_update_edge(g, 3, 2, fast);
+        graph_update_edge(g, 1, 3, slow);
+        graph_update_edge(g, 3, 1, slow);
+
+        if (first_nhop(g, METRIC_HOPS, 3) != 3 ||
+            first_nhop(g, METRIC_DELAY, 3) != 2 ||
+            first_nhop(g, METRIC_CAPACITY, 3) != 2) {
+                printf("Metric not applied.\n");
+                goto fail;
+        }
+
+        /* The slow link gets fast, only its own direction counts. */
+        graph_update_qos(g, 3, 1, fast);
+        if (first_nhop(g, METRIC_DELAY, 3) != 2) {
+                printf("Reverse direction used.\n");
+                goto fail;
+        }
+
+        graph_update_qos(g, 1, 3, fast);
+        if (first_nhop(g, METRIC_DELAY, 3) != 3) {
+                printf("Delay update not applied.\n");
+                goto fail;
+        }
+
+        graph_destroy(g);
+
+        return 0;
+ fail:
+        graph_destroy(g);
+        return -1;
+}
+
+static void add_qlink(struct graph * g,
+                      uint64_t       a,
+                      uint64_t       b,
+                      qosspec_t      q)
+{
+        graph_update_edge(g, a, b, q);
+        graph_update_edge(g, b, a, q);
+}
+
+/*
+ * A dead end chain of heavy links hangs off 1, longer than an int can
+ * sum. The far end of the chain is out of reach, but the sums must
+ * not wrap around and lead back to 1 through the chain.
+ */
+static int graph_test_long(void)
+{
+        struct graph *     g;
+        struct spt *       spt;
+        qosspec_t          heavy = qs;
+        struct list_head * p;
+        uint64_t           nhops[HUB + 1];
+        uint64_t           i;
+        int                ret;
+
+        g = graph_create();
+        if (g == NULL) {
+                printf("Failed to create graph.\n");
+                return -1;
+        }
+
+        spt = graph_spt_create();
+        if (spt == NULL) {
+                printf("Failed to create spt.\n");
+                goto fail_spt;
+        }
+
+        heavy.delay = W_MAX;
+
+        add_qlink(g, 1, 2, heavy);
+        add_qlink(g, 1, 3, heavy);
+        for (i = 3; i < LONG + 3; ++i)
+                add_qlink(g, i, i + 1, heavy);
+
+        ret = graph_routing_update(g, ROUTING_SIMPLE, METRIC_DELAY, 1, spt,
+                                   &table);
+        if (ret < 0) {
+                printf("Failed to update routing table.\n");
+                goto fail;
+        }
+
+        if (get_nhops(&table, 2, nhops) != 1 || nhops[0] != 2 ||
+            get_nhops(&table, LONG / 2, nhops) != 1 || nhops[0] != 3) {
+                printf("Bad next hop next to a long chain.\n");
+                goto fail_table;
+        }
+
+        list_for_each(p, &table) {
+                struct routing_table * t =
+                        list_entry(p, struct routing_table, next);
+                struct nhop *          n =
+                        list_first_entry(&t->nhops, struct nhop, next);
+                if (t->dst != 2 && n->nhop != 3) {
+                        printf("Bad next hop for %" PRIu64 ".\n", t->dst);
+                        goto fail_table;
+                }
+        }
+
+        if (get_nhops(&table, LONG + 3, nhops) != 0) {
+                printf("Reached the end of the chain.\n");
+                goto fail_table;
+        }
+
+        graph_free_routing_table(g, &table);
+
+        graph_spt_destroy(spt);
+        graph_destroy(g);
+
+        return 0;
+ fail_table:
+        graph_free_routing_table(g, &table);
+ fail:
+        graph_spt_destroy(spt);
+ fail_spt:
+        graph_destroy(g);
+        return -1;
+}
+
+/* Every spoke reaches the far node, the per-neighbor runs must agree. */
+static int graph_test_hub(void)
+{
+        struct graph *    g;
+        enum routing_algo algo[] = { ROUTING_LFA, ROUTING_ECMP };
+        uint64_t          first[HUB + 1];
+        uint64_t          nhops[HUB + 1];
+        uint64_t          i;
+        size_t            k;
+        size_t            r;
+        size_t            n;
+
+        g = graph_create();
+        if (g == NULL) {
+                printf("Failed to create graph.\n");
+                return -1;
+        }
+
+        for (i = 2; i < HUB + 2; ++i) {
+                add_link(g, 1, i);
+                add_link(g, i, HUB + 2);
+        }
+
+        for (k = 0; k < 2; ++k) {
+                for (r = 0; r < 4; ++r) {
+                        if (graph_routing_table(g, algo[k], METRIC_HOPS, 1,
+                                                &table)) {
+                                printf("Failed to get hub table.\n");
+                                goto fail_graph;
+                        }
+
+                        /* LFA lists the primary among the alternates. */
+                        n = HUB + (algo[k] == ROUTING_LFA);
+                        if (get_nhops(&table, HUB + 2, nhops) != n) {
+                                printf("Far node lacks next hops.\n");
+                                goto fail_routing;
+                        }
+
+                        if (r == 0)
+                                memcpy(first, nhops, n * sizeof(*first));
+
+                        if (memcmp(first, nhops, n * sizeof(*first))) {
+                                printf("Next hop order changed.\n");
+                                goto fail_routing;
+                        }
+
+                        if (algo[k] == ROUTING_ECMP &&
+                            (get_nhops(&table, 2, nhops) != 1 ||
+                             nhops[0] != 2)) {
+                                printf("Bad route to a spoke.\n");
+                                goto fail_routing;
+                        }
+
+                        graph_free_routing_table(g, &table);
+                }
+        }
+
+        graph_destroy(g);
+
+        return 0;
+
+ fail_routing:
+        graph_free_routing_table(g, &table);
+ fail_graph:
+        graph_destroy(g);
+        return -1;
+}
+
+static size_t apply_table(struct list_head * t,
+                          int                full)
+{
+        struct list_head * p;
+        size_t             n = 0;
+
+        if (full)
+                memset(model, 0, sizeof(model));
+
+        list_for_each(p, t) {
+                struct routing_table * e =
+                        list_entry(p, struct routing_table, next);
+
+                if (list_is_empty(&e->nhops))
+                        model[e->dst] = 0;
+                else
+                        model[e->dst] = list_first_entry(&e->nhops,
+                                                         struct nhop,
+                                                         next)->nhop;
+                ++n;
+        }
+
+        return n;
+}
+
+/* Every next hop must be a neighbor on a shortest path. */
+static int check_model(struct graph *      g,
+                       enum routing_metric metric)
+{
+        const struct csr * csr = &g->csr;
+        struct vertex *    s;
+        struct vertex *    v;
+        struct vertex *    nb;
+        int *              dist;
+        int *              nb_dist;
+        size_t             n;
+        size_t             deg;
+        size_t             i;
+        uint64_t           a;
+        int                ret = -1;
+
+        s = find_vertex_by_addr(g, 1);
+        if (s == NULL) {
+                for (a = 1; a <= INC_N; ++a)
+                        if (model[a] != 0)
+                                return -1;
+                return 0;
+        }
+
+        n   = csr->nr_vertices;
+        deg = csr->end[s->index] - csr->off[s->index];
+
+        dist    = malloc(n * sizeof(*dist));
+        nb_dist = malloc((deg * n + 1) * sizeof(*nb_dist));
+        if (dist == NULL || nb_dist == NULL)
+                goto out;
+
+        dijkstra(csr, metric, s->index, dist, NULL);
+        for (i = 0; i < deg; ++i)
+                dijkstra(csr, metric, csr->adj[csr->off[s->index] + i],
+                         nb_dist + i * n, NULL);
+
+        for (a = 2; a <= INC_N; ++a) {
+                v = find_vertex_by_addr(g, a);
+                if (v == NULL || dist[v->index] == INT_MAX) {
+                        if (model[a] != 0) {
+                                printf("Route to unreachable %" PRIu64
+                                       ".\n", a);
+                                goto out;
+                        }
+                        continue;
+                }
+
+                nb = model[a] == 0 ? NULL : find_vertex_by_addr(g, model[a]);
+                if (nb == NULL) {
+                        printf("No route to %" PRIu64 ".\n", a);
+                        goto out;
+                }
+
+                for (i = 0; i < deg; ++i)
+                        if (csr->adj[csr->off[s->index] + i] == nb->index)
+                                break;
+
+                if (i == deg || nb_dist[i * n + v->index] +
+                    csr->w[metric][csr->off[s->index] + i] != dist[v->index]) {
+                        printf("Bad next hop %" PRIu64 " for %" PRIu64
+                               ".\n", model[a], a);
+                        goto out;
+                }
+        }
+
+        ret = 0;
+ out:
+        free(nb_dist);
+        free(dist);
+        return ret;
+}
+
+/* A link with a different random delay each way. */
+static void add_wlink(struct graph * g,
+                      uint64_t       a,
+                      uint64_t       b)
+{
+        qosspec_t q = qs;
+
+        q.delay = rand() % 20;
+        graph_update_edge(g, a, b, q);
+        q.delay = rand() % 20;
+        graph_update_edge(g, b, a, q);
+}
+
+static void change_links(struct graph * g,
+                         size_t         n)
+{
+        qosspec_t q = qs;
+        size_t    i;
+        size_t    j;
+        uint64_t  x;
+
+        for (i = 0; i < n; ++i) {
+                j = rand() % INC_L;
+                graph_del_edge(g, links[j][0], links[j][1]);
+                graph_del_edge(g, links[j][1], links[j][0]);
+                do {
+                        links[j][0] = rand() % INC_N + 1;
+                        links[j][1] = rand() % INC_N + 1;
+                } while (links[j][0] == links[j][1]);
+                add_wlink(g, links[j][0], links[j][1]);
+
+                /* And one that gets faster or slower. */
+                j = rand() % INC_L;
+                q.delay = rand() % 20;
+                graph_update_qos(g, links[j][0], links[j][1], q);
+        }
+
+        /* Sometimes a node disappears with all of its links. */
+        if (rand() % 4 == 0) {
+                x = rand() % INC_N + 1;
+                for (j = 0; j < INC_L; ++j) {
+                        if (links[j][0] != x && links[j][1] != x)
+                                continue;
+                        graph_del_edge(g, links[j][0], links[j][1]);
+                        graph_del_edge(g, links[j][1], links[j][0]);
+                        links[j][0] = x % INC_N + 1;
+                        links[j][1] = (x + 1) % INC_N + 1;
+                        add_wlink(g, links[j][0], links[j][1]);
+                }
+        }
+}
+
+static int graph_test_incremental(enum routing_metric metric)
+{
+        struct graph * g;
+        struct spt *   spt;
+        size_t         i;
+        size_t         incr = 0;
+        int            ret;
+
+        g = graph_create();
+        if (g == NULL) {
+                printf("Failed to create graph.\n");
+                return -1;
+        }
+
+        spt = graph_spt_create();
+        if (spt == NULL) {
+                printf("Failed to create spt.\n");
+                goto fail_spt;
+        }
+
+        srand(INC_N);
+
+        for (i = 0; i < INC_L; ++i) {
+                do {
+                        links[i][0] = rand() % INC_N + 1;
+                        links[i][1] = rand() % INC_N + 1;
+                } while (links[i][0] == links[i][1]);
+                add_wlink(g, links[i][0], links[i][1]);
+        }
+
+        memset(model, 0, sizeof(model));
+
+        for (i = 0; i < ROUNDS; ++i) {
+                /* Every so often, more changes than the log holds. */
+                change_links(g, i % 25 == 24 ? GRAPH_LOG : rand() % 8);
+
+                ret = graph_routing_update(g, ROUTING_SIMPLE, metric, 1, spt,
+                                           &table);
+                if (ret < 0) {
+                        printf("Failed to update routing table.\n");
+                        goto fail_update;
+                }
+
+                apply_table(&table, ret);
+                graph_free_routing_table(g, &table);
+
+                if (ret == 0)
+                        ++incr;
+
+                if (check_model(g, metric)) {
+                        printf("Round %zu (%s) is wrong.\n", i,
+                               ret ? "full" : "incremental");
+                        goto fail_update;
+                }
+        }
+
+        if (incr < ROUNDS / 2) {
+                printf("Only %zu of %d updates were incremental.\n",
+                       incr, ROUNDS);
+                goto fail_update;
+        }
+
+        graph_spt_destroy(spt);
+        graph_destroy(g);
+
+        return 0;
+
+ fail_update:
+        graph_spt_destroy(spt);
+ fail_spt:
+        graph_destroy(g);
+        return -1;
+}
+
+static int graph_bench_flap(struct graph * g,
+                            size_t         nodes)
+{
+        struct list_head * p;
+        struct spt *       spt;
+        struct timespec    tic;
+        struct timespec    toc;
+        size_t             n[2];
+        long               us[2];
+        int                i;
+
+        spt = graph_spt_create();
+        if (spt == NULL)
+                return -1;
+
+        if (graph_routing_update(g, ROUTING_SIMPLE, METRIC_HOPS, 1, spt,
+                                 &table) != 1)
+                goto fail;
+
+        graph_free_routing_table(g, &table);
+
+        for (i = 0; i < 2; ++i) {
+                if (i == 0) {
+                        graph_del_edge(g, 2, 3);
+                        graph_del_edge(g, 3, 2);
+                } else {
+                        add_link(g, 2, 3);
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &tic);
+
+                if (graph_routing_update(g, ROUTING_SIMPLE, METRIC_HOPS, 1,
+                                         spt, &table) != 0)
+                        goto fail;
+
+                clock_gettime(CLOCK_MONOTONIC, &toc);
+
+                us[i] = ts_diff_us(&tic, &toc);
+                n[i]  = 0;
+                list_for_each(p, &table)
+                        ++n[i];
+
+                graph_free_routing_table(g, &table);
+        }
+
+        printf("%6zu nodes: link down in %6ld us (%zu changes), "
+               "up in %6ld us (%zu changes).\n",
+               nodes, us[0], n[0], us[1], n[1]);
+
+        graph_spt_destroy(spt);
+
+        return 0;
+ fail:
+        printf("Incremental update failed.\n");
+        graph_spt_destroy(spt);
+        return -1;
+}
+
+static int graph_bench_algo(struct graph *    g,
+                            enum routing_algo algo,
+                            const char *      name,
+                            size_t            nodes)
+{
+        struct timespec    tic;
+        struct timespec    toc;
+        struct list_head * p;
+        size_t             n = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &tic);
+
+        if (graph_routing_table(g, algo, METRIC_HOPS, 1, &table)) {
+                printf("Failed to get %s routing table.\n", name);
+                return -1;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &toc);
+
+        list_for_each(p, &table)
+                ++n;
+
+        graph_free_routing_table(g, &table);
+
+        if (n != nodes - 1) {
+                printf("%s table has %zu of %zu entries.\n",
+                       name, n, nodes - 1);
+                return -1;
+        }
+
+        printf("%6zu nodes: %-7s table in %8ld us.\n",
+               nodes, name, (long) ts_diff_us(&tic, &toc));
+
+        return 0;
+}
+
+static int graph_bench(size_t nodes)
+{
+        struct graph *  g;
+        struct timespec tic;
+        struct timespec toc;
+        uint64_t        a;
+        uint64_t        b;
+        size_t          i;
+        size_t          j;
+
+        g = graph_create();
+        if (g == NULL) {
+                printf("Failed to create graph.\n");
+                return -1;
+        }
+
+        srand(nodes);
+
+        clock_gettime(CLOCK_MONOTONIC, &tic);
+
+        /* A ring keeps it connected, random chords keep it short. */
+        for (i = 0; i < nodes; ++i) {
+                a = i + 1;
+                add_link(g, a, (i + 1) % nodes + 1);
+                for (j = 0; j < CHORDS; ++j) {
+                        b = rand() % nodes + 1;
+                        if (b != a)
+                                add_link(g, a, b);
+                }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &toc);
+
+        printf("%6zu nodes: graph built in %8ld us.\n",
+               nodes, (long) ts_diff_us(&tic, &toc));
+
+        if (graph_bench_algo(g, ROUTING_SIMPLE, "simple", nodes))
+                goto fail;
+
+        /* Second run reuses the snapshot. */
+        if (graph_bench_algo(g, ROUTING_SIMPLE, "simple", nodes))
+                goto fail;
+
+        if (graph_bench_algo(g, ROUTING_LFA, "LFA", nodes))
+                goto fail;
+
+        if (graph_bench_algo(g, ROUTING_ECMP, "ECMP", nodes))
+                goto fail;
+
+        /* Make the source a core router, many runs to spread. */
+        for (j = 0; j < HUB; ++j) {
+                b = rand() % nodes + 1;
+                if (b != 1)
+                        add_link(g, 1, b);
+        }
+
+        if (graph_bench_algo(g, ROUTING_LFA, "LFA/48", nodes))
+                goto fail;
+
+        if (graph_bench_algo(g, ROUTING_ECMP, "ECMP/48", nodes))
+                goto fail;
+
+        if (graph_bench_flap(g, nodes))
+                goto fail;
+
+        graph_destroy(g);
+
+        return 0;
+ fail:
+        graph_destroy(g);
+        return -1;
+}
+
 int graph_test(int     argc,
                char ** argv)
 {
@@ -273,7 +1024,8 @@ int graph_test(int     argc,
                 goto fail_graph;
 
 
-        if (graph_routing_table(graph, ROUTING_SIMPLE, 1, &table)) {
+        if (graph_routing_table(graph, ROUTING_SIMPLE, METRIC_HOPS, 1,
+                                &table)) {
                 printf("Failed to get routing table.\n");
                 goto fail_graph;
         }
@@ -295,7 +1047,7 @@ int graph_test(int     argc,
 
         graph_free_routing_table(graph, &table);
 
-        if (graph_routing_table(graph, ROUTING_LFA, 1, &table)) {
+        if (graph_routing_table(graph, ROUTING_LFA, METRIC_HOPS, 1, &table)) {
                 printf("Failed to get routing table for LFA.\n");
                 goto fail_graph;
         }
@@ -317,7 +1069,7 @@ int graph_test(int     argc,
 
         graph_free_routing_table(graph, &table);
 
-        if (graph_routing_table(graph, ROUTING_ECMP, 1, &table)) {
+        if (graph_routing_table(graph, ROUTING_ECMP, METRIC_HOPS, 1, &table)) {
                 printf("Failed to get routing table for ECMP.\n");
                 goto fail_graph;
         }
@@ -341,6 +1093,27 @@ int graph_test(int     argc,
 
         graph_destroy(graph);
 
+        if (graph_test_ring())
+                return -1;
+
+        if (graph_test_hub())
+                return -1;
+
+        if (graph_test_metrics())
+                return -1;
+
+        if (graph_test_long())
+                return -1;
+
+        if (graph_test_incremental(METRIC_HOPS))
+                return -1;
+
+        if (graph_test_incremental(METRIC_DELAY))
+                return -1;
+
+        if (graph_bench(1000) || graph_bench(10000) || graph_bench(50000))
+                return -1;
+
         return 0;
 
  fail_routing:
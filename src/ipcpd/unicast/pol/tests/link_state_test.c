@@ -0,0 +1,323 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the link state routing policy
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#include "link_state.c"
+
+#include <stdio.h>
+
+#define SRC   1
+#define DST   2
+#define RTT   (40 * MILLION) /* Advertised as a delay of 20 ms */
+
+/* The graph comes from graph_test, the rest of the IPCP is stubbed. */
+struct ipcp ipcpi;
+
+int connmgr_comp_init(enum comp_id             id,
+                      const struct conn_info * info)
+{
+        (void) id;
+        (void) info;
+
+        return 0;
+}
+
+void connmgr_comp_fini(enum comp_id id)
+{
+        (void) id;
+}
+
+int connmgr_wait(enum comp_id  id,
+                 struct conn * conn)
+{
+        (void) id;
+        (void) conn;
+
+        return -1;
+}
+
+int fccntl(int fd,
+           int cmd,
+           ...)
+{
+        (void) fd;
+        (void) cmd;
+
+        return -1;
+}
+
+ssize_t flow_write(int          fd,
+                   const void * buf,
+                   size_t       count)
+{
+        (void) fd;
+        (void) buf;
+
+        return count;
+}
+
+ssize_t flow_read(int    fd,
+                  void * buf,
+                  size_t count)
+{
+        (void) fd;
+        (void) buf;
+        (void) count;
+
+        return -1;
+}
+
+fset_t * fset_create(void)
+{
+        return NULL;
+}
+
+void fset_destroy(fset_t * set)
+{
+        (void) set;
+}
+
+int fset_add(fset_t * set,
+             int      fd)
+{
+        (void) set;
+        (void) fd;
+
+        return 0;
+}
+
+void fset_del(fset_t * set,
+              int      fd)
+{
+        (void) set;
+        (void) fd;
+}
+
+fqueue_t * fqueue_create(void)
+{
+        return NULL;
+}
+
+void fqueue_destroy(struct fqueue * fq)
+{
+        (void) fq;
+}
+
+int fqueue_next(fqueue_t * fq)
+{
+        (void) fq;
+
+        return -1;
+}
+
+enum fqtype fqueue_type(fqueue_t * fq)
+{
+        (void) fq;
+
+        return FLOW_PKT;
+}
+
+ssize_t fevent(fset_t *                set,
+               fqueue_t *              fq,
+               const struct timespec * timeo)
+{
+        (void) set;
+        (void) fq;
+        (void) timeo;
+
+        return -1;
+}
+
+void notifier_event(int          event,
+                    const void * o)
+{
+        (void) event;
+        (void) o;
+}
+
+int notifier_reg(notifier_fn_t callback,
+                 void *        obj)
+{
+        (void) callback;
+        (void) obj;
+
+        return 0;
+}
+
+void notifier_unreg(notifier_fn_t callback)
+{
+        (void) callback;
+}
+
+int rib_reg(const char *     path,
+            struct rib_ops * ops)
+{
+        (void) path;
+        (void) ops;
+
+        return 0;
+}
+
+void rib_unreg(const char * path)
+{
+        (void) path;
+}
+
+void pff_lock(struct pff * pff)
+{
+        (void) pff;
+}
+
+void pff_unlock(struct pff * pff)
+{
+        (void) pff;
+}
+
+int pff_add(struct pff * pff,
+            uint64_t     addr,
+            int *        fd,
+            size_t       len)
+{
+        (void) pff;
+        (void) addr;
+        (void) fd;
+        (void) len;
+
+        return 0;
+}
+
+int pff_del(struct pff * pff,
+            uint64_t     addr)
+{
+        (void) pff;
+        (void) addr;
+
+        return 0;
+}
+
+int pff_flush(struct pff * pff)
+{
+        (void) pff;
+
+        return 0;
+}
+
+int pff_flow_state_change(struct pff * pff,
+                          int          fd,
+                          bool         up)
+{
+        (void) pff;
+        (void) fd;
+        (void) up;
+
+        return 0;
+}
+
+/* One refresh of the link, as lsupdate does it. */
+static bool refresh(struct adjacency * adj,
+                    struct nb *        nb,
+                    uint64_t           srtt)
+{
+        nb->srtt = srtt;
+
+        return lsdb_local_qs(adj);
+}
+
+/* The delay of a link only changes when the rtt clearly moved. */
+static int test_delay_jitter(void)
+{
+        struct adjacency adj;
+        struct nb        nb;
+        int              i;
+
+        memset(&adj, 0, sizeof(adj));
+        memset(&nb, 0, sizeof(nb));
+
+        list_head_init(&ls.nbs);
+
+        ls.graph = graph_create();
+        if (ls.graph == NULL) {
+                printf("Failed to create graph.\n");
+                return -1;
+        }
+
+        adj.src      = SRC;
+        adj.dst      = DST;
+        adj.qs.delay = UINT32_MAX;
+
+        graph_update_edge(ls.graph, SRC, DST, adj.qs);
+        graph_update_edge(ls.graph, DST, SRC, adj.qs);
+
+        nb.addr = DST;
+        nb.type = NB_MGMT;
+        list_add(&nb.next, &ls.nbs);
+
+        if (!refresh(&adj, &nb, RTT) || adj.qs.delay != RTT / 2 / MILLION) {
+                printf("First delay not advertised.\n");
+                goto fail;
+        }
+
+        /* Queueing moves the rtt up to a fifth either way. */
+        for (i = 0; i < 100; ++i) {
+                if (refresh(&adj, &nb, RTT + (i % 9 - 4) * RTT / 20)) {
+                        printf("Jitter changed the link.\n");
+                        goto fail;
+                }
+        }
+
+        if (adj.qs.delay != RTT / 2 / MILLION) {
+                printf("Jitter moved the delay.\n");
+                goto fail;
+        }
+
+        if (!refresh(&adj, &nb, 2 * RTT) ||
+            adj.qs.delay != RTT / MILLION) {
+                printf("Delay change not advertised.\n");
+                goto fail;
+        }
+
+        /* Short links get some slack for the rounding to ms. */
+        if (!refresh(&adj, &nb, 2 * MILLION) ||
+            refresh(&adj, &nb, 4 * MILLION) ||
+            refresh(&adj, &nb, 6 * MILLION)) {
+                printf("Short link slack not applied.\n");
+                goto fail;
+        }
+
+        graph_destroy(ls.graph);
+
+        return 0;
+ fail:
+        graph_destroy(ls.graph);
+        return -1;
+}
+
+int link_state_test(int     argc,
+                    char ** argv)
+{
+        (void) argc;
+        (void) argv;
+
+        if (test_delay_jitter())
+                return -1;
+
+        return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the multipath PFF next hop selection
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+/* The pft and epoch are linked in through the other tests. */
+#include "multipath_pff.c"
+
+#include <stdio.h>
+
+#define DST    42
+#define HOPS   4
+#define FD_0   10
+#define FLOWS  4000
+#define BURST  32
+
+static size_t queued[FD_0 + HOPS];
+
+size_t ipcp_flow_queued(int fd)
+{
+        return queued[fd];
+}
+
+static int test_consistent(struct pff_i * pff)
+{
+        uint64_t addr[BURST];
+        uint64_t flow[BURST];
+        int      fd[BURST];
+        size_t   count[HOPS];
+        size_t   i;
+        size_t   j;
+        int      ret;
+
+        memset(count, 0, sizeof(count));
+
+        for (i = 0; i < FLOWS; ++i) {
+                ret = multipath_pff_nhop(pff, DST, i);
+                if (ret < FD_0 || ret >= FD_0 + HOPS) {
+                        printf("Bad next hop %d.\n", ret);
+                        return -1;
+                }
+
+                for (j = 0; j < 8; ++j) {
+                        if (multipath_pff_nhop(pff, DST, i) != ret) {
+                                printf("Flow %zu changed path.\n", i);
+                                return -1;
+                        }
+                }
+
+                ++count[ret - FD_0];
+        }
+
+        for (i = 0; i < HOPS; ++i) {
+                if (count[i] < FLOWS / HOPS / 2) {
+                        printf("Next hop %zu got %zu of %d flows.\n",
+                               i, count[i], FLOWS);
+                        return -1;
+                }
+        }
+
+        for (i = 0; i < BURST; ++i) {
+                addr[i] = DST;
+                flow[i] = i * 7;
+        }
+
+        multipath_pff_nhop_n(pff, addr, flow, fd, BURST);
+
+        for (i = 0; i < BURST; ++i) {
+                if (fd[i] != multipath_pff_nhop(pff, DST, flow[i])) {
+                        printf("Burst lookup differs for flow %zu.\n", i);
+                        return -1;
+                }
+        }
+
+        if (multipath_pff_nhop(pff, DST + 1, 0) != -1) {
+                printf("Found unknown destination.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+#if PFF_FLOWLET_GAP > 0
+static int test_flowlet(struct pff_i * pff)
+{
+        struct timespec gap = {0, (PFF_FLOWLET_GAP + 1000) * 1000L};
+        int             fd;
+        int             other;
+
+        fd = multipath_pff_nhop(pff, DST, 1);
+
+        /* A busy flow stays on its path, however long the queue. */
+        queued[fd] = 100;
+        if (multipath_pff_nhop(pff, DST, 1) != fd) {
+                printf("Flow moved within a flowlet.\n");
+                return -1;
+        }
+
+        nanosleep(&gap, NULL);
+
+        other = multipath_pff_nhop(pff, DST, 1);
+        if (other == fd) {
+                printf("Flow did not move after an idle gap.\n");
+                return -1;
+        }
+
+        queued[fd] = 0;
+
+        if (multipath_pff_nhop(pff, DST, 1) != other) {
+                printf("Flow moved back within a flowlet.\n");
+                return -1;
+        }
+
+        return 0;
+}
+#endif
+
+int multipath_pff_test(int     argc,
+                       char ** argv)
+{
+        struct pff_i * pff;
+        int            fds[HOPS];
+        int            i;
+        int            ret = 0;
+
+        (void) argc;
+        (void) argv;
+
+        pff = multipath_pff_create();
+        if (pff == NULL) {
+                printf("Failed to create.\n");
+                return -1;
+        }
+
+        for (i = 0; i < HOPS; ++i)
+                fds[i] = FD_0 + i;
+
+        multipath_pff_lock(pff);
+
+        if (multipath_pff_add(pff, DST, fds, HOPS)) {
+                multipath_pff_unlock(pff);
+                printf("Failed to add.\n");
+                goto fail;
+        }
+
+        multipath_pff_unlock(pff);
+
+        if (test_consistent(pff))
+                ret = -1;
+#if PFF_FLOWLET_GAP > 0
+        if (ret == 0 && test_flowlet(pff))
+                ret = -1;
+#endif
+        multipath_pff_destroy(pff);
+
+        return ret;
+ fail:
+        multipath_pff_destroy(pff);
+        return -1;
+}
@@ -22,31 +22,24 @@
 
 #include "pft.c"
 
+#include <ouroboros/time_utils.h>
+
+#include <inttypes.h>
 #include <stdio.h>
+#include <time.h>
 
 #define TBL_SIZE 256
 #define INT_TEST 4
+#define LOOKUPS  (1 << 22)
 
-int pft_test(int     argc,
-             char ** argv)
+static int test_pft_basic(void)
 {
         struct pft * pft;
         int          i;
         int *        j;
         size_t       len;
 
-        (void) argc;
-        (void) argv;
-
-        pft = pft_create(TBL_SIZE, true);
-        if (pft == NULL) {
-                printf("Failed to create.\n");
-                return -1;
-        }
-
-        pft_destroy(pft);
-
-        pft = pft_create(TBL_SIZE, false);
+        pft = pft_create(TBL_SIZE);
         if (pft == NULL) {
                 printf("Failed to create.\n");
                 return -1;
@@ -124,3 +117,214 @@ int pft_test(int     argc,
 
         return 0;
 }
+
+static int insert(struct pft * pft,
+                  uint64_t     dst,
+                  int          fd)
+{
+        int * fds;
+
+        fds = malloc(2 * sizeof(*fds));
+        if (fds == NULL)
+                return -1;
+
+        fds[0] = fd;
+        fds[1] = -fd;
+
+        if (pft_insert(pft, dst, fds, 2)) {
+                free(fds);
+                return -1;
+        }
+
+        return 0;
+}
+
+static int check(struct pft * pft,
+                 uint64_t     n,
+                 uint64_t     step)
+{
+        uint64_t i;
+        int *    fds;
+        size_t   len;
+
+        for (i = 0; i < n; ++i) {
+                if (i % step != 0) {
+                        if (pft_lookup(pft, i << 16, &fds, &len) == 0) {
+                                printf("Found deleted %" PRIu64 ".\n", i);
+                                return -1;
+                        }
+                        continue;
+                }
+
+                if (pft_lookup(pft, i << 16, &fds, &len)) {
+                        printf("Lost %" PRIu64 ".\n", i);
+                        return -1;
+                }
+
+                if (fds[0] != (int) i || len != 2) {
+                        printf("Bad entry for %" PRIu64 ".\n", i);
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+static int test_pft_grow(void)
+{
+        struct pft * pft;
+        struct pft * clone;
+        int *        fds;
+        size_t       len;
+        uint64_t     i;
+        uint64_t     n = 10000;
+
+        pft = pft_create(1);
+        if (pft == NULL) {
+                printf("Failed to create.\n");
+                return -1;
+        }
+
+        for (i = 0; i < n; ++i)
+                if (insert(pft, i << 16, i))
+                        goto fail;
+
+        if (insert(pft, 0, 0) == 0) {
+                printf("Inserted duplicate.\n");
+                goto fail;
+        }
+
+        /* Leave tombstones all over the table. */
+        for (i = 0; i < n; ++i)
+                if (i % 3 != 0 && pft_delete(pft, i << 16))
+                        goto fail;
+
+        if (check(pft, n, 3))
+                goto fail;
+
+        clone = pft_clone(pft);
+        if (clone == NULL)
+                goto fail;
+
+        pft_flush(pft);
+
+        if (pft_lookup(pft, 0, &fds, &len) == 0) {
+                printf("Lookup succeeded after flush.\n");
+                pft_destroy(clone);
+                goto fail;
+        }
+
+        if (check(clone, n, 3) || pft_lookup(clone, 3 << 16, &fds, &len) ||
+            fds[1] != -3) {
+                printf("Clone does not match.\n");
+                pft_destroy(clone);
+                goto fail;
+        }
+
+        /* Churn through the tombstones. */
+        for (i = 0; i < 20 * n; ++i) {
+                if (insert(clone, (n + i) << 16, n + i))
+                        goto fail_clone;
+                if (pft_delete(clone, (n + i) << 16))
+                        goto fail_clone;
+        }
+
+        if (check(clone, n, 3))
+                goto fail_clone;
+
+        pft_destroy(clone);
+        pft_destroy(pft);
+
+        return 0;
+
+ fail_clone:
+        printf("Churn failed.\n");
+        pft_destroy(clone);
+ fail:
+        pft_destroy(pft);
+        return -1;
+}
+
+static int bench_pft(size_t n)
+{
+        struct pft *    pft;
+        uint64_t *      dst;
+        struct timespec tic;
+        struct timespec toc;
+        int *           fds;
+        size_t          len;
+        size_t          i;
+        uint64_t        sum = 0;
+
+        dst = malloc(n * sizeof(*dst));
+        if (dst == NULL)
+                return -1;
+
+        pft = pft_create(TBL_SIZE);
+        if (pft == NULL) {
+                free(dst);
+                return -1;
+        }
+
+        for (i = 0; i < n; ++i) {
+                dst[i] = ((uint64_t) rand() << 32) ^ rand();
+                if (insert(pft, dst[i], i) && pft_lookup(pft, dst[i],
+                                                         &fds, &len)) {
+                        printf("Failed to insert.\n");
+                        goto fail;
+                }
+        }
+
+        for (i = 0; i < n; ++i)
+                dst[i] = dst[rand() % n];
+
+        clock_gettime(CLOCK_MONOTONIC, &tic);
+
+        for (i = 0; i < LOOKUPS; ++i) {
+                if (pft_lookup(pft, dst[i % n], &fds, &len))
+                        goto fail;
+                sum += *fds;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &toc);
+
+        printf("%8zu destinations: %6.2f Mlookups/s (%.1f ns, sum %"
+               PRIu64 ").\n", n,
+               LOOKUPS / (ts_diff_ns(&tic, &toc) / 1000.0),
+               ts_diff_ns(&tic, &toc) / (double) LOOKUPS, sum);
+
+        pft_destroy(pft);
+        free(dst);
+
+        return 0;
+ fail:
+        pft_destroy(pft);
+        free(dst);
+        return -1;
+}
+
+int pft_test(int     argc,
+             char ** argv)
+{
+        (void) argc;
+        (void) argv;
+
+        srand(1);
+
+        if (test_pft_basic())
+                return -1;
+
+        if (test_pft_grow())
+                return -1;
+
+        if (bench_pft(1000))
+                return -1;
+
+        if (bench_pft(100000))
+                return -1;
+
+        if (bench_pft(1000000))
+                return -1;
+
+        return 0;
+}
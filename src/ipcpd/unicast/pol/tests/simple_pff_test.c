@@ -0,0 +1,204 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the simple PFF under concurrent route updates
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+/* The pft is linked in through pft_test. */
+#include "epoch.c"
+#include "pft_pub.c"
+#include "simple_pff.c"
+
+#include <ouroboros/time_utils.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ENTRIES  256
+#define READERS  4
+#define UPDATES  2000
+#define BURST    32
+
+static struct pff_i * pff;
+static volatile bool  stop;
+
+struct rdr_stats {
+        size_t lookups;
+        size_t misses;
+        size_t bad;
+};
+
+static void fill(int gen)
+{
+        uint64_t addr;
+        int      fd;
+
+        simple_pff_lock(pff);
+
+        simple_pff_flush(pff);
+
+        for (addr = 0; addr < ENTRIES; ++addr) {
+                /* Odd generations route everything one fd higher. */
+                fd = (int) addr + (gen & 1);
+                simple_pff_add(pff, addr, &fd, 1);
+        }
+
+        simple_pff_unlock(pff);
+}
+
+static void * reader(void * o)
+{
+        struct rdr_stats * s = (struct rdr_stats *) o;
+        uint64_t           addr[BURST];
+        uint64_t           flow[BURST];
+        int                fd[BURST];
+        size_t             i;
+        uint64_t           a = 0;
+
+        while (!stop) {
+                for (i = 0; i < BURST; ++i) {
+                        addr[i] = a++ % ENTRIES;
+                        flow[i] = i;
+                }
+
+                simple_pff_nhop_n(pff, addr, flow, fd, BURST);
+
+                for (i = 0; i < BURST; ++i) {
+                        if (fd[i] == -1)
+                                ++s->misses;
+                        else if (fd[i] != (int) addr[i] &&
+                                 fd[i] != (int) addr[i] + 1)
+                                ++s->bad;
+                }
+
+                s->lookups += BURST;
+        }
+
+        return (void *) 0;
+}
+
+static int test_incremental(void)
+{
+        int fd = 7;
+
+        fill(0);
+
+        simple_pff_lock(pff);
+
+        if (simple_pff_update(pff, 3, &fd, 1)) {
+                simple_pff_unlock(pff);
+                printf("Failed to update.\n");
+                return -1;
+        }
+
+        /* Not visible before the table is published. */
+        if (simple_pff_nhop(pff, 3, 0) != 3) {
+                simple_pff_unlock(pff);
+                printf("Update visible before unlock.\n");
+                return -1;
+        }
+
+        if (simple_pff_del(pff, 4)) {
+                simple_pff_unlock(pff);
+                printf("Failed to delete.\n");
+                return -1;
+        }
+
+        simple_pff_unlock(pff);
+
+        if (simple_pff_nhop(pff, 3, 0) != 7 ||
+            simple_pff_nhop(pff, 4, 0) != -1 ||
+            simple_pff_nhop(pff, 5, 0) != 5) {
+                printf("Incremental update not published.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+static int test_concurrent(void)
+{
+        pthread_t        thr[READERS];
+        struct rdr_stats stats[READERS];
+        struct timespec  tic;
+        struct timespec  toc;
+        size_t           lookups = 0;
+        size_t           i;
+        int              ret = 0;
+
+        fill(0);
+
+        memset(stats, 0, sizeof(stats));
+        stop = false;
+
+        for (i = 0; i < READERS; ++i)
+                pthread_create(&thr[i], NULL, reader, &stats[i]);
+
+        clock_gettime(CLOCK_MONOTONIC, &tic);
+
+        for (i = 1; i <= UPDATES; ++i)
+                fill(i);
+
+        clock_gettime(CLOCK_MONOTONIC, &toc);
+
+        stop = true;
+
+        for (i = 0; i < READERS; ++i) {
+                pthread_join(thr[i], NULL);
+                lookups += stats[i].lookups;
+                if (stats[i].misses > 0 || stats[i].bad > 0) {
+                        printf("Reader %zu: %zu misses, %zu bad hops.\n",
+                               i, stats[i].misses, stats[i].bad);
+                        ret = -1;
+                }
+        }
+
+        printf("%d recomputations of %d entries in %ld ms, "
+               "%zu lookups without a miss.\n", UPDATES, ENTRIES,
+               (long) ts_diff_ms(&tic, &toc), lookups);
+
+        return ret;
+}
+
+int simple_pff_test(int     argc,
+                    char ** argv)
+{
+        int ret = 0;
+
+        (void) argc;
+        (void) argv;
+
+        pff = simple_pff_create();
+        if (pff == NULL) {
+                printf("Failed to create.\n");
+                return -1;
+        }
+
+        if (test_incremental())
+                ret = -1;
+        else if (test_concurrent())
+                ret = -1;
+
+        simple_pff_destroy(pff);
+
+        return ret;
+}
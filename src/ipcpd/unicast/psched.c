@@ -29,68 +29,289 @@
 #include "config.h"
 
 #include <ouroboros/errno.h>
+#include <ouroboros/list.h>
 #include <ouroboros/notifier.h>
+#include <ouroboros/pthread.h>
+#include <ouroboros/utils.h>
 
 #include "common/connmgr.h"
 #include "ipcp.h"
+#include "placement.h"
 #include "psched.h"
 
 #include <assert.h>
-#include <sched.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define PSCHED_WORKERS    (QOS_CUBE_MAX * IPCP_SCHED_THR_MUL)
+#define PSCHED_WEIGHT_MAX 64
+
 static int qos_prio [] = {
         QOS_PRIO_BE,
         QOS_PRIO_VIDEO,
         QOS_PRIO_VOICE,
 };
 
-struct psched {
-        fset_t *         set[QOS_CUBE_MAX];
-        next_packet_fn_t callback;
-        pthread_t        readers[QOS_CUBE_MAX * IPCP_SCHED_THR_MUL];
+/* Per-flow DRR state, the packets themselves stay in the rx rbuff. */
+struct psched_flow {
+        struct list_head next;
+        qoscube_t        qc;
+        size_t           backlog; /* Packets signalled, not yet read */
+        ssize_t          deficit; /* Bytes left in this round        */
+        size_t           weight;
+        bool             used;
+        bool             active;  /* In the active list of its cube  */
+        bool             granted; /* Got its quantum this round      */
+        bool             busy;    /* A worker is reading it          */
+};
+
+/* Packets a worker took from one flow for a burst. */
+struct psched_pick {
+        struct psched_flow * f;
+        size_t               n;     /* Packets to read         */
+        size_t               bytes; /* Bytes actually read     */
+        bool                 fail;  /* The flow failed to read */
 };
 
-struct sched_info {
-        struct psched * sch;
-        qoscube_t       qc;
+struct psched {
+        fset_t *           set;
+        next_packet_fn_t   callback;
+
+        /* Cubes in order of decreasing priority */
+        qoscube_t          order[QOS_CUBE_MAX];
+
+        struct psched_flow flows[PROG_MAX_FLOWS];
+        struct list_head   active[QOS_CUBE_MAX];
+        size_t             backlog;
+        pthread_mutex_t    lock;
+        pthread_cond_t     cond;
+
+        pthread_t          poller;
+        pthread_t          workers[PSCHED_WORKERS];
 };
 
-static void cleanup_reader(void * o)
+static void cleanup_poller(void * o)
 {
         fqueue_destroy((fqueue_t *) o);
 }
 
-static void * packet_reader(void * o)
+static void psched_enqueue(struct psched * psched,
+                           const int *     fds,
+                           size_t          n)
 {
-        struct psched *       sched;
-        struct shm_du_buff *  sdb;
-        int                   fd;
-        fqueue_t *            fq;
-        qoscube_t             qc;
+        struct psched_flow * f;
+        size_t               i;
+
+        if (n == 0)
+                return;
+
+        pthread_mutex_lock(&psched->lock);
+
+        for (i = 0; i < n; ++i) {
+                f = &psched->flows[fds[i]];
+                if (!f->used)
+                        continue;
+
+                ++f->backlog;
+                ++psched->backlog;
+
+                /* A busy flow is put back once the worker is done. */
+                if (!f->active && !f->busy) {
+                        list_add_tail(&f->next, &psched->active[f->qc]);
+                        f->active = true;
+                }
+        }
+
+        if (n > IPCP_SCHED_BURST)
+                pthread_cond_broadcast(&psched->cond);
+        else
+                pthread_cond_signal(&psched->cond);
+
+        pthread_mutex_unlock(&psched->lock);
+}
+
+static void psched_deactivate(struct psched *      psched,
+                              struct psched_flow * f)
+{
+        if (f->active)
+                list_del(&f->next);
+
+        psched->backlog -= f->backlog;
+
+        f->backlog = 0;
+        f->deficit = 0;
+        f->active  = false;
+        f->granted = false;
+}
+
+/*
+ * Strict priority between cubes, deficit round robin between the
+ * flows within a cube. Picks up to a burst of packets from a single
+ * cube, the picked flows are busy until psched_settle. Packet sizes
+ * are only known after the read, so a flow may overdraw its deficit
+ * by the tail of a burst. The debt carries over to the next round.
+ */
+static size_t psched_pick(struct psched *      psched,
+                          qoscube_t *          qc,
+                          struct psched_pick * pick)
+{
+        struct list_head *   h;
+        struct psched_flow * f;
+        size_t               n;
+        size_t               k;
+        size_t               m;
+        int                  i;
+
+        for (i = 0; i < QOS_CUBE_MAX; ++i) {
+                h = &psched->active[psched->order[i]];
+                n = 0;
+                m = 0;
+
+                while (n < IPCP_SCHED_BURST && !list_is_empty(h)) {
+                        f = list_first_entry(h, struct psched_flow, next);
+
+                        if (!f->granted) {
+                                f->deficit += IPCP_SCHED_QUANTUM * f->weight;
+                                f->granted  = true;
+                        }
+
+                        if (f->deficit <= 0) {
+                                /* Surplus carries over to next round. */
+                                list_del(&f->next);
+                                list_add_tail(&f->next, h);
+                                f->granted = false;
+                                continue;
+                        }
+
+                        k = MIN(f->backlog, IPCP_SCHED_BURST - n);
+
+                        list_del(&f->next);
+                        f->active = false;
+                        f->busy   = true;
+
+                        f->backlog       -= k;
+                        psched->backlog  -= k;
+
+                        pick[m].f     = f;
+                        pick[m].n     = k;
+                        pick[m].bytes = 0;
+                        pick[m].fail  = false;
+                        ++m;
+
+                        n += k;
+                }
+
+                if (m > 0) {
+                        *qc = psched->order[i];
+                        return m;
+                }
+        }
+
+        return 0;
+}
+
+/* Reads the picked packets, without the lock. Returns the count. */
+static size_t psched_read(struct psched *       psched,
+                          struct psched_pick *  pick,
+                          size_t                m,
+                          int *                 fds,
+                          struct shm_du_buff ** sdb)
+{
+        size_t i;
+        size_t j;
+        size_t n = 0;
+        int    fd;
+
+        for (i = 0; i < m; ++i) {
+                fd = pick[i].f - psched->flows;
+                for (j = 0; j < pick[i].n; ++j) {
+                        if (ipcp_flow_read(fd, &sdb[n]) < 0) {
+                                pick[i].fail = true;
+                                break;
+                        }
+
+                        pick[i].bytes += shm_du_buff_tail(sdb[n]) -
+                                shm_du_buff_head(sdb[n]);
+                        fds[n++] = fd;
+                }
+        }
+
+        return n;
+}
+
+/* Charges the picked flows and puts them back, with the lock. */
+static void psched_settle(struct psched *      psched,
+                          struct psched_pick * pick,
+                          size_t               m)
+{
+        struct psched_flow * f;
+        size_t               i;
+
+        for (i = 0; i < m; ++i) {
+                f = pick[i].f;
+
+                f->busy     = false;
+                f->deficit -= pick[i].bytes;
+
+                if (!f->used)
+                        continue;
+
+                if (pick[i].fail || f->backlog == 0) {
+                        psched_deactivate(psched, f);
+                        continue;
+                }
 
-        sched = ((struct sched_info *) o)->sch;
-        qc    = ((struct sched_info *) o)->qc;
+                /* Go on where it left off, or wait for the next round. */
+                if (f->deficit > 0) {
+                        list_add(&f->next, &psched->active[f->qc]);
+                } else {
+                        list_add_tail(&f->next, &psched->active[f->qc]);
+                        f->granted = false;
+                }
 
-        ipcp_lock_to_core();
+                f->active = true;
+        }
+}
 
-        free(o);
+static void * packet_poller(void * o)
+{
+        struct psched * psched = (struct psched *) o;
+        int             pkt[IPCP_SCHED_BURST];
+        size_t          n;
+        int             fd;
+        fqueue_t *      fq;
 
         fq = fqueue_create();
         if (fq == NULL)
                 return (void *) -1;
 
-        pthread_cleanup_push(cleanup_reader, fq);
+        pthread_cleanup_push(cleanup_poller, fq);
 
         while (true) {
-                int ret = fevent(sched->set[qc], fq, NULL);
+                int ret = fevent(psched->set, fq, NULL);
                 if (ret < 0)
                         continue;
 
+                n = 0;
+
                 while ((fd = fqueue_next(fq)) >= 0) {
-                        switch (fqueue_type(fq)) {
+                        int type = fqueue_type(fq);
+
+                        if (type == FLOW_PKT) {
+                                pkt[n++] = fd;
+                                if (n == IPCP_SCHED_BURST) {
+                                        psched_enqueue(psched, pkt, n);
+                                        n = 0;
+                                }
+                                continue;
+                        }
+
+                        /* Packets signalled before an event go first. */
+                        psched_enqueue(psched, pkt, n);
+                        n = 0;
+
+                        switch (type) {
                         case FLOW_DEALLOC:
                                 notifier_event(NOTIFY_DT_FLOW_DEALLOC, &fd);
                                 break;
@@ -100,16 +321,12 @@ static void * packet_reader(void * o)
                         case FLOW_UP:
                                 notifier_event(NOTIFY_DT_FLOW_UP, &fd);
                                 break;
-                        case FLOW_PKT:
-                                if (ipcp_flow_read(fd, &sdb))
-                                        continue;
-
-                                sched->callback(fd, qc, sdb);
-                                break;
                         default:
                                 break;
                         }
                 }
+
+                psched_enqueue(psched, pkt, n);
         }
 
         pthread_cleanup_pop(true);
@@ -117,10 +334,48 @@ static void * packet_reader(void * o)
         return (void *) 0;
 }
 
+/*
+ * Flows stay busy until their packets were handed up, so the packets
+ * of a flow go up in order, one burst at a time.
+ */
+static void * packet_worker(void * o)
+{
+        struct psched *       psched = (struct psched *) o;
+        struct shm_du_buff *  sdb[IPCP_SCHED_BURST];
+        int                   fds[IPCP_SCHED_BURST];
+        struct psched_pick    pick[IPCP_SCHED_BURST];
+        size_t                m = 0;
+        size_t                n;
+        qoscube_t             qc;
+
+        placement_bind("psched");
+
+        while (true) {
+                pthread_mutex_lock(&psched->lock);
+                pthread_cleanup_push(__cleanup_mutex_unlock, &psched->lock);
+
+                psched_settle(psched, pick, m);
+
+                while ((m = psched_pick(psched, &qc, pick)) == 0)
+                        pthread_cond_wait(&psched->cond, &psched->lock);
+
+                /* Hand the remaining backlog to another worker. */
+                if (psched->backlog > 0)
+                        pthread_cond_signal(&psched->cond);
+
+                pthread_cleanup_pop(true);
+
+                n = psched_read(psched, pick, m, fds, sdb);
+                if (n > 0)
+                        psched->callback(qc, fds, sdb, n);
+        }
+
+        return (void *) 0;
+}
+
 struct psched * psched_create(next_packet_fn_t callback)
 {
         struct psched *       psched;
-        struct sched_info *   infos[QOS_CUBE_MAX * IPCP_SCHED_THR_MUL];
         int                   i;
         int                   j;
 
@@ -130,70 +385,65 @@ struct psched * psched_create(next_packet_fn_t callback)
         if (psched == NULL)
                 goto fail_malloc;
 
+        memset(psched->flows, 0, sizeof(psched->flows));
+
         psched->callback = callback;
+        psched->backlog  = 0;
 
         for (i = 0; i < QOS_CUBE_MAX; ++i) {
-                psched->set[i] = fset_create();
-                if (psched->set[i] == NULL) {
-                        for (j = 0; j < i; ++j)
-                                fset_destroy(psched->set[j]);
-                        goto fail_flow_set;
-                }
+                list_head_init(&psched->active[i]);
+                psched->order[i] = i;
         }
 
-        for (i = 0; i < QOS_CUBE_MAX * IPCP_SCHED_THR_MUL; ++i) {
-                infos[i] = malloc(sizeof(*infos[i]));
-                if (infos[i] == NULL) {
-                        for (j = 0; j < i; ++j)
-                                free(infos[j]);
-                        goto fail_infos;
+        /* Insertion sort, there are only a handful of cubes. */
+        for (i = 1; i < QOS_CUBE_MAX; ++i) {
+                qoscube_t qc = psched->order[i];
+                for (j = i; j > 0; --j) {
+                        if (qos_prio[psched->order[j - 1]] >= qos_prio[qc])
+                                break;
+                        psched->order[j] = psched->order[j - 1];
                 }
-                infos[i]->sch = psched;
-                infos[i]->qc  = i % QOS_CUBE_MAX;
+                psched->order[j] = qc;
         }
 
-        for (i = 0; i < QOS_CUBE_MAX * IPCP_SCHED_THR_MUL; ++i) {
-                if (pthread_create(&psched->readers[i], NULL,
-                                   packet_reader, infos[i])) {
+        if (pthread_mutex_init(&psched->lock, NULL))
+                goto fail_lock;
+
+        if (pthread_cond_init(&psched->cond, NULL))
+                goto fail_cond;
+
+        psched->set = fset_create();
+        if (psched->set == NULL)
+                goto fail_flow_set;
+
+        for (i = 0; i < PSCHED_WORKERS; ++i) {
+                if (pthread_create(&psched->workers[i], NULL,
+                                   packet_worker, psched)) {
                         for (j = 0; j < i; ++j)
-                                pthread_cancel(psched->readers[j]);
+                                pthread_cancel(psched->workers[j]);
                         for (j = 0; j < i; ++j)
-                                pthread_join(psched->readers[j], NULL);
-                        for (j = i; j < QOS_CUBE_MAX * IPCP_SCHED_THR_MUL; ++j)
-                                free(infos[j]);
-                        goto fail_infos;
+                                pthread_join(psched->workers[j], NULL);
+                        goto fail_workers;
                 }
         }
 
-        for (i = 0; i < QOS_CUBE_MAX * IPCP_SCHED_THR_MUL; ++i) {
-                struct sched_param  par;
-                int                 pol = SCHED_RR;
-                int                 min;
-                int                 max;
-
-                min = sched_get_priority_min(pol);
-                max = sched_get_priority_max(pol);
-
-                min = (max - min) / 2;
-
-                par.sched_priority = min +
-                        (qos_prio[i % QOS_CUBE_MAX] * (max - min) / 99);
-
-                if (pthread_setschedparam(psched->readers[i], pol, &par))
-                        goto fail_sched;
-        }
+        if (pthread_create(&psched->poller, NULL, packet_poller, psched))
+                goto fail_poller;
 
         return psched;
 
- fail_sched:
-        for (j = 0; j < QOS_CUBE_MAX * IPCP_SCHED_THR_MUL; ++j)
-                pthread_cancel(psched->readers[j]);
-        for (j = 0; j < QOS_CUBE_MAX * IPCP_SCHED_THR_MUL; ++j)
-                pthread_join(psched->readers[j], NULL);
- fail_infos:
-        for (j = 0; j < QOS_CUBE_MAX; ++j)
-                fset_destroy(psched->set[j]);
+ fail_poller:
+        for (j = 0; j < PSCHED_WORKERS; ++j)
+                pthread_cancel(psched->workers[j]);
+        for (j = 0; j < PSCHED_WORKERS; ++j)
+                pthread_join(psched->workers[j], NULL);
+ fail_workers:
+        fset_destroy(psched->set);
  fail_flow_set:
+        pthread_cond_destroy(&psched->cond);
+ fail_cond:
+        pthread_mutex_destroy(&psched->lock);
+ fail_lock:
         free(psched);
  fail_malloc:
         return NULL;
@@ -205,35 +455,70 @@ void psched_destroy(struct psched * psched)
 
         assert(psched);
 
-        for (i = 0; i < QOS_CUBE_MAX * IPCP_SCHED_THR_MUL; ++i) {
-                pthread_cancel(psched->readers[i]);
-                pthread_join(psched->readers[i], NULL);
+        pthread_cancel(psched->poller);
+        pthread_join(psched->poller, NULL);
+
+        for (i = 0; i < PSCHED_WORKERS; ++i) {
+                pthread_cancel(psched->workers[i]);
+                pthread_join(psched->workers[i], NULL);
         }
 
-        for (i = 0; i < QOS_CUBE_MAX; ++i)
-                fset_destroy(psched->set[i]);
+        fset_destroy(psched->set);
+
+        pthread_cond_destroy(&psched->cond);
+        pthread_mutex_destroy(&psched->lock);
 
         free(psched);
 }
 
-void psched_add(struct psched * psched,
-                int             fd)
+void psched_add(struct psched *   psched,
+                int               fd,
+                const qosspec_t * qs)
 {
-        qoscube_t qc;
+        struct psched_flow * f;
+        qoscube_t            qc;
+        uint64_t             w;
 
         assert(psched);
+        assert(fd >= 0 && fd < PROG_MAX_FLOWS);
+        assert(qs);
+
+        w = MIN(qs->bandwidth / IPCP_SCHED_WEIGHT_BW, PSCHED_WEIGHT_MAX - 1);
 
         ipcp_flow_get_qoscube(fd, &qc);
-        fset_add(psched->set[qc], fd);
+
+        f = &psched->flows[fd];
+
+        pthread_mutex_lock(&psched->lock);
+
+        psched_deactivate(psched, f);
+
+        f->qc     = qc;
+        f->weight = 1 + w;
+        f->used   = true;
+
+        pthread_mutex_unlock(&psched->lock);
+
+        fset_add(psched->set, fd);
 }
 
 void psched_del(struct psched * psched,
                 int             fd)
 {
-        qoscube_t qc;
+        struct psched_flow * f;
 
         assert(psched);
+        assert(fd >= 0 && fd < PROG_MAX_FLOWS);
 
-        ipcp_flow_get_qoscube(fd, &qc);
-        fset_del(psched->set[qc], fd);
+        fset_del(psched->set, fd);
+
+        f = &psched->flows[fd];
+
+        pthread_mutex_lock(&psched->lock);
+
+        psched_deactivate(psched, f);
+
+        f->used = false;
+
+        pthread_mutex_unlock(&psched->lock);
 }
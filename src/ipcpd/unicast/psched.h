@@ -26,16 +26,20 @@
 #include <ouroboros/ipcp-dev.h>
 #include <ouroboros/fqueue.h>
 
-typedef void (* next_packet_fn_t)(int                  fd,
-                                  qoscube_t            qc,
-                                  struct shm_du_buff * sdb);
+/* Handles a burst of n packets, packet i arrived on fd[i]. */
+typedef void (* next_packet_fn_t)(qoscube_t             qc,
+                                  int *                 fd,
+                                  struct shm_du_buff ** sdb,
+                                  size_t                n);
 
 struct psched * psched_create(next_packet_fn_t callback);
 
 void            psched_destroy(struct psched * psched);
 
-void            psched_add(struct psched * psched,
-                           int             fd);
+/* Flows that request more bandwidth get a larger share of their cube. */
+void            psched_add(struct psched *   psched,
+                           int               fd,
+                           const qosspec_t * qs);
 
 void            psched_del(struct psched * psched,
                            int             fd);
@@ -30,7 +30,8 @@
 
 struct pol_routing_ops * r_ops;
 
-int routing_init(enum pol_routing pr)
+int routing_init(enum pol_routing          pr,
+                 const struct spf_timers * spf)
 {
         enum pol_pff pff_type;
 
@@ -51,15 +52,16 @@ int routing_init(enum pol_routing pr)
                 return -ENOTSUP;
         }
 
-        if (r_ops->init(pr))
+        if (r_ops->init(pr, spf))
                 return -1;
 
         return pff_type;
 }
 
-struct routing_i * routing_i_create(struct pff * pff)
+struct routing_i * routing_i_create(struct pff * pff,
+                                    qoscube_t    qc)
 {
-        return r_ops->routing_i_create(pff);
+        return r_ops->routing_i_create(pff, qc);
 }
 
 void routing_i_destroy(struct routing_i * instance)
@@ -67,6 +69,11 @@ void routing_i_destroy(struct routing_i * instance)
         return r_ops->routing_i_destroy(instance);
 }
 
+qoscube_t routing_cube_table(qoscube_t qc)
+{
+        return r_ops->cube_table(qc);
+}
+
 void routing_fini(void)
 {
         r_ops->fini();
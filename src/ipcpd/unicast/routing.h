@@ -25,17 +25,23 @@
 
 #include <ouroboros/ipcp.h>
 #include <ouroboros/qos.h>
+#include <ouroboros/qoscube.h>
 
 #include "pff.h"
 
 #include <stdint.h>
 
-int                routing_init(enum pol_routing pr);
+int                routing_init(enum pol_routing          pr,
+                                const struct spf_timers * spf);
 
 void               routing_fini(void);
 
-struct routing_i * routing_i_create(struct pff * pff);
+struct routing_i * routing_i_create(struct pff * pff,
+                                    qoscube_t    qc);
 
 void               routing_i_destroy(struct routing_i * instance);
 
+/* Lowest cube with the same forwarding table as qc, qc if none. */
+qoscube_t          routing_cube_table(qoscube_t qc);
+
 #endif /* OUROBOROS_IPCPD_UNICAST_ROUTING_H */
@@ -0,0 +1,206 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the active queue management on N-1 flows
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#include "aqm.c"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#define STEP  (1 * MILLION) /* One packet per ms */
+#define FD    3
+#define BURST 16
+
+static uint64_t sojourn;
+
+uint64_t ipcp_flow_sojourn(int fd)
+{
+        (void) fd;
+
+        return sojourn;
+}
+
+static int test_codel_below_target(void)
+{
+        struct codel c;
+        uint64_t     t;
+
+        memset(&c, 0, sizeof(c));
+
+        for (t = STEP; t < 10 * CODEL_INTERVAL; t += STEP) {
+                if (codel_signal(&c, CODEL_TARGET - 1, t)) {
+                        printf("CoDel signalled below target.\n");
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+static int test_codel_above_target(void)
+{
+        struct codel c;
+        uint64_t     t;
+        uint64_t     first = 0;
+        uint64_t     prev  = 0;
+        uint64_t     gap   = 0;
+        size_t       sigs  = 0;
+
+        memset(&c, 0, sizeof(c));
+
+        for (t = STEP; t < 20 * CODEL_INTERVAL; t += STEP) {
+                if (!codel_signal(&c, 2 * CODEL_TARGET, t))
+                        continue;
+
+                /* Signals land on the next packet, allow one of slack. */
+                if (sigs == 0) {
+                        first = t;
+                } else if (sigs > 1 && t - prev > gap + STEP) {
+                        printf("CoDel signal rate went down.\n");
+                        return -1;
+                }
+
+                if (sigs > 0)
+                        gap = t - prev;
+
+                prev = t;
+                ++sigs;
+        }
+
+        if (first < CODEL_INTERVAL) {
+                printf("CoDel signalled within the first interval.\n");
+                return -1;
+        }
+
+        if (sigs < 20 || gap >= CODEL_INTERVAL / 2) {
+                printf("CoDel signalled %zu times, last gap %" PRIu64
+                       " ns.\n", sigs, gap);
+                return -1;
+        }
+
+        /* The queue drains, signalling stops at once. */
+        if (codel_signal(&c, CODEL_TARGET / 2, t) || c.dropping) {
+                printf("CoDel kept signalling below target.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+static int test_pie(void)
+{
+        struct pie p;
+        uint64_t   t;
+        size_t     sigs = 0;
+
+        memset(&p, 0, sizeof(p));
+        p.burst = PIE_MAX_BURST;
+        p.rnd   = 1;
+
+        for (t = STEP; t < 10 * PIE_MAX_BURST; t += STEP) {
+                if (pie_signal(&p, PIE_TARGET / 4, t)) {
+                        printf("PIE signalled at low delay.\n");
+                        return -1;
+                }
+        }
+
+        for (; t < 100 * PIE_MAX_BURST; t += STEP)
+                if (pie_signal(&p, 4 * PIE_TARGET, t))
+                        ++sigs;
+
+        if (sigs == 0 || p.prob < PIE_PROB_MAX / 10) {
+                printf("PIE probability %" PRIu64 " after %zu signals.\n",
+                       p.prob, sigs);
+                return -1;
+        }
+
+        for (; t < 400 * PIE_MAX_BURST; t += STEP)
+                (void) pie_signal(&p, 0, t);
+
+        if (p.prob != 0) {
+                printf("PIE probability did not decay.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+static int test_enqueue(void)
+{
+        enum aqm_act act[BURST];
+        size_t       i;
+
+        if (aqm_init(true)) {
+                printf("Failed to init.\n");
+                return -1;
+        }
+
+        aqm.pol = AQM_CODEL;
+        sojourn = 0;
+
+        aqm_enqueue_n(FD, act, BURST);
+
+        for (i = 0; i < BURST; ++i) {
+                if (act[i] != AQM_PASS) {
+                        printf("Packet %zu not passed on empty queue.\n", i);
+                        goto fail;
+                }
+        }
+
+        /* Pretend the queue was above target for an interval. */
+        sojourn = 2 * CODEL_TARGET;
+        aqm.flows[FD].u.codel.first_above = 1;
+
+        aqm_enqueue_n(FD, act, BURST);
+
+        if (act[0] != AQM_MARK) {
+                printf("Packet not marked on standing queue.\n");
+                goto fail;
+        }
+
+        aqm_fini();
+
+        return 0;
+ fail:
+        aqm_fini();
+        return -1;
+}
+
+int aqm_test(int     argc,
+             char ** argv)
+{
+        int ret = 0;
+
+        (void) argc;
+        (void) argv;
+
+        if (isqrt(1ULL << 20) != 1 << 10 || isqrt(99) != 9) {
+                printf("Integer square root is off.\n");
+                ret = -1;
+        }
+
+        ret |= test_codel_below_target();
+        ret |= test_codel_above_target();
+        ret |= test_pie();
+        ret |= test_enqueue();
+
+        return ret;
+}
@@ -0,0 +1,158 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the DT PCI codecs
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "dt_pci.c"
+
+#include <ouroboros/time_utils.h>
+
+#include <stdio.h>
+#include <time.h>
+
+#define ADDR     0x0102030405060708ULL
+#define EID      0x1112131415161718ULL
+#define TTL      60
+#define ROUNDS   10000000
+
+static uint64_t mask(uint64_t v,
+                     size_t   len)
+{
+        return len == 8 ? v : v & ((1ULL << (len * 8)) - 1);
+}
+
+static int check_layout(uint8_t addr_size,
+                        uint8_t eid_size)
+{
+        struct dt_pci pci;
+        struct dt_pci out;
+        uint8_t       head[32];
+        uint8_t       gen[32];
+        size_t        i;
+
+        dt_pci_init(addr_size, eid_size, TTL);
+
+        pci.dst_addr = mask(ADDR, addr_size);
+        pci.qc       = QOS_CUBE_VOICE;
+        pci.ecn      = 7;
+        pci.eid      = mask(EID, eid_size);
+
+        memset(head, 0, sizeof(head));
+        dt_pci_ser(head, &pci);
+
+        /* Network byte order, least significant bytes last. */
+        for (i = 0; i < addr_size; ++i) {
+                if (head[i] != 8 - addr_size + i + 1) {
+                        printf("Bad address encoding for %u/%u.\n",
+                               addr_size, eid_size);
+                        return -1;
+                }
+        }
+
+        for (i = 0; i < eid_size; ++i) {
+                if (head[dt_pci_info.eid_o + i] != 0x18 - eid_size + i + 1) {
+                        printf("Bad eid encoding for %u/%u.\n",
+                               addr_size, eid_size);
+                        return -1;
+                }
+        }
+
+        memset(gen, 0, sizeof(gen));
+        dt_pci_ser_gen(gen, &pci);
+
+        if (memcmp(head, gen, sizeof(head))) {
+                printf("Codec mismatch with generic for %u/%u.\n",
+                       addr_size, eid_size);
+                return -1;
+        }
+
+        memset(&out, 0, sizeof(out));
+        dt_pci_des(head, &out);
+
+        if (out.dst_addr != pci.dst_addr || out.eid != pci.eid ||
+            out.qc != pci.qc || out.ecn != pci.ecn || out.ttl != TTL - 1) {
+                printf("Roundtrip failed for %u/%u.\n", addr_size, eid_size);
+                return -1;
+        }
+
+        if (head[dt_pci_info.ttl_o] != TTL - 1) {
+                printf("TTL not decreased in place for %u/%u.\n",
+                       addr_size, eid_size);
+                return -1;
+        }
+
+        return 0;
+}
+
+static double bench(dt_pci_fn_t des)
+{
+        struct timespec tic;
+        struct timespec toc;
+        struct dt_pci   pci;
+        uint8_t         head[32];
+        uint64_t        sum = 0;
+        size_t          i;
+
+        memset(&pci, 0, sizeof(pci));
+        pci.dst_addr = ADDR;
+        pci.eid      = EID;
+
+        dt_pci_ser(head, &pci);
+
+        clock_gettime(CLOCK_MONOTONIC, &tic);
+
+        for (i = 0; i < ROUNDS; ++i) {
+                head[dt_pci_info.ttl_o] = TTL;
+                des(head, &pci);
+                sum += pci.dst_addr ^ pci.eid;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &toc);
+
+        if (sum == 0)
+                printf("Unexpected checksum.\n");
+
+        return ts_diff_ns(&tic, &toc) / (double) ROUNDS;
+}
+
+int dt_pci_test(int     argc,
+                char ** argv)
+{
+        uint8_t addr[] = { 4, 8, 2, 3 };
+        size_t  i;
+
+        (void) argc;
+        (void) argv;
+
+        /* dt only runs with 64 bit EIDs. */
+        for (i = 0; i < sizeof(addr); ++i)
+                if (check_layout(addr[i], 8))
+                        return -1;
+
+        for (i = 0; i < 2; ++i) {
+                dt_pci_init(addr[i], 8, TTL);
+                printf("Decode %u/8: %.2f ns generic, %.2f ns fixed.\n",
+                       addr[i], bench(dt_pci_des_gen), bench(dt_pci_info.des));
+        }
+
+        return 0;
+}
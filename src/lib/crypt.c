@@ -29,9 +29,41 @@
 
 #include <openssl/bio.h>
 
-#define IVSZ     16
+#define IVSZ     12  /* GCM nonce                        */
+#define TAGSZ    16  /* GCM tag, behind the ciphertext   */
+#define EPOCHSZ  1   /* Key epoch in front of the IV     */
+#define MAXSKIP  64  /* Epochs the receiver may jump    */
+#define NONCESZ  16
+#define KCACHESZ 16  /* Peers with a cached ECDH secret */
+#define PUBKEYSZ 256 /* DER encoded public key          */
 /* SYMMKEYSZ defined in dev.c */
 
+struct ecdh_pkp {
+        EVP_PKEY * kp;
+        uint8_t    nonce[NONCESZ];
+};
+
+/*
+ * All flows share one ephemeral key pair, replaced after
+ * ECDH_KEY_LIFETIME seconds. Secrets agreed with a peer's public key
+ * are kept until then, so repeat flows to the same peer only hash
+ * the cached secret with fresh nonces. Dropping the key pair and the
+ * cache on rotation bounds what a compromise can decrypt.
+ */
+static struct {
+        pthread_mutex_t mtx;
+        EVP_PKEY *      kp;
+        uint8_t         pk[PUBKEYSZ];       /* Encoding is costly     */
+        size_t          len;
+        time_t          t;
+        struct {
+                EVP_PKEY * kp;              /* Own key pair used      */
+                uint8_t    id[SYMMKEYSZ];   /* Hash of the peer's key */
+                uint8_t    s[SYMMKEYSZ];    /* Agreed secret          */
+        } c[KCACHESZ];
+        size_t          next;
+} kc = { PTHREAD_MUTEX_INITIALIZER, NULL, {0}, 0, 0, {{ NULL, {0}, {0} }}, 0 };
+
 /*
  * Derive the common secret from
  *  your public key pair (kp)
@@ -92,83 +124,174 @@ static int __openssl_ecdh_derive_secret(EVP_PKEY * kp,
 
 static int __openssl_ecdh_gen_key(void ** kp)
 {
-        EVP_PKEY_CTX * ctx    = NULL;
-        EVP_PKEY_CTX * kctx   = NULL;
-        EVP_PKEY *     params = NULL;
+        EVP_PKEY_CTX * ctx;
         int            ret;
 
         ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
         if (ctx == NULL)
                 goto fail_new_id;
 
-        ret = EVP_PKEY_paramgen_init(ctx);
+        ret = EVP_PKEY_keygen_init(ctx);
         if (ret != 1)
-                goto fail_paramgen;
+                goto fail_keygen;
 
+        /* Named curve, no need to generate parameters first. */
         ret = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1);
-        if (ret != 1)
-                goto fail_paramgen;
-
-        ret = EVP_PKEY_paramgen(ctx, &params);
-        if (ret != 1)
-                goto fail_paramgen;
-
-        kctx = EVP_PKEY_CTX_new(params, NULL);
-        if (kctx == NULL)
-                goto fail_keygen_init;
-
-        ret = EVP_PKEY_keygen_init(kctx);
         if (ret != 1)
                 goto fail_keygen;
 
-        ret = EVP_PKEY_keygen(kctx, (EVP_PKEY **) kp);
+        ret = EVP_PKEY_keygen(ctx, (EVP_PKEY **) kp);
         if (ret != 1)
                 goto fail_keygen;
 
-        EVP_PKEY_free(params);
-        EVP_PKEY_CTX_free(kctx);
         EVP_PKEY_CTX_free(ctx);
 
         return 0;
 
  fail_keygen:
-        EVP_PKEY_CTX_free(kctx);
- fail_keygen_init:
-        EVP_PKEY_free(params);
- fail_paramgen:
         EVP_PKEY_CTX_free(ctx);
  fail_new_id:
         return -ECRYPT;
 }
 
+/* Call with kc.mtx held. */
+static int __openssl_ecdh_rotate(time_t now)
+{
+        EVP_PKEY * kp = NULL;
+        uint8_t    pk[PUBKEYSZ];
+        uint8_t *  pos;
+        int        len;
+
+        if (__openssl_ecdh_gen_key((void **) &kp) < 0)
+                return -ECRYPT;
+
+        if (i2d_PUBKEY(kp, NULL) > PUBKEYSZ)
+                goto fail_pubkey;
+
+        pos = pk; /* i2d_PUBKEY increments the pointer, don't use pk! */
+        len = i2d_PUBKEY(kp, &pos);
+        if (len < 0)
+                goto fail_pubkey;
+
+        if (kc.kp != NULL)
+                EVP_PKEY_free(kc.kp);
+
+        memcpy(kc.pk, pk, len);
+
+        kc.kp   = kp;
+        kc.len  = len;
+        kc.t    = now;
+        kc.next = 0;
+
+        memset(kc.c, 0, sizeof(kc.c));
+
+        return 0;
+
+ fail_pubkey:
+        EVP_PKEY_free(kp);
+        return -ECRYPT;
+}
+
+static int __openssl_ecdh_lookup(EVP_PKEY *      kp,
+                                 const uint8_t * id,
+                                 uint8_t *       s)
+{
+        size_t i;
+
+        pthread_mutex_lock(&kc.mtx);
+
+        for (i = 0; i < KCACHESZ; ++i) {
+                if (kc.c[i].kp == kp && !memcmp(kc.c[i].id, id, SYMMKEYSZ)) {
+                        memcpy(s, kc.c[i].s, SYMMKEYSZ);
+                        pthread_mutex_unlock(&kc.mtx);
+                        return 0;
+                }
+        }
+
+        pthread_mutex_unlock(&kc.mtx);
+
+        return -1;
+}
+
+static void __openssl_ecdh_store(EVP_PKEY *      kp,
+                                 const uint8_t * id,
+                                 const uint8_t * s)
+{
+        pthread_mutex_lock(&kc.mtx);
+
+        /* Don't cache secrets for a key pair that was rotated out. */
+        if (kp == kc.kp) {
+                kc.c[kc.next].kp = kp;
+                memcpy(kc.c[kc.next].id, id, SYMMKEYSZ);
+                memcpy(kc.c[kc.next].s, s, SYMMKEYSZ);
+                kc.next = (kc.next + 1) % KCACHESZ;
+        }
+
+        pthread_mutex_unlock(&kc.mtx);
+}
+
+/*
+ * The public key sent to the peer is the DER encoded key of the
+ * shared key pair, followed by a random nonce for this flow.
+ */
 static ssize_t openssl_ecdh_pkp_create(void **   pkp,
                                        uint8_t * pk)
 {
-        uint8_t *       pos;
-        ssize_t         len;
+        struct ecdh_pkp * p;
+        struct timespec   now;
+        ssize_t           len;
 
         assert(pkp != NULL);
         assert(*pkp == NULL);
         assert(pk != NULL);
 
-        if (__openssl_ecdh_gen_key(pkp) < 0)
-                return -ECRYPT;
+        p = malloc(sizeof(*p));
+        if (p == NULL)
+                goto fail_malloc;
 
-        assert(*pkp != NULL);
+        if (random_buffer(p->nonce, NONCESZ) < 0)
+                goto fail_nonce;
 
-        pos = pk; /* i2d_PUBKEY increments the pointer, don't use buf! */
-        len = i2d_PUBKEY(*pkp, &pos);
-        if (len < 0) {
-                EVP_PKEY_free(*pkp);
-                return -ECRYPT;
+        clock_gettime(PTHREAD_COND_CLOCK, &now);
+
+        pthread_mutex_lock(&kc.mtx);
+
+        if (kc.kp == NULL || now.tv_sec - kc.t >= ECDH_KEY_LIFETIME) {
+                if (__openssl_ecdh_rotate(now.tv_sec) < 0) {
+                        pthread_mutex_unlock(&kc.mtx);
+                        goto fail_nonce;
+                }
         }
 
-        return len;
+        EVP_PKEY_up_ref(kc.kp);
+        p->kp = kc.kp;
+
+        len = kc.len;
+        memcpy(pk, kc.pk, len);
+
+        pthread_mutex_unlock(&kc.mtx);
+
+        memcpy(pk + len, p->nonce, NONCESZ);
+
+        *pkp = p;
+
+        return len + NONCESZ;
+
+ fail_nonce:
+        free(p);
+ fail_malloc:
+        return -ECRYPT;
 }
 
 static void openssl_ecdh_pkp_destroy(void * pkp)
 {
-        EVP_PKEY_free((EVP_PKEY *) pkp);
+        struct ecdh_pkp * p = (struct ecdh_pkp *) pkp;
+
+        if (p == NULL)
+                return;
+
+        EVP_PKEY_free(p->kp);
+        free(p);
 }
 
 static int openssl_ecdh_derive(void *    pkp,
@@ -176,43 +299,194 @@ static int openssl_ecdh_derive(void *    pkp,
                                size_t    len,
                                uint8_t * s)
 {
-        uint8_t *  pos;
-        EVP_PKEY * pub;
-
-        pos = pk; /* d2i_PUBKEY increments the pointer, don't use key ptr! */
-        pub = d2i_PUBKEY(NULL, (const uint8_t **) &pos, (long) len);
-        if (pub == NULL)
+        struct ecdh_pkp * p = (struct ecdh_pkp *) pkp;
+        uint8_t *         pos;
+        uint8_t *         rn;
+        EVP_PKEY *        pub;
+        uint8_t           id[SYMMKEYSZ];
+        uint8_t           buf[SYMMKEYSZ + 2 * NONCESZ];
+
+        if (len <= NONCESZ)
                 return -ECRYPT;
 
-        if (__openssl_ecdh_derive_secret(pkp, pub, s) < 0) {
+        len -= NONCESZ;
+        rn   = pk + len;
+
+        mem_hash(HASH_SHA3_256, id, pk, len);
+
+        if (__openssl_ecdh_lookup(p->kp, id, buf) < 0) {
+                pos = pk; /* d2i_PUBKEY increments the pointer! */
+                pub = d2i_PUBKEY(NULL, (const uint8_t **) &pos, (long) len);
+                if (pub == NULL)
+                        return -ECRYPT;
+
+                if (__openssl_ecdh_derive_secret(p->kp, pub, buf) < 0) {
+                        EVP_PKEY_free(pub);
+                        return -ECRYPT;
+                }
+
                 EVP_PKEY_free(pub);
-                return -ECRYPT;
+
+                __openssl_ecdh_store(p->kp, id, buf);
+        }
+
+        /* Both ends hash the nonces in the same order. */
+        if (memcmp(p->nonce, rn, NONCESZ) < 0) {
+                memcpy(buf + SYMMKEYSZ, p->nonce, NONCESZ);
+                memcpy(buf + SYMMKEYSZ + NONCESZ, rn, NONCESZ);
+        } else {
+                memcpy(buf + SYMMKEYSZ, rn, NONCESZ);
+                memcpy(buf + SYMMKEYSZ + NONCESZ, p->nonce, NONCESZ);
         }
 
-        EVP_PKEY_free(pub);
+        mem_hash(HASH_SHA3_256, s, buf, sizeof(buf));
+
+        memset(buf, 0, sizeof(buf));
 
         return 0;
 }
 
+static void openssl_ecdh_fini(void)
+{
+        pthread_mutex_lock(&kc.mtx);
+
+        if (kc.kp != NULL)
+                EVP_PKEY_free(kc.kp);
+
+        kc.kp = NULL;
+
+        memset(kc.c, 0, sizeof(kc.c));
+
+        pthread_mutex_unlock(&kc.mtx);
+}
+
 /*
- * AES encryption calls. If FRCT is disabled, we should generate a
- * 128-bit random IV and append it to the packet.  If the flow is
- * reliable, we could initialize the context once, and consider the
- * stream a single encrypted message to avoid initializing the
- * encryption context for each packet.
+ * AES-GCM encryption calls. Each packet gets a random 96-bit IV in
+ * front and the tag at the back. The key epoch in front of the IV is
+ * authenticated as additional data.
+ *
+ * Keys are rotated in flight. The sender ratchets its key forward
+ * after REKEY_PKTS packets or REKEY_TIME seconds and tags each
+ * packet with the epoch of its key. The receiver follows the
+ * ratchet when a packet of a newer epoch authenticates and keeps the
+ * previous key to decrypt packets that were still in flight. Neither
+ * side waits.
  */
 
+struct openssl_ctx {
+        EVP_CIPHER_CTX * tx_ctx;
+        EVP_CIPHER_CTX * rx_ctx;
+
+        pthread_mutex_t  tx_lock;        /* tx_ctx and tx state   */
+        pthread_mutex_t  rx_lock;        /* rx_ctx and rx state   */
+
+        struct {
+                uint8_t  key[SYMMKEYSZ];
+                uint8_t  epoch;
+                size_t   cnt;            /* Packets with this key */
+                time_t   t;              /* Key taken in use      */
+        } tx;
+
+        struct {
+                uint8_t  key[SYMMKEYSZ];
+                uint8_t  prev[SYMMKEYSZ];  /* Key of epoch - 1    */
+                uint8_t  epoch;
+                bool     has_prev;
+        } rx;
+};
+
+/* One way, the old key can't be recovered from the new one. */
+static void __openssl_ratchet(uint8_t * key)
+{
+        uint8_t next[SYMMKEYSZ];
+
+        mem_hash(HASH_SHA3_256, next, key, SYMMKEYSZ);
+        memcpy(key, next, SYMMKEYSZ);
+        memset(next, 0, SYMMKEYSZ);
+}
+
+static void __openssl_tx_rekey(struct openssl_ctx * c)
+{
+        struct timespec now;
+
+        clock_gettime(PTHREAD_COND_CLOCK, &now);
+
+        if (++c->tx.cnt < REKEY_PKTS && now.tv_sec - c->tx.t < REKEY_TIME)
+                return;
+
+        __openssl_ratchet(c->tx.key);
+
+        c->tx.epoch++;
+        c->tx.cnt = 0;
+        c->tx.t   = now.tv_sec;
+}
+
+/*
+ * Key for a received epoch, -1 if it is unusable. A newer key is
+ * derived into key, with the one before it in prev. The rx state is
+ * only moved forward by __openssl_rx_commit once the packet checks out.
+ */
+static int __openssl_rx_key(struct openssl_ctx * c,
+                            uint8_t              epoch,
+                            uint8_t *            key,
+                            uint8_t *            prev)
+{
+        int8_t d = (int8_t) (epoch - c->rx.epoch);
+
+        if (d == 0) {
+                memcpy(key, c->rx.key, SYMMKEYSZ);
+                return 0;
+        }
+
+        if (d == -1) {
+                if (!c->rx.has_prev)
+                        return -1;
+                memcpy(key, c->rx.prev, SYMMKEYSZ);
+                return 0;
+        }
+
+        if (d < 0 || d > MAXSKIP)
+                return -1;
+
+        memcpy(key, c->rx.key, SYMMKEYSZ);
+
+        while (d-- > 0) {
+                memcpy(prev, key, SYMMKEYSZ);
+                __openssl_ratchet(key);
+        }
+
+        return 0;
+}
+
+static void __openssl_rx_commit(struct openssl_ctx * c,
+                                uint8_t              epoch,
+                                const uint8_t *      key,
+                                const uint8_t *      prev)
+{
+        if ((int8_t) (epoch - c->rx.epoch) <= 0)
+                return;
+
+        memcpy(c->rx.key, key, SYMMKEYSZ);
+        memcpy(c->rx.prev, prev, SYMMKEYSZ);
+
+        c->rx.epoch    = epoch;
+        c->rx.has_prev = true;
+}
+
 static int openssl_encrypt(struct flow *        f,
                            struct shm_du_buff * sdb)
 {
-        uint8_t * out;
-        uint8_t * in;
-        uint8_t * head;
-        uint8_t   iv[IVSZ];
-        int       in_sz;
-        int       out_sz;
-        int       tmp_sz;
-        int       ret;
+        struct openssl_ctx * c = (struct openssl_ctx *) f->ctx;
+        uint8_t *            out;
+        uint8_t *            in;
+        uint8_t *            head;
+        uint8_t *            tag;
+        uint8_t              iv[IVSZ];
+        uint8_t              epoch;
+        int                  in_sz;
+        int                  out_sz;
+        int                  tmp_sz;
+        int                  ret;
 
         in = shm_du_buff_head(sdb);
         in_sz = shm_du_buff_tail(sdb) - in;
@@ -224,50 +498,72 @@ static int openssl_encrypt(struct flow *        f,
         if (out == NULL)
                 goto fail_iv;
 
-        EVP_CIPHER_CTX_reset(f->ctx);
+        pthread_mutex_lock(&c->tx_lock);
+
+        __openssl_tx_rekey(c);
+
+        epoch = c->tx.epoch;
 
-        ret = EVP_EncryptInit_ex(f->ctx,
-                                 EVP_aes_256_cbc(),
+        EVP_CIPHER_CTX_reset(c->tx_ctx);
+
+        ret = EVP_EncryptInit_ex(c->tx_ctx,
+                                 EVP_aes_256_gcm(),
                                  NULL,
-                                 f->key,
+                                 c->tx.key,
                                  iv);
         if (ret != 1)
                 goto fail_encrypt_init;
 
-        ret = EVP_EncryptUpdate(f->ctx, out, &tmp_sz, in, in_sz);
+        ret = EVP_EncryptUpdate(c->tx_ctx, NULL, &tmp_sz, &epoch, EPOCHSZ);
+        if (ret != 1)
+                goto fail_encrypt;
+
+        ret = EVP_EncryptUpdate(c->tx_ctx, out, &tmp_sz, in, in_sz);
         if (ret != 1)
                 goto fail_encrypt;
 
         out_sz = tmp_sz;
-        ret =  EVP_EncryptFinal_ex(f->ctx, out + tmp_sz, &tmp_sz);
+        ret =  EVP_EncryptFinal_ex(c->tx_ctx, out + tmp_sz, &tmp_sz);
         if (ret != 1)
                 goto fail_encrypt;
 
         out_sz += tmp_sz;
 
-        EVP_CIPHER_CTX_cleanup(f->ctx);
-
-        assert(out_sz >= in_sz);
+        assert(out_sz == in_sz);
 
-        head = shm_du_buff_head_alloc(sdb, IVSZ);
+        head = shm_du_buff_head_alloc(sdb, EPOCHSZ + IVSZ);
         if (head == NULL)
                 goto fail_encrypt;
 
-        if (shm_du_buff_tail_alloc(sdb, out_sz - in_sz) == NULL)
+        tag = shm_du_buff_tail_alloc(sdb, TAGSZ);
+        if (tag == NULL)
                 goto fail_tail_alloc;
 
-        memcpy(head, iv, IVSZ);
+        ret = EVP_CIPHER_CTX_ctrl(c->tx_ctx, EVP_CTRL_GCM_GET_TAG, TAGSZ,
+                                  tag);
+        if (ret != 1)
+                goto fail_tag;
+
+        EVP_CIPHER_CTX_cleanup(c->tx_ctx);
+
+        pthread_mutex_unlock(&c->tx_lock);
+
+        head[0] = epoch;
+        memcpy(head + EPOCHSZ, iv, IVSZ);
         memcpy(in, out, out_sz);
 
         free(out);
 
         return 0;
 
+ fail_tag:
+        shm_du_buff_tail_release(sdb, TAGSZ);
  fail_tail_alloc:
-        shm_du_buff_head_release(sdb, IVSZ);
+        shm_du_buff_head_release(sdb, EPOCHSZ + IVSZ);
  fail_encrypt:
-        EVP_CIPHER_CTX_cleanup(f->ctx);
+        EVP_CIPHER_CTX_cleanup(c->tx_ctx);
  fail_encrypt_init:
+        pthread_mutex_unlock(&c->tx_lock);
         free(out);
  fail_iv:
         return -ECRYPT;
@@ -276,79 +572,168 @@ static int openssl_encrypt(struct flow *        f,
 static int openssl_decrypt(struct flow *        f,
                            struct shm_du_buff * sdb)
 {
-        uint8_t * in;
-        uint8_t * out;
-        uint8_t   iv[IVSZ];
-        int       ret;
-        int       out_sz;
-        int       in_sz;
-        int       tmp_sz;
-
-        in = shm_du_buff_head_release(sdb, IVSZ);
+        struct openssl_ctx * c = (struct openssl_ctx *) f->ctx;
+        uint8_t              key[SYMMKEYSZ];
+        uint8_t              prev[SYMMKEYSZ];
+        uint8_t *            in;
+        uint8_t *            out;
+        uint8_t *            tag;
+        uint8_t              iv[IVSZ];
+        uint8_t              epoch;
+        int                  ret;
+        int                  out_sz;
+        int                  in_sz;
+        int                  tmp_sz;
 
-        memcpy(iv, in, IVSZ);
+        in_sz = shm_du_buff_tail(sdb) - shm_du_buff_head(sdb);
+        if (in_sz < (int) (EPOCHSZ + IVSZ + TAGSZ))
+                goto fail_malloc;
 
         in = shm_du_buff_head(sdb);
 
-        in_sz = shm_du_buff_tail(sdb) - shm_du_buff_head(sdb);
+        epoch = in[0];
+        memcpy(iv, in + EPOCHSZ, IVSZ);
+
+        in += EPOCHSZ + IVSZ;
+        in_sz -= EPOCHSZ + IVSZ + TAGSZ;
+        tag = in + in_sz;
 
-        out = malloc(in_sz);
+        out = malloc(in_sz + EVP_MAX_BLOCK_LENGTH);
         if (out == NULL)
                 goto fail_malloc;
 
-        EVP_CIPHER_CTX_reset(f->ctx);
+        pthread_mutex_lock(&c->rx_lock);
+
+        if (__openssl_rx_key(c, epoch, key, prev) < 0)
+                goto fail_key;
+
+        EVP_CIPHER_CTX_reset(c->rx_ctx);
 
-        ret = EVP_DecryptInit_ex(f->ctx,
-                                 EVP_aes_256_cbc(),
+        ret = EVP_DecryptInit_ex(c->rx_ctx,
+                                 EVP_aes_256_gcm(),
                                  NULL,
-                                 f->key,
+                                 key,
                                  iv);
         if (ret != 1)
                 goto fail_decrypt_init;
 
-        ret = EVP_DecryptUpdate(f->ctx, out, &tmp_sz, in, in_sz);
+        ret = EVP_DecryptUpdate(c->rx_ctx, NULL, &tmp_sz, &epoch, EPOCHSZ);
+        if (ret != 1)
+                goto fail_decrypt;
+
+        ret = EVP_DecryptUpdate(c->rx_ctx, out, &tmp_sz, in, in_sz);
         if (ret != 1)
                 goto fail_decrypt;
 
         out_sz = tmp_sz;
 
-        ret = EVP_DecryptFinal_ex(f->ctx, out + tmp_sz, &tmp_sz);
+        ret = EVP_CIPHER_CTX_ctrl(c->rx_ctx, EVP_CTRL_GCM_SET_TAG, TAGSZ,
+                                  tag);
+        if (ret != 1)
+                goto fail_decrypt;
+
+        /* Fails if the packet or its epoch was tampered with. */
+        ret = EVP_DecryptFinal_ex(c->rx_ctx, out + tmp_sz, &tmp_sz);
         if (ret != 1)
                 goto fail_decrypt;
 
         out_sz += tmp_sz;
 
-        assert(out_sz <= in_sz);
+        EVP_CIPHER_CTX_cleanup(c->rx_ctx);
 
-        shm_du_buff_tail_release(sdb, in_sz - out_sz);
+        __openssl_rx_commit(c, epoch, key, prev);
 
-        memcpy(in, out, out_sz);
+        pthread_mutex_unlock(&c->rx_lock);
+
+        memset(key, 0, SYMMKEYSZ);
+        memset(prev, 0, SYMMKEYSZ);
+
+        assert(out_sz == in_sz);
+
+        shm_du_buff_head_release(sdb, EPOCHSZ + IVSZ);
+        shm_du_buff_tail_release(sdb, TAGSZ);
+
+        memcpy(shm_du_buff_head(sdb), out, out_sz);
 
         free(out);
 
         return 0;
 
  fail_decrypt:
-        EVP_CIPHER_CTX_cleanup(f->ctx);
+        EVP_CIPHER_CTX_cleanup(c->rx_ctx);
  fail_decrypt_init:
+ fail_key:
+        pthread_mutex_unlock(&c->rx_lock);
+        memset(key, 0, SYMMKEYSZ);
+        memset(prev, 0, SYMMKEYSZ);
         free(out);
  fail_malloc:
         return -ECRYPT;
 
 }
 
-static int openssl_crypt_init(void ** ctx)
+static int openssl_crypt_init(void **         ctx,
+                              const uint8_t * key)
 {
-        *ctx = EVP_CIPHER_CTX_new();
-        if (*ctx == NULL)
-                return -ECRYPT;
+        struct openssl_ctx *  c;
+        struct timespec       now;
+
+        c = malloc(sizeof(*c));
+        if (c == NULL)
+                goto fail_malloc;
+
+        memset(c, 0, sizeof(*c));
+
+        c->tx_ctx = EVP_CIPHER_CTX_new();
+        if (c->tx_ctx == NULL)
+                goto fail_tx_ctx;
+
+        c->rx_ctx = EVP_CIPHER_CTX_new();
+        if (c->rx_ctx == NULL)
+                goto fail_rx_ctx;
+
+        if (pthread_mutex_init(&c->tx_lock, NULL))
+                goto fail_tx_lock;
+
+        if (pthread_mutex_init(&c->rx_lock, NULL))
+                goto fail_rx_lock;
+
+        clock_gettime(PTHREAD_COND_CLOCK, &now);
+
+        memcpy(c->tx.key, key, SYMMKEYSZ);
+        memcpy(c->rx.key, key, SYMMKEYSZ);
+
+        c->tx.t = now.tv_sec;
+
+        *ctx = c;
 
         return 0;
+
+ fail_rx_lock:
+        pthread_mutex_destroy(&c->tx_lock);
+ fail_tx_lock:
+        EVP_CIPHER_CTX_free(c->rx_ctx);
+ fail_rx_ctx:
+        EVP_CIPHER_CTX_free(c->tx_ctx);
+ fail_tx_ctx:
+        free(c);
+ fail_malloc:
+        return -ECRYPT;
 }
 
 static void openssl_crypt_fini(void * ctx)
 {
-         EVP_CIPHER_CTX_free(ctx);
+        struct openssl_ctx * c = (struct openssl_ctx *) ctx;
+
+        EVP_CIPHER_CTX_free(c->tx_ctx);
+        EVP_CIPHER_CTX_free(c->rx_ctx);
+
+        pthread_mutex_destroy(&c->tx_lock);
+        pthread_mutex_destroy(&c->rx_lock);
+
+        memset(c, 0, sizeof(*c));
+
+        free(c);
 }
 
 #endif /* HAVE_OPENSSL */
@@ -399,6 +784,13 @@ static int crypt_dh_derive(void *    pkp,
 #endif
 }
 
+static void crypt_dh_fini(void)
+{
+#ifdef HAVE_OPENSSL
+        openssl_ecdh_fini();
+#endif
+}
+
 static int crypt_encrypt(struct flow *        f,
                          struct shm_du_buff * sdb)
 {
@@ -425,13 +817,15 @@ static int crypt_decrypt(struct flow *        f,
 #endif
 }
 
-static int crypt_init(void ** ctx)
+static int crypt_init(void **         ctx,
+                      const uint8_t * key)
 {
 #ifdef HAVE_OPENSSL
-        return openssl_crypt_init(ctx);
+        return openssl_crypt_init(ctx, key);
 #else
         assert(ctx != NULL);
         *ctx = NULL;
+        (void) key;
 
         return 0;
 #endif
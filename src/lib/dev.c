@@ -67,6 +67,16 @@
 #define SECMEMSZ  16384
 #define SYMMKEYSZ 32
 #define MSGBUFSZ  2048
+#define BURSTSZ   32
+
+/* Compression header: type, followed by the length for LZ. */
+#define RAW_HDRLEN (sizeof(uint8_t))
+#define LZ_HDRLEN  (sizeof(uint8_t) + sizeof(uint32_t))
+
+enum comp_type {
+        COMP_RAW = 0,
+        COMP_LZ
+};
 
 struct flow_set {
         size_t idx;
@@ -107,7 +117,6 @@ struct flow {
         ssize_t               part_idx;
 
         void *                ctx;
-        uint8_t               key[SYMMKEYSZ];
 
         pid_t                 pid;
 
@@ -117,6 +126,16 @@ struct flow {
         struct timespec       rcv_timeo;
 
         struct frcti *        frcti;
+#ifdef PROC_FLOW_STATS
+        struct {
+                size_t        n_lz;   /* Packets sent compressed  */
+                size_t        n_raw;  /* Packets sent as is       */
+                size_t        b_in;   /* Payload bytes written    */
+                size_t        b_out;  /* Bytes after compression  */
+                uint64_t      ns_c;   /* CPU time compressing     */
+                uint64_t      ns_d;   /* CPU time decompressing   */
+        } lz;
+#endif
 };
 
 struct {
@@ -249,6 +268,91 @@ static void flow_clear(int fd)
 }
 
 #include "crypt.c"
+#include "lz.c"
+
+#ifdef PROC_FLOW_STATS
+
+#define LZ_NAME_STRLEN 16
+
+static int lz_rib_read(const char * path,
+                       char *       buf,
+                       size_t       len)
+{
+        struct flow * flow;
+        double        ratio;
+        int           fd;
+
+        (void) len;
+
+        path = strchr(path, '.');
+        assert(path);
+
+        fd = atoi(path + 1);
+
+        flow = &ai.flows[fd];
+
+        pthread_rwlock_rdlock(&ai.lock);
+
+        ratio = flow->lz.b_out == 0 ? 1.0 :
+                (double) flow->lz.b_in / flow->lz.b_out;
+
+        sprintf(buf,
+                "Packets sent compressed:         %20zu\n"
+                "Packets sent uncompressed:       %20zu\n"
+                "Payload bytes written:           %20zu\n"
+                "Payload bytes sent:              %20zu\n"
+                "Compression ratio:               %20.3f\n"
+                "Compression CPU time (ns):       %20llu\n"
+                "Decompression CPU time (ns):     %20llu\n",
+                flow->lz.n_lz,
+                flow->lz.n_raw,
+                flow->lz.b_in,
+                flow->lz.b_out,
+                ratio,
+                (unsigned long long) flow->lz.ns_c,
+                (unsigned long long) flow->lz.ns_d);
+
+        pthread_rwlock_unlock(&ai.lock);
+
+        return strlen(buf);
+}
+
+static int lz_rib_readdir(char *** buf)
+{
+        *buf = malloc(sizeof(**buf));
+
+        (*buf)[0] = strdup("lz");
+
+        return 1;
+}
+
+static int lz_rib_getattr(const char *      path,
+                          struct rib_attr * attr)
+{
+        (void) path;
+
+        attr->size  = 512;
+        attr->mtime = 0;
+
+        return 0;
+}
+
+static struct rib_ops lz_r_ops = {
+        .read    = lz_rib_read,
+        .readdir = lz_rib_readdir,
+        .getattr = lz_rib_getattr
+};
+
+static uint64_t lz_cpu_ns(void)
+{
+        struct timespec t;
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+
+        return (uint64_t) t.tv_sec * BILLION + t.tv_nsec;
+}
+
+#endif /* PROC_FLOW_STATS */
 
 static void flow_fini(int fd)
 {
@@ -282,6 +386,13 @@ static void flow_fini(int fd)
         if (ai.flows[fd].ctx != NULL)
                 crypt_fini(ai.flows[fd].ctx);
 
+#ifdef PROC_FLOW_STATS
+        if (ai.flows[fd].qs.compress > 0) {
+                char lzstr[LZ_NAME_STRLEN + 1];
+                sprintf(lzstr, "lz.%d", fd);
+                rib_unreg(lzstr);
+        }
+#endif
         flow_clear(fd);
 }
 
@@ -290,9 +401,11 @@ static int flow_init(int       flow_id,
                      qosspec_t qs,
                      uint8_t * s)
 {
-        int fd;
-        int err = -ENOMEM;
-
+        int  fd;
+        int  err = -ENOMEM;
+#ifdef PROC_FLOW_STATS
+        char lzstr[LZ_NAME_STRLEN + 1];
+#endif
         pthread_rwlock_wrlock(&ai.lock);
 
         fd = bmp_allocate(ai.fds);
@@ -321,12 +434,16 @@ static int flow_init(int       flow_id,
 
         if (qs.cypher_s > 0) {
                 assert(s != NULL);
-                if (crypt_init(&ai.flows[fd].ctx) < 0)
+                if (crypt_init(&ai.flows[fd].ctx, s) < 0)
                         goto fail_ctx;
-
-                memcpy(ai.flows[fd].key, s, SYMMKEYSZ);
         }
-
+#ifdef PROC_FLOW_STATS
+        if (qs.compress > 0) {
+                sprintf(lzstr, "lz.%d", fd);
+                /* Don't bail on fail, it just won't show metrics */
+                rib_reg(lzstr, &lz_r_ops);
+        }
+#endif
         ai.ports[flow_id].fd = fd;
 
         port_set_state(&ai.ports[flow_id], PORT_ID_ASSIGNED);
@@ -517,6 +634,8 @@ static void fini(void)
 
         timerwheel_fini();
 
+        crypt_dh_fini();
+
         shm_rdrbuff_close(ai.rdrb);
 
         free(ai.flows);
@@ -856,6 +975,7 @@ int fccntl(int fd,
 {
         uint32_t *        fflags;
         uint16_t *        cflags;
+        uint8_t *         fec_k;
         va_list           l;
         struct timespec * timeo;
         qosspec_t *       qs;
@@ -981,6 +1101,22 @@ int fccntl(int fd,
                         goto eperm;
                 *cflags = frcti_getflags(flow->frcti);
                 break;
+        case FRCTSFEC:
+                fec_k = va_arg(l, uint8_t *);
+                if (fec_k == NULL)
+                        goto einval;
+                if (flow->frcti == NULL)
+                        goto eperm;
+                frcti_setfec(flow->frcti, *fec_k);
+                break;
+        case FRCTGFEC:
+                fec_k = va_arg(l, uint8_t *);
+                if (fec_k == NULL)
+                        goto einval;
+                if (flow->frcti == NULL)
+                        goto eperm;
+                *fec_k = frcti_getfec(flow->frcti);
+                break;
         default:
                 pthread_rwlock_unlock(&ai.lock);
                 va_end(l);
@@ -1027,6 +1163,150 @@ static int add_crc(struct shm_du_buff * sdb)
         return 0;
 }
 
+/* Send the parity of a completed FEC group, never blocks. */
+static void flow_send_parity(struct flow * flow)
+{
+        struct shm_du_buff * sdb;
+        ssize_t              idx;
+
+        idx = frcti_fec_parity(flow->frcti, &sdb);
+        if (idx < 0)
+                return;
+
+        if (flow->qs.cypher_s > 0 && crypt_encrypt(flow, sdb) < 0)
+                goto fail;
+
+        if (flow->qs.ber == 0 && add_crc(sdb) != 0)
+                goto fail;
+
+        if (shm_rbuff_write(flow->tx_rb, idx) < 0)
+                goto fail;
+
+        shm_flow_set_notify(flow->set, flow->flow_id, FLOW_PKT);
+
+        return;
+ fail:
+        shm_rdrbuff_remove(ai.rdrb, idx);
+}
+
+/*
+ * Compress count bytes from buf into the sdb at ptr, falling back to
+ * a plain copy when the payload doesn't shrink. A header marks which.
+ */
+static int flow_compress(struct flow *        flow,
+                         struct shm_du_buff * sdb,
+                         uint8_t *            ptr,
+                         const void *         buf,
+                         size_t               count)
+{
+        uint8_t * head;
+        uint32_t  len;
+        ssize_t   n = -1;
+#ifdef PROC_FLOW_STATS
+        uint64_t  t0 = lz_cpu_ns();
+#endif
+        if (count > LZ_HDRLEN)
+                n = lz_compress(buf, count, ptr, count - LZ_HDRLEN);
+
+        if (n > 0) {
+                shm_du_buff_truncate(sdb, n);
+                head = shm_du_buff_head_alloc(sdb, LZ_HDRLEN);
+                if (head == NULL)
+                        return -1;
+                len = hton32((uint32_t) count);
+                head[0] = COMP_LZ;
+                memcpy(head + 1, &len, sizeof(len));
+        } else {
+                memcpy(ptr, buf, count);
+                head = shm_du_buff_head_alloc(sdb, RAW_HDRLEN);
+                if (head == NULL)
+                        return -1;
+                head[0] = COMP_RAW;
+        }
+#ifdef PROC_FLOW_STATS
+        if (n > 0)
+                __sync_add_and_fetch(&flow->lz.n_lz, 1);
+        else
+                __sync_add_and_fetch(&flow->lz.n_raw, 1);
+
+        __sync_add_and_fetch(&flow->lz.b_in, count);
+        __sync_add_and_fetch(&flow->lz.b_out, n > 0 ? n + LZ_HDRLEN :
+                             (ssize_t) count + RAW_HDRLEN);
+        __sync_add_and_fetch(&flow->lz.ns_c, lz_cpu_ns() - t0);
+#else
+        (void) flow;
+#endif
+        return 0;
+}
+
+/*
+ * Strip the compression header from the packet at idx. Inflates
+ * directly into buf if the payload fits and returns its length.
+ * Otherwise idx is replaced by the inflated packet, returns -EAGAIN.
+ */
+static ssize_t flow_decompress(struct flow * flow,
+                               ssize_t *     idx,
+                               void *        buf,
+                               size_t        count)
+{
+        struct shm_du_buff * sdb;
+        uint8_t *            head;
+        uint8_t *            ptr;
+        uint32_t             len;
+        ssize_t              n;
+        ssize_t              ret;
+#ifdef PROC_FLOW_STATS
+        uint64_t             t0 = lz_cpu_ns();
+#endif
+        sdb  = shm_rdrbuff_get(ai.rdrb, *idx);
+        head = shm_du_buff_head(sdb);
+        n    = shm_du_buff_tail(sdb) - head;
+
+        if (n >= (ssize_t) RAW_HDRLEN && head[0] == COMP_RAW) {
+                shm_du_buff_head_release(sdb, RAW_HDRLEN);
+                return -EAGAIN;
+        }
+
+        if (n < (ssize_t) LZ_HDRLEN || head[0] != COMP_LZ)
+                goto fail_msg;
+
+        memcpy(&len, head + 1, sizeof(len));
+        len   = ntoh32(len);
+        head += LZ_HDRLEN;
+        n    -= LZ_HDRLEN;
+
+        if (len <= count) {
+                if (lz_decompress(head, n, buf, len) != (ssize_t) len)
+                        goto fail_msg;
+                shm_rdrbuff_remove(ai.rdrb, *idx);
+                ret = len;
+        } else {
+                ret = shm_rdrbuff_alloc(ai.rdrb, len, &ptr, &sdb);
+                if (ret < 0)
+                        goto fail_alloc;
+                if (lz_decompress(head, n, ptr, len) != (ssize_t) len) {
+                        shm_rdrbuff_remove(ai.rdrb, ret);
+                        goto fail_msg;
+                }
+                shm_rdrbuff_remove(ai.rdrb, *idx);
+                *idx = ret;
+                ret  = -EAGAIN;
+        }
+#ifdef PROC_FLOW_STATS
+        __sync_add_and_fetch(&flow->lz.ns_d, lz_cpu_ns() - t0);
+#else
+        (void) flow;
+#endif
+        return ret;
+
+ fail_alloc:
+        shm_rdrbuff_remove(ai.rdrb, *idx);
+        return -ENOMEM;
+ fail_msg:
+        shm_rdrbuff_remove(ai.rdrb, *idx);
+        return -EBADMSG;
+}
+
 ssize_t flow_write(int          fd,
                    const void * buf,
                    size_t       count)
@@ -1041,6 +1321,7 @@ ssize_t flow_write(int          fd,
         struct timespec      tictime;
         struct shm_du_buff * sdb;
         uint8_t *            ptr;
+        bool                 comp;
 
         if (buf == NULL)
                 return 0;
@@ -1067,6 +1348,7 @@ ssize_t flow_write(int          fd,
         }
 
         flags = flow->oflags;
+        comp  = flow->qs.compress > 0;
 
         pthread_rwlock_unlock(&ai.lock);
 
@@ -1095,7 +1377,13 @@ ssize_t flow_write(int          fd,
         if (idx < 0)
                 return idx;
 
-        memcpy(ptr, buf, count);
+        /* Compress above FRCT and crypto, they see compressed bytes. */
+        if (!comp) {
+                memcpy(ptr, buf, count);
+        } else if (flow_compress(flow, sdb, ptr, buf, count) < 0) {
+                shm_rdrbuff_remove(ai.rdrb, idx);
+                return -ENOMEM;
+        }
 
         pthread_rwlock_rdlock(&ai.lock);
 
@@ -1113,10 +1401,12 @@ ssize_t flow_write(int          fd,
         else
                 ret = shm_rbuff_write_b(flow->tx_rb, idx, abstime);
 
-        if (ret < 0)
+        if (ret < 0) {
                 shm_rdrbuff_remove(ai.rdrb, idx);
-        else
+        } else {
                 shm_flow_set_notify(flow->set, flow->flow_id, FLOW_PKT);
+                flow_send_parity(flow);
+        }
 
         pthread_rwlock_unlock(&ai.lock);
 
@@ -1144,6 +1434,7 @@ ssize_t flow_read(int    fd,
         struct flow *        flow;
         bool                 noblock;
         bool                 partrd;
+        bool                 comp;
 
         if (fd < 0 || fd > PROG_MAX_FLOWS)
                 return -EBADF;
@@ -1168,6 +1459,7 @@ ssize_t flow_read(int    fd,
         rb   = flow->rx_rb;
         noblock = flow->oflags & FLOWFRNOBLOCK;
         partrd = !(flow->oflags & FLOWFRNOPART);
+        comp   = flow->qs.compress > 0 && flow->part_idx == NO_PART;
 
         ts_add(&tic, &abs, &tictime);
 
@@ -1223,6 +1515,20 @@ ssize_t flow_read(int    fd,
 
         pthread_rwlock_unlock(&ai.lock);
 
+        if (comp) {
+                n = flow_decompress(flow, &idx, buf, count);
+                if (n >= 0) {
+                        pthread_rwlock_wrlock(&ai.lock);
+                        flow->part_idx = (partrd && n == (ssize_t) count) ?
+                                DONE_PART : NO_PART;
+                        pthread_rwlock_unlock(&ai.lock);
+                        return n;
+                }
+
+                if (n != -EAGAIN)
+                        return n;
+        }
+
         n = shm_rdrbuff_read(&packet, ai.rdrb, idx);
 
         assert(n >= 0);
@@ -1478,6 +1784,7 @@ int np1_flow_alloc(pid_t     n_pid,
                    qosspec_t qs)
 {
         qs.cypher_s = 0; /* No encryption ctx for np1 */
+        qs.compress = 0; /* Compression is end-to-end */
         return flow_init(flow_id, n_pid, qs, NULL);
 }
 
@@ -1586,6 +1893,7 @@ int ipcp_flow_req_arr(const uint8_t * dst,
         }
 
         qs.cypher_s = 0; /* No encryption ctx for np1 */
+        qs.compress = 0; /* Compression is end-to-end */
         fd = flow_init(recv_msg->flow_id, recv_msg->pid, qs, NULL);
 
         irm_msg__free_unpacked(recv_msg, NULL);
@@ -1678,6 +1986,15 @@ int ipcp_flow_read(int                   fd,
         return 0;
 }
 
+static uint64_t now_ns(void)
+{
+        struct timespec now;
+
+        clock_gettime(PTHREAD_COND_CLOCK, &now);
+
+        return (uint64_t) now.tv_sec * BILLION + now.tv_nsec;
+}
+
 int ipcp_flow_write(int                  fd,
                     struct shm_du_buff * sdb)
 {
@@ -1717,6 +2034,8 @@ int ipcp_flow_write(int                  fd,
                 return -ENOMEM;
         }
 
+        shm_du_buff_set_stamp(sdb, now_ns());
+
         ret = shm_rbuff_write_b(flow->tx_rb, idx, NULL);
         if (ret == 0)
                 shm_flow_set_notify(flow->set, flow->flow_id, FLOW_PKT);
@@ -1730,6 +2049,75 @@ int ipcp_flow_write(int                  fd,
         return ret;
 }
 
+ssize_t ipcp_flow_write_n(int                   fd,
+                          struct shm_du_buff ** sdb,
+                          size_t                n)
+{
+        struct flow * flow;
+        size_t        idx[BURSTSZ];
+        size_t        done = 0;
+        size_t        cnt;
+        size_t        i;
+        ssize_t       ret = 0;
+        uint64_t      now;
+
+        assert(fd >= 0 && fd < SYS_MAX_FLOWS);
+        assert(sdb);
+
+        flow = &ai.flows[fd];
+
+        now = now_ns();
+
+        pthread_rwlock_rdlock(&ai.lock);
+
+        if (flow->flow_id < 0) {
+                pthread_rwlock_unlock(&ai.lock);
+                return -ENOTALLOC;
+        }
+
+        if ((flow->oflags & FLOWFACCMODE) == FLOWFRDONLY) {
+                pthread_rwlock_unlock(&ai.lock);
+                return -EPERM;
+        }
+
+        assert(flow->tx_rb);
+
+        while (done < n) {
+                cnt = MIN(n - done, BURSTSZ);
+
+                for (i = 0; i < cnt; ++i) {
+                        struct shm_du_buff * s = sdb[done + i];
+                        if (frcti_snd(flow->frcti, s) < 0)
+                                break;
+                        if (flow->qs.ber == 0 && add_crc(s) != 0)
+                                break;
+                        shm_du_buff_set_stamp(s, now);
+                        idx[i] = shm_du_buff_get_idx(s);
+                }
+
+                if (i == 0) {
+                        ret = -ENOMEM;
+                        break;
+                }
+
+                ret = shm_rbuff_write_b_n(flow->tx_rb, idx, i, NULL);
+                if (ret <= 0)
+                        break;
+
+                shm_flow_set_notify_n(flow->set, flow->flow_id, FLOW_PKT,
+                                      (size_t) ret);
+
+                done += ret;
+
+                if ((size_t) ret < cnt)
+                        break;
+        }
+
+        pthread_rwlock_unlock(&ai.lock);
+
+        return done > 0 ? (ssize_t) done : ret;
+}
+
 int ipcp_sdb_reserve(struct shm_du_buff ** sdb,
                      size_t                len)
 {
@@ -1803,6 +2191,32 @@ size_t ipcp_flow_queued(int fd)
         return q;
 }
 
+uint64_t ipcp_flow_sojourn(int fd)
+{
+        ssize_t  idx;
+        uint64_t stamp = 0;
+        uint64_t now;
+
+        now = now_ns();
+
+        pthread_rwlock_rdlock(&ai.lock);
+
+        /* The fd may have been deallocated since it was looked up. */
+        if (ai.flows[fd].flow_id < 0) {
+                pthread_rwlock_unlock(&ai.lock);
+                return 0;
+        }
+
+        /* The reader may free it meanwhile, the stamp is only a hint. */
+        idx = shm_rbuff_peek(ai.flows[fd].tx_rb);
+        if (idx >= 0)
+                stamp = shm_du_buff_get_stamp(shm_rdrbuff_get(ai.rdrb, idx));
+
+        pthread_rwlock_unlock(&ai.lock);
+
+        return stamp == 0 || stamp > now ? 0 : now - stamp;
+}
+
 ssize_t local_flow_read(int fd)
 {
         ssize_t ret;
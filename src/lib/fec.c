@@ -0,0 +1,341 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * XOR parity forward error correction for FRCT
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+/*
+ * A group is a run of k PDUs with consecutive sequence numbers,
+ * starting at base. After the k-th PDU, one parity PDU is sent that
+ * carries the XOR of the payloads (zero-padded to the longest one)
+ * and the XOR of their lengths. The receiver can rebuild any single
+ * missing PDU of a group without waiting for a retransmission.
+ */
+
+#include <ouroboros/endian.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FEC_PCILEN  (sizeof(struct fec_pci))
+#define FEC_MAX_K   64
+#define FEC_MAX_LEN UINT16_MAX
+
+enum fec_res {
+        FEC_PASS = 0, /* Deliver the PDU              */
+        FEC_DROP,     /* Parity or duplicate, consume */
+        FEC_REC       /* A missing PDU can be rebuilt */
+};
+
+struct fec_pci {
+        uint8_t  k;      /* PDUs in the group             */
+        uint8_t  idx;    /* Index in group, k for parity  */
+        uint16_t len;    /* Parity: XOR of payload length */
+        uint32_t base;   /* Sequence number of first PDU  */
+} __attribute__((packed));
+
+struct fec_buf {
+        uint8_t * buf;
+        size_t    sz;    /* Allocated size                */
+        size_t    len;   /* Longest payload XOR'ed in     */
+        uint16_t  lenx;  /* XOR of the payload lengths    */
+};
+
+struct fec_enc {
+        uint8_t        k;      /* 0 disables FEC                */
+        uint8_t        n;      /* PDUs in current group         */
+        uint32_t       base;
+        struct fec_buf acc;    /* Group being encoded           */
+        struct fec_buf par;    /* Parity of last complete group */
+        uint32_t       p_base;
+        uint8_t        p_k;
+        bool           ready;  /* Parity waiting to be sent     */
+};
+
+struct fec_dec {
+        bool           init;
+        uint8_t        k;
+        uint32_t       base;
+        uint64_t       rcvd;   /* Bitmap of PDUs seen in group  */
+        bool           par;    /* Parity seen for group         */
+        bool           done;   /* Nothing left to rebuild       */
+        uint8_t        miss;   /* Index of rebuilt PDU          */
+        struct fec_buf acc;
+        size_t         n_rec;  /* Rebuilt PDUs, for stats       */
+};
+
+static int fec_buf_xor(struct fec_buf * b,
+                       const uint8_t *  data,
+                       size_t           len)
+{
+        size_t i;
+
+        if (len > b->sz) {
+                uint8_t * buf;
+
+                buf = realloc(b->buf, len);
+                if (buf == NULL)
+                        return -1;
+
+                memset(buf + b->sz, 0, len - b->sz);
+
+                b->buf = buf;
+                b->sz  = len;
+        }
+
+        for (i = 0; i < len; ++i)
+                b->buf[i] ^= data[i];
+
+        if (len > b->len)
+                b->len = len;
+
+        return 0;
+}
+
+static void fec_buf_clear(struct fec_buf * b)
+{
+        if (b->buf != NULL)
+                memset(b->buf, 0, b->len);
+
+        b->len  = 0;
+        b->lenx = 0;
+}
+
+static void fec_buf_fini(struct fec_buf * b)
+{
+        free(b->buf);
+        memset(b, 0, sizeof(*b));
+}
+
+static void fec_enc_init(struct fec_enc * enc,
+                         uint8_t          k)
+{
+        memset(enc, 0, sizeof(*enc));
+
+        enc->k = k > FEC_MAX_K ? FEC_MAX_K : k;
+}
+
+static void fec_enc_fini(struct fec_enc * enc)
+{
+        fec_buf_fini(&enc->acc);
+        fec_buf_fini(&enc->par);
+}
+
+/* Drop the group in progress, e.g. when the sequence is broken. */
+static void fec_enc_reset(struct fec_enc * enc)
+{
+        fec_buf_clear(&enc->acc);
+        enc->n = 0;
+}
+
+static void fec_enc_set_k(struct fec_enc * enc,
+                          uint8_t          k)
+{
+        fec_enc_reset(enc);
+        enc->k = k > FEC_MAX_K ? FEC_MAX_K : k;
+}
+
+/*
+ * Adds a PDU to the current group and fills in its FEC PCI.
+ * Returns 1 if this completed a group and parity is ready,
+ * 0 if not and -1 if the PDU can't be protected, in which
+ * case the PCI marks it as unprotected (k = 0).
+ */
+static int fec_enc_add(struct fec_enc * enc,
+                       uint32_t         seqno,
+                       const uint8_t *  data,
+                       size_t           len,
+                       struct fec_pci * pci)
+{
+        if (enc->k == 0 || len > FEC_MAX_LEN)
+                goto fail;
+
+        if (enc->n > 0 && seqno != enc->base + enc->n)
+                fec_enc_reset(enc);
+
+        if (enc->n == 0)
+                enc->base = seqno;
+
+        if (fec_buf_xor(&enc->acc, data, len) < 0)
+                goto fail;
+
+        enc->acc.lenx ^= (uint16_t) len;
+
+        pci->k    = enc->k;
+        pci->idx  = enc->n;
+        pci->len  = 0;
+        pci->base = hton32(enc->base);
+
+        if (++enc->n < enc->k)
+                return 0;
+
+        /* Swap buffers, the next group reuses the old parity. */
+        fec_buf_clear(&enc->par);
+        {
+                struct fec_buf tmp = enc->par;
+                enc->par = enc->acc;
+                enc->acc = tmp;
+        }
+
+        enc->p_base = enc->base;
+        enc->p_k    = enc->n;
+        enc->ready  = true;
+        enc->n      = 0;
+
+        return 1;
+ fail:
+        fec_enc_reset(enc);
+        memset(pci, 0, sizeof(*pci));
+        return -1;
+}
+
+/* Copies out the pending parity, buf must hold FEC_PCILEN + par.len. */
+static size_t fec_enc_parity(struct fec_enc * enc,
+                             uint8_t *        buf)
+{
+        struct fec_pci * pci = (struct fec_pci *) buf;
+
+        assert(enc->ready);
+
+        pci->k    = enc->p_k;
+        pci->idx  = enc->p_k;
+        pci->len  = hton16(enc->par.lenx);
+        pci->base = hton32(enc->p_base);
+
+        memcpy(buf + FEC_PCILEN, enc->par.buf, enc->par.len);
+
+        enc->ready = false;
+
+        return FEC_PCILEN + enc->par.len;
+}
+
+static void fec_dec_init(struct fec_dec * dec)
+{
+        memset(dec, 0, sizeof(*dec));
+}
+
+static void fec_dec_fini(struct fec_dec * dec)
+{
+        fec_buf_fini(&dec->acc);
+}
+
+static void fec_dec_start(struct fec_dec * dec,
+                          uint32_t         base)
+{
+        fec_buf_clear(&dec->acc);
+
+        dec->init = true;
+        dec->base = base;
+        dec->k    = 0;
+        dec->rcvd = 0;
+        dec->par  = false;
+        dec->done = false;
+}
+
+/*
+ * Processes the FEC PCI and payload of a received PDU.
+ * A PDU from an older group is passed on unprotected.
+ * On FEC_REC, a data PDU should still be delivered.
+ */
+static enum fec_res fec_dec_rcv(struct fec_dec *       dec,
+                                const struct fec_pci * pci,
+                                const uint8_t *        data,
+                                size_t                 len)
+{
+        uint32_t base = ntoh32(pci->base);
+        bool     par  = pci->idx == pci->k;
+        uint64_t all;
+        uint64_t bit;
+
+        if (pci->k == 0) /* Unprotected. */
+                return FEC_PASS;
+
+        if (pci->k > FEC_MAX_K || pci->idx > pci->k)
+                return FEC_DROP;
+
+        if (!dec->init || (int32_t) (base - dec->base) > 0)
+                fec_dec_start(dec, base);
+        else if (base != dec->base)
+                return par ? FEC_DROP : FEC_PASS;
+
+        if (par) {
+                if (dec->par)
+                        return FEC_DROP;
+                dec->par = true;
+                dec->k   = pci->k;
+                dec->acc.lenx ^= ntoh16(pci->len);
+        } else {
+                bit = (uint64_t) 1 << pci->idx;
+                if (dec->rcvd & bit)
+                        return FEC_DROP;
+                dec->rcvd |= bit;
+                dec->acc.lenx ^= (uint16_t) len;
+        }
+
+        if (dec->done)
+                return par ? FEC_DROP : FEC_PASS;
+
+        if (fec_buf_xor(&dec->acc, data, len) < 0) {
+                dec->done = true;
+                return par ? FEC_DROP : FEC_PASS;
+        }
+
+        if (!dec->par)
+                return FEC_PASS;
+
+        all = dec->k == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << dec->k) - 1;
+        if ((dec->rcvd & all) == all) {
+                dec->done = true;
+                return par ? FEC_DROP : FEC_PASS;
+        }
+
+        /* Rebuild when exactly one PDU is missing. */
+        bit = ~dec->rcvd & all;
+        if ((bit & (bit - 1)) != 0)
+                return par ? FEC_DROP : FEC_PASS;
+
+        if (dec->acc.lenx > dec->acc.len) { /* Corrupt group. */
+                dec->done = true;
+                return par ? FEC_DROP : FEC_PASS;
+        }
+
+        for (dec->miss = 0; !(bit & ((uint64_t) 1 << dec->miss)); ++dec->miss)
+                ;
+
+        dec->rcvd |= bit;
+        dec->done  = true;
+
+        return FEC_REC;
+}
+
+/* Get the rebuilt PDU after FEC_REC. */
+static const uint8_t * fec_dec_rebuilt(struct fec_dec * dec,
+                                       uint32_t *       seqno,
+                                       size_t *         len)
+{
+        *seqno = dec->base + dec->miss;
+        *len   = dec->acc.lenx;
+
+        ++dec->n_rec;
+
+        return dec->acc.buf;
+}
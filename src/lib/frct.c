@@ -27,6 +27,8 @@
 #define FRCT_PCILEN      (sizeof(struct frct_pci))
 #define FRCT_NAME_STRLEN 32
 
+#include "fec.c"
+
 struct frct_cr {
         uint32_t        lwe;     /* Left window edge               */
         uint32_t        rwe;     /* Right window edge              */
@@ -59,6 +61,9 @@ struct frcti {
         ssize_t           rq[RQ_SIZE];
         pthread_rwlock_t  lock;
 
+        struct fec_enc    fec_enc;     /* Parity generation      */
+        struct fec_dec    fec_dec;     /* Loss recovery          */
+
         bool              open;        /* Window open/closed     */
         struct timespec   t_wnd;       /* Window closed time     */
         struct timespec   t_rdvs;      /* Last rendez-vous sent  */
@@ -74,6 +79,7 @@ enum frct_flags {
         FRCT_RDVS = 0x10, /* Rendez-vous      */
         FRCT_FFGM = 0x20, /* First Fragment   */
         FRCT_MFGM = 0x40, /* More fragments   */
+        FRCT_FEC  = 0x80, /* FEC PCI follows  */
 };
 
 struct frct_pci {
@@ -130,7 +136,9 @@ static int frct_rib_read(const char * path,
                 "Receiver left window edge:       %20u\n"
                 "Receiver right window edge:      %20u\n"
                 "Receiver inactive (ns):          %20ld\n"
-                "Receiver last ack:               %20u\n",
+                "Receiver last ack:               %20u\n"
+                "FEC group size:                  %20u\n"
+                "FEC packets rebuilt:             %20zu\n",
                 frcti->mpl,
                 frcti->a,
                 frcti->r,
@@ -144,7 +152,9 @@ static int frct_rib_read(const char * path,
                 frcti->rcv_cr.lwe,
                 frcti->rcv_cr.rwe,
                 ts_diff_ns(&frcti->rcv_cr.act, &now),
-                frcti->rcv_cr.seqno);
+                frcti->rcv_cr.seqno,
+                frcti->fec_enc.k,
+                frcti->fec_dec.n_rec);
 
         pthread_rwlock_unlock(&flow->frcti->lock);
 
@@ -365,6 +375,14 @@ static struct frcti * frcti_create(int fd)
                 frcti->rcv_cr.cflags |= FRCTFRTX;
         }
 
+        /* Delay-bounded flows without retransmission get parity. */
+        if (ai.flows[fd].qs.loss > 0 && ai.flows[fd].qs.delay != UINT32_MAX)
+                fec_enc_init(&frcti->fec_enc, FEC_GROUP);
+        else
+                fec_enc_init(&frcti->fec_enc, 0);
+
+        fec_dec_init(&frcti->fec_dec);
+
         frcti->snd_cr.cflags |= FRCTFRESCNTL;
 
         frcti->snd_cr.rwe = START_WINDOW;
@@ -400,6 +418,9 @@ static void frcti_destroy(struct frcti * frcti)
         sprintf(frctstr, "%d", frcti->fd);
         rib_unreg(frctstr);
 #endif
+        fec_enc_fini(&frcti->fec_enc);
+        fec_dec_fini(&frcti->fec_dec);
+
         pthread_cond_destroy(&frcti->cond);
         pthread_mutex_destroy(&frcti->mtx);
         pthread_rwlock_destroy(&frcti->lock);
@@ -438,6 +459,33 @@ static void frcti_setflags(struct frcti * frcti,
         pthread_rwlock_unlock(&frcti->lock);
 }
 
+static uint8_t frcti_getfec(struct frcti * frcti)
+{
+        uint8_t ret;
+
+        assert(frcti);
+
+        pthread_rwlock_rdlock(&frcti->lock);
+
+        ret = frcti->fec_enc.k;
+
+        pthread_rwlock_unlock(&frcti->lock);
+
+        return ret;
+}
+
+static void frcti_setfec(struct frcti * frcti,
+                         uint8_t        k)
+{
+        assert(frcti);
+
+        pthread_rwlock_wrlock(&frcti->lock);
+
+        fec_enc_set_k(&frcti->fec_enc, k);
+
+        pthread_rwlock_unlock(&frcti->lock);
+}
+
 #define frcti_queued_pdu(frcti)                         \
         (frcti == NULL ? idx : __frcti_queued_pdu(frcti))
 
@@ -459,6 +507,9 @@ static void frcti_setflags(struct frcti * frcti,
 #define frcti_window_wait(frcti, abstime)               \
         (frcti == NULL ? 0 : __frcti_window_wait(frcti, abstime))
 
+#define frcti_fec_parity(frcti, sdb)                    \
+        (frcti == NULL ? -1 : __frcti_fec_parity(frcti, sdb))
+
 
 static bool __frcti_is_window_open(struct frcti * frcti)
 {
@@ -648,6 +699,9 @@ static int __frcti_snd(struct frcti *       frcti,
                        struct shm_du_buff * sdb)
 {
         struct frct_pci * pci;
+        struct fec_pci *  fpci = NULL;
+        uint8_t *         data;
+        size_t            len;
         struct timespec   now;
         struct frct_cr *  snd_cr;
         struct frct_cr *  rcv_cr;
@@ -661,16 +715,26 @@ static int __frcti_snd(struct frcti *       frcti,
 
         timerwheel_move();
 
-        pci = (struct frct_pci *) shm_du_buff_head_alloc(sdb, FRCT_PCILEN);
-        if (pci == NULL)
-                return -ENOMEM;
-
-        memset(pci, 0, sizeof(*pci));
+        data = shm_du_buff_head(sdb);
+        len  = shm_du_buff_tail(sdb) - data;
 
         clock_gettime(PTHREAD_COND_CLOCK, &now);
 
         pthread_rwlock_wrlock(&frcti->lock);
 
+        if (frcti->fec_enc.k > 0 && len <= FEC_MAX_LEN) {
+                fpci = (struct fec_pci *)
+                        shm_du_buff_head_alloc(sdb, FEC_PCILEN);
+                if (fpci == NULL)
+                        goto fail_pci;
+        }
+
+        pci = (struct frct_pci *) shm_du_buff_head_alloc(sdb, FRCT_PCILEN);
+        if (pci == NULL)
+                goto fail_fec;
+
+        memset(pci, 0, sizeof(*pci));
+
         rtx = snd_cr->cflags & FRCTFRTX;
 
         pci->flags |= FRCT_DATA;
@@ -691,6 +755,13 @@ static int __frcti_snd(struct frcti *       frcti,
         seqno = snd_cr->seqno;
         pci->seqno = hton32(seqno);
 
+        if (fpci != NULL) {
+                fec_enc_add(&frcti->fec_enc, seqno, data, len, fpci);
+                pci->flags |= FRCT_FEC;
+        } else if (frcti->fec_enc.k > 0) {
+                fec_enc_reset(&frcti->fec_enc); /* Too large to protect. */
+        }
+
         if (now.tv_sec - rcv_cr->act.tv_sec < rcv_cr->inact) {
                 pci->flags |= FRCT_FC;
                 *((uint32_t *) pci) |= hton32(rcv_cr->rwe & 0x00FFFFFF);
@@ -721,6 +792,52 @@ static int __frcti_snd(struct frcti *       frcti,
                 timerwheel_rxm(frcti, seqno, sdb);
 
         return 0;
+
+ fail_fec:
+        if (fpci != NULL)
+                shm_du_buff_head_release(sdb, FEC_PCILEN);
+ fail_pci:
+        pthread_rwlock_unlock(&frcti->lock);
+        return -ENOMEM;
+}
+
+/* Build the parity PDU for the last complete FEC group, if any. */
+static ssize_t __frcti_fec_parity(struct frcti *        frcti,
+                                  struct shm_du_buff ** sdb)
+{
+        struct frct_pci * pci;
+        uint8_t *         ptr;
+        ssize_t           idx;
+
+        assert(frcti);
+
+        pthread_rwlock_wrlock(&frcti->lock);
+
+        if (!frcti->fec_enc.ready) {
+                pthread_rwlock_unlock(&frcti->lock);
+                return -1;
+        }
+
+        idx = shm_rdrbuff_alloc(ai.rdrb,
+                                FRCT_PCILEN + FEC_PCILEN
+                                + frcti->fec_enc.par.len,
+                                &ptr, sdb);
+        if (idx < 0) {
+                frcti->fec_enc.ready = false;
+                pthread_rwlock_unlock(&frcti->lock);
+                return idx;
+        }
+
+        pci = (struct frct_pci *) ptr;
+        memset(pci, 0, sizeof(*pci));
+
+        pci->flags = FRCT_FEC;
+
+        fec_enc_parity(&frcti->fec_enc, ptr + FRCT_PCILEN);
+
+        pthread_rwlock_unlock(&frcti->lock);
+
+        return idx;
 }
 
 static void rtt_estimator(struct frcti * frcti,
@@ -748,13 +865,13 @@ static void __frcti_tick(void)
         timerwheel_move();
 }
 
-/* Always queues the next application packet on the RQ. */
-static void __frcti_rcv(struct frcti *       frcti,
-                        struct shm_du_buff * sdb)
+static void __frcti_rcv_pdu(struct frcti *       frcti,
+                            struct shm_du_buff * sdb,
+                            struct frct_pci *    pci,
+                            bool                 late)
 {
         ssize_t           idx;
         size_t            pos;
-        struct frct_pci * pci;
         struct timespec   now;
         struct frct_cr *  rcv_cr;
         struct frct_cr *  snd_cr;
@@ -770,8 +887,6 @@ static void __frcti_rcv(struct frcti *       frcti,
 
         clock_gettime(PTHREAD_COND_CLOCK, &now);
 
-        pci = (struct frct_pci *) shm_du_buff_head_release(sdb, FRCT_PCILEN);
-
         idx = shm_du_buff_get_idx(sdb);
         seqno = ntoh32(pci->seqno);
         pos = seqno & (RQ_SIZE - 1);
@@ -834,8 +949,13 @@ static void __frcti_rcv(struct frcti *       frcti,
                 goto drop_packet;
 
         if (before(seqno, rcv_cr->lwe)) {
-                rcv_cr->seqno = seqno; /* Ensures we send a new ACK. */
-                goto drop_packet;
+                /* Without rtx, a rebuilt PDU may still be delivered. */
+                if (!late || rcv_cr->cflags & FRCTFRTX
+                    || frcti->rq[rcv_cr->lwe & (RQ_SIZE - 1)] != -1
+                    || rcv_cr->lwe - seqno > RQ_SIZE) {
+                        rcv_cr->seqno = seqno; /* Ensures we send a new ACK. */
+                        goto drop_packet;
+                }
         }
 
         if (rcv_cr->cflags & FRCTFRTX) {
@@ -874,6 +994,76 @@ static void __frcti_rcv(struct frcti *       frcti,
         return;
 }
 
+/* Rebuild the PDU that FEC recovered, call with the lock held. */
+static struct shm_du_buff * __frcti_fec_rebuild(struct frcti * frcti)
+{
+        struct shm_du_buff * sdb;
+        struct frct_pci *    pci;
+        const uint8_t *      buf;
+        uint8_t *            ptr;
+        uint32_t             seqno;
+        size_t               len;
+
+        buf = fec_dec_rebuilt(&frcti->fec_dec, &seqno, &len);
+
+        if (shm_rdrbuff_alloc(ai.rdrb, FRCT_PCILEN + len, &ptr, &sdb) < 0)
+                return NULL;
+
+        pci = (struct frct_pci *) ptr;
+        memset(pci, 0, sizeof(*pci));
+
+        pci->flags = FRCT_DATA;
+        pci->seqno = hton32(seqno);
+
+        memcpy(ptr + FRCT_PCILEN, buf, len);
+
+        return sdb;
+}
+
+/* Always queues the next application packet on the RQ. */
+static void __frcti_rcv(struct frcti *       frcti,
+                        struct shm_du_buff * sdb)
+{
+        struct shm_du_buff * rsdb = NULL;
+        struct frct_pci *    pci;
+        struct fec_pci *     fpci;
+        uint8_t *            data;
+        enum fec_res         res;
+
+        assert(frcti);
+
+        pci = (struct frct_pci *) shm_du_buff_head_release(sdb, FRCT_PCILEN);
+
+        if (pci->flags & FRCT_FEC) {
+                fpci = (struct fec_pci *)
+                        shm_du_buff_head_release(sdb, FEC_PCILEN);
+                data = shm_du_buff_head(sdb);
+
+                pthread_rwlock_wrlock(&frcti->lock);
+
+                res = fec_dec_rcv(&frcti->fec_dec, fpci, data,
+                                  shm_du_buff_tail(sdb) - data);
+                if (res == FEC_REC)
+                        rsdb = __frcti_fec_rebuild(frcti);
+
+                pthread_rwlock_unlock(&frcti->lock);
+
+                if (res == FEC_DROP || !(pci->flags & FRCT_DATA)) {
+                        shm_rdrbuff_remove(ai.rdrb, shm_du_buff_get_idx(sdb));
+                        sdb = NULL;
+                }
+        }
+
+        if (sdb != NULL)
+                __frcti_rcv_pdu(frcti, sdb, pci, false);
+
+        if (rsdb != NULL) {
+                pci = (struct frct_pci *)
+                        shm_du_buff_head_release(rsdb, FRCT_PCILEN);
+                __frcti_rcv_pdu(frcti, rsdb, pci, true);
+        }
+}
+
 /* Filter fqueue events for non-data packets */
 int frcti_filter(struct fqueue * fq)
 {
@@ -132,6 +132,12 @@ int irm_bootstrap_ipcp(pid_t                      pid,
                 config.addr_auth_type     = conf->addr_auth_type;
                 config.has_routing_type   = true;
                 config.routing_type       = conf->routing_type;
+                config.has_spf_init       = true;
+                config.spf_init           = conf->spf.init;
+                config.has_spf_hold       = true;
+                config.spf_hold           = conf->spf.hold;
+                config.has_spf_max        = true;
+                config.spf_max            = conf->spf.max;
                 config.has_cong_avoid     = true;
                 config.cong_avoid         = conf->cong_avoid;
                 break;
@@ -0,0 +1,241 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Lightweight LZ77 payload compression for flows
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+/*
+ * Block format, one packet is one block:
+ *
+ *  token | [lit len ext] | literals | offset | [match len ext]
+ *
+ * The token holds the literal length in the high nibble and the
+ * match length minus LZ_MIN_MATCH in the low nibble. A nibble of
+ * 15 is extended by bytes of 255 until a byte < 255. The offset is
+ * 2 bytes, little endian. The last sequence carries only literals.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define LZ_HASH_LOG   12
+#define LZ_HASH_SZ    (1 << LZ_HASH_LOG)
+#define LZ_MIN_MATCH  4
+#define LZ_LAST_LITS  5           /* Trailing bytes never matched.  */
+#define LZ_MFLIMIT    12          /* No match starts this near end. */
+#define LZ_MAX_OFF    UINT16_MAX
+#define LZ_MAX_LEN    UINT16_MAX  /* Positions fit the hash table.  */
+
+static uint32_t lz_read32(const uint8_t * p)
+{
+        uint32_t v;
+
+        memcpy(&v, p, sizeof(v));
+
+        return v;
+}
+
+static size_t lz_hash(uint32_t v)
+{
+        return (size_t) ((v * 2654435761U) >> (32 - LZ_HASH_LOG));
+}
+
+static uint8_t * lz_put_len(uint8_t * op,
+                            size_t    len)
+{
+        while (len >= 255) {
+                *op++ = 255;
+                len -= 255;
+        }
+
+        *op++ = (uint8_t) len;
+
+        return op;
+}
+
+/* Worst case number of bytes to encode a sequence. */
+static size_t lz_seq_len(size_t lits,
+                         size_t mlen)
+{
+        return 1 + lits / 255 + 1 + lits + 2 + mlen / 255 + 1;
+}
+
+/* Returns the compressed length, -1 if it doesn't fit in cap. */
+static ssize_t lz_compress(const uint8_t * in,
+                           size_t          len,
+                           uint8_t *       out,
+                           size_t          cap)
+{
+        uint16_t        tab[LZ_HASH_SZ];
+        const uint8_t * ip     = in;
+        const uint8_t * anchor = in;
+        const uint8_t * end    = in + len;
+        const uint8_t * ref;
+        uint8_t *       op     = out;
+        uint8_t *       oend   = out + cap;
+        uint8_t *       token;
+        size_t          lits;
+        size_t          mlen;
+        size_t          h;
+        size_t          off;
+
+        if (len > LZ_MAX_LEN)
+                return -1;
+
+        if (len < LZ_MFLIMIT + 1)
+                goto last_lits;
+
+        memset(tab, 0, sizeof(tab));
+
+        while (ip < end - LZ_MFLIMIT) {
+                h      = lz_hash(lz_read32(ip));
+                ref    = in + tab[h];
+                tab[h] = (uint16_t) (ip - in);
+
+                if (ref >= ip || (size_t) (ip - ref) > LZ_MAX_OFF
+                    || lz_read32(ref) != lz_read32(ip)) {
+                        ++ip;
+                        continue;
+                }
+
+                mlen = LZ_MIN_MATCH;
+                while (ip + mlen < end - LZ_LAST_LITS && ref[mlen] == ip[mlen])
+                        ++mlen;
+
+                lits = ip - anchor;
+                if (lz_seq_len(lits, mlen) > (size_t) (oend - op))
+                        return -1;
+
+                token = op++;
+                if (lits >= 15) {
+                        *token = 15 << 4;
+                        op = lz_put_len(op, lits - 15);
+                } else {
+                        *token = (uint8_t) (lits << 4);
+                }
+
+                memcpy(op, anchor, lits);
+                op += lits;
+
+                off   = ip - ref;
+                *op++ = (uint8_t) (off & 0xFF);
+                *op++ = (uint8_t) (off >> 8);
+
+                if (mlen - LZ_MIN_MATCH >= 15) {
+                        *token |= 15;
+                        op = lz_put_len(op, mlen - LZ_MIN_MATCH - 15);
+                } else {
+                        *token |= (uint8_t) (mlen - LZ_MIN_MATCH);
+                }
+
+                ip    += mlen;
+                anchor = ip;
+        }
+
+ last_lits:
+        lits = end - anchor;
+        if (1 + lits / 255 + 1 + lits > (size_t) (oend - op))
+                return -1;
+
+        token = op++;
+        if (lits >= 15) {
+                *token = 15 << 4;
+                op = lz_put_len(op, lits - 15);
+        } else {
+                *token = (uint8_t) (lits << 4);
+        }
+
+        memcpy(op, anchor, lits);
+        op += lits;
+
+        return op - out;
+}
+
+/* Returns the decompressed length, -1 on malformed or oversized input. */
+static ssize_t lz_decompress(const uint8_t * in,
+                             size_t          len,
+                             uint8_t *       out,
+                             size_t          cap)
+{
+        const uint8_t * ip   = in;
+        const uint8_t * iend = in + len;
+        const uint8_t * ref;
+        uint8_t *       op   = out;
+        uint8_t *       oend = out + cap;
+        uint8_t         token;
+        uint8_t         b;
+        size_t          lits;
+        size_t          mlen;
+        size_t          off;
+
+        while (ip < iend) {
+                token = *ip++;
+
+                lits = token >> 4;
+                if (lits == 15) {
+                        do {
+                                if (ip >= iend)
+                                        return -1;
+                                b     = *ip++;
+                                lits += b;
+                        } while (b == 255);
+                }
+
+                if (lits > (size_t) (iend - ip) || lits > (size_t) (oend - op))
+                        return -1;
+
+                memcpy(op, ip, lits);
+                op += lits;
+                ip += lits;
+
+                if (ip == iend)
+                        break;
+
+                if (iend - ip < 2)
+                        return -1;
+
+                off = ip[0] | (ip[1] << 8);
+                ip += 2;
+
+                if (off == 0 || off > (size_t) (op - out))
+                        return -1;
+
+                mlen = token & 15;
+                if (mlen == 15) {
+                        do {
+                                if (ip >= iend)
+                                        return -1;
+                                b     = *ip++;
+                                mlen += b;
+                        } while (b == 255);
+                }
+
+                mlen += LZ_MIN_MATCH;
+                if (mlen > (size_t) (oend - op))
+                        return -1;
+
+                /* Byte copy, the match may overlap the output. */
+                ref = op - off;
+                while (mlen-- > 0)
+                        *op++ = *ref++;
+        }
+
+        return op - out;
+}
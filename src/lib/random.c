@@ -45,8 +45,47 @@
 #include <limits.h>
 #endif
 
-int random_buffer(void * buf,
-                  size_t len)
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHACHA_KEYSZ   32
+#define CHACHA_IVSZ    8
+#define CHACHA_BLKSZ   64
+#define RND_BLKS       16                   /* blocks per refill        */
+#define RND_BUFSZ      (RND_BLKS * CHACHA_BLKSZ)
+#define RND_RESEED     (1 << 20)            /* bytes before reseeding   */
+
+#define ROTL32(v, n)   (((v) << (n)) | ((v) >> (32 - (n))))
+#define QR(a, b, c, d)                                                  \
+        a += b; d ^= a; d = ROTL32(d, 16);                              \
+        c += d; b ^= c; b = ROTL32(b, 12);                              \
+        a += b; d ^= a; d = ROTL32(d, 8);                               \
+        c += d; b ^= c; b = ROTL32(b, 7);
+
+/*
+ * Per-thread ChaCha20 generator with fast key erasure: the first
+ * CHACHA_KEYSZ + CHACHA_IVSZ bytes of each refill rekey the state, so
+ * earlier output cannot be recovered from a captured context. The
+ * state is reseeded from the system source every RND_RESEED bytes and
+ * after a fork().
+ */
+struct rnd_ctx {
+        uint32_t key[CHACHA_KEYSZ / 4];
+        uint32_t iv[CHACHA_IVSZ / 4];
+        uint8_t  buf[RND_BUFSZ];
+        size_t   avail;  /* unused bytes at the end of buf */
+        size_t   count;  /* bytes handed out since seeding */
+        unsigned gen;    /* fork generation at seeding     */
+};
+
+static pthread_key_t  rnd_key;
+static pthread_once_t rnd_once = PTHREAD_ONCE_INIT;
+static volatile unsigned rnd_gen;
+
+static int sys_random(void * buf,
+                      size_t len)
 {
 #if defined(__APPLE__)
         return getentropy(buf, len);
@@ -54,13 +93,196 @@ int random_buffer(void * buf,
         arc4random_buf(buf, len);
         return 0;
 #elif defined(HAVE_SYS_RANDOM)
-        return getrandom(buf, len, GRND_NONBLOCK); /* glibc 2.25 */
+        return getrandom(buf, len, GRND_NONBLOCK) == (ssize_t) len ? 0 : -1;
 #elif defined(HAVE_LIBGCRYPT)
         gcry_randomize(buf, len, GCRY_STRONG_RANDOM);
         return 0;
 #elif defined(HAVE_OPENSSL_RNG)
         if (len > 0 && len < INT_MAX)
-                return RAND_bytes((unsigned char *) buf, (int) len);
+                return RAND_bytes((unsigned char *) buf, (int) len) == 1 ?
+                        0 : -1;
         return -1;
 #endif
 }
+
+static uint32_t le32_load(const uint8_t * p)
+{
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8)
+                | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void le32_store(uint8_t * p,
+                       uint32_t  v)
+{
+        p[0] = (uint8_t) v;
+        p[1] = (uint8_t) (v >> 8);
+        p[2] = (uint8_t) (v >> 16);
+        p[3] = (uint8_t) (v >> 24);
+}
+
+static void chacha20_block(const uint32_t * key,
+                           const uint32_t * iv,
+                           uint64_t         ctr,
+                           uint8_t *        out)
+{
+        uint32_t in[16];
+        uint32_t x[16];
+        int      i;
+
+        in[0]  = 0x61707865; /* "expand 32-byte k" */
+        in[1]  = 0x3320646e;
+        in[2]  = 0x79622d32;
+        in[3]  = 0x6b206574;
+
+        for (i = 0; i < 8; ++i)
+                in[4 + i] = key[i];
+
+        in[12] = (uint32_t) ctr;
+        in[13] = (uint32_t) (ctr >> 32);
+        in[14] = iv[0];
+        in[15] = iv[1];
+
+        memcpy(x, in, sizeof(x));
+
+        for (i = 0; i < 10; ++i) {
+                QR(x[0], x[4], x[8],  x[12]);
+                QR(x[1], x[5], x[9],  x[13]);
+                QR(x[2], x[6], x[10], x[14]);
+                QR(x[3], x[7], x[11], x[15]);
+                QR(x[0], x[5], x[10], x[15]);
+                QR(x[1], x[6], x[11], x[12]);
+                QR(x[2], x[7], x[8],  x[13]);
+                QR(x[3], x[4], x[9],  x[14]);
+        }
+
+        for (i = 0; i < 16; ++i)
+                le32_store(out + 4 * i, x[i] + in[i]);
+}
+
+static void rnd_rekey(struct rnd_ctx * ctx,
+                      const uint8_t *  seed)
+{
+        int i;
+
+        for (i = 0; i < CHACHA_KEYSZ / 4; ++i)
+                ctx->key[i] = le32_load(seed + 4 * i);
+
+        for (i = 0; i < CHACHA_IVSZ / 4; ++i)
+                ctx->iv[i] = le32_load(seed + CHACHA_KEYSZ + 4 * i);
+}
+
+static void rnd_refill(struct rnd_ctx * ctx)
+{
+        uint64_t i;
+
+        for (i = 0; i < RND_BLKS; ++i)
+                chacha20_block(ctx->key, ctx->iv, i,
+                               ctx->buf + i * CHACHA_BLKSZ);
+
+        rnd_rekey(ctx, ctx->buf);
+        memset(ctx->buf, 0, CHACHA_KEYSZ + CHACHA_IVSZ);
+
+        ctx->avail = RND_BUFSZ - CHACHA_KEYSZ - CHACHA_IVSZ;
+}
+
+static int rnd_seed(struct rnd_ctx * ctx)
+{
+        uint8_t seed[CHACHA_KEYSZ + CHACHA_IVSZ];
+
+        if (sys_random(seed, sizeof(seed)) < 0)
+                return -1;
+
+        rnd_rekey(ctx, seed);
+        memset(seed, 0, sizeof(seed));
+
+        ctx->count = 0;
+        ctx->gen   = rnd_gen;
+
+        rnd_refill(ctx);
+
+        return 0;
+}
+
+static void rnd_destroy(void * o)
+{
+        struct rnd_ctx * ctx = (struct rnd_ctx *) o;
+
+        memset(ctx, 0, sizeof(*ctx));
+        free(ctx);
+}
+
+static void rnd_atfork_child(void)
+{
+        ++rnd_gen;
+}
+
+static void rnd_init(void)
+{
+        pthread_key_create(&rnd_key, rnd_destroy);
+        pthread_atfork(NULL, NULL, rnd_atfork_child);
+}
+
+static struct rnd_ctx * rnd_get(void)
+{
+        struct rnd_ctx * ctx;
+
+        pthread_once(&rnd_once, rnd_init);
+
+        ctx = pthread_getspecific(rnd_key);
+        if (ctx != NULL)
+                return ctx;
+
+        ctx = malloc(sizeof(*ctx));
+        if (ctx == NULL)
+                return NULL;
+
+        if (rnd_seed(ctx) < 0)
+                goto fail_seed;
+
+        if (pthread_setspecific(rnd_key, ctx))
+                goto fail_seed;
+
+        return ctx;
+
+ fail_seed:
+        rnd_destroy(ctx);
+        return NULL;
+}
+
+int random_buffer(void * buf,
+                  size_t len)
+{
+        struct rnd_ctx * ctx;
+        uint8_t *        dst = buf;
+        size_t           n;
+
+        ctx = rnd_get();
+        if (ctx == NULL)
+                return sys_random(buf, len);
+
+        if (ctx->gen != rnd_gen || ctx->count > RND_RESEED) {
+                if (rnd_seed(ctx) < 0)
+                        return -1;
+        }
+
+        ctx->count += len;
+
+        while (len > 0) {
+                uint8_t * src;
+
+                if (ctx->avail == 0)
+                        rnd_refill(ctx);
+
+                n = len < ctx->avail ? len : ctx->avail;
+                src = ctx->buf + RND_BUFSZ - ctx->avail;
+
+                memcpy(dst, src, n);
+                memset(src, 0, n);
+
+                ctx->avail -= n;
+                dst        += n;
+                len        -= n;
+        }
+
+        return 0;
+}
@@ -327,6 +327,37 @@ void shm_flow_set_notify(struct shm_flow_set * set,
         pthread_mutex_unlock(set->lock);
 }
 
+/* Post n events at once, readers still see one event per packet. */
+void shm_flow_set_notify_n(struct shm_flow_set * set,
+                           int                   flow_id,
+                           int                   event,
+                           size_t                n)
+{
+        struct portevent * e;
+        ssize_t            q;
+
+        assert(set);
+        assert(!(flow_id < 0) && flow_id < SYS_MAX_FLOWS);
+
+        pthread_mutex_lock(set->lock);
+
+        q = set->mtable[flow_id];
+        if (q == -1 || n == 0) {
+                pthread_mutex_unlock(set->lock);
+                return;
+        }
+
+        while (n-- > 0) {
+                e = fqueue_ptr(set, q) + (set->heads[q])++;
+                e->flow_id = flow_id;
+                e->event   = event;
+        }
+
+        pthread_cond_signal(&set->conds[q]);
+
+        pthread_mutex_unlock(set->lock);
+}
+
 
 ssize_t shm_flow_set_wait(const struct shm_flow_set * set,
                           size_t                      idx,
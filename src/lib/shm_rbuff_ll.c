@@ -131,6 +131,27 @@ int shm_rbuff_write_b(struct shm_rbuff *      rb,
         return ret;
 }
 
+ssize_t shm_rbuff_write_b_n(struct shm_rbuff *      rb,
+                            const size_t *          idx,
+                            size_t                  n,
+                            const struct timespec * abstime)
+{
+        size_t i;
+        int    ret;
+
+        assert(rb);
+        assert(idx);
+
+        /* Writes are lockless, nothing to gain from batching. */
+        for (i = 0; i < n; ++i) {
+                ret = shm_rbuff_write_b(rb, idx[i], abstime);
+                if (ret < 0)
+                        return i == 0 ? ret : (ssize_t) i;
+        }
+
+        return (ssize_t) i;
+}
+
 ssize_t shm_rbuff_read(struct shm_rbuff * rb)
 {
         size_t otail;
@@ -246,3 +267,13 @@ size_t shm_rbuff_queued(struct shm_rbuff * rb)
 
         return shm_rbuff_used(rb);
 }
+
+ssize_t shm_rbuff_peek(struct shm_rbuff * rb)
+{
+        assert(rb);
+
+        if (shm_rbuff_empty(rb))
+                return -EAGAIN;
+
+        return *(rb->shm_base + RB_TAIL);
+}
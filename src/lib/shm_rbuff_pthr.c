@@ -138,6 +138,74 @@ int shm_rbuff_write_b(struct shm_rbuff *      rb,
         return ret;
 }
 
+ssize_t shm_rbuff_write_b_n(struct shm_rbuff *      rb,
+                            const size_t *          idx,
+                            size_t                  n,
+                            const struct timespec * abstime)
+{
+        size_t i   = 0;
+        int    ret = 0;
+
+        assert(rb);
+        assert(idx);
+
+#ifndef HAVE_ROBUST_MUTEX
+        pthread_mutex_lock(rb->lock);
+#else
+        if (pthread_mutex_lock(rb->lock) == EOWNERDEAD)
+                pthread_mutex_consistent(rb->lock);
+#endif
+
+        if (*rb->acl != ACL_RDWR) {
+                if (*rb->acl & ACL_FLOWDOWN)
+                        ret = -EFLOWDOWN;
+                else if (*rb->acl & ACL_RDONLY)
+                        ret = -ENOTALLOC;
+                goto err;
+        }
+
+        pthread_cleanup_push(__cleanup_mutex_unlock, rb->lock);
+
+        while (i < n) {
+                while (!shm_rbuff_free(rb)
+                       && ret != -ETIMEDOUT
+                       && !(*rb->acl & ACL_FLOWDOWN)) {
+                        if (abstime != NULL)
+                                ret = -pthread_cond_timedwait(rb->del,
+                                                              rb->lock,
+                                                              abstime);
+                        else
+                                ret = -pthread_cond_wait(rb->del, rb->lock);
+#ifdef HAVE_ROBUST_MUTEX
+                        if (ret == -EOWNERDEAD)
+                                pthread_mutex_consistent(rb->lock);
+#endif
+                }
+
+                if (ret == -ETIMEDOUT || (*rb->acl & ACL_FLOWDOWN))
+                        break;
+
+                if (shm_rbuff_empty(rb))
+                        pthread_cond_broadcast(rb->add);
+
+                for (; i < n && shm_rbuff_free(rb); ++i) {
+                        assert(idx[i] < SHM_BUFFER_SIZE);
+                        *head_el_ptr(rb) = (ssize_t) idx[i];
+                        *rb->head = (*rb->head + 1) & ((SHM_RBUFF_SIZE) - 1);
+                }
+        }
+
+        pthread_cleanup_pop(true);
+
+        if (i == 0 && n > 0)
+                return ret == -ETIMEDOUT ? -ETIMEDOUT : -EFLOWDOWN;
+
+        return (ssize_t) i;
+ err:
+        pthread_mutex_unlock(rb->lock);
+        return ret;
+}
+
 ssize_t shm_rbuff_read(struct shm_rbuff * rb)
 {
         ssize_t ret = 0;
@@ -292,3 +360,25 @@ size_t shm_rbuff_queued(struct shm_rbuff * rb)
 
         return ret;
 }
+
+ssize_t shm_rbuff_peek(struct shm_rbuff * rb)
+{
+        ssize_t ret;
+
+        assert(rb);
+
+#ifndef HAVE_ROBUST_MUTEX
+        pthread_mutex_lock(rb->lock);
+#else
+        if (pthread_mutex_lock(rb->lock) == EOWNERDEAD)
+                pthread_mutex_consistent(rb->lock);
+#endif
+        if (shm_rbuff_empty(rb))
+                ret = -EAGAIN;
+        else
+                ret = *tail_el_ptr(rb);
+
+        pthread_mutex_unlock(rb->lock);
+
+        return ret;
+}
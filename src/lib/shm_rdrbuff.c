@@ -67,14 +67,15 @@
         (*rdrb->tail == *rdrb->head)
 
 struct shm_du_buff {
-        size_t size;
+        size_t   size;
 #ifdef SHM_RDRB_MULTI_BLOCK
-        size_t blocks;
+        size_t   blocks;
 #endif
-        size_t du_head;
-        size_t du_tail;
-        size_t refs;
-        size_t idx;
+        size_t   du_head;
+        size_t   du_tail;
+        size_t   refs;
+        size_t   idx;
+        uint64_t stamp; /* ns, set when queued */
 };
 
 struct shm_rdrbuff {
@@ -351,6 +352,7 @@ ssize_t shm_rdrbuff_alloc(struct shm_rdrbuff *  rdrb,
         sdb->size    = size;
         sdb->du_head = DU_BUFF_HEADSPACE;
         sdb->du_tail = sdb->du_head + len;
+        sdb->stamp   = 0;
 
         *psdb = sdb;
         if (ptr != NULL)
@@ -449,6 +451,7 @@ ssize_t shm_rdrbuff_alloc_b(struct shm_rdrbuff *    rdrb,
         sdb->size    = size;
         sdb->du_head = DU_BUFF_HEADSPACE;
         sdb->du_tail = sdb->du_head + len;
+        sdb->stamp   = 0;
 
         *psdb = sdb;
         if (ptr != NULL)
@@ -518,6 +521,21 @@ size_t shm_du_buff_get_idx(struct shm_du_buff * sdb)
         return sdb->idx;
 }
 
+void shm_du_buff_set_stamp(struct shm_du_buff * sdb,
+                           uint64_t             stamp)
+{
+        assert(sdb);
+
+        sdb->stamp = stamp;
+}
+
+uint64_t shm_du_buff_get_stamp(struct shm_du_buff * sdb)
+{
+        assert(sdb);
+
+        return sdb->stamp;
+}
+
 uint8_t * shm_du_buff_head(struct shm_du_buff * sdb)
 {
         assert(sdb);
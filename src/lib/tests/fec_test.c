@@ -0,0 +1,221 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the FRCT forward error correction
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#if defined(__linux__) || defined(__CYGWIN__)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "fec.c"
+
+#include <stdio.h>
+
+#define TEST_LEN   1400
+#define TEST_PDUS  100000
+
+struct pdu {
+        struct fec_pci pci;
+        uint8_t        buf[TEST_LEN];
+        size_t         len;
+};
+
+static void fill_pdu(struct pdu * p,
+                     uint32_t     seqno)
+{
+        size_t i;
+
+        p->len = 1 + (seqno * 7919) % TEST_LEN;
+
+        for (i = 0; i < p->len; ++i)
+                p->buf[i] = (uint8_t) (seqno + i);
+}
+
+/* Loses one PDU per group and checks that it comes back intact. */
+static int test_fec_rebuild(uint8_t k)
+{
+        struct fec_enc  enc;
+        struct fec_dec  dec;
+        struct pdu      pdu;
+        struct pdu      org;
+        uint8_t         par[FEC_PCILEN + TEST_LEN];
+        const uint8_t * buf;
+        uint32_t        seqno;
+        uint32_t        rseqno;
+        size_t          len;
+        size_t          plen;
+        uint32_t        g;
+        uint8_t         i;
+
+        fec_enc_init(&enc, 0);
+        fec_enc_set_k(&enc, k);
+        fec_dec_init(&dec);
+
+        seqno = 0xFFFFFFF0; /* Test wrap-around. */
+
+        for (g = 0; g < 64; ++g) {
+                uint8_t lost = (uint8_t) (g % k);
+
+                for (i = 0; i < k; ++i, ++seqno) {
+                        fill_pdu(&pdu, seqno);
+                        if (fec_enc_add(&enc, seqno, pdu.buf, pdu.len,
+                                        &pdu.pci) < 0) {
+                                printf("Failed to add PDU %u.\n", seqno);
+                                goto fail;
+                        }
+
+                        if (i == lost) {
+                                org = pdu;
+                                continue;
+                        }
+
+                        if (fec_dec_rcv(&dec, &pdu.pci, pdu.buf, pdu.len)
+                            != FEC_PASS) {
+                                printf("Data PDU %u not passed.\n", seqno);
+                                goto fail;
+                        }
+                }
+
+                if (!enc.ready) {
+                        printf("No parity after %u PDUs.\n", k);
+                        goto fail;
+                }
+
+                plen = fec_enc_parity(&enc, par);
+
+                if (fec_dec_rcv(&dec, (struct fec_pci *) par,
+                                par + FEC_PCILEN, plen - FEC_PCILEN)
+                    != FEC_REC) {
+                        printf("Could not rebuild PDU in group %u.\n", g);
+                        goto fail;
+                }
+
+                buf = fec_dec_rebuilt(&dec, &rseqno, &len);
+
+                if (rseqno != ntoh32(org.pci.base) + lost) {
+                        printf("Rebuilt wrong seqno %u.\n", rseqno);
+                        goto fail;
+                }
+
+                if (len != org.len || memcmp(buf, org.buf, len)) {
+                        printf("Rebuilt PDU %u is corrupt.\n", rseqno);
+                        goto fail;
+                }
+
+                /* The original showing up late is a duplicate. */
+                if (fec_dec_rcv(&dec, &org.pci, org.buf, org.len)
+                    != FEC_DROP) {
+                        printf("Late duplicate of %u not dropped.\n", rseqno);
+                        goto fail;
+                }
+        }
+
+        fec_enc_fini(&enc);
+        fec_dec_fini(&dec);
+
+        return 0;
+ fail:
+        fec_enc_fini(&enc);
+        fec_dec_fini(&dec);
+        return -1;
+}
+
+/* Random loss on all PDUs, reports the residual loss for the overhead. */
+static int test_fec_impairment(uint8_t k,
+                               int     loss) /* in 1/1000 */
+{
+        struct fec_enc enc;
+        struct fec_dec dec;
+        struct pdu     pdu;
+        uint8_t        par[FEC_PCILEN + TEST_LEN];
+        size_t         plen;
+        size_t         lost = 0;
+        size_t         rebuilt = 0;
+        size_t         n_par = 0;
+        uint32_t       seqno;
+        double         eff;
+
+        fec_enc_init(&enc, k);
+        fec_dec_init(&dec);
+
+        for (seqno = 0; seqno < TEST_PDUS; ++seqno) {
+                fill_pdu(&pdu, seqno);
+                fec_enc_add(&enc, seqno, pdu.buf, pdu.len, &pdu.pci);
+
+                if (rand() % 1000 < loss)
+                        ++lost;
+                else if (fec_dec_rcv(&dec, &pdu.pci, pdu.buf, pdu.len)
+                         == FEC_REC)
+                        ++rebuilt;
+
+                if (!enc.ready)
+                        continue;
+
+                ++n_par;
+                plen = fec_enc_parity(&enc, par);
+                if (rand() % 1000 < loss)
+                        continue;
+
+                if (fec_dec_rcv(&dec, (struct fec_pci *) par,
+                                par + FEC_PCILEN, plen - FEC_PCILEN)
+                    == FEC_REC)
+                        ++rebuilt;
+        }
+
+        eff = (double) (lost - rebuilt) / TEST_PDUS;
+
+        printf("k = %2u, overhead %5.1f%%, loss %4.1f%% -> %6.3f%%.\n",
+               k, 100.0 * n_par / TEST_PDUS, loss / 10.0, 100.0 * eff);
+
+        fec_enc_fini(&enc);
+        fec_dec_fini(&dec);
+
+        if (rebuilt > lost || (loss > 0 && eff >= (double) loss / 1000)) {
+                printf("FEC did not lower the loss rate.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+int fec_test(int     argc,
+             char ** argv)
+{
+        uint8_t k[] = { 2, 4, 8, 16, 32, 64 };
+        int     loss[] = { 1, 10, 50 };
+        size_t  i;
+        size_t  j;
+
+        (void) argc;
+        (void) argv;
+
+        srand(1);
+
+        for (i = 0; i < sizeof(k) / sizeof(k[0]); ++i)
+                if (test_fec_rebuild(k[i]))
+                        return -1;
+
+        for (i = 0; i < sizeof(k) / sizeof(k[0]); ++i)
+                for (j = 0; j < sizeof(loss) / sizeof(loss[0]); ++j)
+                        if (test_fec_impairment(k[i], loss[j]))
+                                return -1;
+
+        return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the LZ77 payload compression
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#include "lz.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_LEN 9000
+#define OUT_LEN  (TEST_LEN + TEST_LEN / 255 + 16)
+
+static const char * words[] = {
+        "flow ", "allocation ", "layer ", "unicast ", "ipcp ",
+        "forwarding ", "directory ", "routing ", "the ", "a "
+};
+
+static void fill_text(uint8_t * buf,
+                      size_t    len)
+{
+        size_t i = 0;
+
+        while (i < len) {
+                const char * w = words[rand() % 10];
+                size_t       n = strlen(w);
+                if (n > len - i)
+                        n = len - i;
+                memcpy(buf + i, w, n);
+                i += n;
+        }
+}
+
+static void fill_rand(uint8_t * buf,
+                      size_t    len)
+{
+        size_t i;
+
+        for (i = 0; i < len; ++i)
+                buf[i] = (uint8_t) rand();
+}
+
+static int roundtrip(const uint8_t * in,
+                     size_t          len,
+                     size_t *        clen)
+{
+        uint8_t c[OUT_LEN];
+        uint8_t d[TEST_LEN];
+        ssize_t n;
+
+        n = lz_compress(in, len, c, sizeof(c));
+        if (n < 0) {
+                printf("Failed to compress %zu bytes.\n", len);
+                return -1;
+        }
+
+        if (lz_decompress(c, n, d, len) != (ssize_t) len) {
+                printf("Failed to decompress %zu bytes.\n", len);
+                return -1;
+        }
+
+        if (len > 0 && memcmp(in, d, len)) {
+                printf("Mismatch after roundtrip of %zu bytes.\n", len);
+                return -1;
+        }
+
+        if (len > 0 && lz_decompress(c, n, d, len - 1) >= 0) {
+                printf("Decompressed into a short buffer.\n");
+                return -1;
+        }
+
+        if (clen != NULL)
+                *clen = n;
+
+        return 0;
+}
+
+static int test_lz_roundtrip(void)
+{
+        uint8_t buf[TEST_LEN];
+        size_t  len;
+        size_t  clen;
+
+        memset(buf, 0, sizeof(buf));
+
+        for (len = 0; len < 300; ++len) {
+                fill_text(buf, len);
+                if (roundtrip(buf, len, NULL))
+                        return -1;
+                fill_rand(buf, len);
+                if (roundtrip(buf, len, NULL))
+                        return -1;
+                memset(buf, 0, len);
+                if (roundtrip(buf, len, NULL))
+                        return -1;
+        }
+
+        memset(buf, 'x', TEST_LEN);
+        if (roundtrip(buf, TEST_LEN, &clen))
+                return -1;
+
+        if (clen > TEST_LEN / 100) {
+                printf("Run of %d bytes compressed to %zu.\n",
+                       TEST_LEN, clen);
+                return -1;
+        }
+
+        fill_text(buf, 1400);
+        if (roundtrip(buf, 1400, &clen))
+                return -1;
+
+        printf("Text, 1400 bytes compressed to %zu (%.2f).\n",
+               clen, 1400.0 / clen);
+
+        if (clen >= 1400 / 2) {
+                printf("Text did not compress.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+static int test_lz_incompressible(void)
+{
+        uint8_t buf[1400];
+        uint8_t out[1400];
+
+        fill_rand(buf, sizeof(buf));
+
+        /* Must refuse rather than overflow when output won't shrink. */
+        if (lz_compress(buf, sizeof(buf), out, sizeof(buf) - 5) >= 0) {
+                printf("Random data fit in less space.\n");
+                return -1;
+        }
+
+        if (lz_compress(buf, UINT16_MAX + 1, out, sizeof(out)) >= 0) {
+                printf("Compressed a block that is too long.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+static int test_lz_malformed(void)
+{
+        uint8_t buf[1400];
+        uint8_t c[OUT_LEN];
+        uint8_t d[TEST_LEN];
+        ssize_t n;
+        ssize_t i;
+        uint8_t bad_off[] = { 0x10, 'a', 0x05, 0x00 };
+        uint8_t zero_off[] = { 0x10, 'a', 0x00, 0x00 };
+
+        fill_text(buf, sizeof(buf));
+
+        n = lz_compress(buf, sizeof(buf), c, sizeof(c));
+        if (n < 0) {
+                printf("Failed to compress.\n");
+                return -1;
+        }
+
+        /* Truncations must never write past the output buffer. */
+        for (i = 0; i < n; ++i)
+                if (lz_decompress(c, i, d, sizeof(buf)) == sizeof(buf)) {
+                        printf("Truncated block decompressed.\n");
+                        return -1;
+                }
+
+        if (lz_decompress(bad_off, sizeof(bad_off), d, sizeof(d)) >= 0) {
+                printf("Accepted offset before start of output.\n");
+                return -1;
+        }
+
+        if (lz_decompress(zero_off, sizeof(zero_off), d, sizeof(d)) >= 0) {
+                printf("Accepted zero offset.\n");
+                return -1;
+        }
+
+        for (i = 0; i < 1000; ++i) {
+                fill_rand(c, 64);
+                lz_decompress(c, 64, d, sizeof(d));
+        }
+
+        return 0;
+}
+
+int lz_test(int     argc,
+            char ** argv)
+{
+        (void) argc;
+        (void) argv;
+
+        srand(1);
+
+        if (test_lz_roundtrip())
+                return -1;
+
+        if (test_lz_incompressible())
+                return -1;
+
+        if (test_lz_malformed())
+                return -1;
+
+        return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Test of the per-thread random generator
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., http://www.fsf.org/about/contact/.
+ */
+
+#include "random.c"
+
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_BUFSZ (3 * RND_BUFSZ + 7)
+
+/* RFC 7539, section 2.3.2 with the 96-bit nonce split over ctr and iv. */
+static int test_chacha20_vector(void)
+{
+        uint8_t  kb[CHACHA_KEYSZ];
+        uint32_t key[CHACHA_KEYSZ / 4];
+        uint32_t iv[CHACHA_IVSZ / 4] = { 0x4a000000, 0x00000000 };
+        uint8_t  out[CHACHA_BLKSZ];
+        uint8_t  exp[16] = { 0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+                             0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4 };
+        int      i;
+
+        for (i = 0; i < CHACHA_KEYSZ; ++i)
+                kb[i] = (uint8_t) i;
+
+        for (i = 0; i < CHACHA_KEYSZ / 4; ++i)
+                key[i] = le32_load(kb + 4 * i);
+
+        chacha20_block(key, iv, 1 | ((uint64_t) 0x09000000 << 32), out);
+
+        if (memcmp(out, exp, sizeof(exp))) {
+                printf("ChaCha20 block does not match test vector.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+static int test_random_buffer(void)
+{
+        uint8_t  a[TEST_BUFSZ];
+        uint8_t  b[TEST_BUFSZ];
+        size_t   len;
+        uint64_t x;
+        uint64_t y;
+
+        for (len = 1; len < TEST_BUFSZ; len = len * 2 + 1) {
+                memset(a, 0, sizeof(a));
+                memset(b, 0, sizeof(b));
+                if (random_buffer(a, len) < 0 || random_buffer(b, len) < 0) {
+                        printf("Failed to get %zu random bytes.\n", len);
+                        return -1;
+                }
+
+                if (len >= sizeof(x) && !memcmp(a, b, len)) {
+                        printf("Repeated output for %zu bytes.\n", len);
+                        return -1;
+                }
+        }
+
+        if (random_buffer(a, sizeof(a)) < 0) {
+                printf("Failed to get %zu random bytes.\n", sizeof(a));
+                return -1;
+        }
+
+        for (len = 0; len + 2 * sizeof(x) <= sizeof(a); len += sizeof(x)) {
+                memcpy(&x, a + len, sizeof(x));
+                memcpy(&y, a + len + sizeof(x), sizeof(y));
+                if (x == y) {
+                        printf("Repeated word in output.\n");
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+static int test_random_fork(void)
+{
+        int      fds[2];
+        pid_t    pid;
+        uint64_t p;
+        uint64_t c;
+        int      status;
+
+        /* Make sure the parent has a seeded context before forking. */
+        if (random_buffer(&p, sizeof(p)) < 0)
+                return -1;
+
+        if (pipe(fds) < 0)
+                return -1;
+
+        pid = fork();
+        if (pid < 0)
+                return -1;
+
+        if (pid == 0) {
+                close(fds[0]);
+                random_buffer(&c, sizeof(c));
+                if (write(fds[1], &c, sizeof(c)) != sizeof(c))
+                        _exit(1);
+                _exit(0);
+        }
+
+        close(fds[1]);
+
+        random_buffer(&p, sizeof(p));
+
+        if (read(fds[0], &c, sizeof(c)) != sizeof(c)) {
+                close(fds[0]);
+                waitpid(pid, &status, 0);
+                printf("Failed to read from child.\n");
+                return -1;
+        }
+
+        close(fds[0]);
+        waitpid(pid, &status, 0);
+
+        if (p == c) {
+                printf("Child repeated parent output after fork.\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+int random_test(int     argc,
+                char ** argv)
+{
+        (void) argc;
+        (void) argv;
+
+        if (test_chacha20_vector())
+                return -1;
+
+        if (test_random_buffer())
+                return -1;
+
+        if (test_random_fork())
+                return -1;
+
+        return 0;
+}
@@ -25,11 +25,97 @@
 #include "config.h"
 
 #include <ouroboros/shm_rbuff.h>
+#include <ouroboros/time_utils.h>
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#define BURST 32
+#define ROUNDS 20000
+
+static double bench(struct shm_rbuff * rb,
+                    bool               burst)
+{
+        struct timespec tic;
+        struct timespec toc;
+        size_t          idx[BURST];
+        size_t          i;
+        size_t          j;
+
+        for (i = 0; i < BURST; ++i)
+                idx[i] = i;
+
+        clock_gettime(CLOCK_MONOTONIC, &tic);
+
+        for (i = 0; i < ROUNDS; ++i) {
+                if (burst) {
+                        shm_rbuff_write_b_n(rb, idx, BURST, NULL);
+                } else {
+                        for (j = 0; j < BURST; ++j)
+                                shm_rbuff_write_b(rb, idx[j], NULL);
+                }
+                for (j = 0; j < BURST; ++j)
+                        shm_rbuff_read(rb);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &toc);
+
+        return ROUNDS * BURST / (double) ts_diff_us(&tic, &toc);
+}
+
+static int test_write_burst(struct shm_rbuff * rb)
+{
+        struct timespec abs;
+        struct timespec intv = {0, MILLION};
+        size_t          idx[BURST];
+        size_t          i;
+        ssize_t         ret;
+
+        printf("Test: write a burst in order...");
+
+        for (i = 0; i < BURST; ++i)
+                idx[i] = i + 1;
+
+        if (shm_rbuff_write_b_n(rb, idx, BURST, NULL) != BURST)
+                return -1;
+
+        for (i = 0; i < BURST; ++i)
+                if (shm_rbuff_read(rb) != (ssize_t) idx[i])
+                        return -1;
+
+        printf("success.\n\n");
+        printf("Test: burst into a nearly full queue...");
+
+        for (i = 0; i < SHM_RBUFF_SIZE - 1 - BURST / 2; ++i)
+                if (shm_rbuff_write(rb, 1) < 0)
+                        return -1;
+
+        clock_gettime(PTHREAD_COND_CLOCK, &abs);
+        ts_add(&abs, &intv, &abs);
+
+        ret = shm_rbuff_write_b_n(rb, idx, BURST, &abs);
+        if (ret != BURST / 2)
+                return -1;
+
+        clock_gettime(PTHREAD_COND_CLOCK, &abs);
+        ts_add(&abs, &intv, &abs);
+
+        if (shm_rbuff_write_b_n(rb, idx, BURST, &abs) != -ETIMEDOUT)
+                return -1;
+
+        printf("success [%zd written].\n\n", ret);
+
+        while (shm_rbuff_read(rb) >= 0)
+                ;
+
+        printf("Single writes: %.2f Mpps, burst writes: %.2f Mpps.\n\n",
+               bench(rb, false), bench(rb, true));
+
+        return 0;
+}
+
 int shm_rbuff_test(int     argc,
                    char ** argv)
 {
@@ -97,6 +183,9 @@ int shm_rbuff_test(int     argc,
         while (shm_rbuff_read(rb) >= 0)
                 ;
 
+        if (test_write_burst(rb))
+                goto error;
+
         shm_rbuff_destroy(rb);
 
         return 0;
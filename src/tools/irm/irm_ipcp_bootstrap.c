@@ -70,6 +70,9 @@
 #define DEFAULT_ADDR_AUTH      ADDR_AUTH_FLAT_RANDOM
 #define DEFAULT_ROUTING        ROUTING_LINK_STATE
 #define DEFAULT_CONG_AVOID     CA_MB_ECN
+#define DEFAULT_SPF_INIT       50   /* ms */
+#define DEFAULT_SPF_HOLD       200  /* ms */
+#define DEFAULT_SPF_MAX        5000 /* ms */
 #define DEFAULT_HASH_ALGO      DIR_HASH_SHA3_256
 #define DEFAULT_ETHERTYPE      0xA000
 #define DEFAULT_UDP_PORT       0x0D6B /* 3435 */
@@ -96,6 +99,12 @@ static void usage(void)
                "                [ttl (max time-to-live value, default: %d)]\n"
                "                [addr_auth <ADDRESS_POLICY> (default: %s)]\n"
                "                [routing <ROUTING_POLICY> (default: %s)]\n"
+               "                [spf_init <initial SPF delay in ms>"
+               " (default: %d)]\n"
+               "                [spf_hold <SPF hold time in ms>"
+               " (default: %d)]\n"
+               "                [spf_max <maximum SPF hold time in ms>"
+               " (default: %d)]\n"
                "                [congestion <CONG_POLICY> (default: %s)]\n"
                "                [hash [ALGORITHM] (default: %s)]\n"
                "                [autobind]\n"
@@ -128,7 +137,8 @@ static void usage(void)
                "if TYPE == " BROADCAST "\n"
                "                [autobind]\n\n",
                DEFAULT_ADDR_SIZE, DEFAULT_EID_SIZE, DEFAULT_TTL,
-               FLAT_RANDOM_ADDR_AUTH, LINK_STATE_ROUTING, MB_ECN_CA,
+               FLAT_RANDOM_ADDR_AUTH, LINK_STATE_ROUTING, DEFAULT_SPF_INIT,
+               DEFAULT_SPF_HOLD, DEFAULT_SPF_MAX, MB_ECN_CA,
                SHA3_256, DEFAULT_UDP_PORT, SHA3_256, 0xA000, SHA3_256,
                SHA3_256);
 }
@@ -144,6 +154,9 @@ int do_bootstrap_ipcp(int     argc,
         uint8_t             max_ttl        = DEFAULT_TTL;
         enum pol_addr_auth  addr_auth_type = DEFAULT_ADDR_AUTH;
         enum pol_routing    routing_type   = DEFAULT_ROUTING;
+        uint32_t            spf_init       = DEFAULT_SPF_INIT;
+        uint32_t            spf_hold       = DEFAULT_SPF_HOLD;
+        uint32_t            spf_max        = DEFAULT_SPF_MAX;
         enum pol_dir_hash   hash_algo      = DEFAULT_HASH_ALGO;
         enum pol_cong_avoid cong_avoid     = DEFAULT_CONG_AVOID;
         uint32_t            ip_addr        = 0;
@@ -205,6 +218,12 @@ int do_bootstrap_ipcp(int     argc,
                         eid_size = atoi(*(argv + 1));
                 } else if (matches(*argv, "ttl") == 0) {
                         max_ttl = atoi(*(argv + 1));
+                } else if (matches(*argv, "spf_init") == 0) {
+                        spf_init = atoi(*(argv + 1));
+                } else if (matches(*argv, "spf_hold") == 0) {
+                        spf_hold = atoi(*(argv + 1));
+                } else if (matches(*argv, "spf_max") == 0) {
+                        spf_max = atoi(*(argv + 1));
                 } else if (matches(*argv, "port") == 0) {
                         port = atoi(*(argv + 1));
                 } else if (matches(*argv, "autobind") == 0) {
@@ -317,6 +336,9 @@ int do_bootstrap_ipcp(int     argc,
                                 conf.max_ttl        = max_ttl;
                                 conf.addr_auth_type = addr_auth_type;
                                 conf.routing_type   = routing_type;
+                                conf.spf.init       = spf_init;
+                                conf.spf.hold       = spf_hold;
+                                conf.spf.max        = spf_max;
                                 conf.cong_avoid     = cong_avoid;
                                 break;
                         case IPCP_UDP:
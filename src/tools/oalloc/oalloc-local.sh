@@ -0,0 +1,97 @@
+#!/bin/sh
+#
+# Ouroboros - Copyright (C) 2016 - 2021
+#
+# Runs oalloc over two unicast IPCPs on this machine
+#
+#    Dimitri Staessens <dimitri@ouroboros.rocks>
+#    Sander Vrijders   <sander@ouroboros.rocks>
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# 1. Redistributions of source code must retain the above copyright
+# notice, this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above
+# copyright notice, this list of conditions and the following
+# disclaimer in the documentation and/or other materials provided
+# with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+# contributors may be used to endorse or promote products derived
+# from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+# COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+# SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+# STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+# OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+# Needs a running irmd and the irm and oalloc tools in the PATH.
+#
+# u1 is bootstrapped in layer net and u2 enrolls with it over a local
+# IPCP, then both the dt and mgmt components are connected. The server
+# is registered at u2 only. irmd queries u1 first, so the client's
+# flows are set up through u1 and cross the dt connection to u2.
+#
+# Usage: oalloc-local.sh [count] [threads]
+
+COUNT=${1:-10000}
+THREADS=${2:-8}
+LAYER=net
+NAME=oalloc
+
+cleanup() {
+        [ -n "$SERVER" ] && kill "$SERVER" 2> /dev/null && wait "$SERVER"
+        irm ipcp destroy name u2 > /dev/null 2>&1
+        irm ipcp destroy name u1 > /dev/null 2>&1
+        irm ipcp destroy name lo > /dev/null 2>&1
+        irm name destroy "$NAME" > /dev/null 2>&1
+}
+
+fail() {
+        echo "$1"
+        cleanup
+        exit 1
+}
+
+trap 'cleanup; exit 1' INT TERM
+
+irm ipcp bootstrap type local name lo layer lo \
+        || fail "Failed to bootstrap local IPCP."
+irm ipcp bootstrap type unicast name u1 layer "$LAYER" autobind \
+        || fail "Failed to bootstrap u1."
+irm name reg u1 layer lo || fail "Failed to register u1."
+irm name reg "$LAYER" layer lo || fail "Failed to register $LAYER."
+
+irm ipcp enroll name u2 type unicast layer "$LAYER" autobind \
+        || fail "Failed to enroll u2."
+irm ipcp connect name u2 component dt dst u1 \
+        || fail "Failed to connect dt."
+irm ipcp connect name u2 component mgmt dst u1 \
+        || fail "Failed to connect mgmt."
+
+irm name reg "$NAME" ipcp u2 || fail "Failed to register $NAME."
+irm bind program oalloc name "$NAME" || fail "Failed to bind oalloc."
+
+oalloc -l -t "$THREADS" &
+SERVER=$!
+
+# Give the directory some time to learn where the server is.
+sleep 2
+
+oalloc -n "$NAME" -c "$COUNT" -t "$THREADS"
+RET=$?
+
+cleanup
+
+exit $RET
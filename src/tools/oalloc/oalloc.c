@@ -0,0 +1,346 @@
+/*
+ * Ouroboros - Copyright (C) 2016 - 2021
+ *
+ * Measures the flow allocation rate and setup latency
+ *
+ *    Dimitri Staessens <dimitri@ouroboros.rocks>
+ *    Sander Vrijders   <sander@ouroboros.rocks>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Allocates flows to an oalloc server from a number of threads at
+ * once, each flow is deallocated as soon as it is up. Reports the
+ * allocation rate and the setup latency distribution.
+ *
+ * oalloc-local.sh sets up two unicast IPCPs over a local layer and
+ * runs a server and a client on them:
+ *
+ *   irm ipcp bootstrap type local name lo layer lo
+ *   irm ipcp bootstrap type unicast name u1 layer net autobind
+ *   irm name reg u1 layer lo
+ *   irm name reg net layer lo
+ *   irm ipcp enroll name u2 type unicast layer net autobind
+ *   irm ipcp connect name u2 component dt dst u1
+ *   irm ipcp connect name u2 component mgmt dst u1
+ *   irm name reg oalloc ipcp u2
+ *   irm bind program oalloc name oalloc
+ *   oalloc -l &
+ *   oalloc -c 10000 -t 8
+ *
+ * The unicast IPCP still handles FLOW_REQs one at a time under
+ * ipcpi.alloc_lock, so more threads do not speed up allocation.
+ */
+
+#define _POSIX_C_SOURCE 199506L
+
+#include <ouroboros/dev.h>
+
+#include "time_utils.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OALLOC_MAX_THREADS 256
+
+struct {
+        char *          name;
+        size_t          count;
+        int             threads;
+
+        size_t          next;    /* Next flow to allocate */
+        size_t          failed;
+        uint64_t *      lat;     /* Setup latency per flow (ns) */
+        pthread_mutex_t lock;
+} oalloc;
+
+static volatile bool stop;
+
+static void usage(void)
+{
+        printf("Usage: oalloc [OPTION]...\n"
+               "Measures the flow allocation rate and setup latency\n\n"
+               "  -l, --listen              Run in server mode\n"
+               "  -n, --server-name         Name of the oalloc server"
+               " (default oalloc)\n"
+               "  -c, --count               Number of flows to allocate"
+               " (default 10000)\n"
+               "  -t, --threads             Number of threads"
+               " (default 8)\n"
+               "      --help                Display this help text and exit\n");
+}
+
+static void shutdown_oalloc(int signo)
+{
+        switch (signo) {
+        case SIGINT:
+        case SIGTERM:
+        case SIGHUP:
+                stop = true;
+        default:
+                return;
+        }
+}
+
+static void * server_thread(void * o)
+{
+        int fd;
+
+        (void) o;
+
+        while (!stop) {
+                fd = flow_accept(NULL, NULL);
+                if (fd < 0) {
+                        printf("Failed to accept flow.\n");
+                        break;
+                }
+
+                flow_dealloc(fd);
+        }
+
+        return (void *) 0;
+}
+
+static int server_main(void)
+{
+        pthread_t thr[OALLOC_MAX_THREADS];
+        int       i;
+
+        printf("Ouroboros flow allocation server started.\n");
+
+        for (i = 0; i < oalloc.threads; ++i)
+                if (pthread_create(&thr[i], NULL, server_thread, NULL))
+                        break;
+
+        if (i == 0) {
+                printf("Failed to start server threads.\n");
+                return -1;
+        }
+
+        while (i-- > 0)
+                pthread_join(thr[i], NULL);
+
+        return 0;
+}
+
+static void * client_thread(void * o)
+{
+        struct timespec tic;
+        struct timespec toc;
+        size_t          idx;
+        int             fd;
+
+        (void) o;
+
+        while (!stop) {
+                pthread_mutex_lock(&oalloc.lock);
+                idx = oalloc.next++;
+                pthread_mutex_unlock(&oalloc.lock);
+
+                if (idx >= oalloc.count)
+                        break;
+
+                clock_gettime(CLOCK_MONOTONIC, &tic);
+
+                fd = flow_alloc(oalloc.name, NULL, NULL);
+
+                clock_gettime(CLOCK_MONOTONIC, &toc);
+
+                if (fd < 0) {
+                        pthread_mutex_lock(&oalloc.lock);
+                        ++oalloc.failed;
+                        pthread_mutex_unlock(&oalloc.lock);
+                        oalloc.lat[idx] = UINT64_MAX;
+                        continue;
+                }
+
+                oalloc.lat[idx] = ts_diff_ns(&tic, &toc);
+
+                flow_dealloc(fd);
+        }
+
+        return (void *) 0;
+}
+
+static int cmp_lat(const void * a,
+                   const void * b)
+{
+        uint64_t x = *(const uint64_t *) a;
+        uint64_t y = *(const uint64_t *) b;
+
+        return x < y ? -1 : x > y;
+}
+
+static double lat_ms(size_t n,
+                     size_t pct)
+{
+        return oalloc.lat[(n - 1) * pct / 100] / (double) MILLION;
+}
+
+static int client_main(void)
+{
+        struct sigaction sig_act;
+        pthread_t        thr[OALLOC_MAX_THREADS];
+        struct timespec  tic;
+        struct timespec  toc;
+        size_t           done;
+        double           secs;
+        int              i;
+
+        /* Stop handing out flows, report on the ones that were done. */
+        memset(&sig_act, 0, sizeof(sig_act));
+        sig_act.sa_handler = shutdown_oalloc;
+
+        if (sigaction(SIGINT,  &sig_act, NULL) ||
+            sigaction(SIGTERM, &sig_act, NULL) ||
+            sigaction(SIGHUP,  &sig_act, NULL)) {
+                printf("Failed to install sighandler.\n");
+                return -1;
+        }
+
+        oalloc.lat = malloc(oalloc.count * sizeof(*oalloc.lat));
+        if (oalloc.lat == NULL) {
+                printf("Failed to allocate latency buffer.\n");
+                return -1;
+        }
+
+        oalloc.next   = 0;
+        oalloc.failed = 0;
+
+        printf("Allocating %zu flows to %s from %d threads.\n",
+               oalloc.count, oalloc.name, oalloc.threads);
+
+        clock_gettime(CLOCK_MONOTONIC, &tic);
+
+        for (i = 0; i < oalloc.threads; ++i)
+                if (pthread_create(&thr[i], NULL, client_thread, NULL))
+                        break;
+
+        if (i == 0) {
+                printf("Failed to start client threads.\n");
+                free(oalloc.lat);
+                return -1;
+        }
+
+        while (i-- > 0)
+                pthread_join(thr[i], NULL);
+
+        clock_gettime(CLOCK_MONOTONIC, &toc);
+
+        /* Stopped early, only count the flows that were started. */
+        if (oalloc.next < oalloc.count)
+                oalloc.count = oalloc.next;
+
+        done = oalloc.count - oalloc.failed;
+        secs = ts_diff_us(&tic, &toc) / (double) MILLION;
+
+        /* Failed allocations sort to the end. */
+        qsort(oalloc.lat, oalloc.count, sizeof(*oalloc.lat), cmp_lat);
+
+        printf("\n--- %s flow allocation statistics ---\n", oalloc.name);
+        printf("%zu flows allocated, %zu failed, time: %.3f s, "
+               "rate: %.1f allocs/s\n", done, oalloc.failed, secs,
+               secs > 0 ? done / secs : 0.0);
+
+        if (done > 0)
+                printf("setup min/p50/p99/max = %.3f/%.3f/%.3f/%.3f ms\n",
+                       lat_ms(done, 0), lat_ms(done, 50),
+                       lat_ms(done, 99), lat_ms(done, 100));
+
+        free(oalloc.lat);
+
+        return oalloc.failed > 0 ? -1 : 0;
+}
+
+int main(int argc, char ** argv)
+{
+        int  ret;
+        bool serv = false;
+
+        argc--;
+        argv++;
+
+        oalloc.name    = "oalloc";
+        oalloc.count   = 10000;
+        oalloc.threads = 8;
+
+        while (argc > 0) {
+                if (strcmp(*argv, "-l") == 0 ||
+                    strcmp(*argv, "--listen") == 0) {
+                        serv = true;
+                } else if (argc > 1 && (strcmp(*argv, "-n") == 0 ||
+                           strcmp(*argv, "--server-name") == 0)) {
+                        oalloc.name = *(++argv);
+                        --argc;
+                } else if (argc > 1 && (strcmp(*argv, "-c") == 0 ||
+                           strcmp(*argv, "--count") == 0)) {
+                        oalloc.count = strtoul(*(++argv), NULL, 10);
+                        --argc;
+                } else if (argc > 1 && (strcmp(*argv, "-t") == 0 ||
+                           strcmp(*argv, "--threads") == 0)) {
+                        oalloc.threads = strtol(*(++argv), NULL, 10);
+                        --argc;
+                } else {
+                        usage();
+                        exit(EXIT_SUCCESS);
+                }
+                argc--;
+                argv++;
+        }
+
+        if (oalloc.count == 0 || oalloc.threads < 1 ||
+            oalloc.threads > OALLOC_MAX_THREADS) {
+                printf("Invalid count or number of threads.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (pthread_mutex_init(&oalloc.lock, NULL)) {
+                printf("Failed to init mutex.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (serv)
+                ret = server_main();
+        else
+                ret = client_main();
+
+        pthread_mutex_destroy(&oalloc.lock);
+
+        if (ret < 0)
+                exit(EXIT_FAILURE);
+
+        exit(EXIT_SUCCESS);
+}
@@ -231,9 +231,11 @@ int client_main(void)
                 printf("%ld%% packet loss, ", client.sent == 0 ? 0 :
                        100 - ((100 * client.rcvd) / client.sent));
                 printf("time: %.3f ms, ", ts_diff_us(&tic, &toc) / 1000.0);
-                printf("bandwidth: %.3lf Mb/s.\n",
+                printf("bandwidth: %.3lf Mb/s, ",
                        (client.rcvd * client.size * 8)
                        / (double) ts_diff_us(&tic, &toc));
+                printf("packet rate: %.3lf Mpps.\n",
+                       client.rcvd / (double) ts_diff_us(&tic, &toc));
         }
 
         flow_dealloc(fd);